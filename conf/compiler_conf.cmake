@@ -22,6 +22,9 @@ if(ANDROID)
 elseif(CMAKE_HOST_SYSTEM_NAME STREQUAL "Linux")
     set(CMAKE_CXX_FLAGS "${CMAKE_CXX_FLAGS} -std=c++17 -g -Wall -pthread")
     set(CMAKE_C_FLAGS "${CMAKE_C_FLAGS} -g -pthread")
+    set(CMAKE_CXX_FLAGS_RELEASE "${CMAKE_CXX_FLAGS_RELEASE} -O2 -Wunused-function")
+    set(CMAKE_C_FLAGS_RELEASE "${CMAKE_C_FLAGS_RELEASE} -O2")
+    # no -march=native: the binary runs on the whole fleet, wider ISAs are dispatched at runtime
 elseif(CMAKE_HOST_SYSTEM_NAME STREQUAL "Darwin")
     if( IOS )
         set( TARGET_ARCH iOS )                 # iOS platform
@@ -0,0 +1,1247 @@
+/**
+ * @file benchmark.cpp
+ * @brief benchmark application for upsampling library components
+ * @version 2.0
+ * @date 2026-10-19
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+#include "common/dsviewer_interface.h"
+#include "upsampling/upsampling.h"
+#include "upsampling/upsampling_async.h"
+#include "upsampling/upsampling_stream.h"
+#include "upsampling/depth_codec.h"
+#include "upsampling/shm_output.h"
+#include "upsampling/shm_input.h"
+#include "upsampling/upsampling_kernels.h"
+#include "upsampling/fgs_solver.h"
+#include <opencv2/opencv.hpp>
+#include <opencv2/ximgproc.hpp>
+#include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <thread>
+#include <vector>
+#include <string>
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+
+using namespace std;
+
+const string rootPath = "../../";
+const string strParam = rootPath + "dat/camParam/camera_calib/param_sun.txt";
+
+/**
+ * @brief read input data of one frame
+ *
+ * @param strDataPath : input data path
+ * @param frame_idx : frame ID
+ * @param imgGuide : output guide image
+ * @param pcFlood : output flood point cloud
+ * @param pcSpot : output spot point cloud
+ * @return true : guide image exists
+ * @return false : no guide image
+ */
+bool read_frame(const string& strDataPath, int frame_idx, cv::Mat& imgGuide, cv::Mat& pcFlood, cv::Mat& pcSpot)
+{
+    char szFN[255];
+    snprintf(szFN, sizeof(szFN), "%s/%08d_rgb_gray_img.png", strDataPath.c_str(), frame_idx);
+    imgGuide = cv::imread(szFN, -1);
+    snprintf(szFN, sizeof(szFN), "%s/%08d_flood_depth_pc.exr", strDataPath.c_str(), frame_idx);
+    pcFlood = cv::imread(szFN, -1);
+    snprintf(szFN, sizeof(szFN), "%s/%08d_spot_depth_pc.exr", strDataPath.c_str(), frame_idx);
+    pcSpot = cv::imread(szFN, -1);
+    return !imgGuide.empty();
+}
+
+/**
+ * @brief create upsampling instance with camera parameters
+ *
+ * @param dc : upsampling instance
+ * @return true : succeed
+ * @return false : camera parameter file not found
+ */
+bool setup_upsampling(upsampling& dc)
+{
+    map<string, float> params;
+    if (!read_param(strParam, params)) {
+        cout << "open param failed" << endl;
+        return false;
+    }
+    float cx, cy, fx, fy;
+    get_rgb_params(params, cx, cy, fx, fy);
+    Camera_Params cam_params(cx, cy, fx, fy);
+    dc.set_cam_paramters(cam_params);
+    return true;
+}
+
+/**
+ * @brief input data of one frame
+ *
+ */
+typedef struct Frame_Data{
+    cv::Mat guide;
+    cv::Mat flood;
+    cv::Mat spot;
+} Frame_Data;
+
+/**
+ * @brief read all frames in the range (benchmarks exclude disk access)
+ *
+ * @param strDataPath : input data path
+ * @param start_frame_idx : start frame ID
+ * @param end_frame_idx : end frame ID
+ * @param vecFrames : output frames
+ * @return true : at least one frame
+ * @return false : no frame
+ */
+bool read_frames(const string& strDataPath, int start_frame_idx, int end_frame_idx, vector<Frame_Data>& vecFrames)
+{
+    for (int idx = start_frame_idx; idx <= end_frame_idx; ++idx) {
+        Frame_Data frame;
+        if (read_frame(strDataPath, idx, frame.guide, frame.flood, frame.spot))
+            vecFrames.push_back(frame);
+    }
+    if (vecFrames.empty()) {
+        cout << "no frames in " << strDataPath << endl;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief print latency statistics
+ *
+ * @param label : label
+ * @param vecLatency : latencies (us), sorted in place
+ */
+void print_latency(const string& label, vector<double>& vecLatency)
+{
+    if (vecLatency.empty())
+        return;
+    sort(vecLatency.begin(), vecLatency.end());
+    double sum = 0.0;
+    for (double v : vecLatency)
+        sum += v;
+    size_t n = vecLatency.size();
+    cout << label << ": avg = " << sum / n << " p50 = " << vecLatency[n / 2]
+         << " p99 = " << vecLatency[min(n - 1, n * 99 / 100)] << " max = " << vecLatency[n - 1] << " [us]" << endl;
+}
+
+/**
+ * @brief max absolute error between two maps, NaN must match
+ *
+ * @param a : map a
+ * @param b : map b
+ * @return float : max error (inf if NaN positions differ)
+ */
+float max_abs_error(const cv::Mat& a, const cv::Mat& b)
+{
+    float max_err = 0.f;
+    for (int r = 0; r < a.rows; ++r) {
+        const float* pa = a.ptr<float>(r);
+        const float* pb = b.ptr<float>(r);
+        for (int c = 0; c < a.cols; ++c) {
+            if (isnan(pa[c]) || isnan(pb[c])) {
+                if (isnan(pa[c]) != isnan(pb[c]))
+                    return INFINITY;
+                continue;
+            }
+            max_err = max(max_err, fabs(pa[c] - pb[c]));
+        }
+    }
+    return max_err;
+}
+
+/**
+ * @brief depth codec benchmark: compression ratio and throughput of run() outputs
+ *
+ * @param strDataPath : input data path
+ * @param start_frame_idx : start frame ID
+ * @param end_frame_idx : end frame ID
+ * @return int : 0 succeed
+ */
+int bench_codec(const string& strDataPath, int start_frame_idx, int end_frame_idx)
+{
+    upsampling dc;
+    if (!setup_upsampling(dc))
+        return 1;
+    // depth: millimetre, confidence: 1/1000, and lossless for reference
+    depth_codec codec_depth(1000.f), codec_conf(1000.f), codec_lossless(0.f);
+    vector<uchar> buf_depth, buf_conf, buf_lossless;
+    cv::Mat dense, conf, dense_dec, conf_dec, lossless_dec;
+    double raw_bytes = 0.0, enc_bytes = 0.0, lossless_bytes = 0.0;
+    double enc_us = 0.0, dec_us = 0.0, lossless_enc_us = 0.0, lossless_dec_us = 0.0;
+    float max_err_depth = 0.f, max_err_conf = 0.f, max_err_lossless = 0.f;
+    int num_frames = 0;
+    chrono::steady_clock::time_point t0, t1;
+    for (int idx = start_frame_idx; idx <= end_frame_idx; ++idx) {
+        cv::Mat imgGuide, pcFlood, pcSpot;
+        if (!read_frame(strDataPath, idx, imgGuide, pcFlood, pcSpot))
+            continue;
+        if (!dc.run(imgGuide, pcFlood, cv::Mat(), dense, conf))
+            continue;
+        t0 = chrono::steady_clock::now();
+        codec_depth.encode(dense, buf_depth);
+        codec_conf.encode(conf, buf_conf);
+        t1 = chrono::steady_clock::now();
+        enc_us += chrono::duration_cast<chrono::microseconds>(t1 - t0).count();
+        t0 = chrono::steady_clock::now();
+        codec_depth.decode(buf_depth, dense_dec);
+        codec_conf.decode(buf_conf, conf_dec);
+        t1 = chrono::steady_clock::now();
+        dec_us += chrono::duration_cast<chrono::microseconds>(t1 - t0).count();
+        t0 = chrono::steady_clock::now();
+        codec_lossless.encode(dense, buf_lossless);
+        t1 = chrono::steady_clock::now();
+        lossless_enc_us += chrono::duration_cast<chrono::microseconds>(t1 - t0).count();
+        t0 = chrono::steady_clock::now();
+        codec_lossless.decode(buf_lossless, lossless_dec);
+        t1 = chrono::steady_clock::now();
+        lossless_dec_us += chrono::duration_cast<chrono::microseconds>(t1 - t0).count();
+
+        max_err_depth = max(max_err_depth, max_abs_error(dense, dense_dec));
+        max_err_conf = max(max_err_conf, max_abs_error(conf, conf_dec));
+        max_err_lossless = max(max_err_lossless, max_abs_error(dense, lossless_dec));
+        raw_bytes += static_cast<double>(dense.total() * dense.elemSize() + conf.total() * conf.elemSize());
+        enc_bytes += static_cast<double>(buf_depth.size() + buf_conf.size());
+        lossless_bytes += static_cast<double>(buf_lossless.size());
+        num_frames += 1;
+    }
+    if (num_frames == 0) {
+        cout << "no frames processed" << endl;
+        return 1;
+    }
+    double raw_depth_bytes = raw_bytes / 2.0;
+    cout << "sequence: " << strDataPath << " (" << num_frames << " frames)" << endl;
+    cout << "dense+conf (1 mm / 0.001): ratio = " << raw_bytes / enc_bytes
+         << ", " << enc_bytes / num_frames / 1024.0 << " KB/frame"
+         << ", encode = " << raw_bytes / enc_us << " MB/s"
+         << ", decode = " << raw_bytes / dec_us << " MB/s"
+         << ", max error = " << max_err_depth << " / " << max_err_conf << endl;
+    cout << "dense lossless: ratio = " << raw_depth_bytes / lossless_bytes
+         << ", encode = " << raw_depth_bytes / lossless_enc_us << " MB/s"
+         << ", decode = " << raw_depth_bytes / lossless_dec_us << " MB/s"
+         << ", max error = " << max_err_lossless << endl;
+    return 0;
+}
+
+/**
+ * @brief shared memory output benchmark: run() writes into the ring, a reader maps the results
+ *
+ * @param strDataPath : input data path
+ * @param start_frame_idx : start frame ID
+ * @param end_frame_idx : end frame ID
+ * @return int : 0 succeed
+ */
+int bench_shm(const string& strDataPath, int start_frame_idx, int end_frame_idx)
+{
+    upsampling dc;
+    if (!setup_upsampling(dc))
+        return 1;
+    vector<Frame_Data> vecFrames;
+    if (!read_frames(strDataPath, start_frame_idx, end_frame_idx, vecFrames))
+        return 1;
+    const string strName = string(SHM_OUTPUT_NAME) + "_bench";
+    shm_output_publisher publisher;
+    cv::Size output_size = dc.get_output_size(); // run() writes into the slots only at this size
+    if (!publisher.open(strName, output_size.width, output_size.height, 4, true)) { // own ring of the benchmark
+        cout << "create shared memory failed" << endl;
+        return 1;
+    }
+    atomic<bool> done(false);
+    vector<double> vecTransport, vecEndToEnd;
+    int num_torn = 0;
+    thread th_reader([&]() -> void { // consumer side, own mapping as in another process
+        shm_output_reader reader;
+        if (!reader.open(strName))
+            return;
+        Shm_Output_Frame frame;
+        uint64_t next_id = 0;
+        while (!done.load()) {
+            if (reader.get_write_count() <= next_id) {
+                this_thread::yield();
+                continue;
+            }
+            if (!reader.acquire_latest(frame))
+                continue;
+            int64_t t_read = shm_ring::now_ns();
+            volatile float touch = frame.dense.at<float>(frame.dense.rows / 2, frame.dense.cols / 2);
+            (void)touch;
+            if (!reader.validate(frame)) {
+                num_torn += 1;
+                continue;
+            }
+            next_id = frame.frame_id + 1;
+            vecTransport.push_back((t_read - frame.publish_ns) / 1000.0);
+            vecEndToEnd.push_back((t_read - frame.timestamp_ns) / 1000.0);
+        }
+    });
+    vector<double> vecPublish;
+    cv::Mat dense, conf;
+    for (const Frame_Data& frame : vecFrames) {
+        int64_t t_input = shm_ring::now_ns();
+        publisher.begin_frame(dense, conf);
+        bool res = dc.run(frame.guide, frame.flood, cv::Mat(), dense, conf);
+        int64_t t_run = shm_ring::now_ns();
+        publisher.end_frame(dense, conf, res, t_input);
+        vecPublish.push_back((shm_ring::now_ns() - t_run) / 1000.0);
+    }
+    this_thread::sleep_for(chrono::milliseconds(10));
+    done.store(true);
+    th_reader.join();
+    cout << "frames = " << vecFrames.size() << " read = " << vecTransport.size() << " torn = " << num_torn << endl;
+    print_latency("publish (end_frame)", vecPublish);
+    print_latency("publish -> read", vecTransport);
+    print_latency("input -> read", vecEndToEnd);
+    return 0;
+}
+
+/**
+ * @brief live stream benchmark: consumes the shared memory input ring (shm_replay) in real time
+ *
+ * @param strName : shared memory name of the input ring
+ * @param num_frames : number of frames to process
+ * @return int : 0 succeed
+ */
+int bench_live(const string& strName, int num_frames)
+{
+    upsampling dc;
+    if (!setup_upsampling(dc))
+        return 1;
+    shm_input_source source;
+    cout << "waiting for " << strName << " (run shm_replay)" << endl;
+    while (!source.open(strName)) {
+        this_thread::sleep_for(chrono::milliseconds(100));
+    }
+    vector<double> vecLatency, vecProcessing;
+    Shm_Input_Frame frame;
+    cv::Mat dense, conf;
+    int num_processed = 0, num_torn = 0;
+    while (num_processed + num_torn < num_frames) {
+        if (!source.acquire_next(frame)) {
+            this_thread::yield();
+            continue;
+        }
+        int64_t t_start = shm_ring::now_ns();
+        dc.run(frame.guide, frame.flood, cv::Mat(), dense, conf); // zero-copy input
+        int64_t t_end = shm_ring::now_ns();
+        if (!source.validate(frame)) { // input overwritten while processing
+            num_torn += 1;
+            continue;
+        }
+        num_processed += 1;
+        vecLatency.push_back((t_end - frame.timestamp_ns) / 1000.0);
+        vecProcessing.push_back((t_end - t_start) / 1000.0);
+    }
+    cout << "processed = " << num_processed << " dropped = " << source.get_num_dropped() << " torn = " << num_torn << endl;
+    print_latency("processing", vecProcessing);
+    print_latency("capture -> output", vecLatency);
+    return 0;
+}
+
+/**
+ * @brief pipelined run benchmark: sustained FPS of run() and upsampling_async
+ *
+ * @param strDataPath : input data path
+ * @param start_frame_idx : start frame ID
+ * @param end_frame_idx : end frame ID
+ * @return int : 0 succeed
+ */
+int bench_async(const string& strDataPath, int start_frame_idx, int end_frame_idx)
+{
+    upsampling dc;
+    if (!setup_upsampling(dc))
+        return 1;
+    vector<Frame_Data> vecFrames;
+    if (!read_frames(strDataPath, start_frame_idx, end_frame_idx, vecFrames))
+        return 1;
+    const int num_repeat = 3;
+    size_t num_frames = vecFrames.size() * num_repeat;
+    // synchronous reference
+    vector<cv::Mat> vecDense(vecFrames.size()), vecConf(vecFrames.size());
+    vector<double> vecSync;
+    chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+    for (size_t i = 0; i < num_frames; ++i) {
+        const Frame_Data& frame = vecFrames[i % vecFrames.size()];
+        chrono::steady_clock::time_point t_start = chrono::steady_clock::now();
+        dc.run(frame.guide, frame.flood, frame.spot, vecDense[i % vecFrames.size()], vecConf[i % vecFrames.size()]);
+        vecSync.push_back(chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - t_start).count());
+    }
+    double sync_sec = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+    // pipelined, 2 and 3 buffers
+    for (int num_buffers = 2; num_buffers <= 3; ++num_buffers) {
+        upsampling_async pipeline(dc, num_buffers);
+        Upsampling_Result result;
+        vector<double> vecLatency;
+        float max_err = 0.f;
+        t0 = chrono::steady_clock::now();
+        for (size_t i = 0; i < num_frames; ++i) {
+            const Frame_Data& frame = vecFrames[i % vecFrames.size()];
+            if (pipeline.get_num_in_flight() == num_buffers && pipeline.wait(result)) {
+                vecLatency.push_back((result.done_ns - result.submit_ns) / 1000.0);
+                size_t k = result.frame_id % vecFrames.size();
+                max_err = max(max_err, max_abs_error(result.dense, vecDense[k]));
+            }
+            pipeline.submit(frame.guide, frame.flood, frame.spot);
+        }
+        while (pipeline.wait(result)) {
+            vecLatency.push_back((result.done_ns - result.submit_ns) / 1000.0);
+            size_t k = result.frame_id % vecFrames.size();
+            max_err = max(max_err, max_abs_error(result.dense, vecDense[k]));
+        }
+        double async_sec = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+        cout << "async (" << num_buffers << " buffers): " << num_frames / async_sec << " FPS"
+             << ", speedup = " << sync_sec / async_sec << ", max diff to run() = " << max_err << endl;
+        print_latency("  submit -> done", vecLatency);
+    }
+    cout << "run(): " << num_frames / sync_sec << " FPS" << endl;
+    print_latency("  run", vecSync);
+    return 0;
+}
+
+/**
+ * @brief streaming benchmark: latency and drops of each backpressure policy at a sensor rate
+ *
+ * @param strDataPath : input data path
+ * @param start_frame_idx : start frame ID
+ * @param end_frame_idx : end frame ID
+ * @return int : 0 succeed
+ */
+int bench_stream(const string& strDataPath, int start_frame_idx, int end_frame_idx)
+{
+    upsampling dc;
+    if (!setup_upsampling(dc))
+        return 1;
+    vector<Frame_Data> vecFrames;
+    if (!read_frames(strDataPath, start_frame_idx, end_frame_idx, vecFrames))
+        return 1;
+    const double fps = 60.0; // faster than mode 3 processing
+    const int num_frames = max(300, static_cast<int>(vecFrames.size()));
+    const char* szPolicy[] = {"block", "drop-oldest", "keep-latest"};
+    chrono::nanoseconds period(static_cast<int64_t>(1e9 / fps));
+    for (int policy = STREAM_BLOCK; policy <= STREAM_KEEP_LATEST; ++policy) {
+        upsampling_stream stream(dc, static_cast<Stream_Policy>(policy), 2);
+        chrono::steady_clock::time_point t_next = chrono::steady_clock::now();
+        for (int i = 0; i < num_frames; ++i) {
+            const Frame_Data& frame = vecFrames[i % vecFrames.size()];
+            t_next += period;
+            this_thread::sleep_until(t_next);
+            stream.push(frame.guide, frame.flood, frame.spot);
+        }
+        stream.flush();
+        Stream_Stats stats;
+        stream.get_stats(stats);
+        cout << szPolicy[policy] << " @ " << fps << " FPS: pushed = " << stats.num_pushed
+             << " processed = " << stats.num_processed << " dropped = " << stats.num_dropped
+             << " latency avg = " << stats.latency_avg_ms << " p99 = " << stats.latency_p99_ms
+             << " max = " << stats.latency_max_ms << " [ms]" << endl;
+    }
+    return 0;
+}
+
+/**
+ * @brief multi stream benchmark: aggregate FPS of 1..N streams sharing one configuration
+ *
+ * @param strDataPath : input data path
+ * @param start_frame_idx : start frame ID
+ * @param end_frame_idx : end frame ID
+ * @return int : 0 succeed
+ */
+int bench_streams(const string& strDataPath, int start_frame_idx, int end_frame_idx)
+{
+    upsampling dc;
+    if (!setup_upsampling(dc))
+        return 1;
+    vector<Frame_Data> vecFrames;
+    if (!read_frames(strDataPath, start_frame_idx, end_frame_idx, vecFrames))
+        return 1;
+    const upsampling& config = dc; // shared, read only
+    const int num_frames = max(100, static_cast<int>(vecFrames.size()));
+    int max_streams = max(1, min(8, static_cast<int>(thread::hardware_concurrency())));
+    double fps_single = 0.0;
+    for (int num_streams = 1; num_streams <= max_streams; num_streams *= 2) {
+        vector<thread> vecThreads;
+        chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+        for (int s = 0; s < num_streams; ++s) {
+            vecThreads.push_back(thread([&config, &vecFrames, num_frames, s]() -> void {
+                upsampling_context ctx; // per stream state
+                cv::Mat dense, conf;
+                for (int i = 0; i < num_frames; ++i) {
+                    const Frame_Data& frame = vecFrames[(i + s) % vecFrames.size()];
+                    config.run(ctx, frame.guide, frame.flood, frame.spot, dense, conf);
+                }
+            }));
+        }
+        for (thread& th : vecThreads)
+            th.join();
+        double sec = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+        double fps = num_streams * num_frames / sec;
+        if (num_streams == 1)
+            fps_single = fps;
+        cout << "streams = " << num_streams << ": aggregate " << fps << " FPS, per stream " << fps / num_streams
+             << " FPS, scaling = " << fps / fps_single << endl;
+    }
+    return 0;
+}
+
+/**
+ * @brief batch benchmark: run_batch() against run() frame by frame
+ *
+ * @param strDataPath : input data path
+ * @param start_frame_idx : start frame ID
+ * @param end_frame_idx : end frame ID
+ * @return int : 0 succeed
+ */
+int bench_batch(const string& strDataPath, int start_frame_idx, int end_frame_idx)
+{
+    upsampling dc;
+    if (!setup_upsampling(dc))
+        return 1;
+    vector<Frame_Data> vecFrames;
+    if (!read_frames(strDataPath, start_frame_idx, end_frame_idx, vecFrames))
+        return 1;
+    const int num_repeat = 4;
+    int num_frames = static_cast<int>(vecFrames.size()) * num_repeat;
+    // one by one
+    vector<cv::Mat> vecDense(num_frames), vecConf(num_frames);
+    chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+    for (int i = 0; i < num_frames; ++i) {
+        const Frame_Data& frame = vecFrames[i % vecFrames.size()];
+        dc.run(frame.guide, frame.flood, frame.spot, vecDense[i], vecConf[i]);
+    }
+    double seq_sec = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+    // batch
+    vector<Upsampling_Batch_Frame> vecBatch(num_frames);
+    for (int i = 0; i < num_frames; ++i) {
+        const Frame_Data& frame = vecFrames[i % vecFrames.size()];
+        vecBatch[i].guide = frame.guide;
+        vecBatch[i].flood = frame.flood;
+        vecBatch[i].spot = frame.spot;
+    }
+    t0 = chrono::steady_clock::now();
+    int num_ok = dc.run_batch(vecBatch.data(), num_frames);
+    double batch_sec = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+    float max_err = 0.f;
+    for (int i = 0; i < num_frames; ++i) {
+        if (vecBatch[i].status == UPSAMPLING_OK)
+            max_err = max(max_err, max_abs_error(vecBatch[i].dense, vecDense[i]));
+    }
+    cout << "frames = " << num_frames << " ok = " << num_ok << " threads = " << thread::hardware_concurrency() << endl;
+    cout << "run(): " << num_frames / seq_sec << " FPS, run_batch(): " << num_frames / batch_sec
+         << " FPS, speedup = " << seq_sec / batch_sec << ", max diff = " << max_err << endl;
+    return 0;
+}
+
+/**
+ * @brief quality control benchmark: FPS and quality levels with a latency budget of half the full quality time
+ *
+ * @param strDataPath : input data path
+ * @param start_frame_idx : start frame ID
+ * @param end_frame_idx : end frame ID
+ * @return int : 0 succeed
+ */
+int bench_quality(const string& strDataPath, int start_frame_idx, int end_frame_idx)
+{
+    upsampling dc;
+    if (!setup_upsampling(dc))
+        return 1;
+    vector<Frame_Data> vecFrames;
+    if (!read_frames(strDataPath, start_frame_idx, end_frame_idx, vecFrames))
+        return 1;
+    const int num_frames = max(300, static_cast<int>(vecFrames.size()));
+    // full quality
+    upsampling_context ctx;
+    vector<cv::Mat> vecDense(vecFrames.size());
+    cv::Mat dense, conf;
+    chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+    for (int i = 0; i < num_frames; ++i) {
+        const Frame_Data& frame = vecFrames[i % vecFrames.size()];
+        dc.run(ctx, frame.guide, frame.flood, frame.spot, dense, conf);
+        if (i < static_cast<int>(vecFrames.size()))
+            dense.copyTo(vecDense[i]);
+    }
+    double full_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - t0).count() / num_frames;
+    // with budget
+    float budget_ms = static_cast<float>(full_ms * 0.5);
+    dc.set_latency_budget(budget_ms);
+    vector<int> vecLevelCount(QUALITY_LOWEST + 1, 0);
+    double sum_err = 0.0;
+    size_t num_err = 0;
+    t0 = chrono::steady_clock::now();
+    for (int i = 0; i < num_frames; ++i) {
+        const Frame_Data& frame = vecFrames[i % vecFrames.size()];
+        dc.run(ctx, frame.guide, frame.flood, frame.spot, dense, conf);
+        vecLevelCount[ctx.get_quality_level()] += 1;
+        const cv::Mat& ref = vecDense[i % vecFrames.size()];
+        for (int r = 0; r < ref.rows; ++r) {
+            const float* pr = ref.ptr<float>(r);
+            const float* pd = dense.ptr<float>(r);
+            for (int c = 0; c < ref.cols; ++c) {
+                if (!isnan(pr[c]) && !isnan(pd[c])) {
+                    sum_err += fabs(pr[c] - pd[c]);
+                    num_err += 1;
+                }
+            }
+        }
+    }
+    double budget_sec = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+    cout << "full quality: " << 1000.0 / full_ms << " FPS (" << full_ms << " ms)" << endl;
+    cout << "budget " << budget_ms << " ms: " << num_frames / budget_sec << " FPS, mean abs diff = "
+         << (num_err > 0 ? sum_err / num_err : 0.0) << " m" << endl;
+    for (int level = 0; level <= QUALITY_LOWEST; ++level)
+        cout << "  level " << level << ": " << vecLevelCount[level] << " frames" << endl;
+    return 0;
+}
+
+/**
+ * @brief static frame skip benchmark: each frame is repeated as a static scene
+ *
+ * @param strDataPath : input data path
+ * @param start_frame_idx : start frame ID
+ * @param end_frame_idx : end frame ID
+ * @return int : 0 succeed
+ */
+int bench_static(const string& strDataPath, int start_frame_idx, int end_frame_idx)
+{
+    upsampling dc;
+    if (!setup_upsampling(dc))
+        return 1;
+    vector<Frame_Data> vecFrames;
+    if (!read_frames(strDataPath, start_frame_idx, end_frame_idx, vecFrames))
+        return 1;
+    const int num_repeat = 10; // frames of the same scene
+    int num_frames = static_cast<int>(vecFrames.size()) * num_repeat;
+    double fps[2] = {0.0, 0.0};
+    Static_Skip_Stats stats;
+    for (int skip = 0; skip < 2; ++skip) {
+        dc.set_static_frame_skip(skip ? 4.0f : 0.0f, 0.02f);
+        upsampling_context ctx;
+        cv::Mat dense, conf, guide;
+        chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+        for (int i = 0; i < num_frames; ++i) {
+            const Frame_Data& frame = vecFrames[i / num_repeat];
+            frame.guide.copyTo(guide);
+            guide.at<cv::Vec3b>(i % guide.rows, 0) += cv::Vec3b(1, 1, 1); // sensor noise
+            dc.run(ctx, guide, frame.flood, frame.spot, dense, conf);
+        }
+        fps[skip] = num_frames / chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+        ctx.get_skip_stats(stats);
+    }
+    cout << "frames = " << num_frames << " (each frame repeated " << num_repeat << " times)" << endl;
+    cout << "without skip: " << fps[0] << " FPS, with skip: " << fps[1] << " FPS" << endl;
+    cout << "skipped frames = " << stats.skipped_frame_ratio * 100 << " %, partial = " << stats.num_partial
+         << ", skipped pixels = " << stats.skipped_pixel_ratio * 100 << " %" << endl;
+    return 0;
+}
+
+/**
+ * @brief solver benchmark: FGS against the warm started PCG on consecutive frames
+ *
+ * @param strDataPath : input data path
+ * @param start_frame_idx : start frame ID
+ * @param end_frame_idx : end frame ID
+ * @return int : 0 succeed
+ */
+int bench_solver(const string& strDataPath, int start_frame_idx, int end_frame_idx)
+{
+    upsampling dc;
+    if (!setup_upsampling(dc))
+        return 1;
+    vector<Frame_Data> vecFrames;
+    if (!read_frames(strDataPath, start_frame_idx, end_frame_idx, vecFrames))
+        return 1;
+    int num_frames = static_cast<int>(vecFrames.size());
+    vector<cv::Mat> vecDense(num_frames);
+    cv::Mat dense, conf;
+    upsampling_context ctx_fgs;
+    chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+    for (int i = 0; i < num_frames; ++i) {
+        const Frame_Data& frame = vecFrames[i];
+        dc.run(ctx_fgs, frame.guide, frame.flood, frame.spot, vecDense[i], conf);
+    }
+    double fgs_sec = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+    cout << "FGS: " << num_frames / fgs_sec << " FPS" << endl;
+    const int max_iters[] = {2, 4, 8, 16};
+    for (int max_iter : max_iters) {
+        dc.set_solver(SOLVER_PCG, 1e-3f, max_iter);
+        upsampling_context ctx; // first frame is solved by FGS
+        double sum_err = 0.0, sum_residual = 0.0;
+        size_t num_err = 0;
+        int sum_iter = 0;
+        t0 = chrono::steady_clock::now();
+        for (int i = 0; i < num_frames; ++i) {
+            const Frame_Data& frame = vecFrames[i];
+            dc.run(ctx, frame.guide, frame.flood, frame.spot, dense, conf);
+            int num_iter;
+            float residual;
+            ctx.get_solver_stats(num_iter, residual);
+            sum_iter += num_iter;
+            sum_residual += residual;
+            for (int r = 0; r < dense.rows; ++r) {
+                const float* pa = vecDense[i].ptr<float>(r);
+                const float* pb = dense.ptr<float>(r);
+                for (int c = 0; c < dense.cols; ++c) {
+                    if (!isnan(pa[c]) && !isnan(pb[c])) {
+                        sum_err += fabs(pa[c] - pb[c]);
+                        num_err += 1;
+                    }
+                }
+            }
+        }
+        double pcg_sec = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+        cout << "PCG max_iter = " << max_iter << ": " << num_frames / pcg_sec << " FPS, iterations = "
+             << static_cast<double>(sum_iter) / num_frames << ", residual = " << sum_residual / num_frames
+             << ", mean abs diff to FGS = " << (num_err > 0 ? sum_err / num_err : 0.0) << " m" << endl;
+    }
+    return 0;
+}
+
+/**
+ * @brief FGS benchmark: fgs_solver against cv::ximgproc::fastGlobalSmootherFilter on the flood samples
+ *
+ * Both filter the sparse flood depth and its mask with the flood parameters,
+ * the difference is of the interpolated depth (sparse / mask) where mask > 0.
+ *
+ * @param strDataPath : input data path
+ * @param start_frame_idx : start frame ID
+ * @param end_frame_idx : end frame ID
+ * @return int : 0 succeed
+ */
+int bench_fgs(const string& strDataPath, int start_frame_idx, int end_frame_idx)
+{
+    upsampling dc;
+    if (!setup_upsampling(dc))
+        return 1;
+    vector<Frame_Data> vecFrames;
+    if (!read_frames(strDataPath, start_frame_idx, end_frame_idx, vecFrames))
+        return 1;
+    shared_ptr<const Upsampling_Config> config = dc.get_config();
+    fgs_solver solver;
+    upsampling_context ctx;
+    cv::Mat dense, conf;
+    double solver_ms = 0.0, ximgproc_ms = 0.0, sum_err = 0.0;
+    float max_err = 0.f;
+    size_t num_err = 0;
+    for (const Frame_Data& frame : vecFrames) {
+        dc.run(ctx, frame.guide, frame.flood, cv::Mat(), dense, conf);
+        cv::Mat sparse = ctx.get_flood_depthMap().clone();
+        cv::Mat mask;
+        cv::threshold(sparse, mask, 0.0, 1.0, cv::THRESH_BINARY);
+        // in-repo solver
+        cv::Mat s1 = sparse.clone(), m1 = mask.clone();
+        chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+        solver.set_guide(frame.guide, config->tables->weight_flood);
+        solver.filter(s1, m1, config->fgs_lambda_flood, config->fgs_lambda_attenuation, config->fgs_num_iter_flood);
+        solver_ms += chrono::duration<double, milli>(chrono::steady_clock::now() - t0).count();
+        // OpenCV
+        cv::Mat s2, m2;
+        t0 = chrono::steady_clock::now();
+        cv::ximgproc::fastGlobalSmootherFilter(frame.guide, sparse, s2, config->fgs_lambda_flood,
+            config->fgs_sigma_color_flood, config->fgs_lambda_attenuation, config->fgs_num_iter_flood);
+        cv::ximgproc::fastGlobalSmootherFilter(frame.guide, mask, m2, config->fgs_lambda_flood,
+            config->fgs_sigma_color_flood, config->fgs_lambda_attenuation, config->fgs_num_iter_flood);
+        ximgproc_ms += chrono::duration<double, milli>(chrono::steady_clock::now() - t0).count();
+        for (int r = 0; r < sparse.rows; ++r) {
+            const float* a_s = s1.ptr<float>(r);
+            const float* a_m = m1.ptr<float>(r);
+            const float* b_s = s2.ptr<float>(r);
+            const float* b_m = m2.ptr<float>(r);
+            for (int c = 0; c < sparse.cols; ++c) {
+                if (a_m[c] <= 0.f || b_m[c] <= 0.f)
+                    continue;
+                float err = fabs(a_s[c] / a_m[c] - b_s[c] / b_m[c]);
+                max_err = max(max_err, err);
+                sum_err += err;
+                num_err += 1;
+            }
+        }
+    }
+    int num_frames = static_cast<int>(vecFrames.size());
+    cout << "fgs_solver: " << solver_ms / num_frames << " ms, ximgproc: " << ximgproc_ms / num_frames << " ms" << endl;
+    cout << "depth diff to ximgproc: max = " << max_err << " m, mean = "
+         << (num_err > 0 ? sum_err / num_err : 0.0) << " m" << endl;
+    return 0;
+}
+
+/**
+ * @brief preprocessing benchmark: prepare() with and without incremental preprocessing
+ *
+ * @param strDataPath : input data path
+ * @param start_frame_idx : start frame ID
+ * @param end_frame_idx : end frame ID
+ * @return int : 0 succeed
+ */
+int bench_preproc(const string& strDataPath, int start_frame_idx, int end_frame_idx)
+{
+    upsampling dc;
+    if (!setup_upsampling(dc))
+        return 1;
+    vector<Frame_Data> vecFrames;
+    if (!read_frames(strDataPath, start_frame_idx, end_frame_idx, vecFrames))
+        return 1;
+    const int num_repeat = 5; // frames of the same scene
+    int num_frames = static_cast<int>(vecFrames.size()) * num_repeat;
+    for (int incremental = 0; incremental < 2; ++incremental) {
+        dc.set_incremental_preprocessing(incremental != 0);
+        Upsampling_Frame frame;
+        vector<double> vecTime;
+        double sum_updated = 0.0;
+        for (int i = 0; i < num_frames; ++i) {
+            const Frame_Data& data = vecFrames[i / num_repeat];
+            chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+            dc.prepare(data.guide, data.flood, data.spot, frame);
+            vecTime.push_back(chrono::duration<double, micro>(chrono::steady_clock::now() - t0).count());
+            sum_updated += incremental ? frame.flood_cache.num_updated : data.flood.total();
+        }
+        print_latency(incremental ? "prepare() incremental" : "prepare()", vecTime);
+        cout << "  recomputed points per frame = " << sum_updated / num_frames << endl;
+    }
+    return 0;
+}
+
+/**
+ * @brief pipeline benchmark: template stage 1 variants against the generic preprocessing
+ *
+ * @param strDataPath : input data path
+ * @param start_frame_idx : start frame ID
+ * @param end_frame_idx : end frame ID
+ * @return int : 0 succeed
+ */
+int bench_pipeline(const string& strDataPath, int start_frame_idx, int end_frame_idx)
+{
+    upsampling dc;
+    if (!setup_upsampling(dc))
+        return 1;
+    vector<Frame_Data> vecFrames;
+    if (!read_frames(strDataPath, start_frame_idx, end_frame_idx, vecFrames))
+        return 1;
+    int num_frames = static_cast<int>(vecFrames.size());
+    const int num_repeat = 5;
+    const char* mode_names[] = {"flood", "spot", "flood + spot"};
+    for (int mode = 1; mode <= 3; ++mode) {
+        for (int preproc = 0; preproc < 2; ++preproc) {
+            dc.use_proprocessing(preproc != 0);
+            vector<cv::Mat> vecDense[2];
+            double fps[2];
+            for (int specialized = 0; specialized < 2; ++specialized) {
+                dc.use_specialized_pipeline(specialized != 0);
+                upsampling_context ctx;
+                cv::Mat dense, conf;
+                chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+                for (int n = 0; n < num_repeat; ++n) {
+                    for (int i = 0; i < num_frames; ++i) {
+                        const Frame_Data& frame = vecFrames[i];
+                        dc.run(ctx, frame.guide, (mode & 1) ? frame.flood : cv::Mat(),
+                                (mode & 2) ? frame.spot : cv::Mat(), dense, conf);
+                        if (n == 0)
+                            vecDense[specialized].push_back(dense.clone());
+                    }
+                }
+                double sec = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+                fps[specialized] = num_frames * num_repeat / sec;
+            }
+            double max_diff = 0.0;
+            for (int i = 0; i < num_frames; ++i) {
+                cv::Mat diff;
+                cv::absdiff(vecDense[0][i], vecDense[1][i], diff);
+                cv::patchNaNs(diff, 0.0);
+                double max_val;
+                cv::minMaxLoc(diff, nullptr, &max_val);
+                max_diff = max(max_diff, max_val);
+            }
+            cout << mode_names[mode - 1] << (preproc ? ", preprocessing" : ", no preprocessing")
+                 << ": generic " << fps[0] << " FPS, specialized " << fps[1] << " FPS, max diff = " << max_diff << endl;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief FPS of output scales 1, 2, 4 and difference to the area-downsampled full resolution result
+ *
+ * @param strDataPath : input data path
+ * @param start_frame_idx : first frame ID
+ * @param end_frame_idx : last frame ID
+ * @return int : 0 on success
+ */
+int bench_scale(const string& strDataPath, int start_frame_idx, int end_frame_idx)
+{
+    upsampling dc;
+    if (!setup_upsampling(dc))
+        return 1;
+    vector<Frame_Data> vecFrames;
+    if (!read_frames(strDataPath, start_frame_idx, end_frame_idx, vecFrames))
+        return 1;
+    int num_frames = static_cast<int>(vecFrames.size());
+    const int num_repeat = 5;
+    vector<cv::Mat> vecFull;
+    for (int scale = 1; scale <= 4; scale *= 2) {
+        dc.set_output_scale(scale);
+        upsampling_context ctx;
+        cv::Mat dense, conf;
+        double sum_diff = 0.0;
+        double num_valid = 0.0;
+        chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+        for (int n = 0; n < num_repeat; ++n) {
+            for (int i = 0; i < num_frames; ++i) {
+                const Frame_Data& frame = vecFrames[i];
+                dc.run(ctx, frame.guide, frame.flood, frame.spot, dense, conf);
+                if (n != 0)
+                    continue;
+                if (scale == 1) {
+                    vecFull.push_back(dense.clone());
+                    continue;
+                }
+                cv::Mat full_small, diff;
+                cv::resize(vecFull[i], full_small, dense.size(), 0, 0, cv::INTER_AREA);
+                cv::absdiff(full_small, dense, diff);
+                cv::Mat valid = (diff == diff); // not NaN
+                sum_diff += cv::sum(diff.setTo(0.0, ~valid))[0];
+                num_valid += cv::countNonZero(valid);
+            }
+        }
+        double sec = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+        cout << "output scale " << scale << " (" << dense.cols << "x" << dense.rows << "): " 
+             << num_frames * num_repeat / sec << " FPS";
+        if (scale > 1)
+            cout << ", mean diff to full resolution = " << (num_valid > 0 ? sum_diff / num_valid : 0.0);
+        cout << endl;
+    }
+    return 0;
+}
+
+/**
+ * @brief benchmark of the foreground mask: run() with a downstream threshold pass,
+ *        the mask fused into run() and the mask only mode
+ *
+ * @param strDataPath : input data path
+ * @param start_frame_idx : first frame ID
+ * @param end_frame_idx : last frame ID
+ * @return int : 0 on success
+ */
+int bench_fg(const string& strDataPath, int start_frame_idx, int end_frame_idx)
+{
+    upsampling dc;
+    if (!setup_upsampling(dc))
+        return 1;
+    vector<Frame_Data> vecFrames;
+    if (!read_frames(strDataPath, start_frame_idx, end_frame_idx, vecFrames))
+        return 1;
+    int num_frames = static_cast<int>(vecFrames.size());
+    const int num_repeat = 5;
+    const float fg_near = 0.2f;
+    const float fg_far = 1.0f;
+    const float fg_conf = 0.3f;
+    dc.set_foreground_range(fg_near, fg_far, fg_conf);
+    const char* names[3] = {"run + threshold", "fused mask", "mask only"};
+    cv::Mat ref_mask;
+    for (int m = 0; m < 3; ++m) {
+        upsampling_context ctx;
+        cv::Mat dense, conf, mask;
+        double num_diff = 0.0;
+        chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+        for (int n = 0; n < num_repeat; ++n) {
+            for (int i = 0; i < num_frames; ++i) {
+                const Frame_Data& frame = vecFrames[i];
+                if (m == 0) { // downstream pass over dense/conf
+                    dc.run(ctx, frame.guide, frame.flood, frame.spot, dense, conf);
+                    mask = (dense >= fg_near) & (dense <= fg_far) & (dense > 0.f) & (conf >= fg_conf);
+                } else {
+                    dc.run(ctx, frame.guide, frame.flood, frame.spot, dense, conf, mask, m == 2);
+                }
+                if (n != 0 || i != num_frames - 1)
+                    continue;
+                if (m == 0)
+                    ref_mask = mask.clone();
+                else
+                    num_diff = cv::countNonZero(mask != ref_mask);
+            }
+        }
+        double sec = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+        cout << names[m] << ": " << num_frames * num_repeat / sec << " FPS";
+        if (m > 0)
+            cout << ", mask pixels different from run + threshold = " << num_diff;
+        cout << endl;
+    }
+    return 0;
+}
+
+/**
+ * @brief benchmark of the occlusion mask against a virtual depth: run() with a downstream depth test,
+ *        the mask fused into run() and the mask only mode
+ *
+ * @param strDataPath : input data path
+ * @param start_frame_idx : first frame ID
+ * @param end_frame_idx : last frame ID
+ * @return int : 0 on success
+ */
+int bench_occlusion(const string& strDataPath, int start_frame_idx, int end_frame_idx)
+{
+    upsampling dc;
+    if (!setup_upsampling(dc))
+        return 1;
+    vector<Frame_Data> vecFrames;
+    if (!read_frames(strDataPath, start_frame_idx, end_frame_idx, vecFrames))
+        return 1;
+    int num_frames = static_cast<int>(vecFrames.size());
+    const int num_repeat = 5;
+    // virtual object: plane at 0.8 m over the centre half of the output
+    cv::Size size = dc.get_output_size();
+    cv::Mat virtual_depth = cv::Mat::zeros(size, CV_32FC1);
+    virtual_depth(cv::Rect(size.width / 4, size.height / 4, size.width / 2, size.height / 2)).setTo(0.8f);
+    dc.set_occlusion_test(0.01f, 0.1f);
+    const char* names[3] = {"run + depth test", "fused mask", "mask only"};
+    cv::Mat ref_mask;
+    for (int m = 0; m < 3; ++m) {
+        upsampling_context ctx;
+        cv::Mat dense, conf, occlusion;
+        double num_diff = 0.0;
+        chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+        for (int n = 0; n < num_repeat; ++n) {
+            for (int i = 0; i < num_frames; ++i) {
+                const Frame_Data& frame = vecFrames[i];
+                if (m == 0) { // downstream pass over dense/conf
+                    dc.run(ctx, frame.guide, frame.flood, frame.spot, dense, conf);
+                    dc.occlusion_mask(dense, conf, virtual_depth, occlusion);
+                } else {
+                    dc.run(ctx, frame.guide, frame.flood, frame.spot, virtual_depth, dense, conf, occlusion, m == 2);
+                }
+                if (n != 0 || i != num_frames - 1)
+                    continue;
+                if (m == 0)
+                    ref_mask = occlusion.clone();
+                else
+                    num_diff = cv::countNonZero(occlusion != ref_mask);
+            }
+        }
+        double sec = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+        cout << names[m] << ": " << num_frames * num_repeat / sec << " FPS";
+        if (m > 0)
+            cout << ", mask pixels different from run + depth test = " << num_diff;
+        cout << endl;
+    }
+    return 0;
+}
+
+/**
+ * @brief A/B of two settings of one option on the same frames: FPS of both,
+ *        and the error and the coverage of setting b against setting a
+ *
+ * The error is taken where both results are valid, pixels valid in only one
+ * of them are counted separately (max_abs_error() alone reports them as inf).
+ *
+ * @param strDataPath : input data path
+ * @param start_frame_idx : first frame ID
+ * @param end_frame_idx : last frame ID
+ * @param label : printed name of the inputs
+ * @param names : printed names of setting a (0) and b (1)
+ * @param setter : applies setting 0 or 1 to the upsampling object
+ * @param use_flood : run() with flood
+ * @param use_spot : run() with spot
+ * @return int : 0 on success
+ */
+int compare_engines(const string& strDataPath, int start_frame_idx, int end_frame_idx, const string& label,
+                    const char* const names[2], const function<void(upsampling&, int)>& setter,
+                    bool use_flood, bool use_spot)
+{
+    upsampling dc;
+    if (!setup_upsampling(dc))
+        return 1;
+    vector<Frame_Data> vecFrames;
+    if (!read_frames(strDataPath, start_frame_idx, end_frame_idx, vecFrames))
+        return 1;
+    int num_frames = static_cast<int>(vecFrames.size());
+    const int num_repeat = 5;
+    vector<cv::Mat> vecRef;
+    for (int setting = 0; setting < 2; ++setting) {
+        setter(dc, setting);
+        upsampling_context ctx;
+        cv::Mat dense, conf;
+        float max_err = 0.f;
+        double sum_diff = 0.0;
+        double num_valid = 0.0;
+        double num_only_a = 0.0; // valid in setting a only
+        double num_only_b = 0.0; // valid in setting b only
+        double num_pixels = 0.0;
+        chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+        for (int n = 0; n < num_repeat; ++n) {
+            for (int i = 0; i < num_frames; ++i) {
+                const Frame_Data& frame = vecFrames[i];
+                dc.run(ctx, frame.guide, use_flood ? frame.flood : cv::Mat(), use_spot ? frame.spot : cv::Mat(), dense, conf);
+                if (n != 0)
+                    continue;
+                if (setting == 0) {
+                    vecRef.push_back(dense.clone());
+                    continue;
+                }
+                cv::Mat ref = vecRef[i].clone();
+                cv::Mat res = dense.clone();
+                cv::Mat valid_a = (ref == ref); // not NaN
+                cv::Mat valid_b = (res == res);
+                cv::Mat only_a = valid_a & ~valid_b;
+                cv::Mat only_b = valid_b & ~valid_a;
+                num_only_a += cv::countNonZero(only_a);
+                num_only_b += cv::countNonZero(only_b);
+                num_pixels += static_cast<double>(ref.total());
+                ref.setTo(NAN, only_a); // common coverage
+                res.setTo(NAN, only_b);
+                max_err = max(max_err, max_abs_error(ref, res));
+                cv::Mat diff;
+                cv::absdiff(ref, res, diff);
+                cv::Mat valid = (diff == diff);
+                sum_diff += cv::sum(diff.setTo(0.0, ~valid))[0];
+                num_valid += cv::countNonZero(valid);
+            }
+        }
+        double sec = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+        cout << label << " " << names[setting] << ": " << num_frames * num_repeat / sec << " FPS";
+        if (setting == 1 && num_pixels > 0) {
+            cout << ", diff to " << names[0] << ": mean = " << (num_valid > 0 ? sum_diff / num_valid : 0.0)
+                 << " max = " << max_err << ", valid only in " << names[0] << " = " << 100.0 * num_only_a / num_pixels
+                 << " %, only in " << names[1] << " = " << 100.0 * num_only_b / num_pixels << " %";
+        }
+        cout << endl;
+    }
+    return 0;
+}
+
+/**
+ * @brief FPS of flood + spot by separate solves and merge against one joint solve,
+ *        and the difference of the joint result
+ *
+ * @param strDataPath : input data path
+ * @param start_frame_idx : first frame ID
+ * @param end_frame_idx : last frame ID
+ * @return int : 0 on success
+ */
+int bench_fusion(const string& strDataPath, int start_frame_idx, int end_frame_idx)
+{
+    const char* names[2] = {"merge", "joint"};
+    return compare_engines(strDataPath, start_frame_idx, end_frame_idx, "flood + spot", names,
+                            [](upsampling& dc, int setting) { dc.set_fusion(setting ? FUSION_JOINT : FUSION_MERGE); },
+                            true, true);
+}
+
+/**
+ * @brief FPS of spot only run() by the solver and by the coarse grid interpolator,
+ *        and the difference of the interpolator result
+ *
+ * @param strDataPath : input data path
+ * @param start_frame_idx : first frame ID
+ * @param end_frame_idx : last frame ID
+ * @return int : 0 on success
+ */
+int bench_spot(const string& strDataPath, int start_frame_idx, int end_frame_idx)
+{
+    const char* names[2] = {"solver", "interpolator"};
+    return compare_engines(strDataPath, start_frame_idx, end_frame_idx, "spot", names,
+                            [](upsampling& dc, int setting) {
+                                dc.set_spot_engine(setting ? SPOT_ENGINE_INTERPOLATOR : SPOT_ENGINE_SOLVER);
+                            }, false, true);
+}
+
+/**
+ * @brief FPS of flood only run() by the solver and by the mesh rasterization,
+ *        and the difference of the mesh result
+ *
+ * @param strDataPath : input data path
+ * @param start_frame_idx : first frame ID
+ * @param end_frame_idx : last frame ID
+ * @return int : 0 on success
+ */
+int bench_mesh(const string& strDataPath, int start_frame_idx, int end_frame_idx)
+{
+    const char* names[2] = {"solver", "mesh"};
+    return compare_engines(strDataPath, start_frame_idx, end_frame_idx, "flood", names,
+                            [](upsampling& dc, int setting) {
+                                dc.set_flood_engine(setting ? FLOOD_ENGINE_MESH : FLOOD_ENGINE_SOLVER);
+                            }, true, false);
+}
+
+/**
+ * @brief Main function of benchmark
+ *
+ * @param argc : argument number (5 is required)
+ * @param argv : arguments
+ * @return int
+ */
+int main(int argc, char* argv[])
+{
+    if (argc != 5) {
+        cout << "*** DS5 Upsampling benchmark ***" << endl;
+        cout << "USAGE:" << endl;
+        cout << "   <exe> <benchmark> <input data path> <start frame ID> <end frame ID>" << endl;
+        cout << "benchmark:" << endl;
+        cout << "   codec : compression ratio and throughput of dense/conf codec" << endl;
+        cout << "   shm : latency of run() results published to shared memory" << endl;
+        cout << "   async : sustained FPS of run() and the pipelined upsampling_async" << endl;
+        cout << "   stream : latency and drops of the streaming policies at 60 FPS input" << endl;
+        cout << "   streams : aggregate FPS of 1, 2, 4.. streams with own contexts on one configuration" << endl;
+        cout << "   batch : throughput of run_batch() against run() frame by frame" << endl;
+        cout << "   quality : FPS and quality levels with a latency budget of half the full quality time" << endl;
+        cout << "   static : FPS and skipped frames/pixels of static frame skip on repeated frames" << endl;
+        cout << "   solver : FPS, iterations and difference of the warm started PCG against FGS" << endl;
+        cout << "   fgs : time and depth difference of fgs_solver against cv::ximgproc::fastGlobalSmootherFilter" << endl;
+        cout << "   preproc : prepare() time with and without incremental preprocessing on repeated frames" << endl;
+        cout << "   pipeline : FPS of the template stage 1 variants against the generic preprocessing per mode" << endl;
+        cout << "   scale : FPS of output scales 1, 2, 4 and difference to the full resolution result" << endl;
+        cout << "   fg : FPS of the foreground mask by a downstream pass, fused into run() and mask only" << endl;
+        cout << "   occlusion : FPS of the occlusion mask by a downstream depth test, fused into run() and mask only" << endl;
+        cout << "   fusion : FPS of flood + spot by two solves and merge against one joint solve" << endl;
+        cout << "   spot : FPS of spot only input by the solver and the coarse grid interpolator" << endl;
+        cout << "   mesh : FPS of flood only input by the solver and the mesh rasterization" << endl;
+        cout << "   live : real-time latency on the shared memory input ring of shm_replay" << endl;
+        cout << "          (input data path: shared memory name or '-', end - start + 1 frames)" << endl;
+        return 0;
+    }
+    string strBench = string(argv[1]);
+    string strDataPath = string(argv[2]);
+    int start_frame_idx = atol(argv[3]);
+    int end_frame_idx = atol(argv[4]);
+    cout << "kernel isa: " << get_kernel_isa() << endl;
+    if (strBench == "codec")
+        return bench_codec(strDataPath, start_frame_idx, end_frame_idx);
+    if (strBench == "shm")
+        return bench_shm(strDataPath, start_frame_idx, end_frame_idx);
+    if (strBench == "async")
+        return bench_async(strDataPath, start_frame_idx, end_frame_idx);
+    if (strBench == "stream")
+        return bench_stream(strDataPath, start_frame_idx, end_frame_idx);
+    if (strBench == "streams")
+        return bench_streams(strDataPath, start_frame_idx, end_frame_idx);
+    if (strBench == "batch")
+        return bench_batch(strDataPath, start_frame_idx, end_frame_idx);
+    if (strBench == "quality")
+        return bench_quality(strDataPath, start_frame_idx, end_frame_idx);
+    if (strBench == "static")
+        return bench_static(strDataPath, start_frame_idx, end_frame_idx);
+    if (strBench == "solver")
+        return bench_solver(strDataPath, start_frame_idx, end_frame_idx);
+    if (strBench == "fgs")
+        return bench_fgs(strDataPath, start_frame_idx, end_frame_idx);
+    if (strBench == "preproc")
+        return bench_preproc(strDataPath, start_frame_idx, end_frame_idx);
+    if (strBench == "pipeline")
+        return bench_pipeline(strDataPath, start_frame_idx, end_frame_idx);
+    if (strBench == "scale")
+        return bench_scale(strDataPath, start_frame_idx, end_frame_idx);
+    if (strBench == "fg")
+        return bench_fg(strDataPath, start_frame_idx, end_frame_idx);
+    if (strBench == "occlusion")
+        return bench_occlusion(strDataPath, start_frame_idx, end_frame_idx);
+    if (strBench == "fusion")
+        return bench_fusion(strDataPath, start_frame_idx, end_frame_idx);
+    if (strBench == "spot")
+        return bench_spot(strDataPath, start_frame_idx, end_frame_idx);
+    if (strBench == "mesh")
+        return bench_mesh(strDataPath, start_frame_idx, end_frame_idx);
+    if (strBench == "live")
+        return bench_live(strDataPath == "-" ? string(SHM_INPUT_NAME) : strDataPath, end_frame_idx - start_frame_idx + 1);
+    cout << "unknown benchmark: " << strBench << endl;
+    return 1;
+}
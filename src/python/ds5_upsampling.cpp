@@ -0,0 +1,697 @@
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include "upsampling.h"
+#include "upsampling_kernels.h"
+#include <algorithm>
+#include <float.h>
+#include <limits.h>
+#include <mutex>
+#include <new>
+#include <string.h>
+#include <utility>
+#include <vector>
+
+/*
+ * Python module ds5_upsampling
+ *
+ * Arrays are exchanged through the buffer protocol: inputs (NumPy arrays or
+ * any exporter) are read in place, outputs are written into the arrays of the
+ * caller or into new arrays sharing the memory of a cv::Mat. The GIL is
+ * released while frames are processed.
+ */
+
+// keys of set_config()/get_config(), values are clamped to [min, max] like the setters of upsampling
+typedef struct Config_Float{
+	const char* name;
+	float Upsampling_Config::* member;
+	float min;
+} Config_Float;
+
+typedef struct Config_Int{
+	const char* name;
+	int Upsampling_Config::* member;
+	int min;
+	int max;
+	bool is_enum; // out of [min, max] raises ValueError instead of clamping
+} Config_Int;
+
+typedef struct Config_Bool{
+	const char* name;
+	bool Upsampling_Config::* member;
+} Config_Bool;
+
+static const Config_Float CONFIG_FLOATS[] = {
+	{"fgs_lambda_flood", &Upsampling_Config::fgs_lambda_flood, 1.f},
+	{"fgs_sigma_color_flood", &Upsampling_Config::fgs_sigma_color_flood, 1.f},
+	{"fgs_lambda_attenuation", &Upsampling_Config::fgs_lambda_attenuation, -FLT_MAX},
+	{"fgs_lambda_spot", &Upsampling_Config::fgs_lambda_spot, -FLT_MAX},
+	{"fgs_sigma_color_spot", &Upsampling_Config::fgs_sigma_color_spot, -FLT_MAX},
+	{"z_continuous_thresh", &Upsampling_Config::z_continuous_thresh, -FLT_MAX},
+	{"occlusion_thresh", &Upsampling_Config::occlusion_thresh, -FLT_MAX},
+	{"depth_diff_thresh", &Upsampling_Config::depth_diff_thresh, -FLT_MAX},
+	{"guide_diff_thresh", &Upsampling_Config::guide_diff_thresh, -FLT_MAX},
+	{"incremental_depth_tolerance", &Upsampling_Config::incremental_depth_tolerance, 0.f},
+	{"incremental_guide_tolerance", &Upsampling_Config::incremental_guide_tolerance, 0.f},
+	{"fx", &Upsampling_Config::fx, -FLT_MAX},
+	{"fy", &Upsampling_Config::fy, -FLT_MAX},
+	{"cx", &Upsampling_Config::cx, -FLT_MAX},
+	{"cy", &Upsampling_Config::cy, -FLT_MAX},
+	{"pcg_tolerance", &Upsampling_Config::pcg_tolerance, 0.f},
+	{"latency_budget_ms", &Upsampling_Config::latency_budget_ms, 0.f},
+	{"static_guide_thresh", &Upsampling_Config::static_guide_thresh, 0.f},
+	{"static_depth_thresh", &Upsampling_Config::static_depth_thresh, 0.f},
+	{"conf_threshold", &Upsampling_Config::conf_threshold, 0.f},
+	{"joint_flood_weight", &Upsampling_Config::joint_flood_weight, 1e-6f},
+	{"joint_spot_weight", &Upsampling_Config::joint_spot_weight, 1e-6f},
+	{"spot_rbf_sigma", &Upsampling_Config::spot_rbf_sigma, 0.f},
+};
+
+static const Config_Int CONFIG_INTS[] = {
+	{"fgs_num_iter_flood", &Upsampling_Config::fgs_num_iter_flood, 1, 5, false},
+	{"fgs_num_iter_spot", &Upsampling_Config::fgs_num_iter_spot, 1, 5, false},
+	{"guide_edge_dilate_size", &Upsampling_Config::guide_edge_dilate_size, INT_MIN, INT_MAX, false},
+	{"range_flood", &Upsampling_Config::range_flood, INT_MIN, INT_MAX, false},
+	{"min_diff_count", &Upsampling_Config::min_diff_count, INT_MIN, INT_MAX, false},
+	{"fgs_downscale", &Upsampling_Config::fgs_downscale, 1, INT_MAX, false},
+	{"solver", &Upsampling_Config::solver, SOLVER_FGS, SOLVER_PCG, true},
+	{"pcg_max_iter", &Upsampling_Config::pcg_max_iter, 1, INT_MAX, false},
+	{"output_scale", &Upsampling_Config::output_scale, 1, INT_MAX, false},
+	{"fusion", &Upsampling_Config::fusion, FUSION_MERGE, FUSION_JOINT, true},
+	{"flood_engine", &Upsampling_Config::flood_engine, FLOOD_ENGINE_SOLVER, FLOOD_ENGINE_MESH, true},
+	{"mesh_tile_size", &Upsampling_Config::mesh_tile_size, 8, INT_MAX, false},
+	{"spot_engine", &Upsampling_Config::spot_engine, SPOT_ENGINE_SOLVER, SPOT_ENGINE_INTERPOLATOR, true},
+	{"spot_grid_step", &Upsampling_Config::spot_grid_step, 1, INT_MAX, false},
+};
+
+static const Config_Bool CONFIG_BOOLS[] = {
+	{"use_preprocessing", &Upsampling_Config::use_preprocessing},
+	{"incremental_preprocessing", &Upsampling_Config::incremental_preprocessing},
+	{"specialized_pipeline", &Upsampling_Config::specialized_pipeline},
+	{"depth_edge_proc_on", &Upsampling_Config::depth_edge_proc_on},
+};
+
+/*
+ * Image: buffer exporter owning a cv::Mat (outputs allocated by the module)
+ */
+typedef struct Py_Image{
+	PyObject_HEAD
+	cv::Mat mat;
+	Py_ssize_t shape[3];
+	Py_ssize_t strides[3];
+} Py_Image;
+
+/**
+ * @brief export the Mat as (rows, cols[, channels]) float32 or uint8 buffer
+ *
+ */
+static int image_getbuffer(PyObject* obj, Py_buffer* view, int flags)
+{
+	Py_Image* self = reinterpret_cast<Py_Image*>(obj);
+	const cv::Mat& mat = self->mat;
+	int cn = mat.channels();
+	self->shape[0] = mat.rows;
+	self->shape[1] = mat.cols;
+	self->shape[2] = cn;
+	self->strides[0] = static_cast<Py_ssize_t>(mat.step[0]);
+	self->strides[1] = static_cast<Py_ssize_t>(mat.elemSize());
+	self->strides[2] = static_cast<Py_ssize_t>(mat.elemSize1());
+	view->obj = obj;
+	Py_INCREF(obj);
+	view->buf = mat.data;
+	view->len = static_cast<Py_ssize_t>(mat.total() * mat.elemSize());
+	view->readonly = 0;
+	view->itemsize = static_cast<Py_ssize_t>(mat.elemSize1());
+	view->format = (flags & PyBUF_FORMAT) ? const_cast<char*>(mat.depth() == CV_8U ? "B" : "f") : nullptr;
+	view->ndim = cn == 1 ? 2 : 3;
+	view->shape = (flags & PyBUF_ND) ? self->shape : nullptr;
+	view->strides = (flags & PyBUF_STRIDES) == PyBUF_STRIDES ? self->strides : nullptr;
+	view->suboffsets = nullptr;
+	view->internal = nullptr;
+	return 0;
+}
+
+static void image_dealloc(PyObject* obj)
+{
+	Py_Image* self = reinterpret_cast<Py_Image*>(obj);
+	self->mat.~Mat();
+	Py_TYPE(obj)->tp_free(obj);
+}
+
+static PyBufferProcs image_buffer_procs = {image_getbuffer, nullptr};
+
+static PyTypeObject image_type = {PyVarObject_HEAD_INIT(nullptr, 0)};
+
+static PyObject* g_numpy_asarray = nullptr; // numpy.asarray (nullptr: results are memoryviews)
+
+/**
+ * @brief wrap a Mat into an array sharing its memory
+ *
+ * @param mat : image (reference is kept by the array)
+ * @return PyObject* : numpy.ndarray (memoryview without NumPy), new reference
+ */
+static PyObject* mat_to_array(const cv::Mat& mat)
+{
+	Py_Image* image = PyObject_New(Py_Image, &image_type);
+	if (image == nullptr)
+		return nullptr;
+	new (&image->mat) cv::Mat(mat);
+	PyObject* array = g_numpy_asarray != nullptr
+						? PyObject_CallFunctionObjArgs(g_numpy_asarray, reinterpret_cast<PyObject*>(image), nullptr)
+						: PyMemoryView_FromObject(reinterpret_cast<PyObject*>(image));
+	Py_DECREF(image);
+	return array;
+}
+
+/*
+ * buffers of the caller
+ */
+typedef struct Py_Input{
+	Py_buffer buffer;
+	bool valid = false;
+	Py_Input() {};
+	~Py_Input() { if (this->valid) PyBuffer_Release(&this->buffer); };
+	Py_Input(const Py_Input&) = delete;
+	Py_Input& operator=(const Py_Input&) = delete;
+} Py_Input; // released with the frame, holds the exporter
+
+/**
+ * @brief Mat header on a buffer of the caller (no copy)
+ *
+ * Accepts C-contiguous rows of (rows, cols) or (rows, cols, channels) uint8
+ * or float32 with any row stride.
+ *
+ * @param obj : exporter (None: empty Mat)
+ * @param name : argument name for errors
+ * @param depth : CV_8U or CV_32F
+ * @param channels : required channels (0: 1 or 3)
+ * @param size : required size (empty: any)
+ * @param writable : output buffer
+ * @param input : buffer holder
+ * @param mat : output header
+ * @return true : succeed
+ * @return false : Python exception is set
+ */
+static bool buffer_to_mat(PyObject* obj, const char* name, int depth, int channels, const cv::Size& size,
+							bool writable, Py_Input& input, cv::Mat& mat)
+{
+	mat.release();
+	if (obj == nullptr || obj == Py_None)
+		return true;
+	int flags = PyBUF_STRIDES | PyBUF_FORMAT | (writable ? PyBUF_WRITABLE : 0);
+	if (PyObject_GetBuffer(obj, &input.buffer, flags) != 0)
+		return false;
+	input.valid = true;
+	const Py_buffer& b = input.buffer;
+	const char* fmt = b.format != nullptr ? b.format : "B";
+	if (*fmt == '<' || *fmt == '=' || *fmt == '@')
+		fmt += 1;
+	char expected = depth == CV_8U ? 'B' : 'f';
+	int cn = b.ndim == 3 ? static_cast<int>(b.shape[2]) : 1;
+	if (fmt[0] != expected || fmt[1] != '\0') {
+		PyErr_Format(PyExc_TypeError, "%s: dtype must be %s", name, depth == CV_8U ? "uint8" : "float32");
+		return false;
+	}
+	if ((b.ndim != 2 && b.ndim != 3) || (channels > 0 ? cn != channels : (cn != 1 && cn != 3))) {
+		PyErr_Format(PyExc_ValueError, "%s: shape must be (rows, cols%s)", name,
+						channels == 1 ? "" : channels == 3 ? ", 3" : "[, 3]");
+		return false;
+	}
+	Py_ssize_t item = b.itemsize;
+	if (b.strides[b.ndim - 1] != item || (b.ndim == 3 && b.strides[1] != item * cn) || b.strides[0] < item * cn * b.shape[1]) {
+		PyErr_Format(PyExc_ValueError, "%s: rows must be contiguous", name);
+		return false;
+	}
+	if (!size.empty() && (b.shape[0] != size.height || b.shape[1] != size.width)) {
+		PyErr_Format(PyExc_ValueError, "%s: shape must be (%d, %d, ...)", name, size.height, size.width);
+		return false;
+	}
+	mat = cv::Mat(static_cast<int>(b.shape[0]), static_cast<int>(b.shape[1]), CV_MAKETYPE(depth, cn),
+					b.buf, static_cast<size_t>(b.strides[0]));
+	return true;
+}
+
+/*
+ * Upsampling: configured upsampling object with its own context
+ */
+typedef struct Py_Upsampling{
+	PyObject_HEAD
+	upsampling* engine;
+	upsampling_context* ctx;
+	std::mutex* mutex; // serializes run()/run_batch() of threads sharing the object and __init__()
+} Py_Upsampling;
+
+/**
+ * @brief allocate with an engine of the default resolutions
+ *
+ * The members are never null, also for Upsampling.__new__() without __init__().
+ */
+static PyObject* upsampling_new(PyTypeObject* type, PyObject*, PyObject*)
+{
+	PyObject* obj = type->tp_alloc(type, 0);
+	if (obj == nullptr)
+		return nullptr;
+	Py_Upsampling* self = reinterpret_cast<Py_Upsampling*>(obj);
+	self->engine = new (std::nothrow) upsampling(UPSAMPLING_GUIDE_WIDTH, UPSAMPLING_GUIDE_HEIGHT,
+													UPSAMPLING_GRID_WIDTH, UPSAMPLING_GRID_HEIGHT);
+	self->ctx = new (std::nothrow) upsampling_context();
+	self->mutex = new (std::nothrow) std::mutex();
+	if (self->engine == nullptr || self->ctx == nullptr || self->mutex == nullptr) {
+		Py_DECREF(obj);
+		return PyErr_NoMemory();
+	}
+	return obj;
+}
+
+/**
+ * @brief __init__(): engine and context of the given resolutions
+ *
+ * The engine is replaced under the mutex, so a run() of another thread finishes first.
+ */
+static int upsampling_init(PyObject* obj, PyObject* args, PyObject* kwargs)
+{
+	Py_Upsampling* self = reinterpret_cast<Py_Upsampling*>(obj);
+	static const char* keywords[] = {"guide_width", "guide_height", "grid_width", "grid_height", nullptr};
+	int guide_width = UPSAMPLING_GUIDE_WIDTH;
+	int guide_height = UPSAMPLING_GUIDE_HEIGHT;
+	int grid_width = UPSAMPLING_GRID_WIDTH;
+	int grid_height = UPSAMPLING_GRID_HEIGHT;
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|iiii", const_cast<char**>(keywords),
+										&guide_width, &guide_height, &grid_width, &grid_height))
+		return -1;
+	if (guide_width <= 0 || guide_height <= 0 || grid_width <= 0 || grid_height <= 0) {
+		PyErr_SetString(PyExc_ValueError, "resolutions must be positive");
+		return -1;
+	}
+	upsampling* engine = new (std::nothrow) upsampling(guide_width, guide_height, grid_width, grid_height);
+	upsampling_context* ctx = new (std::nothrow) upsampling_context();
+	if (engine == nullptr || ctx == nullptr) {
+		delete engine;
+		delete ctx;
+		PyErr_NoMemory();
+		return -1;
+	}
+	std::lock_guard<std::mutex> lock(*self->mutex);
+	delete self->engine;
+	delete self->ctx;
+	self->engine = engine;
+	self->ctx = ctx;
+	return 0;
+}
+
+static void upsampling_dealloc(PyObject* obj)
+{
+	Py_Upsampling* self = reinterpret_cast<Py_Upsampling*>(obj);
+	delete self->engine;
+	delete self->ctx;
+	delete self->mutex;
+	Py_TYPE(obj)->tp_free(obj);
+}
+
+/**
+ * @brief set_cam_parameters(cx, cy, fx, fy)
+ *
+ */
+static PyObject* upsampling_set_cam_parameters(PyObject* obj, PyObject* args)
+{
+	Py_Upsampling* self = reinterpret_cast<Py_Upsampling*>(obj);
+	float cx, cy, fx, fy;
+	if (!PyArg_ParseTuple(args, "ffff", &cx, &cy, &fx, &fy))
+		return nullptr;
+	self->engine->set_cam_paramters(Camera_Params(cx, cy, fx, fy));
+	Py_RETURN_NONE;
+}
+
+/**
+ * @brief set_config(**parameters): publish a snapshot with the given fields of Upsampling_Config
+ *
+ * The fields are applied by update_config(), so concurrent setters keep each other's fields.
+ * Values are clamped like the setters (e.g. fgs_num_iter_* to 1~5, output_scale to 1~),
+ * unknown enum values raise ValueError and nothing is applied. The tables are rebuilt,
+ * depth_edge_proc_on follows z_continuous_thresh/occlusion_thresh unless it is given.
+ *
+ */
+static PyObject* upsampling_set_config(PyObject* obj, PyObject* args, PyObject* kwargs)
+{
+	Py_Upsampling* self = reinterpret_cast<Py_Upsampling*>(obj);
+	if (PyTuple_Size(args) != 0) {
+		PyErr_SetString(PyExc_TypeError, "set_config() takes keyword arguments only");
+		return nullptr;
+	}
+	// values are converted before the engine is locked, the conversion may run Python code
+	std::vector<std::pair<float Upsampling_Config::*, float>> floats;
+	std::vector<std::pair<int Upsampling_Config::*, int>> ints;
+	std::vector<std::pair<bool Upsampling_Config::*, bool>> bools;
+	bool edge_proc_given = false;
+	PyObject* key;
+	PyObject* value;
+	Py_ssize_t pos = 0;
+	while (kwargs != nullptr && PyDict_Next(kwargs, &pos, &key, &value)) {
+		const char* name = PyUnicode_AsUTF8(key);
+		if (name == nullptr)
+			return nullptr;
+		bool found = false;
+		for (const Config_Float& f : CONFIG_FLOATS) {
+			if (strcmp(f.name, name) == 0) {
+				double v = PyFloat_AsDouble(value);
+				if (v == -1.0 && PyErr_Occurred())
+					return nullptr;
+				floats.push_back(std::make_pair(f.member, std::max(f.min, static_cast<float>(v))));
+				found = true;
+			}
+		}
+		for (const Config_Int& f : CONFIG_INTS) {
+			if (strcmp(f.name, name) == 0) {
+				long v = PyLong_AsLong(value);
+				if (v == -1 && PyErr_Occurred())
+					return nullptr;
+				if (f.is_enum && (v < f.min || v > f.max)) {
+					PyErr_Format(PyExc_ValueError, "%s must be %d~%d", name, f.min, f.max);
+					return nullptr;
+				}
+				v = std::min(std::max(v, static_cast<long>(f.min)), static_cast<long>(f.max));
+				ints.push_back(std::make_pair(f.member, static_cast<int>(v)));
+				found = true;
+			}
+		}
+		for (const Config_Bool& f : CONFIG_BOOLS) {
+			if (strcmp(f.name, name) == 0) {
+				int v = PyObject_IsTrue(value);
+				if (v < 0)
+					return nullptr;
+				bools.push_back(std::make_pair(f.member, v != 0));
+				edge_proc_given = edge_proc_given || f.member == &Upsampling_Config::depth_edge_proc_on;
+				found = true;
+			}
+		}
+		if (!found) {
+			PyErr_Format(PyExc_KeyError, "unknown parameter: %s", name);
+			return nullptr;
+		}
+	}
+	Py_BEGIN_ALLOW_THREADS
+	self->engine->update_config([&](Upsampling_Config& config) {
+		for (const auto& f : floats)
+			config.*f.first = f.second;
+		for (const auto& f : ints)
+			config.*f.first = f.second;
+		for (const auto& f : bools)
+			config.*f.first = f.second;
+		if (!edge_proc_given) // as set_preprocessing_parameters()
+			config.depth_edge_proc_on = !(config.z_continuous_thresh == 1.0 && config.occlusion_thresh == 0.0);
+		config.tables.reset();
+	});
+	Py_END_ALLOW_THREADS
+	Py_RETURN_NONE;
+}
+
+/**
+ * @brief get_config() -> dict of the current parameter snapshot
+ *
+ */
+static PyObject* upsampling_get_config(PyObject* obj, PyObject*)
+{
+	Py_Upsampling* self = reinterpret_cast<Py_Upsampling*>(obj);
+	std::shared_ptr<const Upsampling_Config> config = self->engine->get_config();
+	PyObject* dict = PyDict_New();
+	if (dict == nullptr)
+		return nullptr;
+	bool ok = true;
+	for (const Config_Float& f : CONFIG_FLOATS) {
+		PyObject* v = PyFloat_FromDouble((*config).*f.member);
+		ok = ok && v != nullptr && PyDict_SetItemString(dict, f.name, v) == 0;
+		Py_XDECREF(v);
+	}
+	for (const Config_Int& f : CONFIG_INTS) {
+		PyObject* v = PyLong_FromLong((*config).*f.member);
+		ok = ok && v != nullptr && PyDict_SetItemString(dict, f.name, v) == 0;
+		Py_XDECREF(v);
+	}
+	for (const Config_Bool& f : CONFIG_BOOLS) {
+		ok = ok && PyDict_SetItemString(dict, f.name, (*config).*f.member ? Py_True : Py_False) == 0;
+	}
+	if (!ok) {
+		Py_DECREF(dict);
+		return nullptr;
+	}
+	return dict;
+}
+
+/**
+ * @brief raise for a failed Upsampling_Status
+ *
+ * @return true : status is UPSAMPLING_OK or UPSAMPLING_NO_INPUT
+ */
+static bool check_status(int status)
+{
+	if (status == UPSAMPLING_ERROR) {
+		PyErr_SetString(PyExc_RuntimeError, "upsampling failed (invalid input)");
+		return false;
+	}
+	return true;
+}
+
+/**
+ * @brief run(guide, flood=None, spot=None, dense=None, conf=None) -> (dense, conf)
+ *
+ * guide: (h, w[, 3]) uint8, flood: (grid h, grid w, 3) float32, spot: (n, m, 3)
+ * float32, dense/conf: output size float32 outputs written in place (None: new
+ * arrays). The context of the object keeps state between frames (PCG warm
+ * start, static frame skip, latency budget).
+ */
+static PyObject* upsampling_run(PyObject* obj, PyObject* args, PyObject* kwargs)
+{
+	Py_Upsampling* self = reinterpret_cast<Py_Upsampling*>(obj);
+	static const char* keywords[] = {"guide", "flood", "spot", "dense", "conf", nullptr};
+	PyObject* py_guide = nullptr;
+	PyObject* py_flood = Py_None;
+	PyObject* py_spot = Py_None;
+	PyObject* py_dense = Py_None;
+	PyObject* py_conf = Py_None;
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|OOOO", const_cast<char**>(keywords),
+										&py_guide, &py_flood, &py_spot, &py_dense, &py_conf))
+		return nullptr;
+	cv::Size guide_size = self->engine->get_guide_size();
+	cv::Size output_size = self->engine->get_output_size();
+	Py_Input in_guide, in_flood, in_spot, in_dense, in_conf;
+	cv::Mat guide, flood, spot, dense, conf;
+	if (!buffer_to_mat(py_guide, "guide", CV_8U, 0, guide_size, false, in_guide, guide)
+		|| !buffer_to_mat(py_flood, "flood", CV_32F, 3, self->engine->get_grid_size(), false, in_flood, flood)
+		|| !buffer_to_mat(py_spot, "spot", CV_32F, 3, cv::Size(), false, in_spot, spot)
+		|| !buffer_to_mat(py_dense, "dense", CV_32F, 1, output_size, true, in_dense, dense)
+		|| !buffer_to_mat(py_conf, "conf", CV_32F, 1, output_size, true, in_conf, conf))
+		return nullptr;
+	if (guide.empty()) {
+		PyErr_SetString(PyExc_ValueError, "guide is required");
+		return nullptr;
+	}
+	if (dense.empty())
+		dense.create(output_size, CV_32FC1);
+	if (conf.empty())
+		conf.create(output_size, CV_32FC1);
+	Upsampling_View views[5];
+	const cv::Mat* mats[5] = {&guide, &flood, &spot, &dense, &conf};
+	for (int i = 0; i < 5; ++i) {
+		if (mats[i]->empty())
+			continue;
+		views[i].data = mats[i]->data;
+		views[i].width = mats[i]->cols;
+		views[i].height = mats[i]->rows;
+		views[i].step = mats[i]->step[0];
+		views[i].type = mats[i]->type();
+	}
+	int status;
+	Py_BEGIN_ALLOW_THREADS
+	{
+		std::lock_guard<std::mutex> lock(*self->mutex);
+		status = self->engine->run_view(*self->ctx, views[0], views[1], views[2], views[3], views[4]);
+	}
+	Py_END_ALLOW_THREADS
+	if (status == UPSAMPLING_INVALID_VIEW) {
+		PyErr_SetString(PyExc_ValueError, "input or output does not match the resolutions");
+		return nullptr;
+	}
+	if (!check_status(status))
+		return nullptr;
+	PyObject* out_dense = in_dense.valid ? (Py_INCREF(py_dense), py_dense) : mat_to_array(dense);
+	PyObject* out_conf = in_conf.valid ? (Py_INCREF(py_conf), py_conf) : mat_to_array(conf);
+	if (out_dense == nullptr || out_conf == nullptr) {
+		Py_XDECREF(out_dense);
+		Py_XDECREF(out_conf);
+		return nullptr;
+	}
+	return Py_BuildValue("(NN)", out_dense, out_conf);
+}
+
+/**
+ * @brief run_batch(frames, num_threads=0) -> [(dense, conf, status), ...]
+ *
+ * frames: sequence of (guide, flood, spot) with None for a missing cloud.
+ * Frames run on worker threads with their own contexts (run_batch()), the
+ * GIL is released for the whole batch. status is an Upsampling_Status.
+ */
+static PyObject* upsampling_run_batch(PyObject* obj, PyObject* args, PyObject* kwargs)
+{
+	Py_Upsampling* self = reinterpret_cast<Py_Upsampling*>(obj);
+	static const char* keywords[] = {"frames", "num_threads", nullptr};
+	PyObject* py_frames = nullptr;
+	int num_threads = 0;
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|i", const_cast<char**>(keywords), &py_frames, &num_threads))
+		return nullptr;
+	PyObject* seq = PySequence_Fast(py_frames, "frames must be a sequence of (guide, flood, spot)");
+	if (seq == nullptr)
+		return nullptr;
+	Py_ssize_t num_frames = PySequence_Fast_GET_SIZE(seq);
+	cv::Size guide_size = self->engine->get_guide_size();
+	cv::Size grid_size = self->engine->get_grid_size();
+	cv::Size output_size = self->engine->get_output_size();
+	std::vector<Py_Input> inputs(num_frames * 3);
+	std::vector<Upsampling_Batch_Frame> frames(num_frames);
+	for (Py_ssize_t i = 0; i < num_frames; ++i) {
+		PyObject* item = PySequence_Fast_GET_ITEM(seq, i);
+		PyObject* guide = nullptr;
+		PyObject* flood = Py_None;
+		PyObject* spot = Py_None;
+		if (!PyTuple_Check(item) || !PyArg_ParseTuple(item, "O|OO", &guide, &flood, &spot)) {
+			if (!PyErr_Occurred())
+				PyErr_SetString(PyExc_TypeError, "frames must be a sequence of (guide, flood, spot)");
+			Py_DECREF(seq);
+			return nullptr;
+		}
+		Upsampling_Batch_Frame& frame = frames[i];
+		if (!buffer_to_mat(guide, "guide", CV_8U, 0, guide_size, false, inputs[i * 3], frame.guide)
+			|| !buffer_to_mat(flood, "flood", CV_32F, 3, grid_size, false, inputs[i * 3 + 1], frame.flood)
+			|| !buffer_to_mat(spot, "spot", CV_32F, 3, cv::Size(), false, inputs[i * 3 + 2], frame.spot)) {
+			Py_DECREF(seq);
+			return nullptr;
+		}
+		frame.dense.create(output_size, CV_32FC1);
+		frame.conf.create(output_size, CV_32FC1);
+	}
+	Py_BEGIN_ALLOW_THREADS
+	{
+		std::lock_guard<std::mutex> lock(*self->mutex); // the engine is not replaced meanwhile
+		self->engine->run_batch(frames.data(), static_cast<int>(num_frames), num_threads);
+	}
+	Py_END_ALLOW_THREADS
+	Py_DECREF(seq);
+	PyObject* results = PyList_New(num_frames);
+	if (results == nullptr)
+		return nullptr;
+	for (Py_ssize_t i = 0; i < num_frames; ++i) {
+		PyObject* dense = mat_to_array(frames[i].dense);
+		PyObject* conf = mat_to_array(frames[i].conf);
+		PyObject* result = (dense != nullptr && conf != nullptr)
+							? Py_BuildValue("(NNi)", dense, conf, frames[i].status) : nullptr;
+		if (result == nullptr) {
+			if (dense == nullptr || conf == nullptr) {
+				Py_XDECREF(dense);
+				Py_XDECREF(conf);
+			}
+			Py_DECREF(results);
+			return nullptr;
+		}
+		PyList_SET_ITEM(results, i, result);
+	}
+	return results;
+}
+
+static PyObject* upsampling_get_guide_size(PyObject* obj, void*)
+{
+	cv::Size size = reinterpret_cast<Py_Upsampling*>(obj)->engine->get_guide_size();
+	return Py_BuildValue("(ii)", size.width, size.height);
+}
+
+static PyObject* upsampling_get_grid_size(PyObject* obj, void*)
+{
+	cv::Size size = reinterpret_cast<Py_Upsampling*>(obj)->engine->get_grid_size();
+	return Py_BuildValue("(ii)", size.width, size.height);
+}
+
+static PyMethodDef upsampling_methods[] = {
+	{"set_cam_parameters", upsampling_set_cam_parameters, METH_VARARGS,
+		"set_cam_parameters(cx, cy, fx, fy): camera (guide) intrinsics"},
+	{"set_config", reinterpret_cast<PyCFunction>(reinterpret_cast<void(*)(void)>(upsampling_set_config)),
+		METH_VARARGS | METH_KEYWORDS, "set_config(**parameters): set fields of Upsampling_Config"},
+	{"get_config", upsampling_get_config, METH_NOARGS, "get_config() -> dict of Upsampling_Config"},
+	{"run", reinterpret_cast<PyCFunction>(reinterpret_cast<void(*)(void)>(upsampling_run)),
+		METH_VARARGS | METH_KEYWORDS, "run(guide, flood=None, spot=None, dense=None, conf=None) -> (dense, conf)"},
+	{"run_batch", reinterpret_cast<PyCFunction>(reinterpret_cast<void(*)(void)>(upsampling_run_batch)),
+		METH_VARARGS | METH_KEYWORDS, "run_batch(frames, num_threads=0) -> [(dense, conf, status), ...]"},
+	{nullptr, nullptr, 0, nullptr}
+};
+
+static PyGetSetDef upsampling_getset[] = {
+	{const_cast<char*>("guide_size"), upsampling_get_guide_size, nullptr, const_cast<char*>("(width, height)"), nullptr},
+	{const_cast<char*>("grid_size"), upsampling_get_grid_size, nullptr, const_cast<char*>("(width, height)"), nullptr},
+	{nullptr, nullptr, nullptr, nullptr, nullptr}
+};
+
+static PyTypeObject upsampling_type = {PyVarObject_HEAD_INIT(nullptr, 0)};
+
+/**
+ * @brief kernel_isa() -> instruction set of the dispatched kernels
+ *
+ */
+static PyObject* module_kernel_isa(PyObject*, PyObject*)
+{
+	return PyUnicode_FromString(get_kernel_isa());
+}
+
+static PyMethodDef module_methods[] = {
+	{"kernel_isa", module_kernel_isa, METH_NOARGS, "kernel_isa() -> instruction set of the dispatched kernels"},
+	{nullptr, nullptr, 0, nullptr}
+};
+
+static PyModuleDef upsampling_module = {
+	PyModuleDef_HEAD_INIT, "ds5_upsampling", "DS5 depth upsampling (buffer protocol, no copies)", -1, module_methods
+};
+
+PyMODINIT_FUNC PyInit_ds5_upsampling(void)
+{
+	image_type.tp_name = "ds5_upsampling.Image";
+	image_type.tp_basicsize = sizeof(Py_Image);
+	image_type.tp_flags = Py_TPFLAGS_DEFAULT;
+	image_type.tp_dealloc = image_dealloc;
+	image_type.tp_as_buffer = &image_buffer_procs;
+	image_type.tp_doc = "image memory of a result";
+	if (PyType_Ready(&image_type) < 0)
+		return nullptr;
+	upsampling_type.tp_name = "ds5_upsampling.Upsampling";
+	upsampling_type.tp_basicsize = sizeof(Py_Upsampling);
+	upsampling_type.tp_flags = Py_TPFLAGS_DEFAULT;
+	upsampling_type.tp_new = upsampling_new;
+	upsampling_type.tp_init = upsampling_init;
+	upsampling_type.tp_dealloc = upsampling_dealloc;
+	upsampling_type.tp_methods = upsampling_methods;
+	upsampling_type.tp_getset = upsampling_getset;
+	upsampling_type.tp_doc = "Upsampling(guide_width=960, guide_height=540, grid_width=80, grid_height=60)";
+	if (PyType_Ready(&upsampling_type) < 0)
+		return nullptr;
+	PyObject* module = PyModule_Create(&upsampling_module);
+	if (module == nullptr)
+		return nullptr;
+	Py_INCREF(&upsampling_type);
+	if (PyModule_AddObject(module, "Upsampling", reinterpret_cast<PyObject*>(&upsampling_type)) < 0) {
+		Py_DECREF(&upsampling_type);
+		Py_DECREF(module);
+		return nullptr;
+	}
+	PyModule_AddIntConstant(module, "OK", UPSAMPLING_OK);
+	PyModule_AddIntConstant(module, "NO_INPUT", UPSAMPLING_NO_INPUT);
+	PyModule_AddIntConstant(module, "ERROR", UPSAMPLING_ERROR);
+	PyModule_AddIntConstant(module, "SOLVER_FGS", SOLVER_FGS);
+	PyModule_AddIntConstant(module, "SOLVER_PCG", SOLVER_PCG);
+	PyModule_AddIntConstant(module, "FUSION_MERGE", FUSION_MERGE);
+	PyModule_AddIntConstant(module, "FUSION_JOINT", FUSION_JOINT);
+	PyModule_AddIntConstant(module, "FLOOD_ENGINE_SOLVER", FLOOD_ENGINE_SOLVER);
+	PyModule_AddIntConstant(module, "FLOOD_ENGINE_MESH", FLOOD_ENGINE_MESH);
+	PyModule_AddIntConstant(module, "SPOT_ENGINE_SOLVER", SPOT_ENGINE_SOLVER);
+	PyModule_AddIntConstant(module, "SPOT_ENGINE_INTERPOLATOR", SPOT_ENGINE_INTERPOLATOR);
+	PyObject* numpy = PyImport_ImportModule("numpy");
+	if (numpy != nullptr) {
+		g_numpy_asarray = PyObject_GetAttrString(numpy, "asarray");
+		Py_DECREF(numpy);
+	}
+	PyErr_Clear(); // results are memoryviews without NumPy
+	return module;
+}
@@ -0,0 +1,110 @@
+/**
+ * @file shm_consumer.cpp
+ * @brief local test consumer of the shared memory output ring
+ * @version 2.0
+ * @date 2026-10-19
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+#include "upsampling/shm_output.h"
+#include <iostream>
+#include <algorithm>
+#include <thread>
+#include <vector>
+#include <string>
+#include <stdlib.h>
+#include <math.h>
+
+using namespace std;
+
+/**
+ * @brief print latency statistics
+ *
+ * @param label : label
+ * @param vecLatency : latencies (us), sorted in place
+ */
+void print_latency(const string& label, vector<double>& vecLatency)
+{
+    if (vecLatency.empty())
+        return;
+    sort(vecLatency.begin(), vecLatency.end());
+    double sum = 0.0;
+    for (double v : vecLatency)
+        sum += v;
+    size_t n = vecLatency.size();
+    cout << label << ": avg = " << sum / n << " p50 = " << vecLatency[n / 2]
+         << " p99 = " << vecLatency[min(n - 1, n * 99 / 100)] << " max = " << vecLatency[n - 1] << " [us]" << endl;
+}
+
+/**
+ * @brief Main function of shared memory consumer
+ *
+ * @param argc : argument number
+ * @param argv : arguments
+ * @return int
+ */
+int main(int argc, char* argv[])
+{
+    string strName = argc > 1 ? string(argv[1]) : string(SHM_OUTPUT_NAME);
+    int num_frames = argc > 2 ? atol(argv[2]) : 1000;
+    if (argc > 3) {
+        cout << "USAGE:" << endl;
+        cout << "   <exe> [shared memory name] [number of frames]" << endl;
+        return 0;
+    }
+    shm_output_reader reader;
+    while (!reader.open(strName)) { // wait for publisher
+        this_thread::sleep_for(chrono::milliseconds(100));
+    }
+    cout << "opened " << strName << endl;
+    vector<double> vecTransport, vecEndToEnd;
+    Shm_Output_Frame frame;
+    uint64_t last_id = 0;
+    bool first = true;
+    int num_read = 0, num_dropped = 0, num_torn = 0, num_spin = 0;
+    while (num_read < num_frames) {
+        uint64_t count = reader.get_write_count();
+        if (count == 0 || (!first && count - 1 == last_id)) { // no new frame
+            if (++num_spin > 1000) {
+                this_thread::yield();
+                num_spin = 0;
+            }
+            continue;
+        }
+        if (!reader.acquire_latest(frame))
+            continue;
+        int64_t t_read = shm_ring::now_ns();
+        // consume: mean of valid depth
+        double sum = 0.0;
+        int num_valid = 0;
+        for (int r = 0; r < frame.dense.rows; ++r) {
+            const float* p = frame.dense.ptr<float>(r);
+            for (int c = 0; c < frame.dense.cols; ++c) {
+                if (!isnan(p[c])) {
+                    sum += p[c];
+                    num_valid += 1;
+                }
+            }
+        }
+        if (!reader.validate(frame)) { // overwritten while reading
+            num_torn += 1;
+            continue;
+        }
+        if (!first && frame.frame_id > last_id + 1)
+            num_dropped += static_cast<int>(frame.frame_id - last_id - 1);
+        first = false;
+        last_id = frame.frame_id;
+        num_read += 1;
+        vecTransport.push_back((t_read - frame.publish_ns) / 1000.0);
+        vecEndToEnd.push_back((t_read - frame.timestamp_ns) / 1000.0);
+        if (num_read % 100 == 0) {
+            cout << "frame = " << frame.frame_id << " valid = " << frame.valid
+                 << " mean depth = " << (num_valid > 0 ? sum / num_valid : 0.0) << endl;
+        }
+    }
+    cout << "read = " << num_read << " dropped = " << num_dropped << " torn = " << num_torn << endl;
+    print_latency("publish -> read", vecTransport);
+    print_latency("input -> read", vecEndToEnd);
+    return 0;
+}
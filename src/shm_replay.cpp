@@ -0,0 +1,103 @@
+/**
+ * @file shm_replay.cpp
+ * @brief replays a capture into the shared memory input ring (stand-in for the DS5/DSY-01 stream)
+ * @version 2.0
+ * @date 2026-10-19
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+#include "upsampling/shm_input.h"
+#include <opencv2/opencv.hpp>
+#include <iostream>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <vector>
+#include <string>
+#include <stdlib.h>
+#include <stdio.h>
+
+using namespace std;
+
+/**
+ * @brief input data of one frame
+ *
+ */
+typedef struct Frame_Data{
+    cv::Mat guide;
+    cv::Mat flood;
+    cv::Mat spot;
+} Frame_Data;
+
+/**
+ * @brief Main function of replay
+ *
+ * @param argc : argument number (4~8)
+ * @param argv : arguments
+ * @return int
+ */
+int main(int argc, char* argv[])
+{
+    if (argc < 4 || argc > 8) {
+        cout << "*** DS5 stream replay (shared memory) ***" << endl;
+        cout << "USAGE:" << endl;
+        cout << "   <exe> <input data path> <start frame ID> <end frame ID> [FPS] [jitter (ms)] [drop rate (%)] [loops (0: endless)]" << endl;
+        return 0;
+    }
+    string strDataPath = string(argv[1]);
+    int start_frame_idx = atol(argv[2]);
+    int end_frame_idx = atol(argv[3]);
+    double fps = argc > 4 ? atof(argv[4]) : 30.0;
+    double jitter_ms = argc > 5 ? atof(argv[5]) : 0.0;
+    double drop_rate = argc > 6 ? atof(argv[6]) / 100.0 : 0.0;
+    int num_loops = argc > 7 ? atol(argv[7]) : 0;
+    // read capture
+    vector<Frame_Data> vecFrames;
+    for (int idx = start_frame_idx; idx <= end_frame_idx; ++idx) {
+        char szFN[255];
+        Frame_Data frame;
+        snprintf(szFN, sizeof(szFN), "%s/%08d_rgb_gray_img.png", strDataPath.c_str(), idx);
+        frame.guide = cv::imread(szFN, cv::IMREAD_GRAYSCALE);
+        snprintf(szFN, sizeof(szFN), "%s/%08d_flood_depth_pc.exr", strDataPath.c_str(), idx);
+        frame.flood = cv::imread(szFN, -1);
+        snprintf(szFN, sizeof(szFN), "%s/%08d_spot_depth_pc.exr", strDataPath.c_str(), idx);
+        frame.spot = cv::imread(szFN, -1);
+        if (!frame.guide.empty())
+            vecFrames.push_back(frame);
+    }
+    if (vecFrames.empty()) {
+        cout << "no frames in " << strDataPath << endl;
+        return 1;
+    }
+    cv::Size guide_size = vecFrames[0].guide.size();
+    shm_input_producer producer;
+    if (!producer.open(SHM_INPUT_NAME, 8, guide_size.width, guide_size.height)) {
+        cout << "create shared memory failed (another producer running? remove /dev/shm/" << SHM_INPUT_NAME << " if stale)" << endl;
+        return 1;
+    }
+    cout << "replay " << vecFrames.size() << " frames at " << fps << " FPS to " << SHM_INPUT_NAME << endl;
+    mt19937 rng(0);
+    uniform_real_distribution<double> jitter(-jitter_ms, jitter_ms);
+    uniform_real_distribution<double> drop(0.0, 1.0);
+    chrono::nanoseconds period(static_cast<int64_t>(1e9 / fps));
+    chrono::steady_clock::time_point t_next = chrono::steady_clock::now();
+    int num_published = 0, num_dropped = 0;
+    for (int loop = 0; num_loops == 0 || loop < num_loops; ++loop) {
+        for (const Frame_Data& frame : vecFrames) {
+            t_next += period;
+            chrono::steady_clock::time_point t_capture = t_next
+                + chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double, milli>(jitter(rng)));
+            this_thread::sleep_until(t_capture);
+            if (drop(rng) < drop_rate) { // sensor side drop
+                num_dropped += 1;
+                continue;
+            }
+            producer.publish(frame.guide, frame.flood, frame.spot, shm_ring::now_ns());
+            num_published += 1;
+            if (num_published % 100 == 0)
+                cout << "published = " << num_published << " dropped = " << num_dropped << endl;
+        }
+    }
+    return 0;
+}
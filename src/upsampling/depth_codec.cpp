@@ -0,0 +1,211 @@
+#include "depth_codec.h"
+#include <string.h>
+#include <math.h>
+#include <cmath>
+
+#define DEPTH_CODEC_MAGIC 0x4C565244 // "DRVL"
+#define DEPTH_CODEC_MAX_PIXELS (1 << 26) // largest map of a stream (64M pixels)
+#define DEPTH_CODEC_MAX_QUANT (1LL << 52) // largest magnitude of a quantized value
+
+/**
+ * @brief write unsigned varint (7 bits per byte, MSB is continuation flag)
+ *
+ * @param p : write position
+ * @param val : value
+ * @return uchar* : next write position
+ */
+static inline uchar* put_varint(uchar* p, uint64_t val)
+{
+	while (val >= 0x80) {
+		*p++ = static_cast<uchar>(val | 0x80);
+		val >>= 7;
+	}
+	*p++ = static_cast<uchar>(val);
+	return p;
+}
+
+/**
+ * @brief read unsigned varint
+ *
+ * @param p : read position (advanced)
+ * @param end : end of buffer
+ * @param val : output value
+ * @return true : succeed
+ * @return false : truncated or broken stream
+ */
+static inline bool get_varint(const uchar*& p, const uchar* end, uint64_t& val)
+{
+	val = 0;
+	for (int shift = 0; shift < 64 && p < end; shift += 7) {
+		uchar b = *p++;
+		val |= static_cast<uint64_t>(b & 0x7f) << shift;
+		if ((b & 0x80) == 0)
+			return true;
+	}
+	return false;
+}
+
+static inline uint64_t zigzag(int64_t v) { return (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63); }
+static inline int64_t unzigzag(uint64_t u) { return static_cast<int64_t>(u >> 1) ^ -static_cast<int64_t>(u & 1); }
+
+/**
+ * @brief quantize a valid value
+ *
+ * @param v : value
+ * @param scale : quantization steps per unit, 0: keep float bits
+ * @return int64_t : quantized value
+ */
+static inline int64_t quantize(float v, float scale)
+{
+	if (scale == 0.f) {
+		int32_t bits;
+		memcpy(&bits, &v, sizeof(bits));
+		return bits;
+	}
+	const double limit = static_cast<double>(DEPTH_CODEC_MAX_QUANT); // keeps deltas in range
+	double q = std::round(static_cast<double>(v) * scale);
+	if (q > limit) q = limit;
+	if (q < -limit) q = -limit;
+	return static_cast<int64_t>(q);
+}
+
+static inline float dequantize(int64_t q, float scale)
+{
+	if (scale == 0.f) {
+		int32_t bits = static_cast<int32_t>(q);
+		float v;
+		memcpy(&v, &bits, sizeof(v));
+		return v;
+	}
+	return static_cast<float>(static_cast<double>(q) / scale);
+}
+
+/**
+ * @brief Construct a new depth codec object
+ *
+ * @param scale : quantization steps per unit, 0: lossless
+ */
+depth_codec::depth_codec(float scale)
+{
+	this->set_scale(scale);
+}
+
+/**
+ * @brief encode 32FC1 map
+ *
+ * stream : header | { varint(NaN run) varint(valid run) zigzag varint(delta) * valid run } ...
+ *
+ * @param src : input map (32FC1), NaN is invalid
+ * @param dst : output byte stream (capacity reused over frames)
+ * @return true : succeed
+ * @return false : unsupported input
+ */
+bool depth_codec::encode(const cv::Mat& src, std::vector<uchar>& dst)
+{
+	if (src.type() != CV_32FC1 || src.empty() || src.total() > DEPTH_CODEC_MAX_PIXELS)
+		return false;
+	cv::Mat flat = src.isContinuous() ? src : src.clone();
+	const int n = flat.rows * flat.cols;
+	const float scale = this->m_scale_;
+	const float* val = flat.ptr<float>(0);
+	// worst case: 2 run varints + 1 value varint (10 bytes each) per pixel, cut to the stream size below
+	size_t bound = sizeof(Depth_Codec_Header) + static_cast<size_t>(n) * 20 + 20;
+	dst.resize(bound);
+	uchar* begin = dst.data() + sizeof(Depth_Codec_Header);
+	uchar* p = begin;
+	int64_t prev = 0;
+	uint32_t num_valid = 0;
+	int i = 0;
+	while (i < n) {
+		int j = i;
+		while (j < n && isnan(val[j])) ++j;
+		int k = j;
+		while (k < n && !isnan(val[k])) ++k;
+		p = put_varint(p, static_cast<uint64_t>(j - i));
+		p = put_varint(p, static_cast<uint64_t>(k - j));
+		for (int m = j; m < k; ++m) {
+			int64_t q = quantize(val[m], scale);
+			p = put_varint(p, zigzag(q - prev));
+			prev = q;
+		}
+		num_valid += static_cast<uint32_t>(k - j);
+		i = k;
+	}
+	Depth_Codec_Header header;
+	header.magic = DEPTH_CODEC_MAGIC;
+	header.width = flat.cols;
+	header.height = flat.rows;
+	header.scale = scale;
+	header.num_valid = num_valid;
+	header.payload_size = static_cast<uint32_t>(p - begin);
+	memcpy(dst.data(), &header, sizeof(header));
+	dst.resize(p - dst.data()); // capacity is kept for the next frame
+	return true;
+}
+
+/**
+ * @brief decode byte stream to 32FC1 map
+ *
+ * @param data : encoded stream
+ * @param size : stream size in bytes
+ * @param dst : output map (32FC1), reused when size matches
+ * @return true : succeed
+ * @return false : broken stream, dst is not touched if the header is invalid
+ */
+bool depth_codec::decode(const uchar* data, size_t size, cv::Mat& dst)
+{
+	Depth_Codec_Header header;
+	if (data == nullptr || size < sizeof(header))
+		return false;
+	memcpy(&header, data, sizeof(header));
+	// the header is untrusted: validate everything before allocating
+	if (header.magic != DEPTH_CODEC_MAGIC || header.width <= 0 || header.height <= 0
+		|| size - sizeof(header) < header.payload_size)
+		return false;
+	const int64_t num_pixels = static_cast<int64_t>(header.width) * header.height;
+	if (num_pixels > DEPTH_CODEC_MAX_PIXELS || header.num_valid > num_pixels
+		|| header.num_valid > header.payload_size // a valid pixel takes 1 byte at least
+		|| !std::isfinite(header.scale) || header.scale < 0.f) // 0: lossless
+		return false;
+	dst.create(header.height, header.width, CV_32FC1);
+	if (!dst.isContinuous()) { // ROI output
+		cv::Mat tmp;
+		if (!this->decode(data, size, tmp))
+			return false;
+		tmp.copyTo(dst);
+		return true;
+	}
+	const int n = static_cast<int>(num_pixels);
+	const float scale = header.scale;
+	const float nan = static_cast<float>(std::nan(""));
+	const uchar* p = data + sizeof(header);
+	const uchar* end = p + header.payload_size;
+	float* out = dst.ptr<float>(0);
+	// deltas of a crafted stream can wrap: accumulate unsigned, then bound to the range of the encoder
+	const int64_t max_quant = scale == 0.f ? INT32_MAX : DEPTH_CODEC_MAX_QUANT;
+	uint64_t prev = 0;
+	uint64_t decoded_valid = 0;
+	int i = 0;
+	while (i < n) {
+		uint64_t num_invalid, num_valid, code;
+		if (!get_varint(p, end, num_invalid) || num_invalid > static_cast<uint64_t>(n - i))
+			return false;
+		for (int m = 0; m < static_cast<int>(num_invalid); ++m)
+			out[i + m] = nan;
+		i += static_cast<int>(num_invalid);
+		if (!get_varint(p, end, num_valid) || num_valid > static_cast<uint64_t>(n - i))
+			return false;
+		for (int m = 0; m < static_cast<int>(num_valid); ++m) {
+			if (!get_varint(p, end, code))
+				return false;
+			prev += static_cast<uint64_t>(unzigzag(code));
+			int64_t q = static_cast<int64_t>(prev);
+			if (q > max_quant || q < -max_quant - 1)
+				return false;
+			out[i + m] = dequantize(q, scale);
+		}
+		i += static_cast<int>(num_valid);
+		decoded_valid += num_valid;
+	}
+	return decoded_valid == header.num_valid;
+}
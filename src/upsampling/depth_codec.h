@@ -0,0 +1,41 @@
+#pragma once
+#include <opencv2/opencv.hpp>
+#include <vector>
+#include <stdint.h>
+
+typedef struct Depth_Codec_Header{
+	uint32_t magic; // DEPTH_CODEC_MAGIC
+	int32_t width; // map width
+	int32_t height; // map height
+	float scale; // quantization steps per unit, 0: lossless
+	uint32_t num_valid; // number of not NaN pixels
+	uint32_t payload_size; // bytes following the header
+} Depth_Codec_Header;
+
+/**
+ * @brief RVL-style codec for 32FC1 maps (dense depth, confidence)
+ *
+ * NaN pixels are coded as run lengths, valid pixels as zigzag varint deltas
+ * of the previous valid value. With scale > 0 values are quantized to
+ * round(v * scale) (error <= 0.5 / scale), with scale == 0 the float bits are
+ * coded and the round trip is lossless.
+ */
+class depth_codec
+{
+public:
+	// scale: quantization steps per unit (1000: millimetre for depth), 0: lossless
+	depth_codec(float scale = 1000.f);
+	~depth_codec() {};
+	// set/get quantization scale
+	void set_scale(float scale) { this->m_scale_ = scale > 0.f ? scale : 0.f; };
+	float get_scale(void) { return this->m_scale_; };
+	// maximum absolute error of a round trip (0: lossless)
+	float max_error(void) { return this->m_scale_ > 0.f ? 0.5f / this->m_scale_ : 0.f; };
+	// encode 32FC1 map to byte stream
+	bool encode(const cv::Mat& src, std::vector<uchar>& dst);
+	// decode byte stream to 32FC1 map
+	bool decode(const uchar* data, size_t size, cv::Mat& dst);
+	bool decode(const std::vector<uchar>& src, cv::Mat& dst) { return this->decode(src.data(), src.size(), dst); };
+private:
+	float m_scale_ = 1000.f;
+};
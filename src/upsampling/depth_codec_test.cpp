@@ -0,0 +1,192 @@
+/**
+ * @file depth_codec_test.cpp
+ * @brief tests of depth_codec: round trip and malformed streams
+ * @version 2.0
+ * @date 2026-10-19
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+#include "depth_codec.h"
+#include "test_check.h"
+#include <algorithm>
+#include <functional>
+#include <vector>
+#include <string.h>
+#include <math.h>
+
+/**
+ * @brief depth map with NaN runs, a slope and a step
+ *
+ * @param dmap : output map (32FC1)
+ */
+static void make_depth(cv::Mat& dmap)
+{
+	dmap.create(48, 64, CV_32FC1);
+	for (int r = 0; r < dmap.rows; ++r) {
+		float* d = dmap.ptr<float>(r);
+		for (int c = 0; c < dmap.cols; ++c) {
+			if ((r % 7 == 0 && c < 20) || c == 63)
+				d[c] = NAN;
+			else
+				d[c] = 0.5f + 0.001f * (r + c) + (c > 32 ? 1.5f : 0.f);
+		}
+	}
+}
+
+/**
+ * @brief max error of valid pixels, -1 if NaN positions differ
+ *
+ * @param a : map a
+ * @param b : map b
+ * @return float : max absolute error
+ */
+static float round_trip_error(const cv::Mat& a, const cv::Mat& b)
+{
+	if (a.size() != b.size() || b.type() != CV_32FC1)
+		return -1.f;
+	float max_err = 0.f;
+	for (int r = 0; r < a.rows; ++r) {
+		const float* pa = a.ptr<float>(r);
+		const float* pb = b.ptr<float>(r);
+		for (int c = 0; c < a.cols; ++c) {
+			if (isnan(pa[c]) != isnan(pb[c]))
+				return -1.f;
+			if (!isnan(pa[c]))
+				max_err = std::max(max_err, fabsf(pa[c] - pb[c]));
+		}
+	}
+	return max_err;
+}
+
+/**
+ * @brief lossless and quantized round trips, also into an ROI
+ */
+static void test_round_trip(void)
+{
+	cv::Mat dmap, decoded;
+	make_depth(dmap);
+	std::vector<uchar> stream;
+	depth_codec lossless(0.f);
+	TEST_CHECK(lossless.encode(dmap, stream));
+	TEST_CHECK(lossless.decode(stream, decoded));
+	TEST_CHECK(round_trip_error(dmap, decoded) == 0.f);
+	depth_codec quantized(1000.f);
+	TEST_CHECK(quantized.encode(dmap, stream));
+	TEST_CHECK(quantized.decode(stream, decoded));
+	float err = round_trip_error(dmap, decoded);
+	TEST_CHECK(err >= 0.f && err <= quantized.max_error() * 1.001f);
+	cv::Mat big(64, 96, CV_32FC1, cv::Scalar(7.f));
+	cv::Mat roi = big(cv::Rect(8, 4, dmap.cols, dmap.rows));
+	TEST_CHECK(quantized.decode(stream, roi));
+	TEST_CHECK(round_trip_error(dmap, roi) >= 0.f);
+	TEST_CHECK(big.at<float>(0, 0) == 7.f); // outside the ROI untouched
+	cv::Mat empty;
+	TEST_CHECK(!quantized.encode(empty, stream));
+}
+
+/**
+ * @brief decode of a stream with a modified header fails and leaves dst alone
+ *
+ * @param stream : valid stream
+ * @param modify : header change
+ * @return true : rejected
+ */
+static bool rejects(const std::vector<uchar>& stream, const std::function<void(Depth_Codec_Header&)>& modify)
+{
+	std::vector<uchar> broken = stream;
+	Depth_Codec_Header header;
+	memcpy(&header, broken.data(), sizeof(header));
+	modify(header);
+	memcpy(broken.data(), &header, sizeof(header));
+	depth_codec codec;
+	cv::Mat dst;
+	bool res = codec.decode(broken, dst);
+	return !res && dst.empty();
+}
+
+/**
+ * @brief malformed headers and truncated streams
+ */
+static void test_malformed(void)
+{
+	cv::Mat dmap, decoded;
+	make_depth(dmap);
+	std::vector<uchar> stream;
+	depth_codec codec;
+	TEST_CHECK(codec.encode(dmap, stream));
+	TEST_CHECK(rejects(stream, [](Depth_Codec_Header& h) { h.magic += 1; }));
+	TEST_CHECK(rejects(stream, [](Depth_Codec_Header& h) { h.width = 0; }));
+	TEST_CHECK(rejects(stream, [](Depth_Codec_Header& h) { h.height = -4; }));
+	TEST_CHECK(rejects(stream, [](Depth_Codec_Header& h) { h.width = 0x7fffffff; h.height = 0x7fffffff; })); // overflow
+	TEST_CHECK(rejects(stream, [](Depth_Codec_Header& h) { h.width = 1 << 14; h.height = 1 << 14; })); // too large
+	TEST_CHECK(rejects(stream, [](Depth_Codec_Header& h) { h.num_valid = h.width * h.height + 1; }));
+	TEST_CHECK(rejects(stream, [](Depth_Codec_Header& h) { h.num_valid = h.payload_size + 1; }));
+	TEST_CHECK(rejects(stream, [](Depth_Codec_Header& h) { h.payload_size += 1; })); // beyond the stream
+	TEST_CHECK(rejects(stream, [](Depth_Codec_Header& h) { h.scale = NAN; }));
+	TEST_CHECK(rejects(stream, [](Depth_Codec_Header& h) { h.scale = -1.f; }));
+	// count of valid pixels does not match the payload
+	std::vector<uchar> broken = stream;
+	Depth_Codec_Header header;
+	memcpy(&header, broken.data(), sizeof(header));
+	header.num_valid -= 1;
+	memcpy(broken.data(), &header, sizeof(header));
+	TEST_CHECK(!codec.decode(broken, decoded));
+	// truncated header and payload
+	TEST_CHECK(!codec.decode(stream.data(), sizeof(Depth_Codec_Header) - 1, decoded));
+	TEST_CHECK(!codec.decode(stream.data(), stream.size() - 1, decoded));
+	TEST_CHECK(!codec.decode(nullptr, 0, decoded));
+	// payload cut short inside: header claims the cut size
+	broken.assign(stream.begin(), stream.begin() + sizeof(Depth_Codec_Header) + 4);
+	memcpy(&header, broken.data(), sizeof(header));
+	header.payload_size = 4;
+	header.num_valid = 0;
+	memcpy(broken.data(), &header, sizeof(header));
+	TEST_CHECK(!codec.decode(broken, decoded));
+	// deltas out of the quantized range (would overflow the sum)
+	std::vector<uchar> crafted(sizeof(Depth_Codec_Header));
+	const uchar runs[] = {0x00, 0x02}; // no NaN, 2 valid pixels
+	crafted.insert(crafted.end(), runs, runs + sizeof(runs));
+	for (int n = 0; n < 2; ++n) { // zigzag of INT64_MAX twice
+		for (int b = 0; b < 9; ++b)
+			crafted.push_back(b == 0 ? 0xfe : 0xff);
+		crafted.push_back(0x01);
+	}
+	header.magic = reinterpret_cast<const Depth_Codec_Header*>(stream.data())->magic;
+	header.width = 2;
+	header.height = 1;
+	header.scale = 1000.f;
+	header.num_valid = 2;
+	header.payload_size = static_cast<uint32_t>(crafted.size() - sizeof(header));
+	memcpy(crafted.data(), &header, sizeof(header));
+	TEST_CHECK(!codec.decode(crafted, decoded));
+	header.scale = 0.f; // lossless: float bits
+	memcpy(crafted.data(), &header, sizeof(header));
+	TEST_CHECK(!codec.decode(crafted, decoded));
+}
+
+/**
+ * @brief the stream buffer is sized to the stream and reused
+ */
+static void test_stream_size(void)
+{
+	cv::Mat dmap;
+	make_depth(dmap);
+	std::vector<uchar> stream;
+	depth_codec codec;
+	TEST_CHECK(codec.encode(dmap, stream));
+	Depth_Codec_Header header;
+	memcpy(&header, stream.data(), sizeof(header));
+	TEST_CHECK(stream.size() == sizeof(header) + header.payload_size);
+	size_t size = stream.size();
+	TEST_CHECK(codec.encode(dmap, stream));
+	TEST_CHECK(stream.size() == size);
+}
+
+int main(void)
+{
+	test_round_trip();
+	test_malformed();
+	test_stream_size();
+	return g_test_failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,160 @@
+#include "fgs_solver.h"
+#include "upsampling_kernels.h"
+#include <math.h>
+
+const int FGS_TABLE_SIZE = 3 * 255 * 255 + 1; // squared difference of 3 channels
+
+/**
+ * @brief create colour weight table
+ *
+ * @param sigma_color : sigma of guide difference
+ * @param table : output table, table[d^2] = -exp(-d / sigma_color)
+ */
+void fgs_solver::create_weight_table(float sigma_color, std::vector<float>& table)
+{
+	table.resize(FGS_TABLE_SIZE);
+	for (int i = 0; i < FGS_TABLE_SIZE; ++i)
+		table[i] = -expf(-sqrtf(static_cast<float>(i)) / sigma_color);
+}
+
+/**
+ * @brief compute horizontal and vertical weights of the guide image
+ *
+ * @param guide : guide image (8UC1 or 8UC3)
+ * @param table : colour weight table of create_weight_table()
+ */
+void fgs_solver::set_guide(const cv::Mat& guide, const std::vector<float>& table)
+{
+	CV_Assert(guide.type() == CV_8UC1 || guide.type() == CV_8UC3);
+	CV_Assert(table.size() == static_cast<size_t>(FGS_TABLE_SIZE));
+	this->m_chor_.create(guide.size(), CV_32FC1);
+	this->m_cvert_.create(guide.size(), CV_32FC1);
+	this->m_interd_.create(guide.size(), CV_32FC1);
+	cv::Mat chor = this->m_chor_;
+	cv::Mat cvert = this->m_cvert_;
+	const float* lut = table.data();
+	int w = guide.cols;
+	int h = guide.rows;
+	int cn = guide.channels();
+	cv::parallel_for_(cv::Range(0, h), [&guide, &chor, &cvert, lut, w, h, cn](const cv::Range& range) -> void {
+		for (int i = range.start; i < range.end; ++i)
+			fgs_guide_weights_row(guide.ptr<uchar>(i), guide.ptr<uchar>(i < h - 1 ? i + 1 : i), cn, w, i == h - 1,
+								lut, chor.ptr<float>(i), cvert.ptr<float>(i));
+	});
+}
+
+/**
+ * @brief horizontal pass (tridiagonal solve along each row)
+ *
+ * @tparam N : number of images
+ */
+template <int N>
+inline void horizontal_pass(cv::Mat* src, const cv::Mat& chor, cv::Mat& interd, float lambda)
+{
+	int w = chor.cols;
+	cv::parallel_for_(cv::Range(0, chor.rows), [src, &chor, &interd, lambda, w](const cv::Range& range) -> void {
+		for (int i = range.start; i < range.end; ++i) {
+			const float* c = chor.ptr<float>(i);
+			float* d = interd.ptr<float>(i);
+			float* cur[N];
+			for (int k = 0; k < N; ++k)
+				cur[k] = src[k].ptr<float>(i);
+			float denom = 1.f / (1.f - lambda * c[0]);
+			d[0] = lambda * c[0] * denom;
+			for (int k = 0; k < N; ++k)
+				cur[k][0] *= denom;
+			for (int j = 1; j < w; ++j) {
+				denom = 1.f / (1.f - lambda * c[j] - lambda * c[j - 1] * (1.f + d[j - 1]));
+				d[j] = lambda * c[j] * denom;
+				for (int k = 0; k < N; ++k)
+					cur[k][j] = (cur[k][j] - lambda * c[j - 1] * cur[k][j - 1]) * denom;
+			}
+			for (int j = w - 2; j >= 0; --j) {
+				for (int k = 0; k < N; ++k)
+					cur[k][j] -= d[j] * cur[k][j + 1];
+			}
+		}
+	});
+}
+
+/**
+ * @brief vertical pass (tridiagonal solve along each column, processed in column stripes)
+ *
+ * @tparam N : number of images
+ */
+template <int N>
+inline void vertical_pass(cv::Mat* src, const cv::Mat& cvert, cv::Mat& interd, float lambda)
+{
+	int h = cvert.rows;
+	int w = cvert.cols;
+	int num_stripes = std::max(1, std::min(cv::getNumThreads(), w / 16));
+	cv::parallel_for_(cv::Range(0, num_stripes), [src, &cvert, &interd, lambda, h, w, num_stripes](const cv::Range& range) -> void {
+		int start = w * range.start / num_stripes;
+		int end = w * range.end / num_stripes;
+		for (int k = 0; k < N; ++k)
+			fgs_vertical_first_row(cvert.ptr<float>(0), interd.ptr<float>(0), src[k].ptr<float>(0), k == 0, start, end, lambda);
+		for (int i = 1; i < h; ++i) {
+			for (int k = 0; k < N; ++k)
+				fgs_vertical_forward_row(cvert.ptr<float>(i - 1), cvert.ptr<float>(i), interd.ptr<float>(i - 1), interd.ptr<float>(i),
+										src[k].ptr<float>(i - 1), src[k].ptr<float>(i), k == 0, start, end, lambda);
+		}
+		for (int i = h - 2; i >= 0; --i) {
+			for (int k = 0; k < N; ++k)
+				fgs_vertical_backward_row(interd.ptr<float>(i), src[k].ptr<float>(i + 1), src[k].ptr<float>(i), start, end);
+		}
+	});
+}
+
+/**
+ * @brief iterations of horizontal and vertical passes
+ *
+ * @param src : images to be smoothed in place
+ * @param num_src : number of images (1 or 2)
+ * @param lambda : smoothness
+ * @param lambda_attenuation : lambda scale per iteration
+ * @param num_iter : number of iterations
+ */
+void fgs_solver::run_passes(cv::Mat* src, int num_src, float lambda, float lambda_attenuation, int num_iter)
+{
+	for (int k = 0; k < num_src; ++k) {
+		CV_Assert(src[k].type() == CV_32FC1 && src[k].size() == this->m_chor_.size());
+	}
+	for (int n = 0; n < num_iter; ++n) {
+		if (num_src == 2) {
+			horizontal_pass<2>(src, this->m_chor_, this->m_interd_, lambda);
+			vertical_pass<2>(src, this->m_cvert_, this->m_interd_, lambda);
+		} else {
+			horizontal_pass<1>(src, this->m_chor_, this->m_interd_, lambda);
+			vertical_pass<1>(src, this->m_cvert_, this->m_interd_, lambda);
+		}
+		lambda *= lambda_attenuation;
+	}
+}
+
+/**
+ * @brief smooth one image in place
+ *
+ * @param src : image (32FC1)
+ * @param lambda : smoothness
+ * @param lambda_attenuation : lambda scale per iteration
+ * @param num_iter : number of iterations
+ */
+void fgs_solver::filter(cv::Mat& src, float lambda, float lambda_attenuation, int num_iter)
+{
+	this->run_passes(&src, 1, lambda, lambda_attenuation, num_iter);
+}
+
+/**
+ * @brief smooth two images in place with the same weights
+ *
+ * @param src1 : image 1 (32FC1)
+ * @param src2 : image 2 (32FC1)
+ * @param lambda : smoothness
+ * @param lambda_attenuation : lambda scale per iteration
+ * @param num_iter : number of iterations
+ */
+void fgs_solver::filter(cv::Mat& src1, cv::Mat& src2, float lambda, float lambda_attenuation, int num_iter)
+{
+	cv::Mat src[2] = {src1, src2};
+	this->run_passes(src, 2, lambda, lambda_attenuation, num_iter);
+}
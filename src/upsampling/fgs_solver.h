@@ -0,0 +1,36 @@
+#pragma once
+#include <opencv2/opencv.hpp>
+#include <vector>
+
+/**
+ * @brief fast global smoother (Min et al. 2014), same algorithm as cv::ximgproc::FastGlobalSmootherFilter
+ *
+ * The colour weight table only depends on sigma and is shared read-only
+ * between solvers, guide weights and scratch are kept per solver so that
+ * no buffer is allocated per frame. filter() of two images shares the
+ * elimination coefficients (sparse depth and mask are solved in one go).
+ * Passes run in stripes on the OpenCV worker pool (cv::parallel_for_).
+ */
+class fgs_solver
+{
+public:
+	fgs_solver() {};
+	~fgs_solver() {};
+	// colour weight table of sigma_color, index: squared guide difference
+	static void create_weight_table(float sigma_color, std::vector<float>& table);
+	// guide weights of guide image (8UC1 or 8UC3)
+	void set_guide(const cv::Mat& guide, const std::vector<float>& table);
+	// smooth src (32FC1, size of guide) in place
+	void filter(cv::Mat& src, float lambda, float lambda_attenuation, int num_iter);
+	// smooth src1 and src2 (32FC1, size of guide) in place with the same weights
+	void filter(cv::Mat& src1, cv::Mat& src2, float lambda, float lambda_attenuation, int num_iter);
+	cv::Size get_size(void) { return this->m_chor_.size(); };
+	// weights of the last guide (negative, see create_weight_table()) for pcg_solver
+	const cv::Mat& get_horizontal_weights(void) { return this->m_chor_; };
+	const cv::Mat& get_vertical_weights(void) { return this->m_cvert_; };
+private:
+	void run_passes(cv::Mat* src, int num_src, float lambda, float lambda_attenuation, int num_iter);
+	cv::Mat m_chor_; // 32FC1 horizontal weights (last column 0)
+	cv::Mat m_cvert_; // 32FC1 vertical weights (last row 0)
+	cv::Mat m_interd_; // 32FC1 elimination coefficients
+};
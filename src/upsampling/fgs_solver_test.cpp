@@ -0,0 +1,114 @@
+/**
+ * @file fgs_solver_test.cpp
+ * @brief tests of fgs_solver: equivalence with cv::ximgproc::fastGlobalSmootherFilter
+ * @version 2.0
+ * @date 2026-10-19
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+#include "fgs_solver.h"
+#include "test_check.h"
+#include <opencv2/ximgproc.hpp>
+#include <vector>
+
+/**
+ * @brief guide with a step, a gradient and noise
+ *
+ * @param type : CV_8UC1 or CV_8UC3
+ * @param guide : output guide (120x160)
+ */
+static void make_guide(int type, cv::Mat& guide)
+{
+	cv::Mat gray(120, 160, CV_8UC1);
+	for (int r = 0; r < gray.rows; ++r) {
+		uchar* g = gray.ptr<uchar>(r);
+		for (int c = 0; c < gray.cols; ++c)
+			g[c] = static_cast<uchar>(c < 70 ? 40 + r / 4 : 180 - c / 4);
+	}
+	cv::Mat noise(gray.size(), CV_8UC1);
+	cv::RNG rng(12345);
+	rng.fill(noise, cv::RNG::UNIFORM, 0, 8);
+	gray += noise;
+	if (type == CV_8UC1) {
+		guide = gray;
+		return;
+	}
+	cv::Mat channels[3] = {gray, 255 - gray, gray / 2 + 64};
+	cv::merge(channels, 3, guide);
+}
+
+/**
+ * @brief sparse depth (every 4th pixel) and its mask, the filter inputs of the flood
+ *
+ * @param size : map size
+ * @param sparse : output depth (32FC1)
+ * @param mask : output mask (32FC1)
+ */
+static void make_sparse(cv::Size size, cv::Mat& sparse, cv::Mat& mask)
+{
+	sparse = cv::Mat::zeros(size, CV_32FC1);
+	mask = cv::Mat::zeros(size, CV_32FC1);
+	for (int r = 0; r < size.height; r += 4) {
+		float* s = sparse.ptr<float>(r);
+		float* m = mask.ptr<float>(r);
+		for (int c = 1; c < size.width; c += 4) {
+			s[c] = c < 70 ? 1.0f + 0.002f * r : 2.5f;
+			m[c] = 1.f;
+		}
+	}
+}
+
+/**
+ * @brief max difference of a to the reference b relative to the range of b
+ *
+ * @param a : filtered map
+ * @param b : reference map
+ * @return double : max |a - b| / (max(b) - min(b))
+ */
+static double relative_error(const cv::Mat& a, const cv::Mat& b)
+{
+	double min_val, max_val;
+	cv::minMaxLoc(b, &min_val, &max_val);
+	double range = max_val - min_val > 0.0 ? max_val - min_val : 1.0;
+	return cv::norm(a, b, cv::NORM_INF) / range;
+}
+
+/**
+ * @brief filter() matches fastGlobalSmootherFilter for gray and colour guides
+ */
+static void test_equivalence(void)
+{
+	// lambda, sigma_color, lambda_attenuation, num_iter (flood and spot defaults, strong colour weight)
+	const float params[][4] = {{220.f, 4.f, 0.25f, 1.f}, {700.f, 5.f, 0.25f, 2.f}, {30.f, 10.f, 0.25f, 3.f}};
+	const int types[] = {CV_8UC1, CV_8UC3};
+	for (int type : types) {
+		cv::Mat guide;
+		make_guide(type, guide);
+		for (const float* p : params) {
+			std::vector<float> table;
+			fgs_solver::create_weight_table(p[1], table);
+			fgs_solver solver;
+			solver.set_guide(guide, table);
+			cv::Mat sparse, mask;
+			make_sparse(guide.size(), sparse, mask);
+			cv::Mat ref_sparse, ref_mask;
+			cv::ximgproc::fastGlobalSmootherFilter(guide, sparse, ref_sparse, p[0], p[1], p[2], static_cast<int>(p[3]));
+			cv::ximgproc::fastGlobalSmootherFilter(guide, mask, ref_mask, p[0], p[1], p[2], static_cast<int>(p[3]));
+			// single image
+			cv::Mat single = sparse.clone();
+			solver.filter(single, p[0], p[2], static_cast<int>(p[3]));
+			TEST_CHECK(relative_error(single, ref_sparse) <= 1e-3);
+			// sparse depth and mask in one sweep
+			solver.filter(sparse, mask, p[0], p[2], static_cast<int>(p[3]));
+			TEST_CHECK(relative_error(sparse, ref_sparse) <= 1e-3);
+			TEST_CHECK(relative_error(mask, ref_mask) <= 1e-3);
+		}
+	}
+}
+
+int main(void)
+{
+	test_equivalence();
+	return g_test_failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,191 @@
+#include "pcg_solver.h"
+#include "upsampling_kernels.h"
+#include <math.h>
+
+/**
+ * @brief sum of func over row stripes on the OpenCV worker pool
+ *
+ * @param rows : number of rows
+ * @param sum : partial sums buffer
+ * @param func : double func(row_begin, row_end)
+ * @return double : sum of the stripes
+ */
+template <typename Func>
+inline double stripe_sum(int rows, std::vector<double>& sum, const Func& func)
+{
+	int num_stripes = std::max(1, std::min(cv::getNumThreads(), rows));
+	sum.assign(num_stripes, 0.0);
+	cv::parallel_for_(cv::Range(0, num_stripes), [rows, num_stripes, &sum, &func](const cv::Range& range) -> void {
+		for (int s = range.start; s < range.end; ++s)
+			sum[s] = func(rows * s / num_stripes, rows * (s + 1) / num_stripes);
+	});
+	double total = 0.0;
+	for (double v : sum)
+		total += v;
+	return total;
+}
+
+/**
+ * @brief y = (M + lambda * L) x
+ *
+ * @param chor : horizontal weights (negative, last column 0)
+ * @param cvert : vertical weights (negative, last row 0)
+ * @param mask : data weights M
+ * @param lambda : smoothness
+ * @param x : input
+ * @param y : output
+ */
+void pcg_solver::apply(const cv::Mat& chor, const cv::Mat& cvert, const cv::Mat& mask, float lambda,
+						const cv::Mat& x, cv::Mat& y)
+{
+	int w = x.cols;
+	int h = x.rows;
+	cv::parallel_for_(cv::Range(0, h), [&chor, &cvert, &mask, &x, &y, lambda, w, h](const cv::Range& range) -> void {
+		for (int i = range.start; i < range.end; ++i) {
+			pcg_apply_row(chor.ptr<float>(i), cvert.ptr<float>(i), cvert.ptr<float>(i > 0 ? i - 1 : i), mask.ptr<float>(i),
+							x.ptr<float>(i), x.ptr<float>(i > 0 ? i - 1 : i), x.ptr<float>(i < h - 1 ? i + 1 : i),
+							y.ptr<float>(i), i == 0, w, lambda);
+		}
+	});
+}
+
+/**
+ * @brief solve (M + lambda * L) u = M * z from the initial estimate u
+ *
+ * @param chor : horizontal weights of fgs_solver (negative, last column 0)
+ * @param cvert : vertical weights of fgs_solver (negative, last row 0)
+ * @param sparse : M * z (sparse depth, 0 without data)
+ * @param mask : data weights M
+ * @param lambda : smoothness
+ * @param tolerance : relative residual to stop
+ * @param max_iter : iterations at most
+ * @param u : initial estimate, solution (32FC1)
+ * @return int : number of iterations
+ */
+int pcg_solver::solve(const cv::Mat& chor, const cv::Mat& cvert, const cv::Mat& sparse, const cv::Mat& mask,
+						float lambda, float tolerance, int max_iter, cv::Mat& u)
+{
+	CV_Assert(u.type() == CV_32FC1 && u.size() == sparse.size() && u.size() == chor.size());
+	int w = u.cols;
+	int h = u.rows;
+	this->m_inv_diag_.create(u.size(), CV_32FC1);
+	this->m_r_.create(u.size(), CV_32FC1);
+	this->m_z_.create(u.size(), CV_32FC1);
+	this->m_p_.create(u.size(), CV_32FC1);
+	this->m_q_.create(u.size(), CV_32FC1);
+	cv::Mat inv_diag = this->m_inv_diag_;
+	cv::Mat r = this->m_r_;
+	cv::Mat z = this->m_z_;
+	cv::Mat p = this->m_p_;
+	cv::Mat q = this->m_q_;
+	// r = b - A u, z = D^-1 r, p = z
+	this->apply(chor, cvert, mask, lambda, u, q);
+	double b_norm = 0.0;
+	double rz = stripe_sum(h, this->m_sum_, [&](int begin, int end) -> double {
+		double sum = 0.0;
+		for (int i = begin; i < end; ++i) {
+			const float* ch = chor.ptr<float>(i);
+			const float* cv_ = cvert.ptr<float>(i);
+			const float* cv_up = cvert.ptr<float>(i > 0 ? i - 1 : i);
+			const float* m = mask.ptr<float>(i);
+			const float* b = sparse.ptr<float>(i);
+			const float* qi = q.ptr<float>(i);
+			float* d = inv_diag.ptr<float>(i);
+			float* ri = r.ptr<float>(i);
+			float* zi = z.ptr<float>(i);
+			float* pi = p.ptr<float>(i);
+			for (int j = 0; j < w; ++j) {
+				float weight = -ch[j] - cv_[j] - (j > 0 ? ch[j - 1] : 0.f) - (i > 0 ? cv_up[j] : 0.f);
+				d[j] = 1.f / (m[j] + lambda * weight + 1e-6f);
+				ri[j] = b[j] - qi[j];
+				zi[j] = d[j] * ri[j];
+				pi[j] = zi[j];
+				sum += static_cast<double>(ri[j]) * zi[j];
+			}
+		}
+		return sum;
+	});
+	b_norm = sqrt(stripe_sum(h, this->m_sum_, [&sparse, w](int begin, int end) -> double {
+		double sum = 0.0;
+		for (int i = begin; i < end; ++i) {
+			const float* b = sparse.ptr<float>(i);
+			for (int j = 0; j < w; ++j)
+				sum += static_cast<double>(b[j]) * b[j];
+		}
+		return sum;
+	}));
+	if (b_norm == 0.0) { // no data
+		this->m_residual_ = 0.f;
+		return 0;
+	}
+	int iter = 0;
+	double r_norm = sqrt(stripe_sum(h, this->m_sum_, [&r, w](int begin, int end) -> double {
+		double sum = 0.0;
+		for (int i = begin; i < end; ++i) {
+			const float* ri = r.ptr<float>(i);
+			for (int j = 0; j < w; ++j)
+				sum += static_cast<double>(ri[j]) * ri[j];
+		}
+		return sum;
+	}));
+	while (iter < max_iter && r_norm > tolerance * b_norm) {
+		this->apply(chor, cvert, mask, lambda, p, q);
+		double pq = stripe_sum(h, this->m_sum_, [&p, &q, w](int begin, int end) -> double {
+			double sum = 0.0;
+			for (int i = begin; i < end; ++i) {
+				const float* pi = p.ptr<float>(i);
+				const float* qi = q.ptr<float>(i);
+				for (int j = 0; j < w; ++j)
+					sum += static_cast<double>(pi[j]) * qi[j];
+			}
+			return sum;
+		});
+		if (pq <= 0.0) // breakdown (converged in floating point)
+			break;
+		float alpha = static_cast<float>(rz / pq);
+		// u += alpha p, r -= alpha q, z = D^-1 r
+		double r_sq = 0.0;
+		double rz_new = stripe_sum(h, this->m_sum_, [&](int begin, int end) -> double {
+			double sum = 0.0;
+			for (int i = begin; i < end; ++i) {
+				const float* pi = p.ptr<float>(i);
+				const float* qi = q.ptr<float>(i);
+				const float* d = inv_diag.ptr<float>(i);
+				float* ui = u.ptr<float>(i);
+				float* ri = r.ptr<float>(i);
+				float* zi = z.ptr<float>(i);
+				for (int j = 0; j < w; ++j) {
+					ui[j] += alpha * pi[j];
+					ri[j] -= alpha * qi[j];
+					zi[j] = d[j] * ri[j];
+					sum += static_cast<double>(ri[j]) * zi[j];
+				}
+			}
+			return sum;
+		});
+		r_sq = stripe_sum(h, this->m_sum_, [&r, w](int begin, int end) -> double {
+			double sum = 0.0;
+			for (int i = begin; i < end; ++i) {
+				const float* ri = r.ptr<float>(i);
+				for (int j = 0; j < w; ++j)
+					sum += static_cast<double>(ri[j]) * ri[j];
+			}
+			return sum;
+		});
+		r_norm = sqrt(r_sq);
+		float beta = static_cast<float>(rz_new / rz);
+		rz = rz_new;
+		// p = z + beta p
+		cv::parallel_for_(cv::Range(0, h), [&p, &z, beta, w](const cv::Range& range) -> void {
+			for (int i = range.start; i < range.end; ++i) {
+				const float* zi = z.ptr<float>(i);
+				float* pi = p.ptr<float>(i);
+				for (int j = 0; j < w; ++j)
+					pi[j] = zi[j] + beta * pi[j];
+			}
+		});
+		iter += 1;
+	}
+	this->m_residual_ = static_cast<float>(r_norm / b_norm);
+	return iter;
+}
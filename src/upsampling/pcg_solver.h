@@ -0,0 +1,34 @@
+#pragma once
+#include <opencv2/opencv.hpp>
+#include <vector>
+
+/**
+ * @brief preconditioned conjugate gradient on the guide weighted Laplacian
+ *
+ * Solves (M + lambda * L) u = M * z, M = diag(mask), L = Laplacian of the 4
+ * neighbour weights of fgs_solver::set_guide(), with a Jacobi preconditioner.
+ * u is the initial estimate (e.g. the solution of the previous frame), so a
+ * slowly changing scene converges in a few iterations. Scratch is kept per
+ * solver, vector operations run in row stripes on the OpenCV worker pool.
+ */
+class pcg_solver
+{
+public:
+	pcg_solver() {};
+	~pcg_solver() {};
+	// solve in place from the initial estimate u (32FC1), returns the number of iterations
+	int solve(const cv::Mat& chor, const cv::Mat& cvert, const cv::Mat& sparse, const cv::Mat& mask,
+				float lambda, float tolerance, int max_iter, cv::Mat& u);
+	// relative residual |b - Au| / |b| of the last solve()
+	float get_residual(void) { return this->m_residual_; };
+private:
+	void apply(const cv::Mat& chor, const cv::Mat& cvert, const cv::Mat& mask, float lambda,
+				const cv::Mat& x, cv::Mat& y); // y = (M + lambda * L) x
+	cv::Mat m_inv_diag_; // 32FC1 Jacobi preconditioner
+	cv::Mat m_r_; // 32FC1 residual
+	cv::Mat m_z_; // 32FC1 preconditioned residual
+	cv::Mat m_p_; // 32FC1 search direction
+	cv::Mat m_q_; // 32FC1 A * p
+	std::vector<double> m_sum_; // partial sums of the stripes
+	float m_residual_ = 0.f;
+};
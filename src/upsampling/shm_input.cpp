@@ -0,0 +1,177 @@
+#include "shm_input.h"
+
+enum {
+	SHM_INPUT_META_GUIDE_WIDTH = 0,
+	SHM_INPUT_META_GUIDE_HEIGHT = 1,
+	SHM_INPUT_META_FLOOD_WIDTH = 2,
+	SHM_INPUT_META_FLOOD_HEIGHT = 3,
+	SHM_INPUT_META_SPOT_WIDTH = 4,
+	SHM_INPUT_META_SPOT_HEIGHT = 5,
+	SHM_INPUT_META_FLOOD_OFFSET = 6,
+	SHM_INPUT_META_SPOT_OFFSET = 7,
+};
+
+inline size_t align_offset(size_t size)
+{
+	return (size + SHM_RING_ALIGN - 1) / SHM_RING_ALIGN * SHM_RING_ALIGN;
+}
+
+/**
+ * @brief create input ring
+ *
+ * @param name : shared memory name
+ * @param num_slots : number of slots
+ * @param guide_width : guide image width (8UC1)
+ * @param guide_height : guide image height
+ * @param flood_width : flood grid width (32FC3)
+ * @param flood_height : flood grid height
+ * @param spot_width : spot grid width (32FC3)
+ * @param spot_height : spot grid height
+ * @param replace : replace an existing ring of the name
+ * @return true : succeed
+ * @return false : failed (or the name exists)
+ */
+bool shm_input_producer::open(const std::string& name, int num_slots, int guide_width, int guide_height,
+								int flood_width, int flood_height, int spot_width, int spot_height, bool replace)
+{
+	this->m_guide_size_ = cv::Size(guide_width, guide_height);
+	this->m_flood_size_ = cv::Size(flood_width, flood_height);
+	this->m_spot_size_ = cv::Size(spot_width, spot_height);
+	size_t guide_size = align_offset(static_cast<size_t>(guide_width) * guide_height);
+	size_t flood_size = align_offset(static_cast<size_t>(flood_width) * flood_height * sizeof(cv::Vec3f));
+	size_t spot_size = align_offset(static_cast<size_t>(spot_width) * spot_height * sizeof(cv::Vec3f));
+	return this->m_ring_.create(name, num_slots, guide_size + flood_size + spot_size, replace);
+}
+
+/**
+ * @brief copy one frame into the next slot and publish
+ *
+ * @param guide : guide image (8UC1)
+ * @param flood : flood point cloud (32FC3), can be empty
+ * @param spot : spot point cloud (32FC3), can be empty
+ * @param timestamp_ns : capture timestamp (0: now)
+ * @return true : succeed
+ * @return false : type or size not supported
+ */
+bool shm_input_producer::publish(const cv::Mat& guide, const cv::Mat& flood, const cv::Mat& spot, int64_t timestamp_ns)
+{
+	if (guide.type() != CV_8UC1 || guide.cols > this->m_guide_size_.width || guide.rows > this->m_guide_size_.height)
+		return false;
+	if (!flood.empty() && (flood.type() != CV_32FC3 || flood.total() > static_cast<size_t>(this->m_flood_size_.area())))
+		return false;
+	if (!spot.empty() && (spot.type() != CV_32FC3 || spot.total() > static_cast<size_t>(this->m_spot_size_.area())))
+		return false;
+	Shm_Slot_Header* slot = nullptr;
+	unsigned char* payload = this->m_ring_.begin_write(&slot);
+	if (payload == nullptr)
+		return false;
+	size_t flood_offset = align_offset(static_cast<size_t>(this->m_guide_size_.area()));
+	size_t spot_offset = flood_offset + align_offset(static_cast<size_t>(this->m_flood_size_.area()) * sizeof(cv::Vec3f));
+	guide.copyTo(cv::Mat(guide.size(), CV_8UC1, payload));
+	if (!flood.empty())
+		flood.copyTo(cv::Mat(flood.size(), CV_32FC3, payload + flood_offset));
+	if (!spot.empty())
+		spot.copyTo(cv::Mat(spot.size(), CV_32FC3, payload + spot_offset));
+	slot->meta[SHM_INPUT_META_GUIDE_WIDTH] = guide.cols;
+	slot->meta[SHM_INPUT_META_GUIDE_HEIGHT] = guide.rows;
+	slot->meta[SHM_INPUT_META_FLOOD_WIDTH] = flood.cols;
+	slot->meta[SHM_INPUT_META_FLOOD_HEIGHT] = flood.rows;
+	slot->meta[SHM_INPUT_META_SPOT_WIDTH] = spot.cols;
+	slot->meta[SHM_INPUT_META_SPOT_HEIGHT] = spot.rows;
+	slot->meta[SHM_INPUT_META_FLOOD_OFFSET] = static_cast<int32_t>(flood_offset);
+	slot->meta[SHM_INPUT_META_SPOT_OFFSET] = static_cast<int32_t>(spot_offset);
+	this->m_ring_.end_write(timestamp_ns);
+	return true;
+}
+
+/**
+ * @brief open input ring, consumption starts from the next published frame
+ *
+ * @param name : shared memory name
+ * @return true : succeed
+ * @return false : not found
+ */
+bool shm_input_source::open(const std::string& name)
+{
+	if (!this->m_ring_.open(name))
+		return false;
+	this->m_next_id_ = this->m_ring_.get_write_count();
+	this->m_num_dropped_ = 0;
+	return true;
+}
+
+/**
+ * @brief set guide/flood/spot views of an acquired slot
+ *
+ * @param frame : frame with view set
+ * @return true : consistent frame
+ * @return false : broken or overwritten slot
+ */
+bool shm_input_source::make_frame(Shm_Input_Frame& frame)
+{
+	const int32_t* meta = frame.view.slot->meta;
+	unsigned char* payload = const_cast<unsigned char*>(frame.view.payload);
+	size_t payload_size = this->m_ring_.get_payload_size();
+	size_t guide_size = static_cast<size_t>(meta[SHM_INPUT_META_GUIDE_WIDTH]) * meta[SHM_INPUT_META_GUIDE_HEIGHT];
+	size_t flood_size = static_cast<size_t>(meta[SHM_INPUT_META_FLOOD_WIDTH]) * meta[SHM_INPUT_META_FLOOD_HEIGHT] * sizeof(cv::Vec3f);
+	size_t spot_size = static_cast<size_t>(meta[SHM_INPUT_META_SPOT_WIDTH]) * meta[SHM_INPUT_META_SPOT_HEIGHT] * sizeof(cv::Vec3f);
+	size_t flood_offset = static_cast<size_t>(meta[SHM_INPUT_META_FLOOD_OFFSET]);
+	size_t spot_offset = static_cast<size_t>(meta[SHM_INPUT_META_SPOT_OFFSET]);
+	if (guide_size == 0 || guide_size > flood_offset || flood_offset + flood_size > spot_offset
+		|| spot_offset + spot_size > payload_size)
+		return false;
+	frame.guide = cv::Mat(meta[SHM_INPUT_META_GUIDE_HEIGHT], meta[SHM_INPUT_META_GUIDE_WIDTH], CV_8UC1, payload);
+	if (flood_size > 0)
+		frame.flood = cv::Mat(meta[SHM_INPUT_META_FLOOD_HEIGHT], meta[SHM_INPUT_META_FLOOD_WIDTH], CV_32FC3, payload + flood_offset);
+	else
+		frame.flood.release();
+	if (spot_size > 0)
+		frame.spot = cv::Mat(meta[SHM_INPUT_META_SPOT_HEIGHT], meta[SHM_INPUT_META_SPOT_WIDTH], CV_32FC3, payload + spot_offset);
+	else
+		frame.spot.release();
+	frame.frame_id = frame.view.frame_id;
+	frame.timestamp_ns = frame.view.timestamp_ns;
+	return this->m_ring_.validate(frame.view);
+}
+
+/**
+ * @brief next frame in order (zero-copy)
+ *
+ * @param frame : output frame (views on shared memory)
+ * @return true : succeed
+ * @return false : no new frame
+ */
+bool shm_input_source::acquire_next(Shm_Input_Frame& frame)
+{
+	uint64_t count = this->m_ring_.get_write_count();
+	if (count <= this->m_next_id_)
+		return false;
+	uint64_t num_slots = static_cast<uint64_t>(this->m_ring_.get_num_slots());
+	uint64_t oldest = count >= num_slots ? count - num_slots + 1 : 0; // older slots are overwritten
+	if (this->m_next_id_ < oldest) {
+		this->m_num_dropped_ += oldest - this->m_next_id_;
+		this->m_next_id_ = oldest;
+	}
+	if (!this->m_ring_.acquire(this->m_next_id_, frame.view) || !this->make_frame(frame))
+		return this->acquire_latest(frame); // overwritten meanwhile
+	this->m_next_id_ = frame.frame_id + 1;
+	return true;
+}
+
+/**
+ * @brief latest frame (zero-copy)
+ *
+ * @param frame : output frame (views on shared memory)
+ * @return true : succeed
+ * @return false : no new frame
+ */
+bool shm_input_source::acquire_latest(Shm_Input_Frame& frame)
+{
+	if (!this->m_ring_.acquire_latest(frame.view) || frame.view.frame_id < this->m_next_id_)
+		return false;
+	if (!this->make_frame(frame))
+		return false;
+	this->m_num_dropped_ += frame.frame_id - this->m_next_id_;
+	this->m_next_id_ = frame.frame_id + 1;
+	return true;
+}
@@ -0,0 +1,77 @@
+#pragma once
+#include "shm_ring.h"
+#include <opencv2/opencv.hpp>
+
+#define SHM_INPUT_NAME "ds5_upsampling_input" // default shared memory name
+
+typedef struct Shm_Input_Frame{
+	cv::Mat guide; // 8UC1, read only view on shared memory
+	cv::Mat flood; // 32FC3, read only view on shared memory (empty if not in the frame)
+	cv::Mat spot; // 32FC3, read only view on shared memory (empty if not in the frame)
+	uint64_t frame_id = 0; // frame id of the producer
+	int64_t timestamp_ns = 0; // capture timestamp, steady clock
+	Shm_Ring_View view; // seqlock view
+} Shm_Input_Frame;
+
+/**
+ * @brief writes DS5/DSY-01 style frames (guide + flood + spot) into a shared memory ring
+ *
+ * Stand-in for the sensor driver: replays captures so that live stream
+ * behaviour can be tested without hardware. Old frames are overwritten when
+ * the consumer falls behind.
+ */
+class shm_input_producer
+{
+public:
+	shm_input_producer() {};
+	~shm_input_producer() { this->close(); };
+	// create input ring, sizes are the maximum sizes of each stream, fails if the name exists unless replace
+	bool open(const std::string& name = SHM_INPUT_NAME, int num_slots = 8,
+				int guide_width = 960, int guide_height = 540,
+				int flood_width = 80, int flood_height = 60, int spot_width = 12, int spot_height = 12, 
+				bool replace = false);
+	void close() { this->m_ring_.close(); };
+	bool is_open(void) { return this->m_ring_.is_open(); };
+	// copy one frame into the ring and publish, flood/spot can be empty
+	bool publish(const cv::Mat& guide, const cv::Mat& flood, const cv::Mat& spot, int64_t timestamp_ns = 0);
+	// number of published frames
+	uint64_t get_write_count(void) { return this->m_ring_.get_write_count(); };
+private:
+	shm_ring m_ring_;
+	cv::Size m_guide_size_;
+	cv::Size m_flood_size_;
+	cv::Size m_spot_size_;
+};
+
+/**
+ * @brief consumes frames of shm_input_producer without copy
+ *
+ * guide/flood/spot of an acquired frame are views on shared memory and can be
+ * passed to upsampling::run() directly. validate() after processing tells if
+ * the producer overwrote the slot meanwhile (the result must be dropped).
+ */
+class shm_input_source
+{
+public:
+	shm_input_source() {};
+	~shm_input_source() { this->close(); };
+	// open input ring
+	bool open(const std::string& name = SHM_INPUT_NAME);
+	void close() { this->m_ring_.close(); };
+	bool is_open(void) { return this->m_ring_.is_open(); };
+	// next frame in order, overwritten frames are skipped and counted as dropped
+	bool acquire_next(Shm_Input_Frame& frame);
+	// latest frame, frames in between are counted as dropped
+	bool acquire_latest(Shm_Input_Frame& frame);
+	// true if the views of the frame were not overwritten
+	bool validate(const Shm_Input_Frame& frame) { return this->m_ring_.validate(frame.view); };
+	// number of published frames
+	uint64_t get_write_count(void) { return this->m_ring_.get_write_count(); };
+	// number of frames skipped by the consumer
+	uint64_t get_num_dropped(void) { return this->m_num_dropped_; };
+private:
+	bool make_frame(Shm_Input_Frame& frame);
+	shm_ring m_ring_;
+	uint64_t m_next_id_ = 0;
+	uint64_t m_num_dropped_ = 0;
+};
@@ -0,0 +1,208 @@
+#include "shm_output.h"
+
+enum {
+	SHM_OUTPUT_META_WIDTH = 0,
+	SHM_OUTPUT_META_HEIGHT = 1,
+	SHM_OUTPUT_META_VALID = 2,
+};
+
+/**
+ * @brief create output ring
+ *
+ * @param name : shared memory name
+ * @param width : dense/conf width
+ * @param height : dense/conf height
+ * @param num_slots : number of slots
+ * @param replace : replace an existing ring of the name
+ * @return true : succeed
+ * @return false : failed (or the name exists)
+ */
+bool shm_output_publisher::open(const std::string& name, int width, int height, int num_slots, bool replace)
+{
+	size_t plane_size = static_cast<size_t>(width) * height * sizeof(float);
+	this->m_width_ = width;
+	this->m_height_ = height;
+	return this->m_ring_.create(name, num_slots, plane_size * 2, replace);
+}
+
+/**
+ * @brief get dense/conf headers on the next slot
+ *
+ * @param dense : output 32FC1 header on shared memory
+ * @param conf : output 32FC1 header on shared memory
+ * @return true : succeed
+ * @return false : not opened
+ */
+bool shm_output_publisher::begin_frame(cv::Mat& dense, cv::Mat& conf)
+{
+	Shm_Slot_Header* slot = nullptr;
+	unsigned char* payload = this->m_ring_.begin_write(&slot);
+	if (payload == nullptr)
+		return false;
+	size_t plane_size = static_cast<size_t>(this->m_width_) * this->m_height_ * sizeof(float);
+	slot->meta[SHM_OUTPUT_META_WIDTH] = this->m_width_;
+	slot->meta[SHM_OUTPUT_META_HEIGHT] = this->m_height_;
+	dense = cv::Mat(this->m_height_, this->m_width_, CV_32FC1, payload);
+	conf = cv::Mat(this->m_height_, this->m_width_, CV_32FC1, payload + plane_size);
+	return true;
+}
+
+/**
+ * @brief publish the slot of begin_frame
+ *
+ * @param valid : result of run()
+ * @param timestamp_ns : input timestamp (0: now)
+ */
+void shm_output_publisher::end_frame(bool valid, int64_t timestamp_ns)
+{
+	Shm_Slot_Header* slot = nullptr;
+	if (this->m_ring_.begin_write(&slot) == nullptr)
+		return;
+	slot->meta[SHM_OUTPUT_META_VALID] = valid ? 1 : 0;
+	this->m_ring_.end_write(timestamp_ns);
+}
+
+/**
+ * @brief publish the slot of begin_frame after checking dense/conf
+ *
+ * run() reallocates outputs of another size than get_output_size(), then
+ * dense/conf no longer point at the slot. Results of the slot size are
+ * copied into it, others are published as invalid.
+ *
+ * @param dense : dense of begin_frame after run()
+ * @param conf : conf of begin_frame after run()
+ * @param valid : result of run()
+ * @param timestamp_ns : input timestamp (0: now)
+ * @return true : published dense/conf
+ * @return false : not opened, or dense/conf of other size or type (published invalid)
+ */
+bool shm_output_publisher::end_frame(const cv::Mat& dense, const cv::Mat& conf, bool valid, int64_t timestamp_ns)
+{
+	Shm_Slot_Header* slot = nullptr;
+	unsigned char* payload = this->m_ring_.begin_write(&slot);
+	if (payload == nullptr)
+		return false;
+	size_t plane_size = static_cast<size_t>(this->m_width_) * this->m_height_ * sizeof(float);
+	cv::Size size(this->m_width_, this->m_height_);
+	bool on_slot = dense.data == payload && conf.data == payload + plane_size;
+	bool match = dense.size() == size && conf.size() == size && dense.type() == CV_32FC1 && conf.type() == CV_32FC1;
+	if (!on_slot && match) { // reallocated by the caller, same size
+		dense.copyTo(cv::Mat(size, CV_32FC1, payload));
+		conf.copyTo(cv::Mat(size, CV_32FC1, payload + plane_size));
+	}
+	slot->meta[SHM_OUTPUT_META_VALID] = valid && match ? 1 : 0;
+	this->m_ring_.end_write(timestamp_ns);
+	return match;
+}
+
+/**
+ * @brief copy dense/conf into the next slot and publish
+ *
+ * @param dense : dense depthmap (32FC1)
+ * @param conf : confidence map (32FC1)
+ * @param valid : result of run()
+ * @param timestamp_ns : input timestamp (0: now)
+ * @return true : succeed
+ * @return false : size or type mismatch
+ */
+bool shm_output_publisher::publish(const cv::Mat& dense, const cv::Mat& conf, bool valid, int64_t timestamp_ns)
+{
+	cv::Size size(this->m_width_, this->m_height_);
+	if (dense.size() != size || conf.size() != size || dense.type() != CV_32FC1 || conf.type() != CV_32FC1)
+		return false;
+	cv::Mat slot_dense, slot_conf;
+	if (!this->begin_frame(slot_dense, slot_conf))
+		return false;
+	dense.copyTo(slot_dense);
+	conf.copyTo(slot_conf);
+	this->end_frame(valid, timestamp_ns);
+	return true;
+}
+
+/**
+ * @brief open output ring
+ *
+ * @param name : shared memory name
+ * @return true : succeed
+ * @return false : not found
+ */
+bool shm_output_reader::open(const std::string& name)
+{
+	return this->m_ring_.open(name);
+}
+
+/**
+ * @brief set dense/conf headers and meta data of an acquired view
+ *
+ * @param frame : frame with view set
+ * @return true : consistent meta data
+ * @return false : broken slot
+ */
+bool shm_output_reader::make_frame(Shm_Output_Frame& frame)
+{
+	const Shm_Slot_Header* slot = frame.view.slot;
+	int width = slot->meta[SHM_OUTPUT_META_WIDTH];
+	int height = slot->meta[SHM_OUTPUT_META_HEIGHT];
+	size_t plane_size = static_cast<size_t>(width) * height * sizeof(float);
+	if (width <= 0 || height <= 0 || plane_size * 2 > this->m_ring_.get_payload_size())
+		return false;
+	unsigned char* payload = const_cast<unsigned char*>(frame.view.payload);
+	frame.dense = cv::Mat(height, width, CV_32FC1, payload);
+	frame.conf = cv::Mat(height, width, CV_32FC1, payload + plane_size);
+	frame.frame_id = frame.view.frame_id;
+	frame.timestamp_ns = frame.view.timestamp_ns;
+	frame.publish_ns = frame.view.publish_ns;
+	frame.valid = slot->meta[SHM_OUTPUT_META_VALID] != 0;
+	return this->m_ring_.validate(frame.view);
+}
+
+/**
+ * @brief zero-copy view of the latest frame, validate() after use
+ *
+ * @param frame : output frame (dense/conf are read only views)
+ * @return true : succeed
+ * @return false : no frame
+ */
+bool shm_output_reader::acquire_latest(Shm_Output_Frame& frame)
+{
+	if (!this->m_ring_.acquire_latest(frame.view))
+		return false;
+	return this->make_frame(frame);
+}
+
+/**
+ * @brief zero-copy view of frame frame_id, validate() after use
+ *
+ * @param frame_id : frame id
+ * @param frame : output frame (dense/conf are read only views)
+ * @return true : succeed
+ * @return false : not published or overwritten
+ */
+bool shm_output_reader::acquire(uint64_t frame_id, Shm_Output_Frame& frame)
+{
+	if (!this->m_ring_.acquire(frame_id, frame.view))
+		return false;
+	return this->make_frame(frame);
+}
+
+/**
+ * @brief copy of the latest frame
+ *
+ * @param dense : output dense depthmap
+ * @param conf : output confidence map
+ * @param frame : output meta data
+ * @return true : succeed
+ * @return false : no frame or overwritten while copying
+ */
+bool shm_output_reader::read_latest(cv::Mat& dense, cv::Mat& conf, Shm_Output_Frame& frame)
+{
+	for (int retry = 0; retry < 4; ++retry) {
+		if (!this->acquire_latest(frame))
+			continue;
+		frame.dense.copyTo(dense);
+		frame.conf.copyTo(conf);
+		if (this->validate(frame))
+			return true;
+	}
+	return false;
+}
@@ -0,0 +1,80 @@
+#pragma once
+#include "shm_ring.h"
+#include <opencv2/opencv.hpp>
+
+#define SHM_OUTPUT_NAME "ds5_upsampling_output" // default shared memory name
+
+typedef struct Shm_Output_Frame{
+	cv::Mat dense; // 32FC1, read only view on shared memory (or copy by read_latest)
+	cv::Mat conf; // 32FC1, read only view on shared memory (or copy by read_latest)
+	uint64_t frame_id = 0; // frame id of the publisher
+	int64_t timestamp_ns = 0; // input (capture) timestamp, steady clock
+	int64_t publish_ns = 0; // publish time, steady clock
+	bool valid = false; // run() result
+	Shm_Ring_View view; // seqlock view
+} Shm_Output_Frame;
+
+/**
+ * @brief publishes run() results (dense + conf) into a shared memory ring
+ *
+ * begin_frame() returns dense/conf headers on the next slot so that
+ * upsampling::run() writes directly into shared memory. run() keeps them only
+ * if their size is upsampling::get_output_size(), so the publisher must be
+ * opened with that size (guide size / output_scale), otherwise run() writes
+ * into its own buffers. end_frame(dense, conf, ...) detects that.
+ */
+class shm_output_publisher
+{
+public:
+	shm_output_publisher() {};
+	~shm_output_publisher() { this->close(); };
+	// create output ring, fails if the name exists unless replace
+	bool open(const std::string& name = SHM_OUTPUT_NAME, int width = 960, int height = 540, int num_slots = 4, 
+				bool replace = false);
+	void close() { this->m_ring_.close(); };
+	bool is_open(void) { return this->m_ring_.is_open(); };
+	// get dense/conf on the next slot, pass them to upsampling::run()
+	bool begin_frame(cv::Mat& dense, cv::Mat& conf);
+	// publish the slot of begin_frame, timestamp_ns: input timestamp (0: now)
+	void end_frame(bool valid, int64_t timestamp_ns = 0);
+	// publish the slot of begin_frame, dense/conf of begin_frame after run(), false: not on the slot
+	bool end_frame(const cv::Mat& dense, const cv::Mat& conf, bool valid, int64_t timestamp_ns = 0);
+	// dense/conf size of the slots
+	cv::Size get_size(void) { return cv::Size(this->m_width_, this->m_height_); };
+	// copy dense/conf computed elsewhere and publish
+	bool publish(const cv::Mat& dense, const cv::Mat& conf, bool valid, int64_t timestamp_ns = 0);
+private:
+	shm_ring m_ring_;
+	int m_width_ = 0;
+	int m_height_ = 0;
+};
+
+/**
+ * @brief reads results of shm_output_publisher in another process
+ *
+ * acquire_latest() maps the latest frame without copy, validate() must be
+ * called after the data was used. read_latest() copies and validates.
+ */
+class shm_output_reader
+{
+public:
+	shm_output_reader() {};
+	~shm_output_reader() { this->close(); };
+	// open output ring
+	bool open(const std::string& name = SHM_OUTPUT_NAME);
+	void close() { this->m_ring_.close(); };
+	bool is_open(void) { return this->m_ring_.is_open(); };
+	// number of published frames
+	uint64_t get_write_count(void) { return this->m_ring_.get_write_count(); };
+	// zero-copy view of the latest frame
+	bool acquire_latest(Shm_Output_Frame& frame);
+	// zero-copy view of frame frame_id
+	bool acquire(uint64_t frame_id, Shm_Output_Frame& frame);
+	// true if the view of acquire is still consistent
+	bool validate(const Shm_Output_Frame& frame) { return this->m_ring_.validate(frame.view); };
+	// copy of the latest frame into dense/conf, frame gets the meta data
+	bool read_latest(cv::Mat& dense, cv::Mat& conf, Shm_Output_Frame& frame);
+private:
+	bool make_frame(Shm_Output_Frame& frame);
+	shm_ring m_ring_;
+};
@@ -0,0 +1,291 @@
+#include "shm_ring.h"
+#include <chrono>
+#include <new>
+#include <string.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+inline size_t align_up(size_t size, size_t align)
+{
+	return (size + align - 1) / align * align;
+}
+
+inline std::string shm_name(const std::string& name)
+{
+	return name.empty() || name[0] == '/' ? name : "/" + name;
+}
+
+/**
+ * @brief steady clock in ns
+ *
+ * @return int64_t : time (ns)
+ */
+int64_t shm_ring::now_ns(void)
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * @brief create ring in shared memory (writer side)
+ *
+ * @param name : shared memory name
+ * @param num_slots : number of slots
+ * @param payload_size : payload bytes per slot
+ * @param replace : unlink an existing ring of the name first (its writer and readers keep the old memory)
+ * @param mode : access of the shared memory (SHM_RING_MODE)
+ * @return true : succeed
+ * @return false : failed, the name exists (without replace) or not supported
+ */
+bool shm_ring::create(const std::string& name, int num_slots, size_t payload_size, bool replace, int mode)
+{
+	this->close();
+	if (num_slots < 2 || payload_size == 0)
+		return false;
+#ifdef _WIN32
+	return false;
+#else
+	size_t slot_size = sizeof(Shm_Slot_Header) + align_up(payload_size, SHM_RING_ALIGN);
+	size_t size = align_up(sizeof(Shm_Ring_Header), SHM_RING_ALIGN) + slot_size * num_slots;
+	std::string strName = shm_name(name);
+	if (replace)
+		shm_unlink(strName.c_str());
+	int fd = shm_open(strName.c_str(), O_CREAT | O_EXCL | O_RDWR, static_cast<mode_t>(mode)); // never takes over a live ring
+	if (fd >= 0)
+		fchmod(fd, static_cast<mode_t>(mode)); // not masked by umask
+	if (fd < 0)
+		return false;
+	if (ftruncate(fd, static_cast<off_t>(size)) != 0) {
+		::close(fd);
+		shm_unlink(strName.c_str());
+		return false;
+	}
+	void* base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (base == MAP_FAILED) {
+		::close(fd);
+		shm_unlink(strName.c_str());
+		return false;
+	}
+	memset(base, 0, size); // pages are touched here, not in the frame loop
+	Shm_Ring_Header* header = new (base) Shm_Ring_Header;
+	header->version = SHM_RING_VERSION;
+	header->num_slots = static_cast<uint32_t>(num_slots);
+	header->slot_size = slot_size;
+	header->payload_size = payload_size;
+	header->write_count.store(0, std::memory_order_relaxed);
+	this->m_name_ = strName;
+	this->m_fd_ = fd;
+	this->m_base_ = base;
+	this->m_size_ = size;
+	this->m_owner_ = true;
+	this->m_header_ = header;
+	for (int i = 0; i < num_slots; ++i) {
+		Shm_Slot_Header* slot = new (this->slot_header(i)) Shm_Slot_Header;
+		slot->seq.store(0, std::memory_order_relaxed);
+	}
+	header->magic.store(SHM_RING_MAGIC, std::memory_order_release);
+	return true;
+#endif
+}
+
+/**
+ * @brief open existing ring (reader side)
+ *
+ * @param name : shared memory name
+ * @return true : succeed
+ * @return false : not found or not initialized
+ */
+bool shm_ring::open(const std::string& name)
+{
+	this->close();
+#ifdef _WIN32
+	return false;
+#else
+	std::string strName = shm_name(name);
+	int fd = shm_open(strName.c_str(), O_RDONLY, 0);
+	if (fd < 0)
+		return false;
+	struct stat st;
+	if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(Shm_Ring_Header)) {
+		::close(fd);
+		return false;
+	}
+	size_t size = static_cast<size_t>(st.st_size);
+	void* base = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+	if (base == MAP_FAILED) {
+		::close(fd);
+		return false;
+	}
+	Shm_Ring_Header* header = reinterpret_cast<Shm_Ring_Header*>(base);
+	size_t expected = align_up(sizeof(Shm_Ring_Header), SHM_RING_ALIGN) + header->slot_size * header->num_slots;
+	if (header->magic.load(std::memory_order_acquire) != SHM_RING_MAGIC
+		|| header->version != SHM_RING_VERSION || expected > size) {
+		munmap(base, size);
+		::close(fd);
+		return false;
+	}
+	this->m_name_ = strName;
+	this->m_fd_ = fd;
+	this->m_base_ = base;
+	this->m_size_ = size;
+	this->m_owner_ = false;
+	this->m_header_ = header;
+	return true;
+#endif
+}
+
+/**
+ * @brief unmap ring, the writer also removes the shared memory name (if it still refers to this ring)
+ *
+ */
+void shm_ring::close()
+{
+#ifndef _WIN32
+	if (this->m_base_ != nullptr)
+		munmap(this->m_base_, this->m_size_);
+	if (this->m_owner_ && this->m_fd_ >= 0) { // unlink only if the name was not replaced by another writer
+		int fd = shm_open(this->m_name_.c_str(), O_RDONLY, 0);
+		struct stat st_own, st_name;
+		if (fd >= 0 && fstat(this->m_fd_, &st_own) == 0 && fstat(fd, &st_name) == 0
+			&& st_own.st_dev == st_name.st_dev && st_own.st_ino == st_name.st_ino)
+			shm_unlink(this->m_name_.c_str());
+		if (fd >= 0)
+			::close(fd);
+	}
+	if (this->m_fd_ >= 0)
+		::close(this->m_fd_);
+#endif
+	this->m_base_ = nullptr;
+	this->m_fd_ = -1;
+	this->m_size_ = 0;
+	this->m_owner_ = false;
+	this->m_header_ = nullptr;
+	this->m_writing_slot_ = nullptr;
+}
+
+Shm_Slot_Header* shm_ring::slot_header(uint64_t frame_id)
+{
+	unsigned char* slots = reinterpret_cast<unsigned char*>(this->m_base_) + align_up(sizeof(Shm_Ring_Header), SHM_RING_ALIGN);
+	uint64_t idx = frame_id % this->m_header_->num_slots;
+	return reinterpret_cast<Shm_Slot_Header*>(slots + idx * this->m_header_->slot_size);
+}
+
+/**
+ * @brief number of published frames
+ *
+ * @return uint64_t : write count
+ */
+uint64_t shm_ring::get_write_count(void)
+{
+	if (this->m_header_ == nullptr)
+		return 0;
+	return this->m_header_->write_count.load(std::memory_order_acquire);
+}
+
+/**
+ * @brief start writing the next slot (seqlock counter becomes odd)
+ *
+ * @param slot : output slot header (frame meta data can be filled before end_write)
+ * @return unsigned char* : payload of the slot, nullptr if not created
+ */
+unsigned char* shm_ring::begin_write(Shm_Slot_Header** slot)
+{
+	if (this->m_header_ == nullptr || !this->m_owner_)
+		return nullptr;
+	if (this->m_writing_slot_ == nullptr) {
+		this->m_writing_id_ = this->m_header_->write_count.load(std::memory_order_relaxed);
+		this->m_writing_slot_ = this->slot_header(this->m_writing_id_);
+		uint32_t seq = this->m_writing_slot_->seq.load(std::memory_order_relaxed);
+		this->m_writing_slot_->seq.store(seq + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+	}
+	if (slot != nullptr)
+		*slot = this->m_writing_slot_;
+	return reinterpret_cast<unsigned char*>(this->m_writing_slot_) + sizeof(Shm_Slot_Header);
+}
+
+/**
+ * @brief publish the slot started by begin_write (seqlock counter becomes even)
+ *
+ * @param timestamp_ns : frame timestamp (0: now)
+ */
+void shm_ring::end_write(int64_t timestamp_ns)
+{
+	Shm_Slot_Header* slot = this->m_writing_slot_;
+	if (slot == nullptr)
+		return;
+	int64_t now = shm_ring::now_ns();
+	slot->frame_id = this->m_writing_id_;
+	slot->timestamp_ns = timestamp_ns != 0 ? timestamp_ns : now;
+	slot->publish_ns = now;
+	uint32_t seq = slot->seq.load(std::memory_order_relaxed);
+	slot->seq.store(seq + 1, std::memory_order_release);
+	this->m_header_->write_count.store(this->m_writing_id_ + 1, std::memory_order_release);
+	this->m_writing_slot_ = nullptr;
+}
+
+/**
+ * @brief view of a published frame
+ *
+ * @param frame_id : frame id
+ * @param view : output view
+ * @return true : succeed
+ * @return false : not published yet, already overwritten or being written
+ */
+bool shm_ring::acquire(uint64_t frame_id, Shm_Ring_View& view)
+{
+	if (this->m_header_ == nullptr)
+		return false;
+	uint64_t count = this->m_header_->write_count.load(std::memory_order_acquire);
+	if (frame_id >= count || count - frame_id > this->m_header_->num_slots)
+		return false;
+	const Shm_Slot_Header* slot = this->slot_header(frame_id);
+	uint32_t seq = slot->seq.load(std::memory_order_acquire);
+	if (seq & 1)
+		return false;
+	view.slot = slot;
+	view.payload = reinterpret_cast<const unsigned char*>(slot) + sizeof(Shm_Slot_Header);
+	view.seq = seq;
+	view.frame_id = slot->frame_id;
+	view.timestamp_ns = slot->timestamp_ns;
+	view.publish_ns = slot->publish_ns;
+	return view.frame_id == frame_id && this->validate(view);
+}
+
+/**
+ * @brief view of latest published frame
+ *
+ * @param view : output view
+ * @return true : succeed
+ * @return false : nothing published yet
+ */
+bool shm_ring::acquire_latest(Shm_Ring_View& view)
+{
+	for (int retry = 0; retry < 4; ++retry) {
+		uint64_t count = this->get_write_count();
+		if (count == 0)
+			return false;
+		if (this->acquire(count - 1, view))
+			return true;
+	}
+	return false;
+}
+
+/**
+ * @brief check that the slot was not touched since acquire (seqlock read side)
+ *
+ * @param view : view by acquire
+ * @return true : data read from the view is consistent
+ * @return false : overwritten, discard the data
+ */
+bool shm_ring::validate(const Shm_Ring_View& view)
+{
+	if (view.slot == nullptr)
+		return false;
+	std::atomic_thread_fence(std::memory_order_acquire);
+	return view.slot->seq.load(std::memory_order_relaxed) == view.seq;
+}
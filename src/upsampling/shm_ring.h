@@ -0,0 +1,88 @@
+#pragma once
+#include <atomic>
+#include <string>
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHM_RING_MAGIC 0x474E5253 // "SRNG"
+#define SHM_RING_VERSION 1
+#define SHM_RING_ALIGN 64 // slot header and payload alignment (cache line)
+#define SHM_RING_MODE 0600 // access of a created ring (owner only, 0660: readers of the group)
+
+typedef struct Shm_Ring_Header{
+	std::atomic<uint32_t> magic; // SHM_RING_MAGIC, written last by creator
+	uint32_t version; // SHM_RING_VERSION
+	uint32_t num_slots; // number of slots
+	uint32_t reserved;
+	uint64_t slot_size; // bytes per slot (slot header + payload)
+	uint64_t payload_size; // bytes of payload per slot
+	std::atomic<uint64_t> write_count; // number of published frames
+} Shm_Ring_Header;
+
+typedef struct Shm_Slot_Header{
+	std::atomic<uint32_t> seq; // seqlock counter, odd while the slot is written
+	uint32_t flags; // user flags
+	uint64_t frame_id; // frame id (write count when written)
+	int64_t timestamp_ns; // frame timestamp (steady clock)
+	int64_t publish_ns; // publish time (steady clock)
+	int32_t meta[8]; // layout dependent meta data
+} Shm_Slot_Header;
+
+typedef struct Shm_Ring_View{
+	const Shm_Slot_Header* slot = nullptr; // slot header
+	const unsigned char* payload = nullptr; // slot payload (valid until validate() fails)
+	uint32_t seq = 0; // seqlock counter at acquire
+	uint64_t frame_id = 0; // frame id
+	int64_t timestamp_ns = 0; // frame timestamp
+	int64_t publish_ns = 0; // publish time
+} Shm_Ring_View;
+
+/**
+ * @brief single writer / multi reader ring of fixed size slots in POSIX shared memory
+ *
+ * Every slot has a seqlock header: the writer makes the counter odd before it
+ * touches the payload and even again when done. Readers access the payload in
+ * place and call validate() afterwards; a changed counter means the slot was
+ * overwritten and the data must be discarded. No locks and no syscalls per frame.
+ */
+class shm_ring
+{
+public:
+	shm_ring() {};
+	~shm_ring() { this->close(); };
+	shm_ring(const shm_ring&) = delete;
+	shm_ring& operator=(const shm_ring&) = delete;
+	// create ring (writer), fails if the name exists unless replace (e.g. stale ring of a crashed writer)
+	bool create(const std::string& name, int num_slots, size_t payload_size, bool replace = false, int mode = SHM_RING_MODE);
+	// open existing ring (reader, read only mapping)
+	bool open(const std::string& name);
+	// unmap (and unlink if created and not replaced)
+	void close();
+	bool is_open(void) { return this->m_header_ != nullptr; };
+	int get_num_slots(void) { return this->m_header_ ? static_cast<int>(this->m_header_->num_slots) : 0; };
+	size_t get_payload_size(void) { return this->m_header_ ? static_cast<size_t>(this->m_header_->payload_size) : 0; };
+	// number of published frames
+	uint64_t get_write_count(void);
+	// writer: start writing next slot, returns payload pointer
+	unsigned char* begin_write(Shm_Slot_Header** slot = nullptr);
+	// writer: publish slot started by begin_write()
+	void end_write(int64_t timestamp_ns);
+	// reader: view of frame frame_id, false if not published yet, overwritten or being written
+	bool acquire(uint64_t frame_id, Shm_Ring_View& view);
+	// reader: view of latest published frame
+	bool acquire_latest(Shm_Ring_View& view);
+	// reader: true if the view was not overwritten since acquire
+	bool validate(const Shm_Ring_View& view);
+	// steady clock in ns (comparable between processes on the same host)
+	static int64_t now_ns(void);
+private:
+	Shm_Slot_Header* slot_header(uint64_t frame_id);
+	std::string m_name_;
+	int m_fd_ = -1;
+	void* m_base_ = nullptr;
+	size_t m_size_ = 0;
+	bool m_owner_ = false;
+	Shm_Ring_Header* m_header_ = nullptr;
+	uint64_t m_writing_id_ = 0;
+	Shm_Slot_Header* m_writing_slot_ = nullptr;
+};
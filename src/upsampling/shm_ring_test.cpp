@@ -0,0 +1,147 @@
+/**
+ * @file shm_ring_test.cpp
+ * @brief tests of the seqlock of shm_ring: overwritten and torn slots are detected
+ * @version 2.0
+ * @date 2026-10-19
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+#include "shm_ring.h"
+#include "test_check.h"
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define TEST_PAYLOAD_SIZE (1 << 20)
+
+/**
+ * @brief write frame id into every byte of the next slot and publish
+ *
+ * @param ring : writer ring
+ * @param value : byte value
+ */
+static void write_frame(shm_ring& ring, unsigned char value)
+{
+	unsigned char* payload = ring.begin_write();
+	memset(payload, value, TEST_PAYLOAD_SIZE);
+	ring.end_write(0);
+}
+
+/**
+ * @brief a view is invalid once the writer reuses its slot, even before publishing
+ *
+ * @param name : shared memory name
+ */
+static void test_overwrite(const std::string& name)
+{
+	shm_ring writer;
+	TEST_CHECK(writer.create(name, 2, TEST_PAYLOAD_SIZE));
+	shm_ring reader;
+	TEST_CHECK(reader.open(name));
+	Shm_Ring_View view;
+	TEST_CHECK(!reader.acquire_latest(view)); // nothing published
+	write_frame(writer, 0);
+	TEST_CHECK(reader.acquire(0, view));
+	TEST_CHECK(view.payload[0] == 0 && view.payload[TEST_PAYLOAD_SIZE - 1] == 0);
+	TEST_CHECK(reader.validate(view));
+	write_frame(writer, 1); // other slot
+	TEST_CHECK(reader.validate(view));
+	writer.begin_write(); // frame 2 reuses the slot of frame 0, being written
+	TEST_CHECK(!reader.validate(view));
+	Shm_Ring_View view2;
+	TEST_CHECK(!reader.acquire(2, view2)); // not published
+	writer.end_write(0);
+	TEST_CHECK(!reader.validate(view));
+	TEST_CHECK(!reader.acquire(0, view2)); // overwritten
+	TEST_CHECK(reader.acquire(2, view2));
+}
+
+/**
+ * @brief a second writer never takes over a live ring unless asked, rings are not world accessible
+ *
+ * @param name : shared memory name
+ */
+static void test_create(const std::string& name)
+{
+	shm_ring writer;
+	TEST_CHECK(writer.create(name, 2, TEST_PAYLOAD_SIZE));
+	struct stat st;
+	TEST_CHECK(stat(("/dev/shm/" + name).c_str(), &st) == 0 && (st.st_mode & 0777) == SHM_RING_MODE);
+	shm_ring reader;
+	TEST_CHECK(reader.open(name));
+	write_frame(writer, 5);
+	shm_ring writer2;
+	TEST_CHECK(!writer2.create(name, 2, TEST_PAYLOAD_SIZE)); // name in use
+	write_frame(writer, 6);
+	Shm_Ring_View view;
+	TEST_CHECK(reader.acquire_latest(view) && view.payload[0] == 6);
+	TEST_CHECK(writer2.create(name, 2, TEST_PAYLOAD_SIZE, true)); // replaced
+	TEST_CHECK(reader.acquire_latest(view) && view.payload[0] == 6); // old ring still mapped
+	shm_ring reader2;
+	TEST_CHECK(reader2.open(name) && reader2.get_write_count() == 0);
+	writer.close(); // the replaced writer leaves the new name alone
+	TEST_CHECK(reader2.open(name));
+}
+
+/**
+ * @brief a writer publishing as fast as possible, every copy a reader validates is untorn
+ *
+ * @param name : shared memory name
+ */
+static void test_torn_reads(const std::string& name)
+{
+	shm_ring writer;
+	TEST_CHECK(writer.create(name, 2, TEST_PAYLOAD_SIZE));
+	shm_ring reader;
+	TEST_CHECK(reader.open(name));
+	const int num_reads = 2000;
+	std::atomic<bool> done(false);
+	std::thread th_writer([&writer, &done]() -> void { // frame id i is written as byte i
+		for (uint64_t i = 0; !done.load(); ++i)
+			write_frame(writer, static_cast<unsigned char>(i));
+	});
+	std::vector<unsigned char> copy(TEST_PAYLOAD_SIZE);
+	int num_valid = 0;
+	int num_torn = 0; // rejected by validate()
+	int num_corrupt = 0; // accepted but mixed
+	while (reader.get_write_count() == 0) // writer started
+		std::this_thread::yield();
+	for (int n = 0; n < num_reads; ++n) {
+		Shm_Ring_View view;
+		if (!reader.acquire_latest(view))
+			continue;
+		memcpy(copy.data(), view.payload, TEST_PAYLOAD_SIZE);
+		if (!reader.validate(view)) {
+			num_torn += 1;
+			continue;
+		}
+		num_valid += 1;
+		for (int i = 1; i < TEST_PAYLOAD_SIZE; ++i) {
+			if (copy[i] != copy[0]) {
+				num_corrupt += 1;
+				break;
+			}
+		}
+		if (copy[0] != static_cast<unsigned char>(view.frame_id))
+			num_corrupt += 1;
+	}
+	done.store(true);
+	th_writer.join();
+	TEST_CHECK(num_corrupt == 0);
+	TEST_CHECK(num_valid + num_torn > 0);
+	std::cout << "shm_ring: " << num_valid << " valid, " << num_torn << " torn reads rejected" << std::endl;
+}
+
+int main(void)
+{
+	std::string name = "ds5_upsampling_test_" + std::to_string(static_cast<long>(getpid()));
+	test_create(name);
+	test_overwrite(name);
+	test_torn_reads(name);
+	return g_test_failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,13 @@
+#pragma once
+#include <iostream>
+
+static int g_test_failures = 0; // failed checks of the test program, returned by main()
+
+// count and report a failed condition, the test goes on
+#define TEST_CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " << #cond << std::endl; \
+			g_test_failures += 1; \
+		} \
+	} while (0)
@@ -1,23 +1,389 @@
 #include "upsampling.h"
+#include "upsampling_kernels.h"
+#include <atomic>
 #include <chrono>
+#include <limits>
+#include <mutex>
 #include <thread>
 #include <math.h>
 // #define SHOW_TIME
 
+const int QUALITY_DOWN_FRAMES = 3; // frames over budget before lowering quality
+const int QUALITY_UP_FRAMES = 30; // frames under QUALITY_UP_RATIO of budget before raising quality
+const double QUALITY_UP_RATIO = 0.6; // hysteresis of raising quality
+const double QUALITY_AVG_WEIGHT = 0.2; // weight of the last frame in the smoothed time
+const int STATIC_BLOCK_SIZE = 16; // guide block size of change detection
+const int STATIC_SAMPLE_STEP = 4; // sampling step of guide differences in a block
+const int STATIC_MARGIN = 48; // margin of the recomputed region around changed blocks (pixels)
+const double STATIC_MAX_PARTIAL_AREA = 0.5; // area ratio above which the frame is recomputed fully
+const int STATIC_MAX_PARTIAL_FRAMES = 8; // partial recomputes in a row before a full solve (the cropped solves drift)
+
+enum Static_Change {
+	CHANGE_NONE = 0, // inputs are the same as the cache
+	CHANGE_PARTIAL = 1, // recompute the changed region
+	CHANGE_FULL = 2, // recompute the frame
+};
+
+/**
+ * @brief flood preprocessing of the parameters (same order as flood_depth_proc())
+ * 
+ * @param cfg : parameters
+ * @return int : Flood_Preprocessing
+ */
+inline int select_flood_proc(const Upsampling_Config& cfg)
+{
+	if (!cfg.use_preprocessing)
+		return FLOOD_PROC_NONE;
+	if (cfg.incremental_preprocessing)
+		return FLOOD_PROC_INCREMENTAL;
+	if (cfg.depth_diff_thresh == 0.0f || cfg.guide_diff_thresh == 0.0f)
+		return FLOOD_PROC_PARALLAX;
+	return FLOOD_PROC_EDGE;
+}
+
 /**
  * @brief Construct a new upsampling::upsampling object
  * 
+ * Kernels are specialized for the default resolutions, other resolutions
+ * run the generic kernels.
+ * 
+ * @param guide_width : guide image width
+ * @param guide_height : guide image height
+ * @param grid_width : flood depth grid width
+ * @param grid_height : flood depth grid height
+ */
+upsampling::upsampling(int guide_width, int guide_height, int grid_width, int grid_height)
+	: m_guide_width_(std::max(1, guide_width)), m_guide_height_(std::max(1, guide_height)),
+	  m_grid_width_(std::max(1, grid_width)), m_grid_height_(std::max(1, grid_height))
+{
+	this->m_config_readers_[0] = 0;
+	this->m_config_readers_[1] = 0;
+	this->m_config_index_ = 0;
+	std::shared_ptr<Upsampling_Config> config = std::make_shared<Upsampling_Config>();
+	this->update_tables(*config);
+	config->flood_proc = select_flood_proc(*config);
+	this->m_config_slots_[0] = config;
+	this->clear(*this->get_config(), this->m_context_.m_frame_);
+}
+
+/**
+ * @brief current parameter snapshot
+ * 
+ * Lock free: the reader registers on the current slot and takes a reference.
+ * A writer never touches a slot with readers, so the snapshot is never torn.
+ * 
+ * @return std::shared_ptr<const Upsampling_Config> : snapshot, valid while held
+ */
+std::shared_ptr<const Upsampling_Config> upsampling::get_config() const
+{
+	while (true) {
+		int idx = this->m_config_index_.load();
+		this->m_config_readers_[idx].fetch_add(1);
+		if (this->m_config_index_.load() == idx) { // slot is still current, writers wait for us
+			std::shared_ptr<const Upsampling_Config> config = this->m_config_slots_[idx];
+			this->m_config_readers_[idx].fetch_sub(1);
+			return config;
+		}
+		this->m_config_readers_[idx].fetch_sub(1); // swapped meanwhile, retry
+	}
+}
+
+/**
+ * @brief publish a parameter snapshot
+ * 
+ * The snapshot is written into the unused slot and published by swapping
+ * the slot index. Frames already running keep their snapshot until they finish.
+ * 
+ * @param config : new parameters, tables are rebuilt if empty
+ */
+void upsampling::set_config(const Upsampling_Config& config)
+{
+	std::lock_guard<std::mutex> lock(this->m_config_write_mutex_);
+	this->publish_config(config);
+}
+
+/**
+ * @brief modify the current parameters and publish them
+ * 
+ * The writer lock is held from reading the current snapshot to publishing
+ * the modified one, so concurrent setters never lose each other's fields.
+ * modify must not call set_config()/update_config().
+ * 
+ * @param modify : changes the copy of the current parameters
+ */
+void upsampling::update_config(const std::function<void(Upsampling_Config&)>& modify)
+{
+	std::lock_guard<std::mutex> lock(this->m_config_write_mutex_);
+	Upsampling_Config config = *this->m_config_slots_[this->m_config_index_.load()];
+	modify(config);
+	this->publish_config(config);
+}
+
+/**
+ * @brief swap in a parameter snapshot
+ * 
+ * m_config_write_mutex_ must be held by the caller.
+ * 
+ * @param config : new parameters, tables are rebuilt if empty
+ */
+void upsampling::publish_config(const Upsampling_Config& config)
+{
+	std::shared_ptr<Upsampling_Config> next = std::make_shared<Upsampling_Config>(config);
+	if (!next->tables)
+		this->update_tables(*next);
+	next->flood_proc = select_flood_proc(*next);
+	int idx = 1 - this->m_config_index_.load();
+	while (this->m_config_readers_[idx].load() != 0) // readers of the old snapshot leave quickly
+		std::this_thread::yield();
+	this->m_config_slots_[idx] = next;
+	this->m_config_index_.store(idx);
+}
+
+/**
+ * @brief set the latency budget of quality control
+ * 
+ * @param budget_ms : run() time per frame to hold [ms], 0: off
+ */
+void upsampling::set_latency_budget(float budget_ms)
+{
+	this->update_config([&](Upsampling_Config& config) {
+		config.latency_budget_ms = budget_ms > 0.f ? budget_ms : 0.f;
+	});
+}
+
+/**
+ * @brief set static frame skip
+ * 
+ * @param guide_thresh : mean guide difference of a changed block (0~255), 0: off
+ * @param depth_thresh : z difference of a changed flood/spot point [m]
+ */
+void upsampling::set_static_frame_skip(float guide_thresh, float depth_thresh)
+{
+	this->update_config([&](Upsampling_Config& config) {
+		config.static_guide_thresh = guide_thresh > 0.f ? guide_thresh : 0.f;
+		config.static_depth_thresh = depth_thresh > 0.f ? depth_thresh : 0.f;
+	});
+}
+
+/**
+ * @brief set incremental preprocessing
+ * 
+ * @param on : true for incremental preprocessing
+ * @param depth_tolerance : change of a flood point to be recomputed [m]
+ * @param guide_tolerance : change of the guide patch of a point to be recomputed (0~255)
+ */
+void upsampling::set_incremental_preprocessing(bool on, float depth_tolerance, float guide_tolerance)
+{
+	this->update_config([&](Upsampling_Config& config) {
+		config.incremental_preprocessing = on;
+		config.incremental_depth_tolerance = depth_tolerance > 0.f ? depth_tolerance : 0.f;
+		config.incremental_guide_tolerance = guide_tolerance > 0.f ? guide_tolerance : 0.f;
+	});
+}
+
+/**
+ * @brief set the solver backend
+ * 
+ * @param solver : Upsampling_Solver
+ * @param tolerance : relative residual to stop SOLVER_PCG
+ * @param max_iter : SOLVER_PCG iterations per frame at most
+ */
+void upsampling::set_solver(int solver, float tolerance, int max_iter)
+{
+	this->update_config([&](Upsampling_Config& config) {
+		config.solver = solver == SOLVER_PCG ? SOLVER_PCG : SOLVER_FGS;
+		config.pcg_tolerance = tolerance > 0.f ? tolerance : 0.f;
+		config.pcg_max_iter = max_iter > 1 ? max_iter : 1;
+	});
+}
+
+/**
+ * @brief switch between the template variants of stage 1 and the generic preprocessing
+ * 
+ * Stage 2 has one path per mode, the variants only differ in stage 1.
+ * 
+ * @param on : true: variant per mode and preprocessing, false: generic preprocessing
+ */
+void upsampling::use_specialized_pipeline(bool on)
+{
+	this->update_config([&](Upsampling_Config& config) {
+		config.specialized_pipeline = on;
+	});
+}
+
+/**
+ * @brief set the confidence threshold of dense
+ * 
+ * @param threshold : dense is NaN where conf < threshold (0: off)
+ */
+void upsampling::set_confidence_threshold(float threshold)
+{
+	this->update_config([&](Upsampling_Config& config) {
+		config.conf_threshold = threshold > 0.f ? threshold : 0.f;
+	});
+}
+
+/**
+ * @brief set the fusion of flood and spot (mode 3)
+ * 
+ * FUSION_JOINT splats flood and spot samples with their data weights into
+ * one right-hand side and solves once with the flood parameters (lambda,
+ * colour weights, iterations), so no second solve and no merge pass run.
+ * The normalized result follows flood where flood samples are and spot
+ * farther away, the ratio of the weights sets the transition.
+ * 
+ * @param fusion : Upsampling_Fusion
+ * @param flood_weight : FUSION_JOINT data weight of flood samples
+ * @param spot_weight : FUSION_JOINT data weight of spot samples
+ */
+void upsampling::set_fusion(int fusion, float flood_weight, float spot_weight)
+{
+	this->update_config([&](Upsampling_Config& config) {
+		config.fusion = fusion == FUSION_JOINT ? FUSION_JOINT : FUSION_MERGE;
+		config.joint_flood_weight = std::max(1e-6f, flood_weight);
+		config.joint_spot_weight = std::max(1e-6f, spot_weight);
+	});
+}
+
+/**
+ * @brief set the flood engine
+ * 
+ * FLOOD_ENGINE_MESH rasterizes the triangles of neighbouring flood grid
+ * points without depth or guide edges directly into dense, the solver runs
+ * only in tiles with uncovered pixels of the flood range (the bands around
+ * the edges and holes).
+ * 
+ * @param engine : Flood_Engine
+ * @param tile_size : (output pixels) solver tile of the edge bands
+ */
+void upsampling::set_flood_engine(int engine, int tile_size)
+{
+	this->update_config([&](Upsampling_Config& config) {
+		config.flood_engine = engine == FLOOD_ENGINE_MESH ? FLOOD_ENGINE_MESH : FLOOD_ENGINE_SOLVER;
+		config.mesh_tile_size = std::max(8, tile_size);
+	});
+}
+
+/**
+ * @brief set the spot engine
+ * 
+ * SPOT_ENGINE_INTERPOLATOR interpolates the spot samples by a normalized
+ * Gaussian RBF on a coarse grid and upsamples the grid guided by the colour
+ * of the guide (joint bilateral), instead of a solver over all pixels.
+ * 
+ * @param engine : Spot_Engine
+ * @param grid_step : (output pixels) node distance of the coarse grid
+ * @param rbf_sigma : (output pixels) RBF width, 0: mean sample distance
+ */
+void upsampling::set_spot_engine(int engine, int grid_step, float rbf_sigma)
+{
+	this->update_config([&](Upsampling_Config& config) {
+		config.spot_engine = engine == SPOT_ENGINE_INTERPOLATOR ? SPOT_ENGINE_INTERPOLATOR : SPOT_ENGINE_SOLVER;
+		config.spot_grid_step = std::max(1, grid_step);
+		config.spot_rbf_sigma = std::max(0.f, rbf_sigma);
+	});
+}
+
+/**
+ * @brief set the output resolution divider of dense/conf
+ * 
+ * Flood and spot samples are projected onto the output grid and the solver
+ * runs there with the guide downsampled to it, so no pixel of the guide
+ * resolution is computed. Preprocessing stays on the guide resolution.
+ * 
+ * @param scale : dense/conf are guide size / scale (1: guide resolution)
+ */
+void upsampling::set_output_scale(int scale)
+{
+	this->update_config([&](Upsampling_Config& config) {
+		config.output_scale = std::max(1, scale);
+	});
+}
+
+/**
+ * @brief set the foreground range of the mask of run()
+ * 
+ * @param near_z : (m) nearest foreground depth
+ * @param far_z : (m) farthest foreground depth (0: empty mask)
+ * @param conf_threshold : minimum confidence of foreground
+ */
+void upsampling::set_foreground_range(float near_z, float far_z, float conf_threshold)
+{
+	this->update_config([&](Upsampling_Config& config) {
+		config.fg_near = std::max(0.f, near_z);
+		config.fg_far = std::max(config.fg_near, far_z);
+		config.fg_conf_threshold = std::max(0.f, conf_threshold);
+	});
+}
+
+/**
+ * @brief set the occlusion test of the occlusion mask of run()
+ * 
+ * @param margin : (m) tie band around the virtual depth, real depth of conf 1 occludes 
+ *                 up to margin behind it, of conf 0 only margin in front of it
+ * @param conf_threshold : real depth of lower confidence never occludes
  */
-upsampling::upsampling()
+void upsampling::set_occlusion_test(float margin, float conf_threshold)
 {
-	this->m_flood_mask_ = cv::Mat::zeros(cv::Size(m_guide_width_, m_guide_height_), CV_32FC1);
-	this->m_flood_range_ = cv::Mat::zeros(cv::Size(m_guide_width_, m_guide_height_), CV_32FC1);
-	this->m_spot_mask_ = cv::Mat::zeros(cv::Size(m_guide_width_, m_guide_height_), CV_32FC1);
-	this->m_spot_range_ = cv::Mat::zeros(cv::Size(m_guide_width_, m_guide_height_), CV_32FC1);
-	this->m_flood_dmap_ = cv::Mat::zeros(cv::Size(m_guide_width_, m_guide_height_), CV_32FC1);
-	this->m_spot_dmap_ = cv::Mat::zeros(cv::Size(m_guide_width_, m_guide_height_), CV_32FC1);
-	this->m_flood_grid_ = cv::Mat::zeros(cv::Size(m_grid_width_, m_grid_height_), CV_32FC1);
-	this->m_guide_edge_ = cv::Mat::ones(cv::Size(m_guide_width_, m_guide_height_), CV_32FC1);
+	this->update_config([&](Upsampling_Config& config) {
+		config.occlusion_margin = std::max(0.f, margin);
+		config.occlusion_conf_threshold = std::max(0.f, conf_threshold);
+	});
+}
+
+/**
+ * @brief resolution of dense/conf of parameters
+ * 
+ * @param cfg : parameters
+ * @return cv::Size : guide size / output_scale
+ */
+cv::Size upsampling::get_output_size(const Upsampling_Config& cfg) const
+{
+	int scale = std::max(1, cfg.output_scale);
+	return cv::Size(std::max(1, this->m_guide_width_ / scale), std::max(1, this->m_guide_height_ / scale));
+}
+
+/**
+ * @brief camera parameters on the output grid
+ * 
+ * Output pixel i covers guide pixels [i * scale, (i + 1) * scale) (area
+ * downsampling), its centre is guide pixel i * scale + (scale - 1) / 2.
+ * 
+ * @param cfg : parameters
+ * @param fx : output focal length x
+ * @param fy : output focal length y
+ * @param cx : output principal point x
+ * @param cy : output principal point y
+ */
+inline void get_output_intrinsics(const Upsampling_Config& cfg, float& fx, float& fy, float& cx, float& cy)
+{
+	float scale = static_cast<float>(std::max(1, cfg.output_scale));
+	float offset = (scale - 1.f) * 0.5f;
+	fx = cfg.fx / scale;
+	fy = cfg.fy / scale;
+	cx = (cfg.cx - offset) / scale;
+	cy = (cfg.cy - offset) / scale;
+}
+
+/**
+ * @brief build the shared tables of the parameters
+ * 
+ * Contexts running with the previous tables keep them alive until they finish.
+ * 
+ * @param config : parameters, tables are set
+ */
+void upsampling::update_tables(Upsampling_Config& config) const
+{
+	std::shared_ptr<Upsampling_Tables> tables = std::make_shared<Upsampling_Tables>();
+	fgs_solver::create_weight_table(config.fgs_sigma_color_flood, tables->weight_flood);
+	fgs_solver::create_weight_table(config.fgs_sigma_color_spot, tables->weight_spot);
+	tables->x_per_z.resize(this->m_guide_width_);
+	tables->y_per_z.resize(this->m_guide_height_);
+	for (int x = 0; x < this->m_guide_width_; ++x)
+		tables->x_per_z[x] = (x - config.cx) / config.fx;
+	for (int y = 0; y < this->m_guide_height_; ++y)
+		tables->y_per_z[y] = (y - config.cy) / config.fy;
+	config.tables = tables;
 }
 
 
@@ -28,10 +394,13 @@ upsampling::upsampling()
  */
 void upsampling::set_cam_paramters(const Camera_Params& params)
 {
-	this->m_cx_ = params.cx;
-	this->m_cy_ = params.cy;
-	this->m_fx_ = params.fx;
-	this->m_fy_ = params.fy;
+	this->update_config([&](Upsampling_Config& config) {
+		config.cx = params.cx;
+		config.cy = params.cy;
+		config.fx = params.fx;
+		config.fy = params.fy;
+		config.tables.reset();
+	});
 }
 
 /**
@@ -41,18 +410,21 @@ void upsampling::set_cam_paramters(const Camera_Params& params)
  */
 void upsampling::set_upsampling_parameters(const Upsampling_Params& params) 
 { 
-	this->m_fgs_lambda_flood_ = params.fgs_lambda_flood; 
-	this->m_fgs_sigma_color_flood_ = params.fgs_sigma_color_flood; 
-	this->m_fgs_lambda_spot_ = params.fgs_lambda_spot; 
-	this->m_fgs_sigma_color_spot_ = params.fgs_sigma_color_spot; 
-	this->m_fgs_num_iter_flood_ = params.fgs_num_iter_flood;
-	this->m_fgs_num_iter_spot_ = params.fgs_num_iter_spot;
-	if (this->m_fgs_lambda_flood_ < 1) this->m_fgs_lambda_flood_ = 1;
-	if (this->m_fgs_sigma_color_flood_ < 1) this->m_fgs_sigma_color_flood_ = 1;
-	if (this->m_fgs_num_iter_flood_ < 1) this->m_fgs_num_iter_flood_ = 1;
-	if (this->m_fgs_num_iter_flood_ > 5) this->m_fgs_num_iter_flood_ = 5;
-	if (this->m_fgs_num_iter_spot_ < 1) this->m_fgs_num_iter_spot_ = 1;
-	if (this->m_fgs_num_iter_spot_ > 5) this->m_fgs_num_iter_spot_ = 5;
+	this->update_config([&](Upsampling_Config& config) {
+		config.fgs_lambda_flood = params.fgs_lambda_flood; 
+		config.fgs_sigma_color_flood = params.fgs_sigma_color_flood; 
+		config.fgs_lambda_spot = params.fgs_lambda_spot; 
+		config.fgs_sigma_color_spot = params.fgs_sigma_color_spot; 
+		config.fgs_num_iter_flood = params.fgs_num_iter_flood;
+		config.fgs_num_iter_spot = params.fgs_num_iter_spot;
+		if (config.fgs_lambda_flood < 1) config.fgs_lambda_flood = 1;
+		if (config.fgs_sigma_color_flood < 1) config.fgs_sigma_color_flood = 1;
+		if (config.fgs_num_iter_flood < 1) config.fgs_num_iter_flood = 1;
+		if (config.fgs_num_iter_flood > 5) config.fgs_num_iter_flood = 5;
+		if (config.fgs_num_iter_spot < 1) config.fgs_num_iter_spot = 1;
+		if (config.fgs_num_iter_spot > 5) config.fgs_num_iter_spot = 5;
+		config.tables.reset();
+	});
 };
 
 
@@ -63,12 +435,13 @@ void upsampling::set_upsampling_parameters(const Upsampling_Params& params)
  */
 void upsampling::get_default_upsampling_parameters(Upsampling_Params& params)
 {
-	params.fgs_lambda_flood = this->m_fgs_lambda_flood_;
-	params.fgs_sigma_color_flood = this->m_fgs_sigma_color_flood_;
-	params.fgs_lambda_spot = this->m_fgs_lambda_spot_;
-	params.fgs_sigma_color_spot = this->m_fgs_sigma_color_spot_;
-	params.fgs_num_iter_flood = this->m_fgs_num_iter_flood_;
-	params.fgs_num_iter_spot = this->m_fgs_num_iter_spot_;
+	std::shared_ptr<const Upsampling_Config> config = this->get_config();
+	params.fgs_lambda_flood = config->fgs_lambda_flood;
+	params.fgs_sigma_color_flood = config->fgs_sigma_color_flood;
+	params.fgs_lambda_spot = config->fgs_lambda_spot;
+	params.fgs_sigma_color_spot = config->fgs_sigma_color_spot;
+	params.fgs_num_iter_flood = config->fgs_num_iter_flood;
+	params.fgs_num_iter_spot = config->fgs_num_iter_spot;
 }
 
 
@@ -79,16 +452,18 @@ void upsampling::get_default_upsampling_parameters(Upsampling_Params& params)
  */
 void upsampling::set_preprocessing_parameters(const Preprocessing_Params& params)
 {
-	this->m_range_flood_ = params.range_flood;
-	this->m_z_continuous_thresh_ = params.z_continuous_thresh;
-	this->m_occlusion_thresh_ = params.occlusion_thresh;
-	this->m_depth_diff_thresh_ = params.depth_diff_thresh;
-	this->m_guide_diff_thresh_ = params.guide_diff_thresh;
-	this->m_min_diff_count= params.min_diff_count;
-	if (this->m_z_continuous_thresh_ == 1.0 && this->m_occlusion_thresh_ == 0.0)
-		this->m_depth_edge_proc_on_ = false;
-	else
-		this->m_depth_edge_proc_on_ = true;
+	this->update_config([&](Upsampling_Config& config) {
+		config.range_flood = params.range_flood;
+		config.z_continuous_thresh = params.z_continuous_thresh;
+		config.occlusion_thresh = params.occlusion_thresh;
+		config.depth_diff_thresh = params.depth_diff_thresh;
+		config.guide_diff_thresh = params.guide_diff_thresh;
+		config.min_diff_count= params.min_diff_count;
+		if (config.z_continuous_thresh == 1.0 && config.occlusion_thresh == 0.0)
+			config.depth_edge_proc_on = false;
+		else
+			config.depth_edge_proc_on = true;
+	});
 };
 
 /**
@@ -98,72 +473,287 @@ void upsampling::set_preprocessing_parameters(const Preprocessing_Params& params
  */
 void upsampling::get_default_preprocessing_parameters(Preprocessing_Params& params)
 {
-	params.range_flood = this->m_range_flood_;
-	params.occlusion_thresh = this->m_occlusion_thresh_;
-	params.z_continuous_thresh = this->m_z_continuous_thresh_;
-	params.depth_diff_thresh = this->m_depth_diff_thresh_;
-	params.guide_diff_thresh = this->m_guide_diff_thresh_;
-	params.min_diff_count = this->m_min_diff_count;
+	std::shared_ptr<const Upsampling_Config> config = this->get_config();
+	params.range_flood = config->range_flood;
+	params.occlusion_thresh = config->occlusion_thresh;
+	params.z_continuous_thresh = config->z_continuous_thresh;
+	params.depth_diff_thresh = config->depth_diff_thresh;
+	params.guide_diff_thresh = config->guide_diff_thresh;
+	params.min_diff_count = config->min_diff_count;
 };
 
+/**
+ * @brief set preprocessing on/off
+ * 
+ * @param use : true for preprocessing on
+ */
+void upsampling::use_proprocessing(bool use)
+{
+	this->update_config([&](Upsampling_Config& config) {
+		config.use_preprocessing = use;
+	});
+}
+
+
+/**
+ * @brief mode by inputs
+ * 
+ * @param pc_flood : flood point cloud
+ * @param pc_spot : spot point cloud
+ * @return int : 0: no processing, 1: only flood, 2: only spot, 3: both flood and spot
+ */
+int upsampling::get_mode(const cv::Mat& pc_flood, const cv::Mat& pc_spot) const
+{
+	int mode = 0;
+	if (!pc_flood.empty()) // flood
+		mode |= 1;
+	if (!pc_spot.empty()) // spot
+		mode |= 2;
+	return mode;
+}
 
 /**
- * @brief clear buffers
+ * @brief clear sample lists (capacity is kept)
  * 
+ * @param cfg : parameters of the frame
+ * @param frame : frame buffers
  */
-void upsampling::clear()
+void upsampling::clear(const Upsampling_Config& cfg, Upsampling_Frame& frame) const
 {
-	this->m_flood_dmap_.setTo(0.0);
-	this->m_flood_grid_.setTo(0.0);
-	this->m_flood_mask_.setTo(0.0);
-	this->m_flood_range_.setTo(0.0);
-	this->m_spot_dmap_.setTo(0.0);
-	this->m_spot_mask_.setTo(0.0);
-	this->m_spot_range_.setTo(0.0);
-	this->m_guide_edge_.setTo(1.0);
-	this->m_flood_roi_ = cv::Rect(0, 0, this->m_guide_width_, this->m_guide_height_);
-	this->m_spot_roi_ = cv::Rect(0, 0, this->m_guide_width_, this->m_guide_height_);
+	frame.guide_size = this->get_output_size(cfg);
+	frame.flood_points.clear();
+	frame.spot_points.clear();
+	frame.flood_roi = cv::Rect(cv::Point(0, 0), frame.guide_size);
+	frame.spot_roi = cv::Rect(cv::Point(0, 0), frame.guide_size);
 }
 
 /**
  * @brief initialization 
  * 
+ * @param size : output resolution
  * @param dense : dense depthmap 
  * @param conf : confidence depthmap
  */
-void upsampling::initialization(cv::Mat& dense, cv::Mat& conf)
+void upsampling::initialization(const cv::Size& size, cv::Mat& dense, cv::Mat& conf) const
 {
-	this->clear();
-	if(dense.empty())
-		dense = cv::Mat::zeros(cv::Size(this->m_guide_width_, this->m_guide_height_), CV_32FC1);
-	else
-		dense.setTo(0);
-	
-	if(conf.empty())
-		conf = cv::Mat::zeros(cv::Size(this->m_guide_width_, this->m_guide_height_), CV_32FC1);
-	else
-		conf.setTo(0);
+	// kept if the size matches
+	dense.create(size, CV_32FC1);
+	dense.setTo(0);
+	conf.create(size, CV_32FC1);
+	conf.setTo(0);
+}
+
+/**
+ * @brief right-hand side of the solver from the samples
+ * 
+ * sparse = w * z and mask = w at the samples inside the ROI, 0 elsewhere.
+ * At full resolution a later sample of a pixel replaces the earlier one, at
+ * lower resolution the samples of a pixel are averaged (as INTER_AREA).
+ * 
+ * @param points : samples (guide coordinates)
+ * @param roi : ROI of the solver
+ * @param scale : resolution divider
+ * @param size : solver resolution
+ * @param sparse : output sparse depth (32FC1)
+ * @param mask : output mask (32FC1)
+ */
+inline void splat_points(const std::vector<Sparse_Point>& points, const cv::Rect& roi, int scale, const cv::Size& size, 
+							cv::Mat& sparse, cv::Mat& mask)
+{
+	sparse.create(size, CV_32FC1);
+	mask.create(size, CV_32FC1);
+	sparse.setTo(0.0);
+	mask.setTo(0.0);
+	float area = 1.f / (scale * scale);
+	for (const Sparse_Point& p : points) {
+		if (!roi.contains(cv::Point(p.u, p.v)))
+			continue;
+		int x = (p.u - roi.x) / scale;
+		int y = (p.v - roi.y) / scale;
+		if (x >= size.width || y >= size.height)
+			continue;
+		if (scale == 1) {
+			sparse.at<float>(y, x) = p.w * p.z;
+			mask.at<float>(y, x) = p.w;
+		} else {
+			sparse.at<float>(y, x) += p.w * p.z * area;
+			mask.at<float>(y, x) += p.w * area;
+		}
+	}
+}
+
+/**
+ * @brief post processing of the solver output in one pass
+ * 
+ * dense = depth / weight (or depth), conf = min(weight * conf_scale, 1),
+ * both NaN outside the range, dense NaN where conf < conf_thresh.
+ * Rows run on the OpenCV worker pool, the row kernel is dispatched by CPU
+ * (see upsampling_kernels.h).
+ * 
+ * @param depth : smoothed sparse depth (32FC1, size of dense)
+ * @param weight : smoothed mask (32FC1, size of dense)
+ * @param normalize : divide depth by weight
+ * @param conf_scale : confidence per weight
+ * @param range : valid range (8UC1, size of dense, empty: everywhere)
+ * @param conf_thresh : confidence threshold of dense (0: off)
+ * @param fg : output mask (size of dense, empty mask: none)
+ * @param dense : output dense depth, can be depth
+ * @param conf : output confidence, can be weight
+ */
+inline void post_process(const cv::Mat& depth, const cv::Mat& weight, bool normalize, float conf_scale, 
+							const cv::Mat& range, float conf_thresh, const Foreground_Target& fg, 
+							cv::Mat& dense, cv::Mat& conf)
+{
+	int w = dense.cols;
+	cv::Mat mask = fg.mask;
+	const cv::Mat& vd = fg.virtual_depth;
+	bool write_dense = !fg.mask_only || mask.empty();
+	cv::parallel_for_(cv::Range(0, dense.rows), [&depth, &weight, &range, &fg, &mask, &vd, &dense, &conf, normalize, 
+						conf_scale, conf_thresh, write_dense, w](const cv::Range& rows) -> void {
+		for (int i = rows.start; i < rows.end; ++i)
+			post_process_row(depth.ptr<float>(i), weight.ptr<float>(i), range.empty() ? nullptr : range.ptr<uchar>(i), 
+								dense.ptr<float>(i), conf.ptr<float>(i), w, normalize, conf_scale, conf_thresh, 
+								mask.empty() ? nullptr : mask.ptr<uchar>(i), fg.range, 
+								vd.empty() ? nullptr : vd.ptr<float>(i), fg.occlusion, write_dense);
+	});
+}
+
+/**
+ * @brief mask target of a ROI
+ * 
+ * @param fg : mask target of the frame
+ * @param roi : ROI
+ * @return Foreground_Target : mask and virtual depth of the ROI
+ */
+inline Foreground_Target target_roi(const Foreground_Target& fg, const cv::Rect& roi)
+{
+	Foreground_Target fg_roi = fg;
+	if (!fg.mask.empty())
+		fg_roi.mask = fg.mask(roi);
+	if (!fg.virtual_depth.empty())
+		fg_roi.virtual_depth = fg.virtual_depth(roi);
+	return fg_roi;
 }
 
 /**
  * @brief FGS filter processing
  * 
- * @param sparse: sparse depth 
- * @param mask: mask  
+ * @param cfg: parameters of the frame
+ * @param ctx: context (solver and buffers)
+ * @param guide: guide image
+ * @param points: depth samples 
+ * @param roi: ROI 
+ * @param lambda: FGS lambda
+ * @param weight: colour weight table
+ * @param num_iter: FGS iterations
+ * @param range: valid range (8UC1, guide size, empty: everywhere), NaN outside
+ * @param conf_thresh: confidence threshold of dense (0: off)
+ * @param fg: foreground mask of the output pass (empty mask: none)
+ * @param dense: output dense depth 
+ * @param conf: output confidence 
+ */
+void upsampling::fgs_f(const Upsampling_Config& cfg, upsampling_context& ctx, const cv::Mat& guide, 
+					const std::vector<Sparse_Point>& points, const cv::Rect& roi, const float& lambda, 
+					const std::vector<float>& weight, int num_iter, const cv::Mat& range, float conf_thresh, 
+					Foreground_Target& fg, cv::Mat& dense, cv::Mat& conf) const
+{
+	cv::Mat dense_roi = dense(roi);
+	cv::Mat conf_roi = conf(roi);
+	cv::Mat range_roi = range.empty() ? cv::Mat() : range(roi);
+	Foreground_Target fg_roi = target_roi(fg, roi);
+	cv::Mat& matSparse = ctx.m_sparse_;
+	cv::Mat& matMask = ctx.m_mask_;
+	int scale = cfg.fgs_downscale;
+	if (scale > 1) { // solve at lower resolution, sparse and mask are averaged (their ratio is kept)
+		cv::Size size_small(std::max(1, roi.width / scale), std::max(1, roi.height / scale));
+		cv::resize(guide(roi), ctx.m_guide_, size_small, 0, 0, cv::INTER_AREA);
+		splat_points(points, roi, scale, size_small, matSparse, matMask);
+		ctx.m_solver_.set_guide(ctx.m_guide_, weight);
+		ctx.m_solver_.filter(matSparse, matMask, lambda / (scale * scale), cfg.fgs_lambda_attenuation, num_iter);
+		cv::divide(matSparse, matMask, matSparse);
+		cv::resize(matSparse, dense_roi, roi.size(), 0, 0, cv::INTER_LINEAR);
+		cv::resize(matMask, conf_roi, roi.size(), 0, 0, cv::INTER_LINEAR);
+		post_process(dense_roi, conf_roi, false, lambda * 10, range_roi, conf_thresh, fg_roi, dense_roi, conf_roi);
+		return;
+	}
+	ctx.m_solver_.set_guide(guide(roi), weight);
+	splat_points(points, roi, 1, roi.size(), matSparse, matMask);
+	ctx.m_solver_.filter(matSparse, matMask, lambda, cfg.fgs_lambda_attenuation, num_iter);
+	post_process(matSparse, matMask, true, lambda * 10, range_roi, conf_thresh, fg_roi, dense_roi, conf_roi);
+}
+
+/**
+ * @brief PCG processing warm started from the last frame
+ * 
+ * Solves (M + lambda * L) u = M * z on the FGS guide weights from the solution
+ * of the last frame. The confidence solves (I + lambda * L) c = M on the same
+ * weights from the confidence of the last frame, the system FGS approximates
+ * for the mask in fgs_f(). Without an estimate of the ROI (first frame, ROI
+ * grown beyond the solved region) the frame is solved by FGS, which becomes
+ * the initial estimate of the next frame. The estimates are kept at the output
+ * size, so a smaller ROI (e.g. a partial recompute) starts from its region.
+ * 
+ * @param cfg: parameters of the frame
+ * @param ctx: context (solvers and buffers)
+ * @param guide: guide image
+ * @param points: depth samples 
  * @param roi: ROI 
+ * @param lambda: lambda
+ * @param weight: colour weight table
+ * @param num_iter: FGS iterations (first frame)
+ * @param range: valid range (8UC1, guide size, empty: everywhere), NaN outside
+ * @param conf_thresh: confidence threshold of dense (0: off)
+ * @param fg: foreground mask of the output pass (empty mask: none)
+ * @param warm: estimates of the last frames, updated
  * @param dense: output dense depth 
  * @param conf: output confidence 
  */
-void upsampling::fgs_f(const cv::Mat & sparse, const cv::Mat& mask, const cv::Rect& roi, const float& lambda,
-					cv::Mat& dense, cv::Mat& conf)
+void upsampling::pcg_f(const Upsampling_Config& cfg, upsampling_context& ctx, const cv::Mat& guide, 
+					const std::vector<Sparse_Point>& points, const cv::Rect& roi, const float& lambda, 
+					const std::vector<float>& weight, int num_iter, const cv::Mat& range, float conf_thresh, 
+					Foreground_Target& fg, Warm_Start& warm, cv::Mat& dense, cv::Mat& conf) const
 {
-	cv::Mat matSparse, matMask;
-	cv::Mat sparse_roi, mask_roi;
-	this->m_fgs_filter_->filter(sparse(roi), matSparse);
-	this->m_fgs_filter_->filter(mask(roi), matMask);
-	dense(roi) = matSparse / matMask;
-	conf(roi) = matMask * lambda * 10;
-	conf.setTo(1.0, conf > 1.0);
+	cv::Mat dense_roi = dense(roi);
+	cv::Mat conf_roi = conf(roi);
+	cv::Mat range_roi = range.empty() ? cv::Mat() : range(roi);
+	Foreground_Target fg_roi = target_roi(fg, roi);
+	if (cfg.fgs_downscale > 1) { // solved at lower resolution, not a good estimate
+		this->fgs_f(cfg, ctx, guide, points, roi, lambda, weight, num_iter, range, conf_thresh, fg, dense, conf);
+		ctx.m_pcg_iter_ = 0;
+		warm.roi = cv::Rect();
+		return;
+	}
+	cv::Mat& matSparse = ctx.m_sparse_;
+	cv::Mat& matMask = ctx.m_mask_;
+	if (warm.depth.size() != dense.size() || (warm.roi & roi) != roi) { // no estimate, the FGS result is the next one
+		Foreground_Target no_fg;
+		this->fgs_f(cfg, ctx, guide, points, roi, lambda, weight, num_iter, cv::Mat(), 0.f, no_fg, dense, conf);
+		ctx.m_pcg_iter_ = 0;
+		warm.depth.create(dense.size(), CV_32FC1);
+		warm.conf.create(dense.size(), CV_32FC1);
+		dense_roi.copyTo(warm.depth(roi));
+		cv::patchNaNs(warm.depth, 0.0);
+		matMask.copyTo(warm.conf(roi)); // smoothed mask of fgs_f()
+		warm.roi = roi;
+		if (!range.empty() || conf_thresh > 0.f || !fg.mask.empty())
+			post_process(dense_roi, conf_roi, false, 1.f, range_roi, conf_thresh, fg_roi, dense_roi, conf_roi);
+		return;
+	}
+	cv::Mat& ones = ctx.m_pcg_ones_;
+	if (ones.size() != roi.size()) {
+		ones.create(roi.size(), CV_32FC1);
+		ones.setTo(1.f);
+	}
+	cv::Mat warm_depth = warm.depth(roi);
+	cv::Mat warm_conf = warm.conf(roi);
+	ctx.m_solver_.set_guide(guide(roi), weight);
+	splat_points(points, roi, 1, roi.size(), matSparse, matMask);
+	const cv::Mat& chor = ctx.m_solver_.get_horizontal_weights();
+	const cv::Mat& cvert = ctx.m_solver_.get_vertical_weights();
+	// confidence first, the solver stats are of the depth solve
+	ctx.m_pcg_.solve(chor, cvert, matMask, ones, lambda, cfg.pcg_tolerance, cfg.pcg_max_iter, warm_conf);
+	ctx.m_pcg_iter_ = ctx.m_pcg_.solve(chor, cvert, matSparse, matMask, lambda, cfg.pcg_tolerance, cfg.pcg_max_iter, warm_depth);
+	post_process(warm_depth, warm_conf, false, lambda * 10, range_roi, conf_thresh, fg_roi, dense_roi, conf_roi);
 }
 
 
@@ -191,11 +781,13 @@ inline void mark_block(cv::Mat& img, int u, int v, int r)
 /**
  * @brief depth preproocessing without edge processing
  * 
+ * @param cfg : parameters of the frame
  * @param pc_flood 
+ * @param frame : output frame buffers
  */
-void upsampling::flood_depth_proc_without_edge(const cv::Mat& pc_flood)
+void upsampling::flood_depth_proc_without_edge(const Upsampling_Config& cfg, const cv::Mat& pc_flood, Upsampling_Frame& frame) const
 {
-	this->pc2flood_dmap(pc_flood);
+	this->pc2flood_points(cfg, pc_flood, frame);
 }
 
 /**
@@ -228,152 +820,191 @@ inline float get_rect_avg_val(const cv::Mat & img, int cx, int cy, int r)
 /**
  * @brief filtering parallax devation error points
  * 
+ * @param cfg : parameters of the frame
  * @param pc_in : point cloud input
  * @param pc_out : point cloud output
  */
-void upsampling::filter_parallax_devation_points(const cv::Mat& pc_in, cv::Mat& pc_out)
+void upsampling::filter_parallax_devation_points(const Upsampling_Config& cfg, const cv::Mat& pc_in, cv::Mat& pc_out) const
 {
-	int width = this->m_guide_width_;
-	int height = this->m_guide_height_;
-	cv::Mat flood_dmap = this->m_flood_dmap_; // final output
-	cv::Mat flood_mask = this->m_flood_mask_; // final output
-	cv::Mat flood_range = this->m_flood_range_; // final output
-	int range = this->m_range_flood_;
 	float inval = 100.0f;
 	// copy one for check error
-	pc_out = cv::Mat::ones(pc_in.size(), CV_32FC3) * inval;
+	pc_out.create(pc_in.size(), CV_32FC3);
+	pc_out.setTo(cv::Scalar::all(inval));
 	/* cv::Mat flood_edge_dmap = this->m_flood_edge_dmap_; // for mark edge points */
-	
+	for (int y = 0; y < pc_in.rows; ++y)
+		this->filter_parallax_row(cfg, pc_in, y, pc_out);
+}
+
+/**
+ * @brief filtering parallax devation error points of one grid row (kernel)
+ * 
+ * @tparam GW : grid width (0: pc_in.cols)
+ * @param cfg : parameters of the frame
+ * @param guide_width : guide width
+ * @param guide_height : guide height
+ * @param pc_in : point cloud input
+ * @param y : grid row
+ * @param pc_out : point cloud output (removed points are not written)
+ */
+template <int GW>
+inline void filter_parallax_row_t(const Upsampling_Config& cfg, int guide_width, int guide_height, 
+									const cv::Mat& pc_in, int y, cv::Mat& pc_out)
+{
+	const int grid_width = GW > 0 ? GW : pc_in.cols;
+	const cv::Vec3f* in = pc_in.ptr<cv::Vec3f>(y);
+	cv::Vec3f* out = pc_out.ptr<cv::Vec3f>(y);
 	// declaration
 	float z, uf, vf;
 	float z_left, u_left; // save left u, z
 	float z_diff, u_diff, z_diff_per; // difference 
 	int u, v;
-	for (int y = 0; y < this->m_grid_height_; ++y) {
-		z_left = static_cast<float>(std::nan(""));
-		u_left = -1;
-		for (int x = 0; x < this->m_grid_width_; ++x) {
-			z = pc_in.at<cv::Vec3f>(y, x)[2];
-			if (isnan(z)) { //remove 
-				continue;
-			}
-			uf = pc_in.at<cv::Vec3f>(y, x)[0] * this->m_fx_ / z + this->m_cx_;
-			vf = pc_in.at<cv::Vec3f>(y, x)[1] * this->m_fy_ / z + this->m_cy_;
-			u = static_cast<int>(std::round(uf));
-			v = static_cast<int>(std::round(vf));
-			if (u >= 0 && u < width && v >= 0 && v < height) { 
-				if (isnan(z_left)) { // new left
-					z_left = z;
-					u_left = uf;
+	z_left = static_cast<float>(std::nan(""));
+	u_left = -1;
+	for (int x = 0; x < grid_width; ++x) {
+		z = in[x][2];
+		if (isnan(z)) { //remove 
+			continue;
+		}
+		uf = in[x][0] * cfg.fx / z + cfg.cx;
+		vf = in[x][1] * cfg.fy / z + cfg.cy;
+		u = static_cast<int>(std::round(uf));
+		v = static_cast<int>(std::round(vf));
+		if (u >= 0 && u < guide_width && v >= 0 && v < guide_height) { 
+			if (isnan(z_left)) { // new left
+				z_left = z;
+				u_left = uf;
+			} else {
+				z_diff = abs(z - z_left);
+				z_diff_per = z_diff / z;
+				u_diff = uf - u_left;
+				if (u_diff < cfg.occlusion_thresh && z_diff_per > cfg.z_continuous_thresh) {
+					//remove
+					continue;
 				} else {
-					z_diff = abs(z - z_left);
-					z_diff_per = z_diff / z;
-					u_diff = uf - u_left;
-					if (u_diff < this->m_occlusion_thresh_ && z_diff_per > this->m_z_continuous_thresh_) {
-						//remove
-						continue;
-					} else {
-						if (u_left < uf) {
-							u_left = uf;
-							z_left = z;
-						}
+					if (u_left < uf) {
+						u_left = uf;
+						z_left = z;
 					}
 				}
-				//* insert for output
-				pc_out.at<cv::Vec3f>(y, x) = pc_in.at<cv::Vec3f>(y, x);
 			}
+			//* insert for output
+			out[x] = in[x];
 		}
 	}
 }
 
 /**
- * @brief convert flood point cloud to depthmap 
+ * @brief filtering parallax devation error points of one grid row
+ * 
+ * Points are kept from left to right, a row does not depend on other rows.
+ * 
+ * @param cfg : parameters of the frame
+ * @param pc_in : point cloud input
+ * @param y : grid row
+ * @param pc_out : point cloud output (removed points are not written)
+ */
+void upsampling::filter_parallax_row(const Upsampling_Config& cfg, const cv::Mat& pc_in, int y, cv::Mat& pc_out) const
+{
+	if (pc_in.cols == UPSAMPLING_GRID_WIDTH)
+		filter_parallax_row_t<UPSAMPLING_GRID_WIDTH>(cfg, this->m_guide_width_, this->m_guide_height_, pc_in, y, pc_out);
+	else
+		filter_parallax_row_t<0>(cfg, this->m_guide_width_, this->m_guide_height_, pc_in, y, pc_out);
+}
+
+/**
+ * @brief convert flood point cloud to samples 
  * 
+ * @param cfg : parameters of the frame
  * @param pc : point cloud input
+ * @param frame : output frame buffers
  */
-void upsampling::pc2flood_dmap(const cv::Mat& pc)
+void upsampling::pc2flood_points(const Upsampling_Config& cfg, const cv::Mat& pc, Upsampling_Frame& frame) const
 {
-	float cx = this->m_cx_;
-	float cy = this->m_cy_;
-	float fx = this->m_fx_;
-	float fy = this->m_fy_;
-	cv::Mat dmap = this->m_flood_dmap_;
-	cv::Mat mask = this->m_flood_mask_;
-	cv::Mat range =  this->m_flood_range_;	
+	float cx, cy, fx, fy;
+	get_output_intrinsics(cfg, fx, fy, cx, cy); // samples on the output grid
+	std::vector<Sparse_Point>& points = frame.flood_points;
+	points.reserve(pc.total());
 	float inval = 100.0f;
+	float width = static_cast<float>(frame.guide_size.width);
+	float height = static_cast<float>(frame.guide_size.height);
+	frame.proj_u.resize(pc.cols);
+	frame.proj_v.resize(pc.cols);
+	frame.flood_grid.create(pc.size(), CV_32FC3);
 	for (int j = 0; j < pc.rows; ++j) {
+		const float* xyz = pc.ptr<float>(j);
+		cv::Vec3f* grid = frame.flood_grid.ptr<cv::Vec3f>(j);
+		project_row(xyz, pc.cols, fx, fy, cx, cy, frame.proj_u.data(), frame.proj_v.data());
 		for (int i = 0; i < pc.cols; ++i) {
-			cv::Vec3f vals = pc.at<cv::Vec3f>(j, i);
-			float x = vals[0];
-			float y =  vals[1];
-			float z = vals[2];
+			float z = xyz[i * 3 + 2];
+			float u = frame.proj_u[i];
+			float v = frame.proj_v[i];
+			grid[i] = cv::Vec3f(u, v, 0.f);
 			if (z == inval) continue;
-			int u = static_cast<int>(round(x * fx / z + cx));
-			int v = static_cast<int>(round(y * fy / z + cy));
-			if (u >= 0 && u < this->m_guide_width_ && v >=0 && v < this->m_guide_height_) {
-				dmap.at<float>(v, u) = z;
-				mask.at<float>(v, u) = 1.0;
-				mark_block(range, u, v, this->m_range_flood_);
+			if (u >= 0.f && u < width && v >= 0.f && v < height) {
+				points.push_back({static_cast<int>(u), static_cast<int>(v), z, 1.0f});
+				grid[i][2] = z;
 			}
 		}
 	}
 }
 
 /**
- * @brief error edge points detection based on the guide image 
+ * @brief error edge points detection kernel
  * 
- * @param guide : guide image
- * @param z_map : flood z map (80 x 60)
- * @param edge_mask : input mask for edge points
- * @param err_mask1 : input mask for error points last iteration
- * @param err_mask2 : output mask for error points this iteration
- * @param num_neigbors : number of neigbors are taken as reference points. 8 or 24 now
- * @param region_size : region size of guide is applied for average value calculation
- * @param depth_thresh : threshold of depth to justify different or not
- * @param guide_thresh : threshold of guide to justify different or not
- * @param min_diff_count : minimum different count for not an error
+ * Neighbours outside the grid are not referenced.
+ * 
+ * @tparam DELTA : neighbour radius (1: 8 neighbours, 2: 24 neighbours)
+ * @tparam GW : grid width (0: z_map.cols)
+ * @tparam GH : grid height (0: z_map.rows)
  */
-inline void error_points_detection(const cv::Mat& guide, const cv::Mat& z_map, const cv::Mat& edge_mask,
-									cv::Mat& err_mask1, cv::Mat& err_mask2, int num_neigbors, int region_size = 1,
-									float depth_thresh = 0.1f, float guide_thresh = 40.0f, int min_diff_count = -1)
+template <int DELTA, int GW, int GH>
+inline void error_points_detection_t(const cv::Mat& guide, const cv::Mat& z_map, const cv::Mat& edge_mask,
+										const cv::Mat& err_mask1, cv::Mat& err_mask2, int region_size,
+										float depth_thresh, float guide_thresh, int min_diff_count, 
+										const cv::Mat& update_mask)
 {
-	int delta;
 	const float inval = 100.0f;
-	if (num_neigbors == 8) { // stage 1: absolute error
-		delta = 1;
-	} else { // stage 2: relative error
-		delta = 2;
-	}
-	float z, z_ref, val, val_ref;
-	int u, v, u_ref, v_ref;
-	bool is_depth_diff, is_guide_diff;
-	for (int r = 1; r < z_map.rows-1; ++r) {
-        for (int c = 1; c < z_map.cols-1; ++c) {
-			if (edge_mask.at<uchar>(r, c) == 0) { //* not edge
+	const int width = GW > 0 ? GW : z_map.cols;
+	const int height = GH > 0 ? GH : z_map.rows;
+	const cv::Vec3f* z_rows[2 * DELTA + 1];
+	const uchar* err_rows[2 * DELTA + 1];
+	for (int r = 1; r < height-1; ++r) {
+		for (int j = -DELTA; j <= DELTA; ++j) {
+			bool inside = r + j >= 0 && r + j < height;
+			z_rows[j + DELTA] = inside ? z_map.ptr<cv::Vec3f>(r + j) : nullptr;
+			err_rows[j + DELTA] = inside ? err_mask1.ptr<uchar>(r + j) : nullptr;
+		}
+		const uchar* update = update_mask.empty() ? nullptr : update_mask.ptr<uchar>(r);
+		const uchar* edge = edge_mask.ptr<uchar>(r);
+		uchar* err2 = err_mask2.ptr<uchar>(r);
+		for (int c = 1; c < width-1; ++c) {
+			if (update != nullptr && update[c] == 0) //* not changed
 				continue;
-			}
-			if (err_mask1.at<uchar>(r, c) == 1) { //* already masked as errors
-				err_mask2.at<uchar>(r, c) = 1;
+			err2[c] = 0;
+			if (edge[c] == 0) //* not edge
+				continue;
+			if (err_rows[DELTA][c] == 1) { //* already masked as errors
+				err2[c] = 1;
 				continue;
 			}
 			// * comparation of guide and depth 
-			cv::Vec3f pnt = z_map.at<cv::Vec3f>(r, c);
-			u = static_cast<int>(pnt[0]);
-			v = static_cast<int>(pnt[1]);
-			z = pnt[2];
-			val = get_rect_avg_val(guide, u, v, region_size);
+			const cv::Vec3f& pnt = z_rows[DELTA][c];
+			int u = static_cast<int>(pnt[0]);
+			int v = static_cast<int>(pnt[1]);
+			float z = pnt[2];
+			float val = get_rect_avg_val(guide, u, v, region_size);
 			int count_diff = 0;
-			for (int j = -delta; j <= delta; ++j) { //* match local feature
-				for (int i = -delta; i <= delta; ++i) {
-					if (i == 0 && j == 0) // ref = org
+			for (int j = -DELTA; j <= DELTA; ++j) { //* match local feature
+				if (z_rows[j + DELTA] == nullptr)
+					continue;
+				for (int i = -DELTA; i <= DELTA; ++i) {
+					if ((i == 0 && j == 0) || c + i < 0 || c + i >= width) // ref = org, outside
 						continue;
-					if (err_mask1.at<uchar>(r+j, c+i) == 1) { // ref is err
+					if (err_rows[j + DELTA][c + i] == 1) // ref is err
 						continue;
-					}
-					is_depth_diff = false;
-					is_guide_diff = false;	
-					cv::Vec3f pnt_ref = z_map.at<cv::Vec3f>(r+j, c+i);
-					z_ref = pnt_ref[2];
+					const cv::Vec3f& pnt_ref = z_rows[j + DELTA][c + i];
+					float z_ref = pnt_ref[2];
+					int u_ref, v_ref;
 					if (z_ref == inval) {
 						u_ref = u + 12*i;
 						v_ref = v + 12*j;
@@ -381,87 +1012,161 @@ inline void error_points_detection(const cv::Mat& guide, const cv::Mat& z_map, c
 						u_ref = static_cast<int>(pnt_ref[0]);
 						v_ref = static_cast<int>(pnt_ref[1]);
 					}
-					val_ref = get_rect_avg_val(guide, u_ref, v_ref, region_size);
-					if (z_ref == inval || fabs(z_ref - z) > depth_thresh) {
-						is_depth_diff = true;	
-					}
-					if (fabs(val_ref -val) > guide_thresh)	{
-						is_guide_diff = true;
-					}
-					if (is_guide_diff^is_depth_diff) { //* different
-						count_diff += 1;
-					} else {
-						count_diff -= 1 ;
-					}
+					float val_ref = get_rect_avg_val(guide, u_ref, v_ref, region_size);
+					bool is_depth_diff = z_ref == inval || fabs(z_ref - z) > depth_thresh;
+					bool is_guide_diff = fabs(val_ref - val) > guide_thresh;
+					count_diff += (is_guide_diff ^ is_depth_diff) ? 1 : -1; //* different
 				}
 			}
-			if (count_diff > min_diff_count) { // error
-				err_mask2.at<uchar>(r, c) = 1;
-			}
+			if (count_diff > min_diff_count) // error
+				err2[c] = 1;
 		}
 	}
 }
 
 /**
- * @brief extract depth edge
+ * @brief error edge points detection based on the guide image 
+ * 
+ * @param guide : guide image
+ * @param z_map : flood z map (80 x 60)
+ * @param edge_mask : input mask for edge points
+ * @param err_mask1 : input mask for error points last iteration
+ * @param err_mask2 : output mask for error points this iteration
+ * @param num_neigbors : number of neigbors are taken as reference points. 8 or 24 now
+ * @param region_size : region size of guide is applied for average value calculation
+ * @param depth_thresh : threshold of depth to justify different or not
+ * @param guide_thresh : threshold of guide to justify different or not
+ * @param min_diff_count : minimum different count for not an error
+ * @param update_mask : points to be detected (empty: all), others keep err_mask2
+ */
+inline void error_points_detection(const cv::Mat& guide, const cv::Mat& z_map, const cv::Mat& edge_mask,
+									cv::Mat& err_mask1, cv::Mat& err_mask2, int num_neigbors, int region_size = 1,
+									float depth_thresh = 0.1f, float guide_thresh = 40.0f, int min_diff_count = -1,
+									const cv::Mat& update_mask = cv::Mat())
+{
+	bool grid = z_map.cols == UPSAMPLING_GRID_WIDTH && z_map.rows == UPSAMPLING_GRID_HEIGHT;
+	if (num_neigbors == 8) { // stage 1: absolute error
+		if (grid)
+			error_points_detection_t<1, UPSAMPLING_GRID_WIDTH, UPSAMPLING_GRID_HEIGHT>(guide, z_map, edge_mask, err_mask1, 
+								err_mask2, region_size, depth_thresh, guide_thresh, min_diff_count, update_mask);
+		else
+			error_points_detection_t<1, 0, 0>(guide, z_map, edge_mask, err_mask1, 
+								err_mask2, region_size, depth_thresh, guide_thresh, min_diff_count, update_mask);
+	} else { // stage 2: relative error
+		if (grid)
+			error_points_detection_t<2, UPSAMPLING_GRID_WIDTH, UPSAMPLING_GRID_HEIGHT>(guide, z_map, edge_mask, err_mask1, 
+								err_mask2, region_size, depth_thresh, guide_thresh, min_diff_count, update_mask);
+		else
+			error_points_detection_t<2, 0, 0>(guide, z_map, edge_mask, err_mask1, 
+								err_mask2, region_size, depth_thresh, guide_thresh, min_diff_count, update_mask);
+	}
+}
+
+/**
+ * @brief (u, v, z) of a point for the z map
+ * 
+ * @param p : point
+ * @param fx : focal length x
+ * @param fy : focal length y
+ * @param cx : principal point x
+ * @param cy : principal point y
+ * @param guide_width : guide width
+ * @param guide_height : guide height
+ * @param inval : invalid value
+ * @return cv::Vec3f : (u, v, z), inval for points outside the guide
+ */
+inline cv::Vec3f project_to_z_map(const cv::Vec3f& p, float fx, float fy, float cx, float cy, 
+									int guide_width, int guide_height, float inval)
+{
+	float u = std::round((p[0] * fx) / p[2] + cx);
+	float v = std::round((p[1] * fy) / p[2] + cy);
+	if (u >= 0 && u < guide_width && v >= 0 && v < guide_height) // not use points outside image
+		return cv::Vec3f(u, v, p[2]);
+	return cv::Vec3f(inval, inval, inval);
+}
+
+/**
+ * @brief extract depth edge kernel
  * 
+ * @tparam GW : grid width (0: z_map.cols)
+ * @tparam GH : grid height (0: z_map.rows)
  * @param z_map : input z map
+ * @param depth_thresh : threshold of depth difference
  * @param edge_mask : output edge point mask
+ * @param update_mask : points to be extracted (empty: all), others keep edge_mask
  */
-void upsampling::extract_depth_edge(const cv::Mat& z_map, cv::Mat& edge_mask)
+template <int GW, int GH>
+inline void extract_depth_edge_t(const cv::Mat& z_map, float depth_thresh, cv::Mat& edge_mask, const cv::Mat& update_mask)
 {
-	float inval = 100.0;
-	float depth_thresh = this->m_depth_diff_thresh_;
-	int num_diff_for_edge = 0;
-	if (edge_mask.empty()) 
-		edge_mask = cv::Mat::zeros(z_map.size(), CV_8UC1);
-	for (int r = 1; r < z_map.rows-1; ++r) {
-		for (int c = 1; c < z_map.cols-1; ++c) {
-			if (z_map.at<cv::Vec3f>(r, c)[2] == inval)
+	const float inval = 100.0f;
+	const int num_diff_for_edge = 0;
+	const int width = GW > 0 ? GW : z_map.cols;
+	const int height = GH > 0 ? GH : z_map.rows;
+	for (int r = 1; r < height-1; ++r) {
+		const cv::Vec3f* z_up = z_map.ptr<cv::Vec3f>(r-1);
+		const cv::Vec3f* z_cur = z_map.ptr<cv::Vec3f>(r);
+		const cv::Vec3f* z_down = z_map.ptr<cv::Vec3f>(r+1);
+		const uchar* update = update_mask.empty() ? nullptr : update_mask.ptr<uchar>(r);
+		uchar* edge = edge_mask.ptr<uchar>(r);
+		for (int c = 1; c < width-1; ++c) {
+			if (update != nullptr && update[c] == 0)
+				continue;
+			edge[c] = 0;
+			if (z_cur[c][2] == inval)
 				continue;
-			float fGrad = 0.0f;
 			int count = 0;
-			fGrad = fabs(z_map.at<cv::Vec3f>(r, c-1)[2] - z_map.at<cv::Vec3f>(r, c+1)[2]);
-			if (fGrad > depth_thresh)
-				count += 1;
-			fGrad = fabs(z_map.at<cv::Vec3f>(r-1, c)[2] - z_map.at<cv::Vec3f>(r+1, c)[2]);
-			if (fGrad > depth_thresh)
-				count += 1;
-			fGrad = fabs(z_map.at<cv::Vec3f>(r-1, c-1)[2] - z_map.at<cv::Vec3f>(r+1, c+1)[2]);
-			if (fGrad > depth_thresh) 
-				count += 1;
-			fGrad = fabs(z_map.at<cv::Vec3f>(r-1, c+1)[2] - z_map.at<cv::Vec3f>(r+1, c-1)[2]);
-			if (fGrad > depth_thresh) 
-				count += 1;
-			if (count > num_diff_for_edge) { // * edge point
-				edge_mask.at<uchar>(r, c) = 1;
-			}
+			count += fabs(z_cur[c-1][2] - z_cur[c+1][2]) > depth_thresh ? 1 : 0;
+			count += fabs(z_up[c][2] - z_down[c][2]) > depth_thresh ? 1 : 0;
+			count += fabs(z_up[c-1][2] - z_down[c+1][2]) > depth_thresh ? 1 : 0;
+			count += fabs(z_up[c+1][2] - z_down[c-1][2]) > depth_thresh ? 1 : 0;
+			if (count > num_diff_for_edge) // * edge point
+				edge[c] = 1;
 		}
 	}
 }
 
+/**
+ * @brief extract depth edge
+ * 
+ * @param cfg : parameters of the frame
+ * @param z_map : input z map
+ * @param edge_mask : output edge point mask
+ * @param update_mask : points to be extracted (empty: all), others keep edge_mask
+ */
+void upsampling::extract_depth_edge(const Upsampling_Config& cfg, const cv::Mat& z_map, cv::Mat& edge_mask, 
+									const cv::Mat& update_mask) const
+{
+	if (edge_mask.empty()) 
+		edge_mask = cv::Mat::zeros(z_map.size(), CV_8UC1);
+	if (z_map.cols == UPSAMPLING_GRID_WIDTH && z_map.rows == UPSAMPLING_GRID_HEIGHT)
+		extract_depth_edge_t<UPSAMPLING_GRID_WIDTH, UPSAMPLING_GRID_HEIGHT>(z_map, cfg.depth_diff_thresh, edge_mask, update_mask);
+	else
+		extract_depth_edge_t<0, 0>(z_map, cfg.depth_diff_thresh, edge_mask, update_mask);
+}
+
 /**
  * @brief filter error edge points
  * 
+ * @param cfg : parameters of the frame
  * @param img_guide : guide image
  * @param pc_in : input point cloud
  * @param pc_out : output point cloud
  */
-void upsampling::filter_error_edge_points(const cv::Mat& img_guide, const cv::Mat& pc_in, cv::Mat& pc_out)
+void upsampling::filter_error_edge_points(const Upsampling_Config& cfg, const cv::Mat& img_guide, const cv::Mat& pc_in, cv::Mat& pc_out) const
 {
 #define USE_REG_AVG 1
 #ifdef USE_REG_AVG
 	int region_size = 1;
 #endif
-	float depth_thresh = this->m_depth_diff_thresh_;
-	float guide_thresh = this->m_guide_diff_thresh_;
+	float depth_thresh = cfg.depth_diff_thresh;
+	float guide_thresh = cfg.guide_diff_thresh;
 	float inval = 100.0f;
 	int num_diff_for_edge = 0;
-	int min_diff_num = this->m_min_diff_count;
-	float fx = this->m_fx_;
-	float fy = this->m_fy_;
-	float cx = this->m_cx_;
-	float cy = this->m_cy_;
+	int min_diff_num = cfg.min_diff_count;
+	float fx = cfg.fx;
+	float fy = cfg.fy;
+	float cx = cfg.cx;
+	float cy = cfg.cy;
 	int guide_width = this->m_guide_width_;
 	int guide_height = this->m_guide_height_;
 	pc_in.copyTo(pc_out);
@@ -472,19 +1177,11 @@ void upsampling::filter_error_edge_points(const cv::Mat& img_guide, const cv::Ma
 	cv::Mat err_mask2 = cv::Mat::zeros(pc_in.size(), CV_8UC1); // * error mask of stage 2
 	cv::Mat err_mask3 = cv::Mat::zeros(pc_in.size(), CV_8UC1); // * error mask of stage 2
 	//* create z map
-	pc_in.forEach<cv::Vec3f>([&z_map, fx, fy, cx, cy, guide_width, guide_height](cv::Vec3f& pixel, const int pos[]) -> void {
-        int c = pos[1];
-        int r = pos[0];
-		float x = pixel[0];
-		float y = pixel[1];
-        float z = pixel[2];
-		float u = std::round((x * fx)/z + cx);
-		float v = std::round((y * fy)/z + cy);
-		if (u >= 0 && u < guide_width && v >= 0 && v < guide_height) // not use points outside image
-			z_map.at<cv::Vec3f>(r, c) = cv::Vec3f(u, v, z);
+	pc_in.forEach<cv::Vec3f>([&z_map, fx, fy, cx, cy, guide_width, guide_height, inval](cv::Vec3f& pixel, const int pos[]) -> void {
+		z_map.at<cv::Vec3f>(pos[0], pos[1]) = project_to_z_map(pixel, fx, fy, cx, cy, guide_width, guide_height, inval);
     });
 	//* stage 0: edge detection 
-	this->extract_depth_edge(z_map, edge_mask);
+	this->extract_depth_edge(cfg, z_map, edge_mask);
 
 	// * stage 1: absolute error detection
 	error_points_detection(img_guide, z_map, edge_mask, err_mask0, err_mask1, 8, 1, 
@@ -503,214 +1200,697 @@ void upsampling::filter_error_edge_points(const cv::Mat& img_guide, const cv::Ma
 	});
 }
 
+/**
+ * @brief true if a flood point changed beyond the tolerance (validity or position)
+ * 
+ * @param a : point of the cache
+ * @param b : new point
+ * @param tolerance : position tolerance
+ * @return true : changed
+ */
+inline bool flood_point_changed(const cv::Vec3f& a, const cv::Vec3f& b, float tolerance)
+{
+	bool valid_a = !isnan(a[2]);
+	bool valid_b = !isnan(b[2]);
+	if (valid_a != valid_b)
+		return true;
+	if (!valid_a)
+		return false;
+	return fabs(a[0] - b[0]) > tolerance || fabs(a[1] - b[1]) > tolerance || fabs(a[2] - b[2]) > tolerance;
+}
+
+/**
+ * @brief incremental parallax and edge error filtering with the cache of the frame buffers
+ * 
+ * Grid rows with a changed point are filtered for parallax again (a row
+ * depends on its points from the left). Points whose projection or guide
+ * patch changed mark the points to be recomputed: depth edges within 1 point,
+ * stage 1 errors within 1 point, stage 2 errors within 2 points of them or of
+ * changed stage 1 errors, and points with a changed edge flag. Guide changes
+ * at the extrapolated positions of invalid neighbours are not tracked.
+ * Without a cache (or after a parameter change) all points are computed.
+ * 
+ * @param cfg : parameters of the frame
+ * @param img_guide : guide image
+ * @param pc_flood : flood point cloud (grid size)
+ * @param frame : frame buffers with the cache
+ * @param pc_out : output point cloud, error points are NaN
+ */
+void upsampling::update_flood_cache(const Upsampling_Config& cfg, const cv::Mat& img_guide, const cv::Mat& pc_flood, 
+									Upsampling_Frame& frame, cv::Mat& pc_out) const
+{
+	Flood_Cache& cache = frame.flood_cache;
+	float inval = 100.0f;
+	int rows = pc_flood.rows;
+	int cols = pc_flood.cols;
+	bool full = !cache.config || cache.config != frame.config || cache.pc_in.size() != pc_flood.size();
+	if (full) {
+		cache.pc_in.create(pc_flood.size(), CV_32FC3);
+		cache.pc_parallax.create(pc_flood.size(), CV_32FC3);
+		cache.z_map.create(pc_flood.size(), CV_32FC3);
+		cache.guide_val.create(pc_flood.size(), CV_32FC1);
+		cache.edge_mask = cv::Mat::zeros(pc_flood.size(), CV_8UC1);
+		cache.err_mask0 = cv::Mat::zeros(pc_flood.size(), CV_8UC1);
+		cache.err_mask1 = cv::Mat::zeros(pc_flood.size(), CV_8UC1);
+		cache.err_mask2 = cv::Mat::zeros(pc_flood.size(), CV_8UC1);
+		cache.config = frame.config;
+	}
+	cache.changed.create(pc_flood.size(), CV_8UC1);
+	cache.changed.setTo(0);
+	// parallax filtering and projection of changed rows
+	for (int r = 0; r < rows; ++r) {
+		bool row_changed = full;
+		for (int c = 0; c < cols && !row_changed; ++c)
+			row_changed = flood_point_changed(cache.pc_in.at<cv::Vec3f>(r, c), pc_flood.at<cv::Vec3f>(r, c), 
+												cfg.incremental_depth_tolerance);
+		if (!row_changed) // keeps the points of the cache
+			continue;
+		pc_flood.row(r).copyTo(cache.pc_in.row(r));
+		cache.pc_parallax.row(r).setTo(cv::Scalar::all(inval));
+		this->filter_parallax_row(cfg, cache.pc_in, r, cache.pc_parallax);
+		for (int c = 0; c < cols; ++c) {
+			cv::Vec3f pnt = project_to_z_map(cache.pc_parallax.at<cv::Vec3f>(r, c), cfg.fx, cfg.fy, cfg.cx, cfg.cy, 
+												this->m_guide_width_, this->m_guide_height_, inval);
+			if (full || pnt != cache.z_map.at<cv::Vec3f>(r, c)) {
+				cache.z_map.at<cv::Vec3f>(r, c) = pnt;
+				cache.changed.at<uchar>(r, c) = 1;
+			}
+		}
+	}
+	if (cfg.depth_diff_thresh == 0.0f || cfg.guide_diff_thresh == 0.0f) { // no edge error filtering
+		cache.pc_parallax.copyTo(pc_out);
+		cache.num_updated = cv::countNonZero(cache.changed);
+		return;
+	}
+	// guide patches
+	for (int r = 0; r < rows; ++r) {
+		for (int c = 0; c < cols; ++c) {
+			cv::Vec3f pnt = cache.z_map.at<cv::Vec3f>(r, c);
+			if (pnt[2] == inval)
+				continue;
+			float val = get_rect_avg_val(img_guide, static_cast<int>(pnt[0]), static_cast<int>(pnt[1]), 1);
+			float& val_cache = cache.guide_val.at<float>(r, c);
+			if (cache.changed.at<uchar>(r, c) == 1 || fabs(val - val_cache) > cfg.incremental_guide_tolerance) {
+				val_cache = val;
+				cache.changed.at<uchar>(r, c) = 1;
+			}
+		}
+	}
+	// stage 0: depth edges around changed points
+	cv::dilate(cache.changed, cache.update, cv::Mat());
+	cache.edge_mask.copyTo(cache.edge_changed);
+	this->extract_depth_edge(cfg, cache.z_map, cache.edge_mask, cache.update);
+	cv::compare(cache.edge_mask, cache.edge_changed, cache.edge_changed, cv::CMP_NE);
+	// stage 1: absolute error detection
+	cv::bitwise_or(cache.update, cache.edge_changed, cache.update);
+	cache.err_mask1.copyTo(cache.err_changed);
+	error_points_detection(img_guide, cache.z_map, cache.edge_mask, cache.err_mask0, cache.err_mask1, 8, 1, 
+							cfg.depth_diff_thresh, cfg.guide_diff_thresh, 0, cache.update);
+	cv::compare(cache.err_mask1, cache.err_changed, cache.err_changed, cv::CMP_NE);
+	// stage 2: relative error detection
+	cv::bitwise_or(cache.changed, cache.err_changed, cache.update);
+	cv::dilate(cache.update, cache.update, cv::Mat(), cv::Point(-1, -1), 2);
+	cv::bitwise_or(cache.update, cache.edge_changed, cache.update);
+	error_points_detection(img_guide, cache.z_map, cache.edge_mask, cache.err_mask1, cache.err_mask2, 24, 1, 
+							cfg.depth_diff_thresh, cfg.guide_diff_thresh, cfg.min_diff_count - 24, cache.update);
+	cache.num_updated = cv::countNonZero(cache.update);
+	// filtered error points
+	cache.pc_parallax.copyTo(pc_out);
+	pc_out.setTo(cv::Scalar::all(std::nan("")), cache.err_mask2);
+}
+
 /**
  * @brief flood depth preprocessing with edge
  * 
+ * @param cfg : parameters of the frame
  * @param pc_flood : input flood point cloud
  * @param img_guide : input guide image
+ * @param frame : output frame buffers
  */
-void upsampling::flood_depth_proc_with_edge(const cv::Mat& pc_flood, const cv::Mat& img_guide)
+void upsampling::flood_depth_proc_with_edge(const Upsampling_Config& cfg, const cv::Mat& pc_flood, const cv::Mat& img_guide, 
+												Upsampling_Frame& frame) const
 {
+	if (cfg.incremental_preprocessing && pc_flood.type() == CV_32FC3 
+		&& pc_flood.rows == this->m_grid_height_ && pc_flood.cols == this->m_grid_width_) {
+		this->update_flood_cache(cfg, img_guide, pc_flood, frame, frame.flood_cache.pc_out);
+		this->pc2flood_points(cfg, frame.flood_cache.pc_out, frame);
+		return;
+	}
 	cv::Mat pc_filtered_parallax, pc_filtered_edge_err;
-	this->filter_parallax_devation_points(pc_flood, pc_filtered_parallax);
-	if (this->m_depth_diff_thresh_ == 0.0f || this->m_guide_diff_thresh_ == 0.0f) { // no edge error filtering
-		this->pc2flood_dmap(pc_filtered_parallax);
+	this->filter_parallax_devation_points(cfg, pc_flood, pc_filtered_parallax);
+	if (cfg.depth_diff_thresh == 0.0f || cfg.guide_diff_thresh == 0.0f) { // no edge error filtering
+		this->pc2flood_points(cfg, pc_filtered_parallax, frame);
 		return;
 	}
-	this->filter_error_edge_points(img_guide, pc_filtered_parallax, pc_filtered_edge_err);
-	this->pc2flood_dmap(pc_filtered_edge_err);
+	this->filter_error_edge_points(cfg, img_guide, pc_filtered_parallax, pc_filtered_edge_err);
+	this->pc2flood_points(cfg, pc_filtered_edge_err, frame);
 }
 
 
 /**
  * @brief depth preprocessing
  * 
+ * @param cfg : parameters of the frame
  * @param pc_flood : flood point cloud
  * @param img_guide : guide image
+ * @param frame : output frame buffers
  */
-void upsampling::flood_depth_proc(const cv::Mat& pc_flood, const cv::Mat& img_guide)
+void upsampling::flood_depth_proc(const Upsampling_Config& cfg, const cv::Mat& pc_flood, const cv::Mat& img_guide, 
+									Upsampling_Frame& frame) const
 {
-	if (this->m_use_preprocessing) {
-		this->flood_depth_proc_with_edge(pc_flood, img_guide);
+	if (cfg.use_preprocessing) {
+		this->flood_depth_proc_with_edge(cfg, pc_flood, img_guide, frame);
 	} else {
-		this->flood_depth_proc_without_edge(pc_flood);
+		this->flood_depth_proc_without_edge(cfg, pc_flood, frame);
 	}
 }
 
 
 /**
- * @brief create FGS filter
+ * @brief depth processing for spot
  * 
- * @param guide: guide image 
+ * @param cfg parameters of the frame
+ * @param pc_spot point cloud of spot 
+ * @param frame output frame buffers
  */
-void upsampling::flood_guide_proc(const cv::Mat& guide)
+void upsampling::spot_depth_proc(const Upsampling_Config& cfg, const cv::Mat& pc_spot, Upsampling_Frame& frame) const
 {
-	cv::Rect roi = this->m_flood_roi_;
-	this->m_fgs_filter_ = cv::ximgproc::createFastGlobalSmootherFilter(guide(roi), 
-							(double)this->m_fgs_lambda_flood_, (double)this->m_fgs_sigma_color_flood_, 
-							(double)this->m_fgs_lambda_attenuation_, this->m_fgs_num_iter_flood_);
+	std::vector<Sparse_Point>& points = frame.spot_points;
+	points.reserve(pc_spot.total());
+	int width = frame.guide_size.width;
+	int height = frame.guide_size.height;
+	float cx, cy, fx, fy;
+	get_output_intrinsics(cfg, fx, fy, cx, cy); // samples on the output grid
+
+	for (int r = 0; r < pc_spot.rows; ++r) {
+		const cv::Vec3f* p = pc_spot.ptr<cv::Vec3f>(r);
+		for (int c = 0; c < pc_spot.cols; ++c) {
+			float z = p[c][2];
+			float uf = (p[c][0] * fx / z) + cx;
+			float vf = (p[c][1] * fy / z) + cy;
+			int u = static_cast<int>(std::round(uf));
+			int v = static_cast<int>(std::round(vf));
+			if (u >= 0 && u < width && v >= 0 && v < height)
+				points.push_back({u, v, z, 1.0f});
+		}
+	}
 }
 
 /**
- * @brief preprocessing for flood
+ * @brief FGS for flood of a prepared frame
  * 
- * @param img_guide: input guide image
- * @param pc_flood: input flood pointcloud 
+ * @param cfg: parameters of the frame
+ * @param ctx: context
+ * @param img_guide: guide image
+ * @param frame: frame buffers
+ * @param conf_thresh: confidence threshold of dense (0: off)
+ * @param fg: foreground mask of the output pass (empty mask: none)
+ * @param dense: output dense depthmap 
+ * @param conf: output confidence 
  */
-void upsampling::flood_preprocessing(const cv::Mat& img_guide, const cv::Mat& pc_flood)
+void upsampling::flood_upsampling(const Upsampling_Config& cfg, upsampling_context& ctx, const cv::Mat& img_guide, 
+									const Upsampling_Frame& frame, float conf_thresh, Foreground_Target& fg, 
+									cv::Mat& dense, cv::Mat& conf) const
 {
-	/* img_guide.copyTo(this->m_guide); */
-	std::thread th3([this, img_guide]()->void{
-		this->flood_guide_proc(img_guide); //create FGS filter
-	});
-	std::thread th1([this, pc_flood, img_guide]()->void {
-		this->flood_depth_proc(pc_flood, img_guide); //depth edge processing and convert to depthmap 
-	});
-	th1.join();
-	th3.join();
+	// flood range around the samples, invalid regions are filled by the solver
+	// range and smoothness in pixels of the output grid
+	int scale = std::max(1, cfg.output_scale);
+	float lambda = cfg.fgs_lambda_flood / (scale * scale);
+	cv::Mat& range = ctx.m_flood_range_;
+	range.create(dense.size(), CV_8UC1);
+	range.setTo(0);
+	for (const Sparse_Point& p : frame.flood_points)
+		mark_block(range, p.u, p.v, std::max(1, cfg.range_flood / scale));
+	if (cfg.flood_engine == FLOOD_ENGINE_MESH) {
+		this->flood_mesh(cfg, ctx, img_guide, frame, range, lambda, conf_thresh, fg, dense, conf);
+		return;
+	}
+	if (cfg.solver == SOLVER_PCG)
+		this->pcg_f(cfg, ctx, img_guide, frame.flood_points, frame.flood_roi, lambda,
+					cfg.tables->weight_flood, cfg.fgs_num_iter_flood, range, conf_thresh, fg, ctx.m_warm_flood_, dense, conf);
+	else
+		this->fgs_f(cfg, ctx, img_guide, frame.flood_points, frame.flood_roi, lambda,
+					cfg.tables->weight_flood, cfg.fgs_num_iter_flood, range, conf_thresh, fg, dense, conf);
 }
 
 /**
- * @brief create FGS Filter for spot
+ * @brief FGS for spot of a prepared frame
  * 
- * @param guide: guide image 
+ * @param cfg: parameters of the frame
+ * @param ctx: context
+ * @param img_guide: guide image
+ * @param frame: frame buffers
+ * @param conf_thresh: confidence threshold of dense (0: off)
+ * @param fg: foreground mask of the output pass (empty mask: none)
+ * @param dense: output dense depthmap 
+ * @param conf: output confidence 
  */
-void upsampling::spot_guide_proc(const cv::Mat& guide)
+void upsampling::spot_upsampling(const Upsampling_Config& cfg, upsampling_context& ctx, const cv::Mat& img_guide, 
+									const Upsampling_Frame& frame, float conf_thresh, Foreground_Target& fg, 
+									cv::Mat& dense, cv::Mat& conf) const
 {
-	cv::Rect roi = this->m_spot_roi_;
-	this->m_fgs_filter_ = cv::ximgproc::createFastGlobalSmootherFilter(guide(roi), 
-							(double)this->m_fgs_lambda_spot_, (double)this->m_fgs_sigma_color_spot_, 
-							(double)this->m_fgs_lambda_attenuation_, this->m_fgs_num_iter_spot_);
-
+	if (cfg.spot_engine == SPOT_ENGINE_INTERPOLATOR) {
+		this->spot_interpolation(cfg, ctx, img_guide, frame.spot_points, frame.spot_roi, conf_thresh, fg, dense, conf);
+		return;
+	}
+	// no spot range: full region results, smoothness in pixels of the output grid
+	int scale = std::max(1, cfg.output_scale);
+	float lambda = cfg.fgs_lambda_spot / (scale * scale);
+	if (cfg.solver == SOLVER_PCG)
+		this->pcg_f(cfg, ctx, img_guide, frame.spot_points, frame.spot_roi, lambda, 
+					cfg.tables->weight_spot, cfg.fgs_num_iter_spot, cv::Mat(), conf_thresh, fg, ctx.m_warm_spot_, dense, conf);
+	else
+		this->fgs_f(cfg, ctx, img_guide, frame.spot_points, frame.spot_roi, lambda, 
+					cfg.tables->weight_spot, cfg.fgs_num_iter_spot, cv::Mat(), conf_thresh, fg, dense, conf);
 }
 
 /**
- * @brief depth processing for spot
+ * @brief rasterize a triangle of the flood grid with depth test
  * 
- * @param pc_spot point cloud of spot 
+ * 1/z is linear in the image for a planar triangle, so it is interpolated
+ * by the barycentric weights (perspective correct depth). Pixels already
+ * holding a nearer depth are kept.
+ * 
+ * @param a : (u, v, z) vertex
+ * @param b : (u, v, z) vertex
+ * @param c : (u, v, z) vertex
+ * @param roi : pixels to draw
+ * @param dense : depth (32FC1, NaN: empty)
  */
-void upsampling::spot_depth_proc(const cv::Mat& pc_spot)
+inline void rasterize_triangle(const cv::Vec3f& a, const cv::Vec3f& b, const cv::Vec3f& c, const cv::Rect& roi, 
+								cv::Mat& dense)
 {
-	cv::Mat dmap = this->m_spot_dmap_;
-	cv::Mat mask = this->m_spot_mask_;
-	int width = this->m_guide_width_;
-	int height = this->m_guide_height_;
-	float cx = this->m_cx_;
-	float cy = this->m_cy_;
-	float fx = this->m_fx_;
-	float fy = this->m_fy_;
+	float area = (b[0] - a[0]) * (c[1] - a[1]) - (b[1] - a[1]) * (c[0] - a[0]);
+	if (fabs(area) < 1e-3f) // degenerate
+		return;
+	int x0 = std::max(roi.x, static_cast<int>(std::floor(std::min({a[0], b[0], c[0]}))));
+	int x1 = std::min(roi.x + roi.width - 1, static_cast<int>(std::ceil(std::max({a[0], b[0], c[0]}))));
+	int y0 = std::max(roi.y, static_cast<int>(std::floor(std::min({a[1], b[1], c[1]}))));
+	int y1 = std::min(roi.y + roi.height - 1, static_cast<int>(std::ceil(std::max({a[1], b[1], c[1]}))));
+	float inv_area = 1.f / area;
+	float iza = 1.f / a[2], izb = 1.f / b[2], izc = 1.f / c[2];
+	const float eps = -1e-4f; // shared edges are drawn by both triangles
+	for (int y = y0; y <= y1; ++y) {
+		float* d = dense.ptr<float>(y);
+		for (int x = x0; x <= x1; ++x) {
+			float wa = ((b[0] - x) * (c[1] - y) - (b[1] - y) * (c[0] - x)) * inv_area;
+			float wb = ((c[0] - x) * (a[1] - y) - (c[1] - y) * (a[0] - x)) * inv_area;
+			float wc = 1.f - wa - wb;
+			if (wa < eps || wb < eps || wc < eps)
+				continue;
+			float z = 1.f / (wa * iza + wb * izb + wc * izc);
+			if (!(d[x] <= z)) // empty (NaN) or farther
+				d[x] = z;
+		}
+	}
+}
 
-	pc_spot.forEach<cv::Vec3f>([&dmap, &mask, width, height, cx, cy, fx, fy]
-								(cv::Vec3f& p, const int* pos) -> void{
-		float z = p[2];
-		float uf = (p[0] * fx / z) + cx;
-		float vf = (p[1] * fy / z) + cy;
-		int u = static_cast<int>(std::round(uf));
-		int v = static_cast<int>(std::round(vf));
-		if (u >= 0 && u < width && v >= 0 && v < height) {
-			dmap.at<float>(v, u) = z;
-			mask.at<float>(v, u) = 1.0;
+/**
+ * @brief guide edge pixels as an integral image
+ * 
+ * A pixel is a guide edge if a channel differs by more than thresh from its
+ * right or lower neighbour. The integral image counts edge pixels of a rectangle.
+ * 
+ * @param guide : guide image (8UC1 or 8UC3)
+ * @param roi : pixels to test
+ * @param thresh : guide difference of an edge (0~255)
+ * @param edge : scratch (8UC1, size of roi)
+ * @param sum : output integral image of edge (32SC1, size of roi + 1)
+ */
+inline void guide_edge_integral(const cv::Mat& guide, const cv::Rect& roi, float thresh, cv::Mat& edge, cv::Mat& sum)
+{
+	edge.create(roi.size(), CV_8UC1);
+	int cn = guide.channels();
+	int x_end = guide.cols - 1;
+	int y_end = guide.rows - 1;
+	cv::parallel_for_(cv::Range(0, roi.height), [&guide, &roi, &edge, cn, x_end, y_end, thresh](const cv::Range& rows) -> void {
+		for (int i = rows.start; i < rows.end; ++i) {
+			int y = roi.y + i;
+			const uchar* g = guide.ptr<uchar>(y);
+			const uchar* g_down = guide.ptr<uchar>(std::min(y + 1, y_end));
+			uchar* e = edge.ptr<uchar>(i);
+			for (int j = 0; j < roi.width; ++j) {
+				int x = roi.x + j;
+				int x_right = std::min(x + 1, x_end);
+				int diff = 0;
+				for (int k = 0; k < cn; ++k) {
+					diff = std::max(diff, std::abs(g[x * cn + k] - g[x_right * cn + k]));
+					diff = std::max(diff, std::abs(g[x * cn + k] - g_down[x * cn + k]));
+				}
+				e[j] = diff > thresh ? 1 : 0;
+			}
 		}
-	});	
+	});
+	cv::integral(edge, sum, CV_32S);
 }
 
 /**
- * @brief preprocessing for spot
+ * @brief flood by mesh rasterization (FLOOD_ENGINE_MESH)
  * 
- * @param guide: guide image 
- * @param pc_spot: point cloud of spot 
+ * 1. depth edge points of the flood grid (extract_depth_edge()), every grid
+ *    cell gives two triangles, a triangle with an edge point, a missing
+ *    point, a depth step or a guide edge (guide_diff_thresh) in its bounding
+ *    box is not drawn (the mesh breaks at depth and colour edges)
+ * 2. the triangles are rasterized into dense with depth test, conf 1
+ * 3. pixels of the flood range left uncovered are the bands around the
+ *    breaks and holes, only tiles holding them are solved by FGS from the
+ *    rasterized pixels around (a margin of half a tile), and only the band
+ *    pixels are taken, the tiles are solved in parallel
+ * 4. post processing (flood range, confidence threshold, mask)
+ * 
+ * @param cfg: parameters of the frame
+ * @param ctx: context (solver and buffers)
+ * @param guide: guide image
+ * @param frame: frame buffers
+ * @param range: flood range (8UC1, size of dense)
+ * @param lambda: FGS lambda of the bands
+ * @param conf_thresh: confidence threshold of dense (0: off)
+ * @param fg: foreground mask of the output pass (empty mask: none)
+ * @param dense: output dense depth 
+ * @param conf: output confidence 
  */
-void upsampling::spot_preprocessing(const cv::Mat& guide, const cv::Mat& pc_spot)
+void upsampling::flood_mesh(const Upsampling_Config& cfg, upsampling_context& ctx, const cv::Mat& guide, 
+							const Upsampling_Frame& frame, const cv::Mat& range, float lambda, float conf_thresh, 
+							Foreground_Target& fg, cv::Mat& dense, cv::Mat& conf) const
 {
-	std::thread th1([this, guide]()->void{
-		this->spot_guide_proc(guide); //create FGS filter
+	const float inval = 100.0f;
+	const cv::Rect& roi = frame.flood_roi;
+	const cv::Mat& grid = frame.flood_grid;
+	cv::Mat dense_roi = dense(roi);
+	cv::Mat conf_roi = conf(roi);
+	dense_roi.setTo(std::nan(""));
+	// depth edges of the grid
+	cv::Mat& z_map = ctx.m_mesh_zmap_;
+	cv::Mat& edge = ctx.m_mesh_edge_;
+	z_map.create(grid.size(), CV_32FC3);
+	for (int r = 0; r < grid.rows; ++r) {
+		const cv::Vec3f* g = grid.ptr<cv::Vec3f>(r);
+		cv::Vec3f* zr = z_map.ptr<cv::Vec3f>(r);
+		for (int c = 0; c < grid.cols; ++c)
+			zr[c] = cv::Vec3f(g[c][0], g[c][1], g[c][2] > 0.f ? g[c][2] : inval);
+	}
+	edge.create(grid.size(), CV_8UC1);
+	edge.setTo(0);
+	this->extract_depth_edge(cfg, z_map, edge);
+	bool guide_test = cfg.guide_diff_thresh > 0.f;
+	cv::Mat& guide_sum = ctx.m_mesh_guide_sum_;
+	if (guide_test)
+		guide_edge_integral(guide, roi, cfg.guide_diff_thresh, ctx.m_mesh_guide_edge_, guide_sum);
+	// mesh
+	for (int r = 0; r + 1 < grid.rows; ++r) {
+		const cv::Vec3f* g0 = grid.ptr<cv::Vec3f>(r);
+		const cv::Vec3f* g1 = grid.ptr<cv::Vec3f>(r + 1);
+		const uchar* e0 = edge.ptr<uchar>(r);
+		const uchar* e1 = edge.ptr<uchar>(r + 1);
+		for (int c = 0; c + 1 < grid.cols; ++c) {
+			const cv::Vec3f* v[4] = {&g0[c], &g0[c + 1], &g1[c], &g1[c + 1]};
+			bool ok[4] = {g0[c][2] > 0.f && e0[c] == 0, g0[c + 1][2] > 0.f && e0[c + 1] == 0, 
+							g1[c][2] > 0.f && e1[c] == 0, g1[c + 1][2] > 0.f && e1[c + 1] == 0};
+			static const int tris[2][3] = {{0, 1, 2}, {1, 3, 2}};
+			for (const int* t : tris) {
+				if (!ok[t[0]] || !ok[t[1]] || !ok[t[2]])
+					continue;
+				float z_min = std::min({(*v[t[0]])[2], (*v[t[1]])[2], (*v[t[2]])[2]});
+				float z_max = std::max({(*v[t[0]])[2], (*v[t[1]])[2], (*v[t[2]])[2]});
+				if (z_max - z_min > cfg.depth_diff_thresh) // depth step inside the cell
+					continue;
+				if (guide_test) { // colour edge in the footprint, the pixels are left to the band solver
+					const cv::Vec3f& a = *v[t[0]];
+					const cv::Vec3f& b = *v[t[1]];
+					const cv::Vec3f& d = *v[t[2]];
+					int x0 = std::max(0, static_cast<int>(std::floor(std::min({a[0], b[0], d[0]}))) - roi.x);
+					int x1 = std::min(roi.width, static_cast<int>(std::ceil(std::max({a[0], b[0], d[0]}))) + 1 - roi.x);
+					int y0 = std::max(0, static_cast<int>(std::floor(std::min({a[1], b[1], d[1]}))) - roi.y);
+					int y1 = std::min(roi.height, static_cast<int>(std::ceil(std::max({a[1], b[1], d[1]}))) + 1 - roi.y);
+					if (x0 < x1 && y0 < y1 && guide_sum.at<int>(y1, x1) - guide_sum.at<int>(y0, x1) 
+											- guide_sum.at<int>(y1, x0) + guide_sum.at<int>(y0, x0) > 0)
+						continue;
+				}
+				rasterize_triangle(*v[t[0]], *v[t[1]], *v[t[2]], roi, dense);
+			}
+		}
+	}
+	// rasterized pixels conf 1, bands: uncovered pixels of the flood range
+	cv::Mat& band = ctx.m_mesh_band_;
+	band.create(dense.size(), CV_8UC1);
+	band.setTo(0);
+	cv::Mat band_roi = band(roi);
+	cv::Mat range_roi = range(roi);
+	cv::parallel_for_(cv::Range(0, roi.height), [&dense_roi, &conf_roi, &band_roi, &range_roi](const cv::Range& rows) -> void {
+		for (int i = rows.start; i < rows.end; ++i) {
+			const float* d = dense_roi.ptr<float>(i);
+			const uchar* r = range_roi.ptr<uchar>(i);
+			float* c = conf_roi.ptr<float>(i);
+			uchar* b = band_roi.ptr<uchar>(i);
+			for (int j = 0; j < dense_roi.cols; ++j) {
+				bool covered = d[j] == d[j];
+				c[j] = covered ? 1.f : 0.f;
+				b[j] = (!covered && r[j] != 0) ? 1 : 0;
+			}
+		}
 	});
-	std::thread th2([this, pc_spot]()->void{
-		this->spot_depth_proc(pc_spot);
+	// tiles of the bands
+	int tile = cfg.mesh_tile_size;
+	int margin = tile / 2;
+	std::vector<cv::Rect>& tiles = ctx.m_mesh_tiles_;
+	tiles.clear();
+	for (int ty = roi.y; ty < roi.y + roi.height; ty += tile) {
+		for (int tx = roi.x; tx < roi.x + roi.width; tx += tile) {
+			cv::Rect t(tx, ty, std::min(tile, roi.x + roi.width - tx), std::min(tile, roi.y + roi.height - ty));
+			if (cv::countNonZero(band(t)) != 0)
+				tiles.push_back(t);
+		}
+	}
+	// solver in the tiles, a solver per stripe of tiles: a tile reads rasterized pixels
+	// and writes only its band pixels, so the overlapping margins do not conflict
+	int num_tiles = static_cast<int>(tiles.size());
+	int num_stripes = std::max(1, std::min(cv::getNumThreads(), num_tiles));
+	if (static_cast<int>(ctx.m_mesh_solvers_.size()) < num_stripes) {
+		ctx.m_mesh_solvers_.resize(num_stripes);
+		ctx.m_mesh_sparse_.resize(num_stripes);
+		ctx.m_mesh_mask_.resize(num_stripes);
+	}
+	const std::vector<float>& weight = cfg.tables->weight_flood;
+	cv::parallel_for_(cv::Range(0, num_stripes), [&](const cv::Range& stripes) -> void {
+		for (int n = stripes.start; n < stripes.end; ++n) {
+			fgs_solver& solver = ctx.m_mesh_solvers_[n];
+			cv::Mat& matSparse = ctx.m_mesh_sparse_[n];
+			cv::Mat& matMask = ctx.m_mesh_mask_[n];
+			for (int k = n; k < num_tiles; k += num_stripes) {
+				const cv::Rect& t = tiles[k];
+				cv::Rect solve_roi = cv::Rect(t.x - margin, t.y - margin, t.width + 2 * margin, t.height + 2 * margin) & roi;
+				cv::Mat d = dense(solve_roi);
+				cv::Mat b = band(solve_roi);
+				matSparse.create(solve_roi.size(), CV_32FC1);
+				matMask.create(solve_roi.size(), CV_32FC1);
+				for (int i = 0; i < d.rows; ++i) { // rasterized pixels are the samples
+					const float* di = d.ptr<float>(i);
+					const uchar* bi = b.ptr<uchar>(i);
+					float* s = matSparse.ptr<float>(i);
+					float* m = matMask.ptr<float>(i);
+					for (int j = 0; j < d.cols; ++j) {
+						bool sample = bi[j] == 0 && di[j] == di[j]; // band pixels of other tiles are not read
+						s[j] = sample ? di[j] : 0.f;
+						m[j] = sample ? 1.f : 0.f;
+					}
+				}
+				solver.set_guide(guide(solve_roi), weight);
+				solver.filter(matSparse, matMask, lambda, cfg.fgs_lambda_attenuation, cfg.fgs_num_iter_flood);
+				cv::Rect t_local(t.x - solve_roi.x, t.y - solve_roi.y, t.width, t.height);
+				for (int i = 0; i < t.height; ++i) { // band pixels of the tile
+					const uchar* bi = band.ptr<uchar>(t.y + i) + t.x;
+					const float* s = matSparse.ptr<float>(t_local.y + i) + t_local.x;
+					const float* m = matMask.ptr<float>(t_local.y + i) + t_local.x;
+					float* di = dense.ptr<float>(t.y + i) + t.x;
+					float* ci = conf.ptr<float>(t.y + i) + t.x;
+					for (int j = 0; j < t.width; ++j) {
+						if (bi[j] == 0)
+							continue;
+						di[j] = s[j] / m[j];
+						ci[j] = std::min(m[j] * lambda * 10, 1.f);
+					}
+				}
+			}
+		}
 	});
-	th1.join();
-	th2.join();
+	Foreground_Target fg_roi = target_roi(fg, roi);
+	post_process(dense_roi, conf_roi, false, 1.f, range_roi, conf_thresh, fg_roi, dense_roi, conf_roi);
 }
 
 /**
- * @brief full processing for flood 
+ * @brief spot interpolation on a coarse grid (SPOT_ENGINE_INTERPOLATOR)
  * 
- * @param img_guide: image guide 
- * @param pc_flood: point cloud of flood 
- * @param dense: output dense depthmap 
+ * 1. every node of a grid of step pixels gets the normalized Gaussian RBF
+ *    of the samples, z = sum(w z) / sum(w), conf = min(sum(w), 1) (a sample
+ *    on the node gives 1), the separable weights are computed once per
+ *    sample and node column/row
+ * 2. every pixel gets the confidence weighted average of its 4 nodes by
+ *    bilinear and colour weights against the guide at the nodes
+ * 3. post processing (confidence threshold, mask) as the solver output
+ * 
+ * @param cfg: parameters of the frame
+ * @param ctx: context (buffers)
+ * @param guide: guide image
+ * @param points: spot samples
+ * @param roi: ROI
+ * @param conf_thresh: confidence threshold of dense (0: off)
+ * @param fg: foreground mask of the output pass (empty mask: none)
+ * @param dense: output dense depth 
  * @param conf: output confidence 
  */
-void upsampling::run_flood(const cv::Mat& img_guide, const cv::Mat& pc_flood, cv::Mat& dense, cv::Mat& conf)
+void upsampling::spot_interpolation(const Upsampling_Config& cfg, upsampling_context& ctx, const cv::Mat& guide, 
+									const std::vector<Sparse_Point>& points, const cv::Rect& roi, float conf_thresh, 
+									Foreground_Target& fg, cv::Mat& dense, cv::Mat& conf) const
 {
-#ifdef SHOW_TIME
-	std::chrono::system_clock::time_point t_start, t_end;
-	double elapsed;
-	t_start = std::chrono::system_clock::now();
-#endif
-	// preprocessing
-	this->flood_preprocessing(img_guide, pc_flood);
-#ifdef SHOW_TIME
-	t_end = std::chrono::system_clock::now();
-	elapsed = std::chrono::duration_cast<std::chrono::microseconds>(t_end - t_start).count();
-	std::cout << "xyz2depthmap time = " << elapsed << " [us]" << std::endl;
-#endif
-
-	// upsampling
-#ifdef SHOW_TIME
-	t_start = std::chrono::system_clock::now();
-#endif
-	// cv::Rect roi(0, 0, this->guide_width, this->guide_height);
-	this->fgs_f(this->m_flood_dmap_, this->m_flood_mask_, this->m_flood_roi_, this->m_fgs_lambda_flood_,
-				dense, conf);
-#ifdef SHOW_TIME
-	t_end = std::chrono::system_clock::now();
-	elapsed = std::chrono::duration_cast<std::chrono::microseconds>(t_end - t_start).count();
-	std::cout << "FGS processing time = " << elapsed << " [us]" << std::endl;
-#endif
-	// fill invalid regions
-	dense.setTo(std::nan(""), this->m_flood_range_ == 0.0);
-	conf.setTo(std::nan(""), this->m_flood_range_ == 0.0);
+	int step = std::max(1, cfg.spot_grid_step);
+	int gw = (roi.width - 1) / step + 2; // last node at or after the last column
+	int gh = (roi.height - 1) / step + 2;
+	int num_points = static_cast<int>(points.size());
+	float sigma = cfg.spot_rbf_sigma > 0.f ? cfg.spot_rbf_sigma 
+					: sqrtf(static_cast<float>(roi.area()) / std::max(1, num_points));
+	float inv_2sigma2 = 1.f / (2.f * sigma * sigma);
+	// separable RBF weights of the samples
+	std::vector<float>& rbf_x = ctx.m_spot_rbf_x_;
+	std::vector<float>& rbf_y = ctx.m_spot_rbf_y_;
+	rbf_x.resize(static_cast<size_t>(num_points) * gw);
+	rbf_y.resize(static_cast<size_t>(num_points) * gh);
+	for (int k = 0; k < num_points; ++k) {
+		float u = static_cast<float>(points[k].u - roi.x);
+		float v = static_cast<float>(points[k].v - roi.y);
+		for (int j = 0; j < gw; ++j) {
+			float d = j * step - u;
+			rbf_x[k * gw + j] = expf(-d * d * inv_2sigma2);
+		}
+		for (int i = 0; i < gh; ++i) {
+			float d = i * step - v;
+			rbf_y[k * gh + i] = points[k].w * expf(-d * d * inv_2sigma2);
+		}
+	}
+	// nodes, the guide at the nodes is sampled at their pixel (clamped to the ROI)
+	cv::Mat& grid_z = ctx.m_spot_grid_z_;
+	cv::Mat& grid_c = ctx.m_spot_grid_c_;
+	cv::Mat& grid_guide = ctx.m_spot_grid_guide_;
+	grid_z.create(gh, gw, CV_32FC1);
+	grid_c.create(gh, gw, CV_32FC1);
+	grid_guide.create(gh, gw, guide.type());
+	int cn = guide.channels();
+	cv::parallel_for_(cv::Range(0, gh), [&](const cv::Range& range) -> void {
+		std::vector<float> sum_z(gw), sum_w(gw);
+		for (int i = range.start; i < range.end; ++i) {
+			std::fill(sum_z.begin(), sum_z.end(), 0.f);
+			std::fill(sum_w.begin(), sum_w.end(), 0.f);
+			for (int k = 0; k < num_points; ++k) {
+				float wy = rbf_y[k * gh + i];
+				if (wy < 1e-6f) // beyond about 5 sigma
+					continue;
+				const float* wx = &rbf_x[k * gw];
+				float z = points[k].z;
+				for (int j = 0; j < gw; ++j) {
+					float w = wy * wx[j];
+					sum_w[j] += w;
+					sum_z[j] += w * z;
+				}
+			}
+			float* z = grid_z.ptr<float>(i);
+			float* c = grid_c.ptr<float>(i);
+			const uchar* g = guide.ptr<uchar>(roi.y + std::min(i * step, roi.height - 1));
+			uchar* gg = grid_guide.ptr<uchar>(i);
+			for (int j = 0; j < gw; ++j) {
+				z[j] = sum_w[j] > 0.f ? sum_z[j] / sum_w[j] : 0.f;
+				c[j] = std::min(sum_w[j], 1.f);
+				const uchar* gp = g + (roi.x + std::min(j * step, roi.width - 1)) * cn;
+				for (int ch = 0; ch < cn; ++ch)
+					gg[j * cn + ch] = gp[ch];
+			}
+		}
+	});
+	// joint bilateral upsampling into the solver buffers, then the output pass
+	cv::Mat& matSparse = ctx.m_sparse_;
+	cv::Mat& matMask = ctx.m_mask_;
+	matSparse.create(roi.size(), CV_32FC1);
+	matMask.create(roi.size(), CV_32FC1);
+	const float* lut = cfg.tables->weight_spot.data();
+	cv::Mat guide_roi = guide(roi);
+	int w = roi.width;
+	cv::parallel_for_(cv::Range(0, roi.height), [&guide_roi, &grid_guide, &grid_z, &grid_c, &matSparse, &matMask, 
+						lut, cn, step, w](const cv::Range& range) -> void {
+		for (int i = range.start; i < range.end; ++i) {
+			int k = i / step;
+			float fy = static_cast<float>(i - k * step) / step;
+			spot_jbu_row(guide_roi.ptr<uchar>(i), cn, grid_guide.ptr<uchar>(k), grid_guide.ptr<uchar>(k + 1), 
+							grid_z.ptr<float>(k), grid_c.ptr<float>(k), grid_z.ptr<float>(k + 1), grid_c.ptr<float>(k + 1), 
+							fy, step, w, lut, matSparse.ptr<float>(i), matMask.ptr<float>(i));
+		}
+	});
+	cv::Mat dense_roi = dense(roi);
+	cv::Mat conf_roi = conf(roi);
+	Foreground_Target fg_roi = target_roi(fg, roi);
+	post_process(matSparse, matMask, true, 1.f, cv::Mat(), conf_thresh, fg_roi, dense_roi, conf_roi);
 }
 
 /**
- * @brief full processing for spot
+ * @brief one solve of flood and spot samples (FUSION_JOINT)
  * 
- * @param img_guide: image guide 
- * @param pc_spot: point cloud of spot 
+ * @param cfg: parameters of the frame
+ * @param ctx: context
+ * @param img_guide: guide image
+ * @param frame: frame buffers
+ * @param fg: foreground mask of the output pass (empty mask: none)
  * @param dense: output dense depthmap 
  * @param conf: output confidence 
  */
-void upsampling::run_spot(const cv::Mat& img_guide, const cv::Mat& pc_spot, cv::Mat& dense, cv::Mat& conf)
+void upsampling::joint_upsampling(const Upsampling_Config& cfg, upsampling_context& ctx, const cv::Mat& img_guide, 
+									const Upsampling_Frame& frame, Foreground_Target& fg, 
+									cv::Mat& dense, cv::Mat& conf) const
 {
-#ifdef SHOW_TIME
-	std::chrono::system_clock::time_point t_start, t_end;
-	double elapsed;
-	t_start = std::chrono::system_clock::now();
-#endif
-	this->spot_preprocessing(img_guide, pc_spot);
-
-#ifdef SHOW_TIME
-	t_end = std::chrono::system_clock::now();
-	elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(t_end - t_start).count();
-	std::cout << "spot preprocessing time = " << elapsed << " [ms]" << std::endl;
-#endif
+	// weighted samples of both sources, smoothness of flood in pixels of the output grid
+	std::vector<Sparse_Point>& points = ctx.m_joint_points_;
+	points.clear();
+	points.reserve(frame.flood_points.size() + frame.spot_points.size());
+	for (const Sparse_Point& p : frame.flood_points)
+		points.push_back({p.u, p.v, p.z, p.w * cfg.joint_flood_weight});
+	for (const Sparse_Point& p : frame.spot_points)
+		points.push_back({p.u, p.v, p.z, p.w * cfg.joint_spot_weight});
+	cv::Rect roi = frame.flood_roi | frame.spot_roi;
+	int scale = std::max(1, cfg.output_scale);
+	float lambda = cfg.fgs_lambda_flood / (scale * scale);
+	if (cfg.solver == SOLVER_PCG)
+		this->pcg_f(cfg, ctx, img_guide, points, roi, lambda, cfg.tables->weight_flood, cfg.fgs_num_iter_flood, 
+					cv::Mat(), cfg.conf_threshold, fg, ctx.m_warm_joint_, dense, conf);
+	else
+		this->fgs_f(cfg, ctx, img_guide, points, roi, lambda, cfg.tables->weight_flood, cfg.fgs_num_iter_flood, 
+					cv::Mat(), cfg.conf_threshold, fg, dense, conf);
+}
 
-#ifdef SHOW_TIME
-	t_start = std::chrono::system_clock::now();
-#endif
-	// upsampling
-	fgs_f(this->m_spot_dmap_, this->m_spot_mask_, this->m_spot_roi_, this->m_fgs_lambda_spot_, 
-		dense, conf);
-#ifdef SHOW_TIME
-		t_end = std::chrono::system_clock::now();
-		elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(t_end - t_start).count();
-		std::cout << "FGS spot processing time = " << elapsed << " [ms]" << std::endl;
-#endif
-#if 0 // skipped for full region results
-	// fill invalid regions
-	dense.setTo(std::nan(""), this->m_spot_range == 0.0);
-	conf.setTo(std::nan(""), this->m_spot_range == 0.0);
-#endif
+/**
+ * @brief merge spot results outside flood range and apply the confidence threshold in one pass
+ * 
+ * Depth and confidence are taken from flood inside the flood range and
+ * from spot outside it, the threshold applies to the merged confidence.
+ * 
+ * @param flood_range: flood range of flood_upsampling()
+ * @param dense_spot: dense depthmap of spot
+ * @param conf_spot: confidence of spot
+ * @param conf_thresh: confidence threshold of dense (0: off)
+ * @param fg: foreground mask of the merged result (empty mask: none)
+ * @param dense: dense depthmap of flood, merged result 
+ * @param conf: confidence of flood, merged result
+ */
+void upsampling::merge_flood_spot(const cv::Mat& flood_range, const cv::Mat& dense_spot, const cv::Mat& conf_spot, 
+									float conf_thresh, Foreground_Target& fg, cv::Mat& dense, cv::Mat& conf) const
+{
+	int w = dense.cols;
+	cv::Mat& mask = fg.mask;
+	const cv::Mat& vd = fg.virtual_depth;
+	bool write_dense = !fg.mask_only || mask.empty();
+	cv::parallel_for_(cv::Range(0, dense.rows), [&flood_range, &dense_spot, &conf_spot, &fg, &mask, &vd, &dense, &conf, 
+						conf_thresh, write_dense, w](const cv::Range& rows) -> void {
+		for (int i = rows.start; i < rows.end; ++i)
+			merge_row(flood_range.ptr<uchar>(i), dense_spot.ptr<float>(i), conf_spot.ptr<float>(i), 
+						dense.ptr<float>(i), conf.ptr<float>(i), w, conf_thresh, 
+						mask.empty() ? nullptr : mask.ptr<uchar>(i), fg.range, 
+						vd.empty() ? nullptr : vd.ptr<float>(i), fg.occlusion, write_dense);
+	});
 }
 
 /**
@@ -727,46 +1907,870 @@ void upsampling::run_spot(const cv::Mat& img_guide, const cv::Mat& pc_spot, cv::
 bool upsampling::run(const cv::Mat& img_guide, const cv::Mat& pc_flood, const cv::Mat& pc_spot, 
 						cv::Mat& dense, cv::Mat& conf)
 {
+	return this->run(this->m_context_, img_guide, pc_flood, pc_spot, dense, conf);
+}
+
+/**
+ * @brief Upsampling main processing with a per stream context
+ * 
+ * Stage times are kept in the context, with a latency budget they select
+ * the quality level of the next frame of the context.
+ * 
+ * @param ctx : context of the stream
+ * @param img_guide : guide image 
+ * @param pc_flood : flood point cloud 
+ * @param pc_spot : spot point cloud 
+ * @param dense : upsampling result dense depthmap 
+ * @param conf : confidence map 
+ * @return true 
+ * @return false 
+ */
+bool upsampling::run(upsampling_context& ctx, const cv::Mat& img_guide, const cv::Mat& pc_flood, const cv::Mat& pc_spot, 
+						cv::Mat& dense, cv::Mat& conf) const
+{
+	return this->run_frame(ctx, this->get_config(), img_guide, pc_flood, pc_spot, dense, conf, nullptr, false, nullptr);
+}
+
+/**
+ * @brief Upsampling main processing with the foreground mask
+ * 
+ * The mask (255: fg_near <= dense <= fg_far and conf >= fg_conf_threshold,
+ * 0: elsewhere and NaN) is written by the final pass of the solver output
+ * (post processing or merge), so no extra pass over dense runs. With
+ * mask_only dense/conf stay in the context and the final pass stores only
+ * the mask. With static frame skip dense/conf are always written, the mask
+ * is fused into frames solved in full and computed from dense/conf of skipped
+ * or partially recomputed frames, always on the parameters of the frame.
+ * 
+ * @param ctx : context of the stream
+ * @param img_guide : guide image 
+ * @param pc_flood : flood point cloud 
+ * @param pc_spot : spot point cloud 
+ * @param dense : upsampling result dense depthmap (not written with mask_only)
+ * @param conf : confidence map (not written with mask_only)
+ * @param mask : output foreground mask (8UC1, size of dense)
+ * @param mask_only : skip the output of dense/conf
+ * @return true 
+ * @return false 
+ */
+bool upsampling::run(upsampling_context& ctx, const cv::Mat& img_guide, const cv::Mat& pc_flood, const cv::Mat& pc_spot, 
+						cv::Mat& dense, cv::Mat& conf, cv::Mat& mask, bool mask_only) const
+{
+	return this->run_frame(ctx, this->get_config(), img_guide, pc_flood, pc_spot, dense, conf, &mask, mask_only, nullptr);
+}
+
+/**
+ * @brief Upsampling main processing with the occlusion mask against a virtual depth
+ * 
+ * The mask is 255 where the real depth hides the virtual object. It is
+ * written by the final pass of the solver output as the foreground mask of
+ * run(), so the compositor needs no depth test pass over dense. Ties within
+ * occlusion_margin go to the real depth by its confidence (see
+ * set_occlusion_test()), low confidence real depth never occludes.
+ * 
+ * @param ctx : context of the stream
+ * @param img_guide : guide image 
+ * @param pc_flood : flood point cloud 
+ * @param pc_spot : spot point cloud 
+ * @param virtual_depth : virtual depth (32FC1, size of dense, <= 0 or NaN: no virtual object), read in place
+ * @param dense : upsampling result dense depthmap (not written with mask_only)
+ * @param conf : confidence map (not written with mask_only)
+ * @param occlusion : output occlusion mask (8UC1, size of dense)
+ * @param mask_only : skip the output of dense/conf
+ * @return true 
+ * @return false : no guide, no point cloud or virtual depth of other size or type
+ */
+bool upsampling::run(upsampling_context& ctx, const cv::Mat& img_guide, const cv::Mat& pc_flood, const cv::Mat& pc_spot, 
+						const cv::Mat& virtual_depth, cv::Mat& dense, cv::Mat& conf, cv::Mat& occlusion, 
+						bool mask_only) const
+{
+	std::shared_ptr<const Upsampling_Config> config = this->get_config(); // checked and run on one snapshot
+	if (virtual_depth.type() != CV_32FC1 || virtual_depth.size() != this->get_output_size(*config))
+		return false;
+	return this->run_frame(ctx, config, img_guide, pc_flood, pc_spot, dense, conf, &occlusion, mask_only, &virtual_depth);
+}
+
+/**
+ * @brief body of run()
+ * 
+ * All decisions of the frame (static frame skip, partial recompute, masks)
+ * and all stages use the one snapshot passed in, get_config() is not called again.
+ * 
+ * @param ctx : context of the stream
+ * @param config : parameter snapshot of the frame
+ * @param img_guide : guide image 
+ * @param pc_flood : flood point cloud 
+ * @param pc_spot : spot point cloud 
+ * @param dense : upsampling result dense depthmap 
+ * @param conf : confidence map 
+ * @param mask : output foreground or occlusion mask (nullptr: none)
+ * @param mask_only : skip the output of dense/conf
+ * @param virtual_depth : virtual depth of the occlusion mask (nullptr: foreground mask)
+ * @return true 
+ * @return false 
+ */
+bool upsampling::run_frame(upsampling_context& ctx, const std::shared_ptr<const Upsampling_Config>& config, 
+						const cv::Mat& img_guide, const cv::Mat& pc_flood, const cv::Mat& pc_spot, 
+						cv::Mat& dense, cv::Mat& conf, cv::Mat* mask, bool mask_only, const cv::Mat* virtual_depth) const
+{
+	std::chrono::steady_clock::time_point t_start, t_end;
+	t_start = std::chrono::steady_clock::now();
+	if (img_guide.empty() || img_guide.size() != this->get_guide_size()) // no guide or other resolution
+		return false;
+	// static frame skip
+	if (config->static_guide_thresh > 0.f) // the cache holds dense/conf: always written, the mask fused into full solves
+		mask_only = false;
+	int change = CHANGE_FULL;
+	cv::Rect dirty;
+	if (config->static_guide_thresh <= 0.f) {
+		ctx.m_cached_config_.reset();
+	} else if (ctx.m_cached_config_ == config && ctx.m_cached_quality_level_ == ctx.m_quality_level_
+				&& ctx.m_cached_mode_ == this->get_mode(pc_flood, pc_spot)) {
+		change = this->detect_changes(*config, ctx, img_guide, pc_flood, pc_spot, dirty);
+		if (change == CHANGE_PARTIAL && config->output_scale > 1) // dirty region is in guide pixels
+			change = CHANGE_FULL;
+	}
+	double num_pixels = static_cast<double>(img_guide.total());
+	if (config->static_guide_thresh > 0.f)
+		ctx.m_skip_stats_.num_frames += 1;
+	if (change == CHANGE_NONE) { // no stage runs, quality control is not updated
+		ctx.m_cached_dense_.copyTo(dense);
+		ctx.m_cached_conf_.copyTo(conf);
+		if (mask != nullptr) // mask of the cached output on the parameters of this frame
+			this->mask_pass(*config, dense, conf, virtual_depth, *mask);
+		ctx.m_skip_stats_.num_skipped += 1;
+		ctx.m_skip_stats_.skipped_pixel_ratio += 1.0; // sum, divided in get_skip_stats()
+		return true;
+	}
+	ctx.m_frame_.quality_level = ctx.m_quality_level_;
+	if (!this->prepare(config, img_guide, pc_flood, pc_spot, ctx.m_frame_)) { // no point cloud: NaN output, no solve
+		ctx.m_cached_config_.reset();
+		if (!mask_only || mask == nullptr) {
+			this->initialization(this->get_output_size(*config), dense, conf);
+			dense.setTo(std::nan(""));
+			conf.setTo(std::nan(""));
+		}
+		if (mask != nullptr) {
+			mask->create(this->get_output_size(*config), CV_8UC1);
+			mask->setTo(0);
+		}
+		return false;
+	}
+	t_end = std::chrono::steady_clock::now();
+	ctx.m_prepare_ms_ = std::chrono::duration<double, std::milli>(t_end - t_start).count();
 #ifdef SHOW_TIME
-	std::chrono::system_clock::time_point t_start, t_end;
-	double elapsed;
+	std::cout << "preprocessing time = " << ctx.m_prepare_ms_ * 1000 << " [us]" << std::endl;
 #endif
-	if (img_guide.empty()) // no guide
+	t_start = t_end;
+	bool res = false;
+	cv::Rect roi;
+	if (change == CHANGE_PARTIAL) { // solver region: changed region with margin inside the flood ROI
+		roi = cv::Rect(dirty.x - STATIC_MARGIN, dirty.y - STATIC_MARGIN, 
+						dirty.width + 2 * STATIC_MARGIN, dirty.height + 2 * STATIC_MARGIN) & ctx.m_frame_.flood_roi;
+		if (roi.empty() || ctx.m_partial_frames_ >= STATIC_MAX_PARTIAL_FRAMES) // nothing to solve or refresh
+			change = CHANGE_FULL;
+	}
+	if (change == CHANGE_PARTIAL) { // solve around the changed region, outside is kept from the cache
+		cv::Rect flood_roi = ctx.m_frame_.flood_roi;
+		cv::Rect spot_roi = ctx.m_frame_.spot_roi;
+		ctx.m_frame_.flood_roi = roi;
+		ctx.m_frame_.spot_roi &= roi;
+		res = this->solve(ctx, img_guide, ctx.m_frame_, ctx.m_part_dense_, ctx.m_part_conf_);
+		if (res) {
+			ctx.m_part_dense_(dirty).copyTo(ctx.m_cached_dense_(dirty));
+			ctx.m_part_conf_(dirty).copyTo(ctx.m_cached_conf_(dirty));
+			ctx.m_cached_dense_.copyTo(dense);
+			ctx.m_cached_conf_.copyTo(conf);
+			if (mask != nullptr)
+				this->mask_pass(*config, dense, conf, virtual_depth, *mask);
+			img_guide(dirty).copyTo(ctx.m_prev_guide_(dirty));
+			pc_flood.copyTo(ctx.m_prev_flood_, ctx.m_dirty_cells_);
+			ctx.m_partial_frames_ += 1;
+			ctx.m_skip_stats_.num_partial += 1;
+			ctx.m_skip_stats_.skipped_pixel_ratio += 1.0 - roi.area() / num_pixels; // the solver ran on roi
+		} else { // cache is dropped, the frame is recomputed fully
+			ctx.m_frame_.flood_roi = flood_roi;
+			ctx.m_frame_.spot_roi = spot_roi;
+			ctx.m_cached_config_.reset();
+			change = CHANGE_FULL;
+		}
+	}
+	if (change != CHANGE_PARTIAL) {
+		res = this->solve(ctx, img_guide, ctx.m_frame_, dense, conf, mask, mask_only, virtual_depth);
+		if (res && config->static_guide_thresh > 0.f) { // new cache
+			dense.copyTo(ctx.m_cached_dense_);
+			conf.copyTo(ctx.m_cached_conf_);
+			img_guide.copyTo(ctx.m_prev_guide_);
+			pc_flood.copyTo(ctx.m_prev_flood_);
+			pc_spot.copyTo(ctx.m_prev_spot_);
+			ctx.m_cached_config_ = ctx.m_frame_.config;
+			ctx.m_cached_mode_ = ctx.m_frame_.mode;
+			ctx.m_cached_quality_level_ = ctx.m_frame_.quality_level;
+		} else {
+			ctx.m_cached_config_.reset();
+		}
+		ctx.m_partial_frames_ = 0;
+	}
+	t_end = std::chrono::steady_clock::now();
+	ctx.m_solve_ms_ = std::chrono::duration<double, std::milli>(t_end - t_start).count();
+#ifdef SHOW_TIME
+	std::cout << "FGS processing time = " << ctx.m_solve_ms_ * 1000 << " [us]" << std::endl;
+#endif
+	this->update_quality_level(*config, ctx);
+	return res;
+}
+
+/**
+ * @brief render samples into a depthmap
+ * 
+ * @param points : samples
+ * @param size : resolution
+ * @param dmap : output depthmap (32FC1, 0 without sample)
+ */
+inline void render_points(const std::vector<Sparse_Point>& points, const cv::Size& size, cv::Mat& dmap)
+{
+	dmap.create(size, CV_32FC1);
+	dmap.setTo(0.0);
+	for (const Sparse_Point& p : points)
+		dmap.at<float>(p.v, p.u) = p.z;
+}
+
+/**
+ * @brief flood depthmap of the last frame (rendered on demand)
+ * 
+ * @return cv::Mat : depthmap (32FC1)
+ */
+cv::Mat upsampling_context::get_flood_depthMap()
+{
+	render_points(this->m_frame_.flood_points, this->m_frame_.guide_size, this->m_flood_dmap_);
+	return this->m_flood_dmap_;
+}
+
+/**
+ * @brief spot depthmap of the last frame (rendered on demand)
+ * 
+ * @return cv::Mat : depthmap (32FC1)
+ */
+cv::Mat upsampling_context::get_spot_depthMap()
+{
+	render_points(this->m_frame_.spot_points, this->m_frame_.guide_size, this->m_spot_dmap_);
+	return this->m_spot_dmap_;
+}
+
+/**
+ * @brief Mat header on a view (no copy)
+ * 
+ * @param view : view of caller memory
+ * @param type : expected type (-1: CV_8UC1 or CV_8UC3)
+ * @param size : expected size (empty: any)
+ * @param mat : output header (empty for an empty view)
+ * @return true : valid (or empty) view
+ * @return false : type, size or step does not match
+ */
+inline bool view_to_mat(const Upsampling_View& view, int type, const cv::Size& size, cv::Mat& mat)
+{
+	mat.release();
+	if (view.data == nullptr)
+		return true;
+	if (type < 0 ? (view.type != CV_8UC1 && view.type != CV_8UC3) : view.type != type)
 		return false;
-	this->initialization(dense, conf);
-	// set mode
-	m_mode_ = 0;
-	if (!pc_flood.empty()) { // flood
-		m_mode_ = 1;
-	}
-	if (!pc_spot.empty()) { // spot
-		if(m_mode_ == 1)
-			m_mode_ = 3;
-		else
-			m_mode_ = 2;
+	if (view.width <= 0 || view.height <= 0)
+		return false;
+	if (!size.empty() && (view.width != size.width || view.height != size.height))
+		return false;
+	size_t row_bytes = static_cast<size_t>(view.width) * CV_ELEM_SIZE(view.type);
+	size_t step = view.step != 0 ? view.step : row_bytes;
+	if (step < row_bytes || step % CV_ELEM_SIZE1(view.type) != 0)
+		return false;
+	mat = cv::Mat(view.height, view.width, view.type, view.data, step);
+	return true;
+}
+
+/**
+ * @brief Upsampling main processing on caller memory
+ * 
+ * Views are wrapped by Mat headers: inputs are read in place and results are
+ * written into the output views, nothing is copied or reallocated. Sizes,
+ * types and steps are validated before processing, on the parameter snapshot
+ * the frame runs on (a concurrent set_output_scale() applies to the next call).
+ * Without a conf view the confidence goes to a context buffer, allocated by
+ * the first call and again only when the output size changes.
+ * 
+ * @param ctx : context of the stream
+ * @param guide : guide image (guide size, CV_8UC1 or CV_8UC3)
+ * @param flood : flood point cloud (grid size, CV_32FC3, can be empty)
+ * @param spot : spot point cloud (CV_32FC3, can be empty)
+ * @param dense : output dense depthmap (output size, CV_32FC1)
+ * @param conf : output confidence (output size, CV_32FC1, empty: not returned, kept in the context)
+ * @return int : Upsampling_Status
+ */
+int upsampling::run_view(upsampling_context& ctx, const Upsampling_View& guide, const Upsampling_View& flood, 
+							const Upsampling_View& spot, const Upsampling_View& dense, const Upsampling_View& conf) const
+{
+	std::shared_ptr<const Upsampling_Config> config = this->get_config(); // validated and run on one snapshot
+	cv::Size guide_size(this->m_guide_width_, this->m_guide_height_);
+	cv::Size output_size = this->get_output_size(*config);
+	cv::Mat img_guide, pc_flood, pc_spot, img_dense, img_conf;
+	if (!view_to_mat(guide, -1, guide_size, img_guide) 
+		|| !view_to_mat(flood, CV_32FC3, cv::Size(this->m_grid_width_, this->m_grid_height_), pc_flood)
+		|| !view_to_mat(spot, CV_32FC3, cv::Size(), pc_spot) 
+		|| !view_to_mat(dense, CV_32FC1, output_size, img_dense) || img_dense.empty()
+		|| !view_to_mat(conf, CV_32FC1, output_size, img_conf))
+		return UPSAMPLING_INVALID_VIEW;
+	if (img_conf.empty()) { // no allocation once the context holds a buffer of the output size
+		ctx.m_view_conf_.create(output_size, CV_32FC1);
+		img_conf = ctx.m_view_conf_;
+	}
+	const uchar* dense_data = img_dense.data;
+	const uchar* conf_data = img_conf.data;
+	int status;
+	try {
+		status = this->run_frame(ctx, config, img_guide, pc_flood, pc_spot, img_dense, img_conf, nullptr, false, nullptr) 
+					? UPSAMPLING_OK : UPSAMPLING_NO_INPUT;
+	} catch (const cv::Exception&) {
+		return UPSAMPLING_ERROR;
+	}
+	if (img_dense.data != dense_data || img_conf.data != conf_data) // never reallocated, checked for safety
+		return UPSAMPLING_ERROR;
+	return status;
+}
+
+/**
+ * @brief frames and pixels skipped by static frame skip
+ * 
+ * @param stats : output statistics
+ */
+void upsampling_context::get_skip_stats(Static_Skip_Stats& stats)
+{
+	stats = this->m_skip_stats_;
+	if (stats.num_frames == 0) {
+		stats.skipped_pixel_ratio = 0.0;
+		return;
+	}
+	stats.skipped_frame_ratio = static_cast<double>(stats.num_skipped) / stats.num_frames;
+	stats.skipped_pixel_ratio = this->m_skip_stats_.skipped_pixel_ratio / stats.num_frames;
+}
+
+/**
+ * @brief mark guide blocks changed by a point
+ * 
+ * A point changes the flood range around its projection (range_flood).
+ * 
+ * @param cfg : parameters
+ * @param p : point (invalid points are ignored)
+ * @param dirty_blocks : changed blocks
+ */
+void upsampling::mark_dirty_point(const Upsampling_Config& cfg, const cv::Vec3f& p, cv::Mat& dirty_blocks) const
+{
+	if (!(p[2] > 0.f)) // invalid or NaN
+		return;
+	float u = p[0] * cfg.fx / p[2] + cfg.cx;
+	float v = p[1] * cfg.fy / p[2] + cfg.cy;
+	int r = cfg.range_flood + 1;
+	if (u + r < 0.f || v + r < 0.f) // outside, avoids overflow of the casts below
+		return;
+	int bx0 = std::max(0, static_cast<int>(u - r) / STATIC_BLOCK_SIZE);
+	int by0 = std::max(0, static_cast<int>(v - r) / STATIC_BLOCK_SIZE);
+	int bx1 = std::min(dirty_blocks.cols - 1, static_cast<int>(std::min(u + r, 1e6f)) / STATIC_BLOCK_SIZE);
+	int by1 = std::min(dirty_blocks.rows - 1, static_cast<int>(std::min(v + r, 1e6f)) / STATIC_BLOCK_SIZE);
+	for (int by = by0; by <= by1; ++by) {
+		for (int bx = bx0; bx <= bx1; ++bx)
+			dirty_blocks.at<uchar>(by, bx) = 1;
+	}
+}
+
+/**
+ * @brief true if a point changed beyond the threshold (validity or z)
+ * 
+ * @param a : point of the cache
+ * @param b : new point
+ * @param thresh : z threshold
+ * @return true : changed
+ */
+inline bool point_changed(const cv::Vec3f& a, const cv::Vec3f& b, float thresh)
+{
+	bool valid_a = a[2] > 0.f;
+	bool valid_b = b[2] > 0.f;
+	if (valid_a != valid_b)
+		return true;
+	return valid_a && fabs(a[2] - b[2]) > thresh;
+}
+
+/**
+ * @brief detect changes of the inputs against the cache of the context
+ * 
+ * Guide: mean absolute difference of sampled pixels per block. Flood: z
+ * difference per point, a changed point also marks its 8 neighbours (edge
+ * filtering) and the blocks around the old and new projections. Spot: any
+ * change recomputes the frame.
+ * 
+ * @param cfg : parameters
+ * @param ctx : context with a cache
+ * @param img_guide : guide image
+ * @param pc_flood : flood point cloud
+ * @param pc_spot : spot point cloud
+ * @param dirty : output changed region (CHANGE_PARTIAL)
+ * @return int : Static_Change
+ */
+int upsampling::detect_changes(const Upsampling_Config& cfg, upsampling_context& ctx, const cv::Mat& img_guide, 
+								const cv::Mat& pc_flood, const cv::Mat& pc_spot, cv::Rect& dirty) const
+{
+	if (img_guide.size() != ctx.m_prev_guide_.size() || img_guide.type() != ctx.m_prev_guide_.type()
+		|| pc_flood.size() != ctx.m_prev_flood_.size() || pc_spot.size() != ctx.m_prev_spot_.size())
+		return CHANGE_FULL;
+	if ((!pc_flood.empty() && pc_flood.type() != CV_32FC3) || (!pc_spot.empty() && pc_spot.type() != CV_32FC3))
+		return CHANGE_FULL;
+	float depth_thresh = cfg.static_depth_thresh;
+	// spot
+	for (int r = 0; r < pc_spot.rows; ++r) {
+		const cv::Vec3f* a = ctx.m_prev_spot_.ptr<cv::Vec3f>(r);
+		const cv::Vec3f* b = pc_spot.ptr<cv::Vec3f>(r);
+		for (int c = 0; c < pc_spot.cols; ++c) {
+			if (point_changed(a[c], b[c], depth_thresh))
+				return CHANGE_FULL;
+		}
+	}
+	// guide blocks
+	int width = img_guide.cols;
+	int height = img_guide.rows;
+	int cn = img_guide.channels();
+	cv::Mat& blocks = ctx.m_dirty_blocks_;
+	blocks.create((height + STATIC_BLOCK_SIZE - 1) / STATIC_BLOCK_SIZE, (width + STATIC_BLOCK_SIZE - 1) / STATIC_BLOCK_SIZE, CV_8UC1);
+	const cv::Mat& prev_guide = ctx.m_prev_guide_;
+	float guide_thresh = cfg.static_guide_thresh;
+	cv::parallel_for_(cv::Range(0, blocks.rows), [&img_guide, &prev_guide, &blocks, width, height, cn, guide_thresh]
+						(const cv::Range& range) -> void {
+		for (int by = range.start; by < range.end; ++by) {
+			uchar* flag = blocks.ptr<uchar>(by);
+			int y_end = std::min(height, (by + 1) * STATIC_BLOCK_SIZE);
+			for (int bx = 0; bx < blocks.cols; ++bx) {
+				int x_end = std::min(width, (bx + 1) * STATIC_BLOCK_SIZE);
+				int sum = 0, count = 0;
+				for (int y = by * STATIC_BLOCK_SIZE; y < y_end; y += STATIC_SAMPLE_STEP) {
+					const uchar* a = prev_guide.ptr<uchar>(y);
+					const uchar* b = img_guide.ptr<uchar>(y);
+					for (int x = bx * STATIC_BLOCK_SIZE; x < x_end; x += STATIC_SAMPLE_STEP) {
+						for (int k = 0; k < cn; ++k)
+							sum += std::abs(a[x * cn + k] - b[x * cn + k]);
+						count += cn;
+					}
+				}
+				flag[bx] = sum > guide_thresh * count ? 1 : 0;
+			}
+		}
+	});
+	// flood points
+	cv::Mat& cells = ctx.m_dirty_cells_;
+	cells.create(pc_flood.size(), CV_8UC1);
+	cells.setTo(0);
+	for (int r = 0; r < pc_flood.rows; ++r) {
+		const cv::Vec3f* a = ctx.m_prev_flood_.ptr<cv::Vec3f>(r);
+		const cv::Vec3f* b = pc_flood.ptr<cv::Vec3f>(r);
+		for (int c = 0; c < pc_flood.cols; ++c) {
+			if (!point_changed(a[c], b[c], depth_thresh))
+				continue;
+			cv::Rect neighbours = cv::Rect(c - 1, r - 1, 3, 3) & cv::Rect(0, 0, pc_flood.cols, pc_flood.rows);
+			cells(neighbours).setTo(1);
+		}
+	}
+	for (int r = 0; r < pc_flood.rows; ++r) {
+		const uchar* flag = cells.ptr<uchar>(r);
+		for (int c = 0; c < pc_flood.cols; ++c) {
+			if (flag[c] == 0)
+				continue;
+			this->mark_dirty_point(cfg, ctx.m_prev_flood_.at<cv::Vec3f>(r, c), blocks);
+			this->mark_dirty_point(cfg, pc_flood.at<cv::Vec3f>(r, c), blocks);
+		}
+	}
+	// changed region
+	cv::Rect block_rect;
+	bool changed = false;
+	for (int by = 0; by < blocks.rows; ++by) {
+		const uchar* flag = blocks.ptr<uchar>(by);
+		for (int bx = 0; bx < blocks.cols; ++bx) {
+			if (flag[bx] == 0)
+				continue;
+			block_rect = changed ? (block_rect | cv::Rect(bx, by, 1, 1)) : cv::Rect(bx, by, 1, 1);
+			changed = true;
+		}
+	}
+	if (!changed)
+		return CHANGE_NONE;
+	dirty = cv::Rect(block_rect.x * STATIC_BLOCK_SIZE, block_rect.y * STATIC_BLOCK_SIZE, 
+						block_rect.width * STATIC_BLOCK_SIZE, block_rect.height * STATIC_BLOCK_SIZE);
+	dirty &= cv::Rect(0, 0, width, height);
+	if (ctx.m_cached_mode_ != 1 || dirty.area() > STATIC_MAX_PARTIAL_AREA * width * height) // spot is solved globally
+		return CHANGE_FULL;
+	return CHANGE_PARTIAL;
+}
+
+/**
+ * @brief parameters of a frame reduced by its quality level
+ * 
+ * @param frame : frame (quality level)
+ * @param cfg : parameter snapshot of the frame
+ * @param reduced : buffer of reduced parameters
+ * @return const Upsampling_Config& : cfg or reduced
+ */
+const Upsampling_Config& upsampling::get_frame_config(const Upsampling_Frame& frame, const Upsampling_Config& cfg, 
+														Upsampling_Config& reduced) const
+{
+	if (frame.quality_level <= QUALITY_FULL || cfg.latency_budget_ms <= 0.f)
+		return cfg;
+	reduced = cfg;
+	if (frame.quality_level >= QUALITY_FEWER_ITER) {
+		reduced.fgs_num_iter_flood = 1;
+		reduced.fgs_num_iter_spot = 1;
+		reduced.pcg_max_iter = std::max(1, cfg.pcg_max_iter / 2);
+	}
+	if (frame.quality_level >= QUALITY_NO_PREPROCESSING) {
+		reduced.use_preprocessing = false;
+		reduced.flood_proc = FLOOD_PROC_NONE;
+	}
+	if (frame.quality_level >= QUALITY_HALF_RESOLUTION)
+		reduced.fgs_downscale = 2 * cfg.fgs_downscale;
+	return reduced;
+}
+
+/**
+ * @brief quality level of the next frame of a context
+ * 
+ * The smoothed run() time is compared with the budget. Quality is lowered
+ * after QUALITY_DOWN_FRAMES frames over budget, to the next level which
+ * reduces the slower stage, and raised by one level after QUALITY_UP_FRAMES
+ * frames under QUALITY_UP_RATIO of the budget.
+ * 
+ * @param cfg : parameter snapshot of the last frame
+ * @param ctx : context, stage times of the last frame are set
+ */
+void upsampling::update_quality_level(const Upsampling_Config& cfg, upsampling_context& ctx) const
+{
+	if (cfg.latency_budget_ms <= 0.f) { // off
+		ctx.m_quality_level_ = QUALITY_FULL;
+		ctx.m_avg_ms_ = -1.0;
+		ctx.m_num_over_ = 0;
+		ctx.m_num_under_ = 0;
+		return;
+	}
+	double total_ms = ctx.m_prepare_ms_ + ctx.m_solve_ms_;
+	if (ctx.m_avg_ms_ < 0.0)
+		ctx.m_avg_ms_ = total_ms;
+	else
+		ctx.m_avg_ms_ += QUALITY_AVG_WEIGHT * (total_ms - ctx.m_avg_ms_);
+	if (ctx.m_avg_ms_ > cfg.latency_budget_ms) {
+		ctx.m_num_over_ += 1;
+		ctx.m_num_under_ = 0;
+	} else if (ctx.m_avg_ms_ < cfg.latency_budget_ms * QUALITY_UP_RATIO) {
+		ctx.m_num_under_ += 1;
+		ctx.m_num_over_ = 0;
+	} else {
+		ctx.m_num_over_ = 0;
+		ctx.m_num_under_ = 0;
+	}
+	int level = ctx.m_quality_level_;
+	if (ctx.m_num_over_ >= QUALITY_DOWN_FRAMES && level < QUALITY_LOWEST) {
+		level += 1;
+		bool prepare_slower = ctx.m_prepare_ms_ > ctx.m_solve_ms_ && cfg.use_preprocessing;
+		if (prepare_slower && level < QUALITY_NO_PREPROCESSING)
+			level = QUALITY_NO_PREPROCESSING;
+		else if (!prepare_slower && level == QUALITY_NO_PREPROCESSING) // does not reduce solve()
+			level = QUALITY_HALF_RESOLUTION;
+	} else if (ctx.m_num_under_ >= QUALITY_UP_FRAMES && level > QUALITY_FULL) {
+		level -= 1;
+	}
+	if (level != ctx.m_quality_level_) { // restart measurement at the new level
+		ctx.m_quality_level_ = level;
+		ctx.m_avg_ms_ = -1.0;
+		ctx.m_num_over_ = 0;
+		ctx.m_num_under_ = 0;
+	}
+}
+
+typedef struct Batch_Range{
+	std::mutex mutex;
+	int begin = 0; // next frame of the owner
+	int end = 0; // end of the range, thieves take the upper part
+} Batch_Range; // frames of one worker in run_batch()
+
+/**
+ * @brief take the next frame of a worker, steal half of the largest range if empty
+ * 
+ * @param ranges : ranges of all workers
+ * @param worker : worker index
+ * @param idx : output frame index
+ * @return true : got a frame
+ * @return false : all frames are taken
+ */
+static bool take_batch_frame(std::vector<Batch_Range>& ranges, int worker, int& idx)
+{
+	Batch_Range& own = ranges[worker];
+	while (true) {
+		{
+			std::lock_guard<std::mutex> lock(own.mutex);
+			if (own.begin < own.end) {
+				idx = own.begin++;
+				return true;
+			}
+		}
+		// steal: find the victim with the most frames left
+		int victim = -1, max_left = 0;
+		for (int w = 0; w < static_cast<int>(ranges.size()); ++w) {
+			if (w == worker)
+				continue;
+			std::lock_guard<std::mutex> lock(ranges[w].mutex);
+			int left = ranges[w].end - ranges[w].begin;
+			if (left > max_left) {
+				max_left = left;
+				victim = w;
+			}
+		}
+		if (victim < 0) // nothing left
+			return false;
+		std::lock(own.mutex, ranges[victim].mutex);
+		std::lock_guard<std::mutex> lock_own(own.mutex, std::adopt_lock);
+		std::lock_guard<std::mutex> lock_victim(ranges[victim].mutex, std::adopt_lock);
+		Batch_Range& other = ranges[victim];
+		int left = other.end - other.begin;
+		if (left <= 0) // taken meanwhile, retry
+			continue;
+		int mid = other.begin + left / 2; // steal upper half (at least one frame)
+		own.begin = mid;
+		own.end = other.end;
+		other.end = mid;
+	}
+}
+
+/**
+ * @brief run frames on worker threads for offline reprocessing
+ * 
+ * Each worker starts with a contiguous range of frames and its own context
+ * (buffers are reused across its frames). A worker that runs out of frames
+ * steals the upper half of the largest remaining range, so all cores stay
+ * busy even if frames differ in cost (mode 1 / mode 3).
+ * 
+ * @param frames : frames, outputs and status are written per frame
+ * @param num_frames : number of frames
+ * @param num_threads : number of workers (0: all cores)
+ * @return int : number of frames with UPSAMPLING_OK
+ */
+int upsampling::run_batch(Upsampling_Batch_Frame* frames, int num_frames, int num_threads) const
+{
+	if (frames == nullptr || num_frames <= 0)
+		return 0;
+	if (num_threads <= 0)
+		num_threads = static_cast<int>(std::thread::hardware_concurrency());
+	num_threads = std::max(1, std::min(num_threads, num_frames));
+	std::vector<Batch_Range> ranges(num_threads);
+	for (int w = 0; w < num_threads; ++w) {
+		ranges[w].begin = static_cast<int>(static_cast<int64_t>(num_frames) * w / num_threads);
+		ranges[w].end = static_cast<int>(static_cast<int64_t>(num_frames) * (w + 1) / num_threads);
+	}
+	std::atomic<int> num_ok(0);
+	auto worker = [this, frames, &ranges, &num_ok](int w) -> void {
+		upsampling_context ctx; // per worker buffers
+		int idx;
+		while (take_batch_frame(ranges, w, idx)) {
+			Upsampling_Batch_Frame& frame = frames[idx];
+			try {
+				bool res = this->run(ctx, frame.guide, frame.flood, frame.spot, frame.dense, frame.conf);
+				frame.status = res ? UPSAMPLING_OK : UPSAMPLING_NO_INPUT;
+			} catch (const cv::Exception&) {
+				frame.status = UPSAMPLING_ERROR;
+			}
+			if (frame.status == UPSAMPLING_OK)
+				num_ok += 1;
+		}
+	};
+	std::vector<std::thread> threads;
+	for (int w = 1; w < num_threads; ++w)
+		threads.push_back(std::thread(worker, w));
+	worker(0); // caller thread is worker 0
+	for (std::thread& th : threads)
+		th.join();
+	return num_ok.load();
+}
+
+/**
+ * @brief stage 1 of a mode and flood preprocessing
+ * 
+ * Stages of other modes and preprocessing are compiled out. Scratch of the
+ * preprocessing is kept in the frame.
+ * 
+ * @tparam MODE : 1: only flood, 2: only spot, 3: both flood and spot
+ * @tparam FLOOD_PROC : Flood_Preprocessing
+ * @param cfg : parameters of the frame
+ * @param img_guide : guide image
+ * @param pc_flood : flood point cloud 
+ * @param pc_spot : spot point cloud 
+ * @param frame : output frame buffers (cleared)
+ */
+template <int MODE, int FLOOD_PROC>
+void upsampling::prepare_variant(const Upsampling_Config& cfg, const cv::Mat& img_guide, const cv::Mat& pc_flood, 
+									const cv::Mat& pc_spot, Upsampling_Frame& frame) const
+{
+	if constexpr ((MODE & 1) != 0) {
+		if constexpr (FLOOD_PROC == FLOOD_PROC_NONE) {
+			this->pc2flood_points(cfg, pc_flood, frame);
+		} else if constexpr (FLOOD_PROC == FLOOD_PROC_PARALLAX) {
+			this->filter_parallax_devation_points(cfg, pc_flood, frame.pc_parallax);
+			this->pc2flood_points(cfg, frame.pc_parallax, frame);
+		} else if constexpr (FLOOD_PROC == FLOOD_PROC_EDGE) {
+			this->filter_parallax_devation_points(cfg, pc_flood, frame.pc_parallax);
+			this->filter_error_edge_points(cfg, img_guide, frame.pc_parallax, frame.pc_filtered);
+			this->pc2flood_points(cfg, frame.pc_filtered, frame);
+		} else { // FLOOD_PROC_INCREMENTAL, the cache needs a grid of the configured size
+			if (pc_flood.type() == CV_32FC3 && pc_flood.rows == this->m_grid_height_ && pc_flood.cols == this->m_grid_width_) {
+				this->update_flood_cache(cfg, img_guide, pc_flood, frame, frame.flood_cache.pc_out);
+				this->pc2flood_points(cfg, frame.flood_cache.pc_out, frame);
+			} else {
+				this->flood_depth_proc_with_edge(cfg, pc_flood, img_guide, frame);
+			}
+		}
+	}
+	if constexpr ((MODE & 2) != 0)
+		this->spot_depth_proc(cfg, pc_spot, frame);
+}
+
+/**
+ * @brief stage 1 of run(): projection and depth edge filtering (no FGS)
+ * 
+ * Stage 1 only reads parameters and writes the frame buffers, so it can run
+ * for the next frame while solve() of the current frame runs on another thread.
+ * The parameter snapshot is captured here and kept in the frame for solve().
+ * 
+ * @param img_guide : guide image 
+ * @param pc_flood : flood point cloud 
+ * @param pc_spot : spot point cloud 
+ * @param frame : output frame buffers
+ * @return true 
+ * @return false : no guide, guide of other resolution or no point cloud
+ */
+bool upsampling::prepare(const cv::Mat& img_guide, const cv::Mat& pc_flood, const cv::Mat& pc_spot, 
+							Upsampling_Frame& frame) const
+{
+	return this->prepare(this->get_config(), img_guide, pc_flood, pc_spot, frame);
+}
+
+/**
+ * @brief stage 1 of run() on a parameter snapshot taken by the caller
+ * 
+ * run() decides static frame skip and the masks on the same snapshot, so a
+ * frame never mixes parameters of two set_*() calls.
+ * 
+ * @param config : parameter snapshot of the frame, kept in the frame for solve()
+ * @param img_guide : guide image 
+ * @param pc_flood : flood point cloud 
+ * @param pc_spot : spot point cloud 
+ * @param frame : output frame buffers
+ * @return true 
+ * @return false : no guide, guide of other resolution or no point cloud
+ */
+bool upsampling::prepare(const std::shared_ptr<const Upsampling_Config>& config, const cv::Mat& img_guide, 
+							const cv::Mat& pc_flood, const cv::Mat& pc_spot, Upsampling_Frame& frame) const
+{
+	frame.mode = 0;
+	frame.config = config; // snapshot for all stages of the frame, also of an invalid one
+	if (img_guide.empty() || img_guide.size() != this->get_guide_size()) // no guide or other resolution
+		return false;
+	Upsampling_Config reduced;
+	const Upsampling_Config& cfg = this->get_frame_config(frame, *frame.config, reduced);
+	this->clear(cfg, frame);
+	frame.mode = this->get_mode(pc_flood, pc_spot);
+	if (cfg.specialized_pipeline && frame.mode != 0) { // stage 1 variant picked by mode and preprocessing of the snapshot
+		typedef void (upsampling::*Prepare_Variant)(const Upsampling_Config&, const cv::Mat&, const cv::Mat&, 
+													const cv::Mat&, Upsampling_Frame&) const;
+		static const Prepare_Variant variants[4][3] = {
+			{&upsampling::prepare_variant<1, FLOOD_PROC_NONE>, &upsampling::prepare_variant<2, FLOOD_PROC_NONE>, 
+				&upsampling::prepare_variant<3, FLOOD_PROC_NONE>},
+			{&upsampling::prepare_variant<1, FLOOD_PROC_PARALLAX>, &upsampling::prepare_variant<2, FLOOD_PROC_PARALLAX>, 
+				&upsampling::prepare_variant<3, FLOOD_PROC_PARALLAX>},
+			{&upsampling::prepare_variant<1, FLOOD_PROC_EDGE>, &upsampling::prepare_variant<2, FLOOD_PROC_EDGE>, 
+				&upsampling::prepare_variant<3, FLOOD_PROC_EDGE>},
+			{&upsampling::prepare_variant<1, FLOOD_PROC_INCREMENTAL>, &upsampling::prepare_variant<2, FLOOD_PROC_INCREMENTAL>, 
+				&upsampling::prepare_variant<3, FLOOD_PROC_INCREMENTAL>},
+		};
+		(this->*variants[cfg.flood_proc][frame.mode - 1])(cfg, img_guide, pc_flood, pc_spot, frame);
+		return true;
 	}
+	if (frame.mode & 1) // flood
+		this->flood_depth_proc(cfg, pc_flood, img_guide, frame);
+	if (frame.mode & 2) // spot
+		this->spot_depth_proc(cfg, pc_spot, frame);
+	return frame.mode != 0;
+}
 
-	if (m_mode_ == 0) { // invalid
+/**
+ * @brief stage 2 of run(): guide weights, FGS and merge of a prepared frame
+ * 
+ * @param ctx : context (solver and buffers)
+ * @param img_guide : guide image (same as prepare())
+ * @param frame : frame buffers of prepare()
+ * @param dense : upsampling result dense depthmap (not written with mask_only)
+ * @param conf : confidence map (not written with mask_only)
+ * @param mask : output foreground or occlusion mask (8UC1, nullptr: none), written by the final pass
+ * @param mask_only : dense/conf are context scratch, the final pass writes only the mask
+ * @param virtual_depth : virtual depth (32FC1, size of dense) of the occlusion mask (nullptr: foreground mask)
+ * @return true 
+ * @return false 
+ */
+bool upsampling::solve(upsampling_context& ctx, const cv::Mat& img_guide, const Upsampling_Frame& frame, 
+						cv::Mat& dense_out, cv::Mat& conf_out, cv::Mat* mask, bool mask_only, 
+						const cv::Mat* virtual_depth) const
+{
+	if (img_guide.empty()) // no guide
+		return false;
+	std::shared_ptr<const Upsampling_Config> config = frame.config ? frame.config : this->get_config();
+	Upsampling_Config reduced;
+	const Upsampling_Config& cfg = this->get_frame_config(frame, *config, reduced);
+	bool scratch = mask != nullptr && mask_only;
+	cv::Mat& dense = scratch ? ctx.m_fg_dense_ : dense_out;
+	cv::Mat& conf = scratch ? ctx.m_fg_conf_ : conf_out;
+	this->initialization(this->get_output_size(cfg), dense, conf);
+	Foreground_Target fg;
+	if (mask != nullptr) { // 0 outside the ROI of the solver
+		mask->create(dense.size(), CV_8UC1);
+		mask->setTo(0);
+		fg.mask = *mask;
+		fg.range.near_z = cfg.fg_near;
+		fg.range.far_z = cfg.fg_far;
+		fg.range.conf_threshold = cfg.fg_conf_threshold;
+		fg.mask_only = mask_only;
+		if (virtual_depth != nullptr) {
+			CV_Assert(virtual_depth->type() == CV_32FC1 && virtual_depth->size() == dense.size());
+			fg.virtual_depth = *virtual_depth;
+			fg.occlusion.margin = cfg.occlusion_margin;
+			fg.occlusion.conf_threshold = cfg.occlusion_conf_threshold;
+		}
+	}
+	if (frame.mode == 0) { // invalid
 		dense.setTo(std::nan(""));
 		conf.setTo(std::nan(""));
 		return false;
 	}
-	if (m_mode_ == 1) { // flood only
-		this->run_flood(img_guide, pc_flood, dense, conf);
+	cv::Mat guide = img_guide;
+	if (dense.size() != img_guide.size()) { // output_scale: guide on the output grid
+		cv::resize(img_guide, ctx.m_output_guide_, dense.size(), 0, 0, cv::INTER_AREA);
+		guide = ctx.m_output_guide_;
+	}
+	if (frame.mode == 1) { // flood only
+		this->flood_upsampling(cfg, ctx, guide, frame, cfg.conf_threshold, fg, dense, conf);
+		return true;
+	}
+	if (frame.mode == 2) { // spot only
+		this->spot_upsampling(cfg, ctx, guide, frame, cfg.conf_threshold, fg, dense, conf);
 		return true;
 	}
-	if (m_mode_ == 2) { // spot only
-		this->run_spot(img_guide, pc_spot, dense, conf);
+	if (frame.mode == 3 && cfg.fusion == FUSION_JOINT) { // flood + spot in one solve
+		this->joint_upsampling(cfg, ctx, guide, frame, fg, dense, conf);
 		return true;
 	}
-	if (m_mode_ == 3) { // flood + spot
-		cv::Mat denseSpot = cv::Mat::zeros(dense.size(), dense.type());
-		cv::Mat confSpot = cv::Mat::zeros(conf.size(), conf.type());
-		this->run_flood(img_guide, pc_flood, dense, conf);
-		this->run_spot(img_guide, pc_spot, denseSpot, confSpot);
-		// merge
-		denseSpot.copyTo(dense, this->m_flood_range_ == 0);
-		confSpot.copyTo(conf, this->m_spot_range_ == 0);
+	if (frame.mode == 3) { // flood + spot
+		Foreground_Target no_fg; // the merge is the final pass
+		this->initialization(dense.size(), ctx.m_dense_spot_, ctx.m_conf_spot_);
+		this->flood_upsampling(cfg, ctx, guide, frame, 0.f, no_fg, dense, conf);
+		this->spot_upsampling(cfg, ctx, guide, frame, 0.f, no_fg, ctx.m_dense_spot_, ctx.m_conf_spot_);
+		// merge, threshold by the merged confidence
+		this->merge_flood_spot(ctx.m_flood_range_, ctx.m_dense_spot_, ctx.m_conf_spot_, cfg.conf_threshold, fg, dense, conf);
 		return true;
 	}
 	return false;
@@ -778,20 +2782,29 @@ bool upsampling::run(const cv::Mat& img_guide, const cv::Mat& pc_flood, const cv
  * @param depth : input depthmap 
  * @param pc : output point cloud 
  */
-void upsampling::depth2pc(const cv::Mat& depth, cv::Mat& pc)
+void upsampling::depth2pc(const cv::Mat& depth, cv::Mat& pc) const
 {
 	pc.create(depth.size(), CV_32FC3);
-	float fx = this->m_fx_;
-	float fy = this->m_fy_;
-	float cx = this->m_cx_;
-	float cy = this->m_cy_;
+	std::shared_ptr<const Upsampling_Config> config = this->get_config();
+	float fx = config->fx;
+	float fy = config->fy;
+	float cx = config->cx;
+	float cy = config->cy;
+	const Upsampling_Tables& tables = *config->tables;
+	bool use_table = depth.cols <= this->m_guide_width_ && depth.rows <= this->m_guide_height_;
+	if (config->output_scale > 1 && depth.size() == this->get_output_size(*config)) { // dense of output_scale
+		get_output_intrinsics(*config, fx, fy, cx, cy);
+		use_table = false;
+	}
 
 	for (int y = 0; y < depth.rows; ++y) {
+		const float* d = depth.ptr<float>(y);
+		cv::Vec3f* p = pc.ptr<cv::Vec3f>(y);
+		float y_per_z = use_table ? tables.y_per_z[y] : (y - cy) / fy;
 		for (int x = 0; x < depth.cols; ++x) {
-			float z = depth.at<float>(y, x);
-			pc.at<cv::Vec3f>(y, x)[0] = (x - cx) * z / fx;
-			pc.at<cv::Vec3f>(y, x)[1] = (y - cy) * z / fy;
-			pc.at<cv::Vec3f>(y, x)[2] = z;
+			float z = d[x];
+			float x_per_z = use_table ? tables.x_per_z[x] : (x - cx) / fx;
+			p[x] = cv::Vec3f(x_per_z * z, y_per_z * z, z);
 		}
 	}
 }
@@ -802,13 +2815,14 @@ void upsampling::depth2pc(const cv::Mat& depth, cv::Mat& pc)
  * @param pc : input point cloud
  * @param depth : output depth image
  */
-void upsampling::pc2depthmap(const cv::Mat& pc, cv::Mat& depth)
+void upsampling::pc2depthmap(const cv::Mat& pc, cv::Mat& depth) const
 {
 	depth.create(cv::Size(this->m_guide_width_, this->m_guide_height_), CV_32FC1);
-	float fx = this->m_fx_;
-	float fy = this->m_fy_;
-	float cx = this->m_cx_;
-	float cy = this->m_cy_;
+	std::shared_ptr<const Upsampling_Config> config = this->get_config();
+	float fx = config->fx;
+	float fy = config->fy;
+	float cx = config->cx;
+	float cy = config->cy;
 
 	for (int r = 0; r < pc.rows; ++r) {
 		for (int c = 0; c < pc.cols; ++c) {
@@ -836,8 +2850,78 @@ void upsampling::pc2depthmap(const cv::Mat& pc, cv::Mat& depth)
  * @param filtered : output filtered depthmap
  * @param threshold : threshold
  */
-void upsampling::filter_by_confidence(const cv::Mat& dense, const cv::Mat& conf, cv::Mat& filtered, float threshold)
+void upsampling::filter_by_confidence(const cv::Mat& dense, const cv::Mat& conf, cv::Mat& filtered, float threshold) const
 {
-	dense.copyTo(filtered);
-	filtered.setTo(std::nan(""), conf < threshold);
-}
\ No newline at end of file
+	CV_Assert(dense.type() == CV_32FC1 && conf.type() == CV_32FC1 && dense.size() == conf.size());
+	filtered.create(dense.size(), CV_32FC1);
+	int w = dense.cols;
+	cv::parallel_for_(cv::Range(0, dense.rows), [&dense, &conf, &filtered, threshold, w](const cv::Range& rows) -> void {
+		for (int i = rows.start; i < rows.end; ++i)
+			confidence_mask_row(dense.ptr<float>(i), conf.ptr<float>(i), filtered.ptr<float>(i), w, threshold);
+	});
+}
+
+/**
+ * @brief foreground mask of dense depthmap
+ * 
+ * Separate pass of the mask fused into run(), for dense/conf computed before.
+ * 
+ * @param dense : input dense depthmap
+ * @param conf : confidence map
+ * @param mask : output foreground mask (8UC1, 255: fg_near <= dense <= fg_far and conf >= fg_conf_threshold)
+ */
+void upsampling::foreground_mask(const cv::Mat& dense, const cv::Mat& conf, cv::Mat& mask) const
+{
+	this->mask_pass(*this->get_config(), dense, conf, nullptr, mask);
+}
+
+/**
+ * @brief occlusion mask of dense depthmap against a virtual depth
+ * 
+ * Separate pass of the occlusion mask fused into run(), for dense/conf computed before.
+ * 
+ * @param dense : input dense depthmap
+ * @param conf : confidence map
+ * @param virtual_depth : virtual depth (32FC1, size of dense, <= 0 or NaN: no virtual object)
+ * @param occlusion : output occlusion mask (8UC1, 255: real depth in front of the virtual depth)
+ */
+void upsampling::occlusion_mask(const cv::Mat& dense, const cv::Mat& conf, const cv::Mat& virtual_depth, 
+								cv::Mat& occlusion) const
+{
+	this->mask_pass(*this->get_config(), dense, conf, &virtual_depth, occlusion);
+}
+
+/**
+ * @brief foreground or occlusion mask of dense/conf on given parameters
+ * 
+ * @param cfg : parameters (of the frame in run())
+ * @param dense : input dense depthmap
+ * @param conf : confidence map
+ * @param virtual_depth : virtual depth of the occlusion mask (32FC1, size of dense, nullptr: foreground mask)
+ * @param mask : output mask (8UC1)
+ */
+void upsampling::mask_pass(const Upsampling_Config& cfg, const cv::Mat& dense, const cv::Mat& conf, 
+							const cv::Mat* virtual_depth, cv::Mat& mask) const
+{
+	CV_Assert(dense.type() == CV_32FC1 && conf.type() == CV_32FC1 && dense.size() == conf.size());
+	CV_Assert(virtual_depth == nullptr 
+				|| (virtual_depth->type() == CV_32FC1 && virtual_depth->size() == dense.size()));
+	Foreground_Range fg_range;
+	fg_range.near_z = cfg.fg_near;
+	fg_range.far_z = cfg.fg_far;
+	fg_range.conf_threshold = cfg.fg_conf_threshold;
+	Occlusion_Test test;
+	test.margin = cfg.occlusion_margin;
+	test.conf_threshold = cfg.occlusion_conf_threshold;
+	mask.create(dense.size(), CV_8UC1);
+	int w = dense.cols;
+	cv::parallel_for_(cv::Range(0, dense.rows), [&dense, &conf, virtual_depth, &mask, &fg_range, &test, w](const cv::Range& rows) -> void {
+		for (int i = rows.start; i < rows.end; ++i) {
+			if (virtual_depth != nullptr)
+				occlusion_mask_row(dense.ptr<float>(i), conf.ptr<float>(i), virtual_depth->ptr<float>(i), 
+									mask.ptr<uchar>(i), w, test);
+			else
+				foreground_mask_row(dense.ptr<float>(i), conf.ptr<float>(i), mask.ptr<uchar>(i), w, fg_range);
+		}
+	});
+}
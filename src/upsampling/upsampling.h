@@ -1,6 +1,18 @@
 #pragma once
+#include "fgs_solver.h"
+#include "pcg_solver.h"
+#include "upsampling_kernels.h"
 #include <opencv2/opencv.hpp>
-#include <opencv2/ximgproc.hpp>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+const int UPSAMPLING_GUIDE_WIDTH = 960; // default guide width (specialized kernels)
+const int UPSAMPLING_GUIDE_HEIGHT = 540; // default guide height
+const int UPSAMPLING_GRID_WIDTH = 80; // default flood grid width (specialized kernels)
+const int UPSAMPLING_GRID_HEIGHT = 60; // default flood grid height
 
 typedef struct Upsampling_Params{
 	float fgs_lambda_flood; // 0.1~100
@@ -31,11 +43,317 @@ typedef struct Camera_Params{
 	float fy;
 } Camera_Params;
 
+enum Upsampling_Status {
+	UPSAMPLING_OK = 0, // processed
+	UPSAMPLING_NO_INPUT = 1, // no guide or no point cloud (outputs are NaN)
+	UPSAMPLING_ERROR = 2, // exception in processing (invalid input)
+	UPSAMPLING_INVALID_VIEW = 3, // size, type or step of a view does not match (nothing is written)
+	UPSAMPLING_UNSUPPORTED = 4, // parameters not supported by the API (upsampling_async: latency budget, static frame skip)
+};
+
+typedef struct Upsampling_View{
+	void* data = nullptr; // first pixel, memory of the caller (nullptr: no image)
+	int width = 0; // pixels per row
+	int height = 0; // rows
+	size_t step = 0; // bytes per row (0: packed)
+	int type = CV_32FC1; // OpenCV pixel type
+} Upsampling_View; // strided view of caller memory, never copied or reallocated
+
+enum Upsampling_Quality {
+	QUALITY_FULL = 0, // configured parameters
+	QUALITY_FEWER_ITER = 1, // one FGS iteration for flood and spot
+	QUALITY_NO_PREPROCESSING = 2, // + no depth edge preprocessing
+	QUALITY_HALF_RESOLUTION = 3, // + FGS at half resolution of the guide
+	QUALITY_LOWEST = QUALITY_HALF_RESOLUTION,
+};
+
+typedef struct Upsampling_Batch_Frame{
+	cv::Mat guide; // input guide image
+	cv::Mat flood; // input flood point cloud (can be empty)
+	cv::Mat spot; // input spot point cloud (can be empty)
+	cv::Mat dense; // output dense depthmap (allocated if empty)
+	cv::Mat conf; // output confidence (allocated if empty)
+	int status = UPSAMPLING_OK; // Upsampling_Status of the frame
+} Upsampling_Batch_Frame;
+
+enum Upsampling_Solver {
+	SOLVER_FGS = 0, // fast global smoother per frame
+	SOLVER_PCG = 1, // conjugate gradient warm started from the previous frame of the context
+};
+
+enum Upsampling_Fusion {
+	FUSION_MERGE = 0, // flood and spot solved separately, spot outside the flood range
+	FUSION_JOINT = 1, // flood and spot samples weighted in one right-hand side, solved once
+};
+
+enum Flood_Engine {
+	FLOOD_ENGINE_SOLVER = 0, // FGS (or SOLVER_PCG) over the guide
+	FLOOD_ENGINE_MESH = 1, // rasterized flood grid mesh, solver only in tiles of the edge bands
+};
+
+enum Spot_Engine {
+	SPOT_ENGINE_SOLVER = 0, // FGS (or SOLVER_PCG) over the guide
+	SPOT_ENGINE_INTERPOLATOR = 1, // Gaussian RBF on a coarse grid and joint bilateral upsampling
+};
+
+enum Flood_Preprocessing {
+	FLOOD_PROC_NONE = 0, // raw flood points
+	FLOOD_PROC_PARALLAX = 1, // parallax filtering only (a zero edge error threshold)
+	FLOOD_PROC_EDGE = 2, // parallax and edge error filtering
+	FLOOD_PROC_INCREMENTAL = 3, // FLOOD_PROC_EDGE of changed points only
+};
+
+typedef struct Static_Skip_Stats{
+	uint64_t num_frames = 0; // frames of run(ctx, ...)
+	uint64_t num_skipped = 0; // frames returned from the cache
+	uint64_t num_partial = 0; // frames recomputed only in the changed region
+	double skipped_frame_ratio = 0.0; // num_skipped / num_frames
+	double skipped_pixel_ratio = 0.0; // pixels not recomputed / all pixels
+} Static_Skip_Stats;
+
+typedef struct Upsampling_Tables{
+	std::vector<float> weight_flood; // FGS colour weight table of fgs_sigma_color_flood
+	std::vector<float> weight_spot; // FGS colour weight table of fgs_sigma_color_spot
+	std::vector<float> x_per_z; // (u - cx) / fx of guide columns
+	std::vector<float> y_per_z; // (v - cy) / fy of guide rows
+} Upsampling_Tables; // read only tables shared by all contexts
+
+typedef struct Upsampling_Config{
+	// upsampling main processing paramters
+	float fgs_lambda_flood = 220.f; // 0.1~1000
+	float fgs_sigma_color_flood = 4.f; // 0~256
+	float fgs_lambda_attenuation = 0.25f;
+	float fgs_lambda_spot = 700.f; 
+	float fgs_sigma_color_spot = 5.f; // 1~20
+	int fgs_num_iter_flood = 1; //1~5
+	int fgs_num_iter_spot = 2;
+	// flood preprocessing paramters
+	bool use_preprocessing = true;
+	int guide_edge_dilate_size = 4; // (1~10) dilate size of guide image edge
+	float z_continuous_thresh = 0.1f; // (0~1) z threshold for continuous region 
+	float occlusion_thresh = 10.5f; // (0~20.0)  threshold for justification of occlusion (max pixels between neigbors)
+	int range_flood = 20; // 2~40
+	float depth_diff_thresh = 0.1f; // meter
+	float guide_diff_thresh = 40.0f; // 0~ 255
+	int min_diff_count = 1; // 0~8
+	bool incremental_preprocessing = false; // recompute only changed flood points of the edge filtering
+	float incremental_depth_tolerance = 0.005f; // (m) change of a flood point to be recomputed
+	float incremental_guide_tolerance = 2.0f; // (0~255) change of the guide patch of a point to be recomputed
+	// camera paramters
+	float fx = 135.51f;
+	float fy = 135.51f;
+	float cx = 159.81f;
+	float cy = 120.41f;
+	int fgs_downscale = 1; // FGS resolution divider (1: guide resolution)
+	// solver
+	int solver = SOLVER_FGS; // Upsampling_Solver
+	float pcg_tolerance = 1e-3f; // relative residual to stop SOLVER_PCG
+	int pcg_max_iter = 8; // SOLVER_PCG iterations per frame at most
+	// flood + spot fusion
+	int fusion = FUSION_MERGE; // Upsampling_Fusion
+	float joint_flood_weight = 1.f; // FUSION_JOINT data weight of flood samples
+	float joint_spot_weight = 0.1f; // FUSION_JOINT data weight of spot samples
+	// flood engine
+	int flood_engine = FLOOD_ENGINE_SOLVER; // Flood_Engine (not used by FUSION_JOINT)
+	int mesh_tile_size = 32; // (output pixels) solver tile of the edge bands of FLOOD_ENGINE_MESH
+	// spot engine
+	int spot_engine = SPOT_ENGINE_SOLVER; // Spot_Engine (not used by FUSION_JOINT)
+	int spot_grid_step = 8; // (output pixels) node distance of the coarse grid of SPOT_ENGINE_INTERPOLATOR
+	float spot_rbf_sigma = 0.f; // (output pixels) RBF width of SPOT_ENGINE_INTERPOLATOR, 0: mean sample distance
+	// quality control
+	float latency_budget_ms = 0.f; // run() time per frame to hold, 0: quality control off
+	// static frame skip
+	float static_guide_thresh = 0.f; // (0~255) mean guide difference of a changed block, 0: static frame skip off
+	float static_depth_thresh = 0.02f; // (m) z difference of a changed point
+	// post processing
+	float conf_threshold = 0.f; // dense is NaN where conf < conf_threshold, 0: off
+	int output_scale = 1; // output resolution divider of dense/conf (1: guide resolution)
+	float fg_near = 0.f; // (m) nearest depth of the foreground mask
+	float fg_far = 0.f; // (m) farthest depth of the foreground mask (0: empty mask)
+	float fg_conf_threshold = 0.f; // minimum confidence of the foreground mask
+	float occlusion_margin = 0.01f; // (m) tie band of the occlusion mask around the virtual depth
+	float occlusion_conf_threshold = 0.f; // real depth of lower confidence never occludes
+	// pipeline
+	bool specialized_pipeline = true; // stage 1 template variant per mode and preprocessing (false: generic preprocessing)
+	int flood_proc = FLOOD_PROC_EDGE; // Flood_Preprocessing of the parameters, derived by set_config()
+	// processing flag
+	bool depth_edge_proc_on = true;
+	/* bool guide_edge_proc_on = true; */
+	std::shared_ptr<const Upsampling_Tables> tables; // tables of the parameters above
+} Upsampling_Config; // immutable parameter snapshot
+
+typedef struct Flood_Cache{
+	std::shared_ptr<const Upsampling_Config> config; // parameters of the cache (empty: no cache)
+	cv::Mat pc_in; // 32FC3 flood points of the cache
+	cv::Mat pc_parallax; // 32FC3 points after parallax filtering
+	cv::Mat z_map; // 32FC3 (u, v, z) of the points
+	cv::Mat guide_val; // 32FC1 guide patch average at the projection of the points
+	cv::Mat edge_mask; // 8UC1 depth edge points
+	cv::Mat err_mask0; // 8UC1 zeros (input of stage 1)
+	cv::Mat err_mask1; // 8UC1 error points of stage 1
+	cv::Mat err_mask2; // 8UC1 error points of stage 2
+	cv::Mat pc_out; // 32FC3 output points (error points are NaN)
+	cv::Mat changed; // 8UC1 scratch: points with changed position or guide patch
+	cv::Mat update; // 8UC1 scratch: points to be recomputed
+	cv::Mat edge_changed; // 8UC1 scratch: changed edge flags
+	cv::Mat err_changed; // 8UC1 scratch: changed error flags of stage 1
+	int num_updated = 0; // points recomputed by the last frame (error stage 2)
+} Flood_Cache; // per point results of flood edge filtering of the last frame
+
+typedef struct Sparse_Point{
+	int u; // guide column
+	int v; // guide row
+	float z; // depth
+	float w; // data weight of the solver
+} Sparse_Point; // projected depth sample
+
+typedef struct Upsampling_Frame{
+	int mode = 0; // 0: no processing, 1: only flood, 2: only spot, 3: both flood and spot
+	int quality_level = QUALITY_FULL; // Upsampling_Quality of the frame
+	cv::Size guide_size; // resolution of the samples and of dense/conf (guide / output_scale)
+	std::vector<Sparse_Point> flood_points; // projected flood samples (a later sample of a pixel replaces the earlier)
+	std::vector<Sparse_Point> spot_points; // projected spot samples
+	cv::Rect flood_roi; // ROI for flood
+	cv::Rect spot_roi; // ROI for spot
+	std::shared_ptr<const Upsampling_Config> config; // parameters captured at frame start
+	Flood_Cache flood_cache; // incremental preprocessing
+	cv::Mat pc_parallax; // 32FC3 scratch: flood points after parallax filtering
+	cv::Mat pc_filtered; // 32FC3 scratch: flood points after edge error filtering
+	std::vector<float> proj_u; // scratch: projected u of a flood row
+	std::vector<float> proj_v; // scratch: projected v of a flood row
+	cv::Mat flood_grid; // 32FC3 (u, v, z) of the flood grid on the output grid, z 0: no sample
+} Upsampling_Frame; // per frame buffers
+
+typedef struct Foreground_Target{
+	cv::Mat mask; // 8UC1 output at dense resolution (empty: no mask)
+	Foreground_Range range; // depth and confidence bounds
+	cv::Mat virtual_depth; // 32FC1 at dense resolution (non-empty: mask is the occlusion mask against it)
+	Occlusion_Test occlusion; // tie handling of the occlusion mask
+	bool mask_only = false; // the final pass writes only the mask
+} Foreground_Target; // foreground or occlusion mask fused into the final pass of solve()
+
+typedef struct Warm_Start{
+	cv::Mat depth; // 32FC1 SOLVER_PCG solution of the last frames (output size)
+	cv::Mat conf; // 32FC1 smoothed mask of the last frames (output size)
+	cv::Rect roi; // region of depth/conf solved by the last frames (empty: none)
+} Warm_Start; // initial estimates of SOLVER_PCG, kept at the output size over ROI changes
+
+/**
+ * @brief per stream state of upsampling (frame buffers and solver scratch)
+ * 
+ * A context serves one stream on one thread at a time. Any number of
+ * contexts can run concurrently on the same upsampling configuration.
+ */
+class upsampling_context
+{
+public:
+	upsampling_context() {};
+	~upsampling_context() {};
+	// for show depthmap of the last frame (rendered from the samples on demand)
+	cv::Mat get_flood_depthMap();
+	cv::Mat get_spot_depthMap();
+	// Upsampling_Quality of the last frame
+	int get_quality_level() {return this->m_frame_.quality_level;};
+	// stage times of the last frame
+	void get_stage_times(double& prepare_ms, double& solve_ms) {prepare_ms = this->m_prepare_ms_; solve_ms = this->m_solve_ms_;};
+	// frames and pixels skipped by static frame skip
+	void get_skip_stats(Static_Skip_Stats& stats);
+	// SOLVER_PCG iterations and relative residual of the last solve (0 iterations: solved by FGS)
+	void get_solver_stats(int& num_iter, float& residual) {num_iter = this->m_pcg_iter_; residual = this->m_pcg_.get_residual();};
+private:
+	friend class upsampling;
+	Upsampling_Frame m_frame_; // frame buffers of run()
+	fgs_solver m_solver_; // guide weights and scratch of FGS
+	pcg_solver m_pcg_; // scratch of SOLVER_PCG
+	Warm_Start m_warm_flood_; // SOLVER_PCG estimates of flood
+	Warm_Start m_warm_spot_; // SOLVER_PCG estimates of spot
+	Warm_Start m_warm_joint_; // SOLVER_PCG estimates of FUSION_JOINT
+	cv::Mat m_pcg_ones_; // 32FC1 unit data weights of the confidence system
+	std::vector<Sparse_Point> m_joint_points_; // weighted flood and spot samples of FUSION_JOINT
+	// FLOOD_ENGINE_MESH
+	cv::Mat m_mesh_zmap_; // 32FC3 (u, v, z) map of the flood grid for depth edges
+	cv::Mat m_mesh_edge_; // 8UC1 depth edge points of the flood grid
+	cv::Mat m_mesh_guide_edge_; // 8UC1 guide edge pixels of the ROI
+	cv::Mat m_mesh_guide_sum_; // 32SC1 integral image of the guide edge pixels
+	cv::Mat m_mesh_band_; // 8UC1 pixels of the edge bands
+	std::vector<cv::Rect> m_mesh_tiles_; // solver tiles holding band pixels
+	std::vector<fgs_solver> m_mesh_solvers_; // FGS per stripe of tiles
+	std::vector<cv::Mat> m_mesh_sparse_; // 32FC1 FGS buffer of sparse depth per stripe of tiles
+	std::vector<cv::Mat> m_mesh_mask_; // 32FC1 FGS buffer of mask per stripe of tiles
+	// SPOT_ENGINE_INTERPOLATOR
+	cv::Mat m_spot_grid_z_; // 32FC1 depth of the coarse grid
+	cv::Mat m_spot_grid_c_; // 32FC1 confidence of the coarse grid
+	cv::Mat m_spot_grid_guide_; // guide at the nodes of the coarse grid
+	std::vector<float> m_spot_rbf_x_; // RBF weights of the samples per node column
+	std::vector<float> m_spot_rbf_y_; // RBF weights of the samples per node row
+	int m_pcg_iter_ = 0; // SOLVER_PCG iterations of the last solve
+	cv::Mat m_guide_; // FGS buffer of downscaled guide
+	cv::Mat m_sparse_; // 32FC1 FGS buffer of sparse depth
+	cv::Mat m_mask_; // 32FC1 FGS buffer of mask
+	cv::Mat m_flood_range_; // 8UC1 flood range of the last solve
+	cv::Mat m_flood_dmap_; // 32FC1 buffer of get_flood_depthMap()
+	cv::Mat m_spot_dmap_; // 32FC1 buffer of get_spot_depthMap()
+	cv::Mat m_view_conf_; // 32FC1 confidence of run_view() without conf view (allocated once per output size)
+	cv::Mat m_output_guide_; // guide at output resolution (output_scale > 1)
+	// quality control
+	int m_quality_level_ = QUALITY_FULL; // level of the next frame
+	double m_prepare_ms_ = 0.0; // prepare() time of the last frame
+	double m_solve_ms_ = 0.0; // solve() time of the last frame
+	double m_avg_ms_ = -1.0; // smoothed run() time since the last level change (< 0: no frame)
+	int m_num_over_ = 0; // consecutive frames over budget
+	int m_num_under_ = 0; // consecutive frames well under budget
+	// static frame skip
+	std::shared_ptr<const Upsampling_Config> m_cached_config_; // parameters of the cache (empty: no cache)
+	int m_cached_mode_ = 0; // mode of the cache
+	int m_cached_quality_level_ = QUALITY_FULL; // quality level of the cache
+	cv::Mat m_prev_guide_; // guide of the cache
+	cv::Mat m_prev_flood_; // flood point cloud of the cache
+	cv::Mat m_prev_spot_; // spot point cloud of the cache
+	cv::Mat m_cached_dense_; // 32FC1 cached dense depthmap
+	cv::Mat m_cached_conf_; // 32FC1 cached confidence
+	cv::Mat m_part_dense_; // 32FC1 dense depthmap of partial recompute
+	cv::Mat m_part_conf_; // 32FC1 confidence of partial recompute
+	int m_partial_frames_ = 0; // partial recomputes since the last full solve
+	cv::Mat m_dirty_blocks_; // 8UC1 changed guide blocks
+	cv::Mat m_dirty_cells_; // 8UC1 changed flood points
+	Static_Skip_Stats m_skip_stats_; // skipped_pixel_ratio is the sum over frames
+	cv::Mat m_dense_spot_; // 32FC1 spot result of mode 3
+	cv::Mat m_conf_spot_; // 32FC1 spot confidence of mode 3
+	// foreground mask only
+	cv::Mat m_fg_dense_; // 32FC1 dense depthmap not returned by run()
+	cv::Mat m_fg_conf_; // 32FC1 confidence not returned by run()
+};
+
+/**
+ * @brief upsampling configuration and processing
+ * 
+ * The processing is const and keeps per frame state in upsampling_context,
+ * so one configured object can serve several streams (one context per
+ * stream) on different threads. Lookup tables are shared read only between
+ * all contexts.
+ * 
+ * Parameters are immutable snapshots (Upsampling_Config). set_* publish a
+ * new snapshot by pointer swap and can be called from a control thread while
+ * streaming; each frame captures the current snapshot once at its start
+ * (lock free) and uses it for all stages.
+ * 
+ * With a latency budget, run(ctx, ...) watches the stage times of the
+ * context and steps the quality level (Upsampling_Quality) of its next
+ * frames down or up with hysteresis to stay within the budget.
+ * 
+ * With static frame skip, run(ctx, ...) compares the inputs with those of
+ * the cached result of the context and returns the cache if nothing changed,
+ * or recomputes only the changed region.
+ * 
+ * With SOLVER_PCG, the context keeps the solution of its last frame as
+ * the initial estimate of the next one.
+ */
 class upsampling
 {
 public:
-	// number is method for upsampling
-	upsampling();
+	// number is method for upsampling, resolutions of guide and flood grid
+	upsampling(int guide_width = UPSAMPLING_GUIDE_WIDTH, int guide_height = UPSAMPLING_GUIDE_HEIGHT, 
+				int grid_width = UPSAMPLING_GRID_WIDTH, int grid_height = UPSAMPLING_GRID_HEIGHT);
 
 	~upsampling() {};
 	// set camera(RGB) parameters 
@@ -49,81 +367,158 @@ public:
 	// get default preprocessing paramters
 	void get_default_preprocessing_parameters(Preprocessing_Params& params);	
 	// set preprocessing on/off
-	bool use_proprocessing(void){ return this->m_use_preprocessing;};
-	void use_proprocessing(bool use){this->m_use_preprocessing = use;};
-	// main processing interface
+	bool use_proprocessing(void){ return this->get_config()->use_preprocessing;};
+	void use_proprocessing(bool use);
+	// main processing interface (internal context)
 	bool run(const cv::Mat& rgb, const cv::Mat& flood_pc, const cv::Mat& spot_pc, cv::Mat& dense, cv::Mat& conf);
+	// main processing interface with a per stream context (thread safe for different contexts)
+	bool run(upsampling_context& ctx, const cv::Mat& rgb, const cv::Mat& flood_pc, const cv::Mat& spot_pc, 
+				cv::Mat& dense, cv::Mat& conf) const;
+	// main processing with the foreground mask (8UC1) fused into the final pass,
+	// mask_only: dense/conf are not written (ignored with static frame skip)
+	bool run(upsampling_context& ctx, const cv::Mat& rgb, const cv::Mat& flood_pc, const cv::Mat& spot_pc, 
+				cv::Mat& dense, cv::Mat& conf, cv::Mat& mask, bool mask_only = false) const;
+	// main processing with the occlusion mask (8UC1, 255: real depth in front) against a virtual depth view
+	// (32FC1 at output resolution, <= 0 or NaN: no virtual object) fused into the final pass
+	bool run(upsampling_context& ctx, const cv::Mat& rgb, const cv::Mat& flood_pc, const cv::Mat& spot_pc, 
+				const cv::Mat& virtual_depth, cv::Mat& dense, cv::Mat& conf, cv::Mat& occlusion, 
+				bool mask_only = false) const;
+	// main processing on caller memory: inputs are read in place, outputs written in place (conf can be empty)
+	// returns Upsampling_Status, UPSAMPLING_INVALID_VIEW if a view does not match
+	int run_view(upsampling_context& ctx, const Upsampling_View& guide, const Upsampling_View& flood, 
+				const Upsampling_View& spot, const Upsampling_View& dense, const Upsampling_View& conf) const;
+	// run frames on worker threads (0: all cores) with work stealing, returns number of processed frames
+	int run_batch(Upsampling_Batch_Frame* frames, int num_frames, int num_threads = 0) const;
+	// stage 1 of run(): projection and depth edge filtering into frame buffers 
+	bool prepare(const cv::Mat& rgb, const cv::Mat& flood_pc, const cv::Mat& spot_pc, Upsampling_Frame& frame) const;
+	// stage 1 on a snapshot of get_config() taken by the caller (one snapshot for a whole frame)
+	bool prepare(const std::shared_ptr<const Upsampling_Config>& config, const cv::Mat& rgb, 
+				const cv::Mat& flood_pc, const cv::Mat& spot_pc, Upsampling_Frame& frame) const;
+	// stage 2 of run(): guide weights, FGS and merge of a prepared frame 
+	bool solve(upsampling_context& ctx, const cv::Mat& rgb, const Upsampling_Frame& frame, 
+				cv::Mat& dense, cv::Mat& conf, cv::Mat* mask = nullptr, bool mask_only = false, 
+				const cv::Mat* virtual_depth = nullptr) const;
 	// filtered by confidence
-	void filter_by_confidence(const cv::Mat& dense, const cv::Mat& conf, cv::Mat& filtered, float threshold);
+	void filter_by_confidence(const cv::Mat& dense, const cv::Mat& conf, cv::Mat& filtered, float threshold) const;
+	// foreground mask (8UC1) of dense/conf by the foreground range
+	void foreground_mask(const cv::Mat& dense, const cv::Mat& conf, cv::Mat& mask) const;
+	// occlusion mask (8UC1) of dense/conf against a virtual depth
+	void occlusion_mask(const cv::Mat& dense, const cv::Mat& conf, const cv::Mat& virtual_depth, cv::Mat& occlusion) const;
 	// for show depthmap
-	cv::Mat get_flood_depthMap() {return this->m_flood_dmap_;};
+	cv::Mat get_flood_depthMap() {return this->m_context_.get_flood_depthMap();};
 	/* cv::Mat get_flood_edge_depthMap() {return this->m_flood_edge_dmap_;}; */
-	cv::Mat get_spot_depthMap() {return this->m_spot_dmap_;};
+	cv::Mat get_spot_depthMap() {return this->m_context_.get_spot_depthMap();};
 	// convert depth map to point cloud
-	void depth2pc(const cv::Mat& depth, cv::Mat& pc);
-	void pc2depthmap(const cv::Mat& pc, cv::Mat& depth);
+	void depth2pc(const cv::Mat& depth, cv::Mat& pc) const;
+	void pc2depthmap(const cv::Mat& pc, cv::Mat& depth) const;
+	// current parameter snapshot (lock free)
+	std::shared_ptr<const Upsampling_Config> get_config() const;
+	// publish a parameter snapshot, tables are rebuilt if needed
+	void set_config(const Upsampling_Config& config);
+	// modify the current parameters and publish them, atomic against other writers
+	void update_config(const std::function<void(Upsampling_Config&)>& modify);
+	// run() time per frame to hold by lowering quality (0: off, always QUALITY_FULL)
+	void set_latency_budget(float budget_ms);
+	// reuse the result of run(ctx, ...) for unchanged inputs (guide_thresh 0: off)
+	void set_static_frame_skip(float guide_thresh, float depth_thresh);
+	// recompute only flood points changed beyond the tolerances in the edge filtering
+	void set_incremental_preprocessing(bool on, float depth_tolerance = 0.005f, float guide_tolerance = 2.0f);
+	// solver backend (Upsampling_Solver), tolerance and max_iter for SOLVER_PCG
+	void set_solver(int solver, float tolerance = 1e-3f, int max_iter = 8);
+	// dense of run() is NaN where conf < threshold (0: off), fused into the solver output pass
+	void set_confidence_threshold(float threshold);
+	// flood + spot fusion (Upsampling_Fusion), data weights of the samples for FUSION_JOINT
+	void set_fusion(int fusion, float flood_weight = 1.f, float spot_weight = 0.1f);
+	// flood engine (Flood_Engine), solver tile size of the edge bands of FLOOD_ENGINE_MESH
+	void set_flood_engine(int engine, int tile_size = 32);
+	// spot engine (Spot_Engine), coarse grid step and RBF width (0: mean sample distance) of SPOT_ENGINE_INTERPOLATOR
+	void set_spot_engine(int engine, int grid_step = 8, float rbf_sigma = 0.f);
+	// stage 1 template variants picked by mode and preprocessing (default), false: generic preprocessing
+	void use_specialized_pipeline(bool on);
+	// dense/conf at guide resolution / scale (1: guide resolution), solved at that resolution
+	void set_output_scale(int scale);
+	// foreground mask of run(): near <= dense <= far (m) and conf >= conf_threshold
+	void set_foreground_range(float near_z, float far_z, float conf_threshold = 0.f);
+	// occlusion mask of run(): tie band (m) around the virtual depth, minimum confidence of occluding depth
+	void set_occlusion_test(float margin, float conf_threshold = 0.f);
+	// resolution of dense/conf of the current parameters
+	cv::Size get_output_size() const {return this->get_output_size(*this->get_config());};
+	// resolutions of the constructor
+	cv::Size get_guide_size() const {return cv::Size(this->m_guide_width_, this->m_guide_height_);};
+	cv::Size get_grid_size() const {return cv::Size(this->m_grid_width_, this->m_grid_height_);};
+	// read only tables shared by the contexts
+	std::shared_ptr<const Upsampling_Tables> get_tables() const {return this->get_config()->tables;};
 private:
-	void clear(); // clear temperary variables
-	void initialization(cv::Mat& dense, cv::Mat& conf); // initialization
-	void run_flood(const cv::Mat& img_guide, const cv::Mat& pc_flood, cv::Mat& dense, cv::Mat& conf); // processing for flood
-	void run_spot(const cv::Mat& img_guide, const cv::Mat& pc_spot, cv::Mat& dense, cv::Mat& conf); // processing for spot
-	void fgs_f(const cv::Mat & sparse, const cv::Mat& mask, const cv::Rect& roi, const float& lambda, 
-					cv::Mat& dense, cv::Mat& conf);
-	void spot_guide_proc(const cv::Mat& img_guide); // guide image processing for spot
-	void spot_depth_proc(const cv::Mat& pc_spot); // depth processing for flood
-	void spot_preprocessing(const cv::Mat& img_guide, const cv::Mat& pc_spot); // preprocessing for spot
-	void flood_guide_proc(const cv::Mat& img_guide); // guide image processing for flood
-	void flood_depth_proc(const cv::Mat& pc_flood, const cv::Mat& guide); // depth processing for flood
+	void update_tables(Upsampling_Config& config) const; // rebuild shared tables of parameters
+	void publish_config(const Upsampling_Config& config); // swap in a snapshot, m_config_write_mutex_ held
+	int get_mode(const cv::Mat& pc_flood, const cv::Mat& pc_spot) const; // mode by inputs
+	const Upsampling_Config& get_frame_config(const Upsampling_Frame& frame, const Upsampling_Config& cfg, 
+					Upsampling_Config& reduced) const; // parameters reduced by quality level
+	void update_quality_level(const Upsampling_Config& cfg, upsampling_context& ctx) const; // level of the next frame
+	int detect_changes(const Upsampling_Config& cfg, upsampling_context& ctx, const cv::Mat& img_guide, 
+					const cv::Mat& pc_flood, const cv::Mat& pc_spot, cv::Rect& dirty) const; // changes against the cache
+	void mark_dirty_point(const Upsampling_Config& cfg, const cv::Vec3f& p, cv::Mat& dirty_blocks) const; // blocks of a point
+	void clear(const Upsampling_Config& cfg, Upsampling_Frame& frame) const; // clear temperary variables
+	cv::Size get_output_size(const Upsampling_Config& cfg) const; // dense/conf resolution of parameters
+	void mask_pass(const Upsampling_Config& cfg, const cv::Mat& dense, const cv::Mat& conf, 
+					const cv::Mat* virtual_depth, cv::Mat& mask) const; // foreground or occlusion mask of dense/conf
+	bool run_frame(upsampling_context& ctx, const std::shared_ptr<const Upsampling_Config>& config, 
+					const cv::Mat& img_guide, const cv::Mat& pc_flood, const cv::Mat& pc_spot, 
+					cv::Mat& dense, cv::Mat& conf, cv::Mat* mask, bool mask_only, 
+					const cv::Mat* virtual_depth) const; // run() on one snapshot, with the foreground or occlusion mask
+	template <int MODE, int FLOOD_PROC>
+	void prepare_variant(const Upsampling_Config& cfg, const cv::Mat& img_guide, const cv::Mat& pc_flood, 
+					const cv::Mat& pc_spot, Upsampling_Frame& frame) const; // stage 1 of a mode and preprocessing
+	void initialization(const cv::Size& size, cv::Mat& dense, cv::Mat& conf) const; // initialization
+	void flood_upsampling(const Upsampling_Config& cfg, upsampling_context& ctx, const cv::Mat& img_guide, 
+					const Upsampling_Frame& frame, float conf_thresh, Foreground_Target& fg, 
+					cv::Mat& dense, cv::Mat& conf) const; // FGS for flood
+	void spot_upsampling(const Upsampling_Config& cfg, upsampling_context& ctx, const cv::Mat& img_guide, 
+					const Upsampling_Frame& frame, float conf_thresh, Foreground_Target& fg, 
+					cv::Mat& dense, cv::Mat& conf) const; // FGS for spot
+	void flood_mesh(const Upsampling_Config& cfg, upsampling_context& ctx, const cv::Mat& guide, 
+					const Upsampling_Frame& frame, const cv::Mat& range, float lambda, float conf_thresh, 
+					Foreground_Target& fg, cv::Mat& dense, cv::Mat& conf) const; // FLOOD_ENGINE_MESH
+	void spot_interpolation(const Upsampling_Config& cfg, upsampling_context& ctx, const cv::Mat& guide, 
+					const std::vector<Sparse_Point>& points, const cv::Rect& roi, float conf_thresh, 
+					Foreground_Target& fg, cv::Mat& dense, cv::Mat& conf) const; // SPOT_ENGINE_INTERPOLATOR
+	void joint_upsampling(const Upsampling_Config& cfg, upsampling_context& ctx, const cv::Mat& img_guide, 
+					const Upsampling_Frame& frame, Foreground_Target& fg, 
+					cv::Mat& dense, cv::Mat& conf) const; // one solve of flood and spot samples
+	void merge_flood_spot(const cv::Mat& flood_range, const cv::Mat& dense_spot, const cv::Mat& conf_spot, 
+					float conf_thresh, Foreground_Target& fg, cv::Mat& dense, cv::Mat& conf) const; // merge spot results outside flood range
+	void fgs_f(const Upsampling_Config& cfg, upsampling_context& ctx, const cv::Mat& guide, 
+					const std::vector<Sparse_Point>& points, const cv::Rect& roi, const float& lambda, 
+					const std::vector<float>& weight, int num_iter, const cv::Mat& range, float conf_thresh, 
+					Foreground_Target& fg, cv::Mat& dense, cv::Mat& conf) const;
+	void pcg_f(const Upsampling_Config& cfg, upsampling_context& ctx, const cv::Mat& guide, 
+					const std::vector<Sparse_Point>& points, const cv::Rect& roi, const float& lambda, 
+					const std::vector<float>& weight, int num_iter, const cv::Mat& range, float conf_thresh, 
+					Foreground_Target& fg, Warm_Start& warm, cv::Mat& dense, cv::Mat& conf) const;
+	void spot_depth_proc(const Upsampling_Config& cfg, const cv::Mat& pc_spot, Upsampling_Frame& frame) const; // depth processing for flood
+	void flood_depth_proc(const Upsampling_Config& cfg, const cv::Mat& pc_flood, const cv::Mat& guide, Upsampling_Frame& frame) const; // depth processing for flood
 	/* void flood_depth_proc_with_edge(const cv::Mat& pc_flood); // * release 1 with bugs */ 
-	void extract_depth_edge(const cv::Mat& z_map, cv::Mat& edge_mask);
-	void filter_parallax_devation_points(const cv::Mat& pc_in, cv::Mat& pc_out);
-	void filter_error_edge_points(const cv::Mat& img_guide, const cv::Mat& pc_in, cv::Mat& pc_out);
-	void pc2flood_dmap(const cv::Mat& pc); // * convert pointcloud to dmap for upsampling
-	void flood_depth_proc_with_edge(const cv::Mat& pc_flood, const cv::Mat& img_guide); // * release depth edge
-	void flood_depth_proc_without_edge(const cv::Mat& pc_flood);
-	void flood_preprocessing(const cv::Mat& img_guide, const cv::Mat& pc_flood); // preprocessing for flood
+	void extract_depth_edge(const Upsampling_Config& cfg, const cv::Mat& z_map, cv::Mat& edge_mask, 
+					const cv::Mat& update_mask = cv::Mat()) const;
+	void filter_parallax_devation_points(const Upsampling_Config& cfg, const cv::Mat& pc_in, cv::Mat& pc_out) const;
+	void filter_parallax_row(const Upsampling_Config& cfg, const cv::Mat& pc_in, int y, cv::Mat& pc_out) const;
+	void update_flood_cache(const Upsampling_Config& cfg, const cv::Mat& img_guide, const cv::Mat& pc_flood, 
+					Upsampling_Frame& frame, cv::Mat& pc_out) const; // incremental edge filtering
+	void filter_error_edge_points(const Upsampling_Config& cfg, const cv::Mat& img_guide, const cv::Mat& pc_in, cv::Mat& pc_out) const;
+	void pc2flood_points(const Upsampling_Config& cfg, const cv::Mat& pc, Upsampling_Frame& frame) const; // * convert pointcloud to samples for upsampling
+	void flood_depth_proc_with_edge(const Upsampling_Config& cfg, const cv::Mat& pc_flood, const cv::Mat& img_guide, Upsampling_Frame& frame) const; // * release depth edge
+	void flood_depth_proc_without_edge(const Upsampling_Config& cfg, const cv::Mat& pc_flood, Upsampling_Frame& frame) const;
 private:
-	bool m_use_preprocessing = true;
-	const int m_guide_width_ = 960; // guide image width 
-	const int m_guide_height_ = 540; // guide image height
-	const int m_grid_width_ = 80; // flood depth grid width
-	const int m_grid_height_ = 60; // flood depth grid height
-	int m_mode_ = 0; // 0: no processing, 1: only flood, 2: only spot, 3: both flood and spot
+	const int m_guide_width_; // guide image width 
+	const int m_guide_height_; // guide image height
+	const int m_grid_width_; // flood depth grid width
+	const int m_grid_height_; // flood depth grid height
 	// temperary data
-	cv::Mat m_flood_mask_; // 32FC1 
-	cv::Mat m_flood_range_; // 32FC1 
-	cv::Mat m_spot_mask_; // 32FC1 
-	cv::Mat m_spot_range_; // 32FCC1 
-	cv::Mat m_flood_dmap_; // 32FC1 depth map resolution same as guide
-	cv::Mat m_spot_dmap_; // 32FC1 depth map resuolution same as guide 
-	cv::Mat m_flood_grid_; // 32FC1
-	cv::Mat m_flood_edge_; // 32FC1
-	cv::Mat m_guide_edge_; // 8UC1 0 or 255
-	cv::Rect m_flood_roi_; // ROI for flood
-	cv::Rect m_spot_roi_; // ROI for spot
-	// upsampling main processing paramters
-	float m_fgs_lambda_flood_ = 220.f; // 0.1~1000
-	float m_fgs_sigma_color_flood_ = 4.f; // 0~256
-	float m_fgs_lambda_attenuation_ = 0.25f;
-	float m_fgs_lambda_spot_ = 700.f; 
-	float m_fgs_sigma_color_spot_ = 5.f; // 1~20
-	int m_fgs_num_iter_flood_ = 1; //1~5
-	int m_fgs_num_iter_spot_ = 2;
-	// flood preprocessing paramters
-	int m_guide_edge_dilate_size_ = 4; // (1~10) dilate size of guide image edge
-	float m_z_continuous_thresh_ = 0.1f; // (0~1) z threshold for continuous region 
-	float m_occlusion_thresh_ = 10.5f; // (0~20.0)  threshold for justification of occlusion (max pixels between neigbors)
-	int m_range_flood_ = 20; // 2~40
-	float m_depth_diff_thresh_ = 0.1f; // meter
-	float m_guide_diff_thresh_ = 40.0f; // 0~ 255
-	int m_min_diff_count = 1; // 0~8
-	// camera paramters
-	float m_fx_ = 135.51f;
-	float m_fy_ = 135.51f;
-	float m_cx_ = 159.81f;
-	float m_cy_ = 120.41f;
-	// processing flag
-	bool m_depth_edge_proc_on_ = true;
-	/* bool m_guide_edge_proc_on_ = true; */
-	cv::Ptr<cv::ximgproc::FastGlobalSmootherFilter> m_fgs_filter_;
+	upsampling_context m_context_; // context of run() without context
+	// parameter snapshots, double buffered: readers take the current slot lock free,
+	// a writer fills the other slot after its readers left and swaps the index
+	std::shared_ptr<const Upsampling_Config> m_config_slots_[2];
+	mutable std::atomic<int> m_config_readers_[2];
+	std::atomic<int> m_config_index_;
+	std::mutex m_config_write_mutex_; // serializes writers (read, modify and publish) only
 };
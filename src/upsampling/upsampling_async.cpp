@@ -0,0 +1,254 @@
+#include "upsampling_async.h"
+#include <chrono>
+
+/**
+ * @brief steady clock in nanoseconds
+ *
+ * @return int64_t : now
+ */
+inline int64_t steady_now_ns()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * @brief Construct a new upsampling async object and start the stage threads
+ *
+ * @param engine : configured upsampling object
+ * @param num_buffers : number of frame slots (>= 2)
+ */
+upsampling_async::upsampling_async(const upsampling& engine, int num_buffers) 
+	: upsampling_async(engine, num_buffers, nullptr)
+{
+}
+
+/**
+ * @brief Construct a new upsampling async object delivering results by callback
+ *
+ * @param engine : configured upsampling object
+ * @param num_buffers : number of frame slots (>= 2)
+ * @param callback : called on the stage 2 thread for each result (dense/conf are handed over)
+ */
+upsampling_async::upsampling_async(const upsampling& engine, int num_buffers, std::function<void(Upsampling_Result&)> callback)
+	: m_engine_(engine), m_callback_(callback)
+{
+	if (num_buffers < 2) num_buffers = 2;
+	this->m_slots_.resize(num_buffers);
+	for (int i = 0; i < num_buffers; ++i)
+		this->m_free_.push_back(i);
+	this->m_prepare_thread_ = std::thread(&upsampling_async::prepare_loop, this);
+	this->m_solve_thread_ = std::thread(&upsampling_async::solve_loop, this);
+}
+
+/**
+ * @brief Destroy the upsampling async object, frames in flight are finished first
+ *
+ */
+upsampling_async::~upsampling_async()
+{
+	{
+		std::unique_lock<std::mutex> lock(this->m_mutex_);
+		this->m_cond_.wait(lock, [this]() -> bool {
+			return this->m_prepare_queue_.empty() && this->m_solve_queue_.empty()
+				&& this->m_free_.size() + this->m_done_.size() == this->m_slots_.size();
+		});
+		this->m_stop_ = true;
+	}
+	this->m_cond_.notify_all();
+	this->m_prepare_thread_.join();
+	this->m_solve_thread_.join();
+}
+
+/**
+ * @brief submit one frame
+ *
+ * @param img_guide : guide image
+ * @param pc_flood : flood point cloud (can be empty)
+ * @param pc_spot : spot point cloud (can be empty)
+ * @param dense : output buffer of dense depthmap (empty: allocated)
+ * @param conf : output buffer of confidence (empty: allocated)
+ * @param timestamp_ns : capture timestamp (0: submit time)
+ * @return uint64_t : frame id
+ */
+uint64_t upsampling_async::submit(const cv::Mat& img_guide, const cv::Mat& pc_flood, const cv::Mat& pc_spot,
+									cv::Mat dense, cv::Mat conf, int64_t timestamp_ns)
+{
+	int idx;
+	{
+		std::unique_lock<std::mutex> lock(this->m_mutex_);
+		this->m_cond_.wait(lock, [this]() -> bool { return !this->m_free_.empty(); });
+		idx = this->m_free_.front();
+		this->m_free_.pop_front();
+	}
+	// the slot is owned by the caller until queued
+	Async_Slot& slot = this->m_slots_[idx];
+	img_guide.copyTo(slot.guide);
+	pc_flood.copyTo(slot.flood);
+	pc_spot.copyTo(slot.spot);
+	slot.result.dense = dense;
+	slot.result.conf = conf;
+	slot.result.success = false;
+	slot.result.status = UPSAMPLING_OK;
+	slot.result.submit_ns = steady_now_ns();
+	slot.result.timestamp_ns = timestamp_ns != 0 ? timestamp_ns : slot.result.submit_ns;
+	uint64_t frame_id;
+	{
+		std::lock_guard<std::mutex> lock(this->m_mutex_);
+		frame_id = this->m_next_id_++;
+		slot.result.frame_id = frame_id;
+		this->m_prepare_queue_.push_back(idx);
+	}
+	this->m_cond_.notify_all();
+	return frame_id;
+}
+
+/**
+ * @brief get the oldest finished frame
+ *
+ * @param result : output result, dense/conf are handed over to the caller
+ * @return true : finished
+ * @return false : not finished yet
+ */
+bool upsampling_async::poll(Upsampling_Result& result)
+{
+	int idx;
+	{
+		std::lock_guard<std::mutex> lock(this->m_mutex_);
+		if (this->m_done_.empty())
+			return false;
+		idx = this->m_done_.front();
+		this->m_done_.pop_front();
+	}
+	Async_Slot& slot = this->m_slots_[idx];
+	result = slot.result;
+	slot.result.dense.release(); // never written again by this slot
+	slot.result.conf.release();
+	{
+		std::lock_guard<std::mutex> lock(this->m_mutex_);
+		this->m_free_.push_back(idx);
+	}
+	this->m_cond_.notify_all();
+	return true;
+}
+
+/**
+ * @brief wait for the oldest frame
+ *
+ * @param result : output result, dense/conf are handed over to the caller
+ * @return true : finished
+ * @return false : no frame in flight
+ */
+bool upsampling_async::wait(Upsampling_Result& result)
+{
+	{
+		std::unique_lock<std::mutex> lock(this->m_mutex_);
+		this->m_cond_.wait(lock, [this]() -> bool {
+			return !this->m_done_.empty() || this->m_free_.size() == this->m_slots_.size();
+		});
+		if (this->m_done_.empty()) // nothing in flight
+			return false;
+	}
+	return this->poll(result);
+}
+
+/**
+ * @brief number of frames in flight
+ *
+ * @return int : submitted but not returned yet
+ */
+int upsampling_async::get_num_in_flight(void)
+{
+	std::lock_guard<std::mutex> lock(this->m_mutex_);
+	return static_cast<int>(this->m_slots_.size() - this->m_free_.size());
+}
+
+/**
+ * @brief wait for a slot in the queue
+ *
+ * @param queue : input queue of the stage
+ * @param idx : output slot index
+ * @return true : got a slot
+ * @return false : stopped
+ */
+bool upsampling_async::pop(std::deque<int>& queue, int& idx)
+{
+	std::unique_lock<std::mutex> lock(this->m_mutex_);
+	this->m_cond_.wait(lock, [this, &queue]() -> bool { return this->m_stop_ || !queue.empty(); });
+	if (queue.empty())
+		return false;
+	idx = queue.front();
+	queue.pop_front();
+	return true;
+}
+
+/**
+ * @brief stage 1: projection and depth edge filtering
+ *
+ * Frames are prepared in submission order on the parameter snapshot of the frame.
+ */
+void upsampling_async::prepare_loop()
+{
+	int idx;
+	while (this->pop(this->m_prepare_queue_, idx)) {
+		Async_Slot& slot = this->m_slots_[idx];
+		std::shared_ptr<const Upsampling_Config> config = this->m_engine_.get_config();
+		if (config->latency_budget_ms > 0.f || config->static_guide_thresh > 0.f) { // needs the feedback of run()
+			slot.frame.mode = 0;
+			slot.frame.config = config;
+			slot.result.status = UPSAMPLING_UNSUPPORTED;
+		} else {
+			std::swap(slot.frame.flood_cache, this->m_flood_cache_); // cache of the previous frame
+			try {
+				this->m_engine_.prepare(config, slot.guide, slot.flood, slot.spot, slot.frame);
+			} catch (const cv::Exception&) { // invalid input, solved as no processing
+				slot.frame.mode = 0;
+				slot.frame.flood_cache.config.reset();
+				slot.result.status = UPSAMPLING_ERROR;
+			}
+			std::swap(slot.frame.flood_cache, this->m_flood_cache_); // solve() does not use it
+		}
+		{
+			std::lock_guard<std::mutex> lock(this->m_mutex_);
+			this->m_solve_queue_.push_back(idx);
+		}
+		this->m_cond_.notify_all();
+	}
+}
+
+/**
+ * @brief stage 2: FGS filter creation, FGS and merge
+ *
+ */
+void upsampling_async::solve_loop()
+{
+	int idx;
+	while (this->pop(this->m_solve_queue_, idx)) {
+		Async_Slot& slot = this->m_slots_[idx];
+		if (slot.result.status != UPSAMPLING_UNSUPPORTED) { // an invalid input of stage 1 is solved as no processing
+			try {
+				slot.result.success = this->m_engine_.solve(this->m_context_, slot.guide, slot.frame, 
+															slot.result.dense, slot.result.conf);
+				if (slot.result.status == UPSAMPLING_OK)
+					slot.result.status = slot.result.success ? UPSAMPLING_OK : UPSAMPLING_NO_INPUT;
+			} catch (const cv::Exception&) {
+				slot.result.success = false;
+				slot.result.status = UPSAMPLING_ERROR;
+			}
+		}
+		slot.result.done_ns = steady_now_ns();
+		if (this->m_callback_) {
+			this->m_callback_(slot.result);
+			slot.result.dense.release(); // handed over
+			slot.result.conf.release();
+		}
+		{
+			std::lock_guard<std::mutex> lock(this->m_mutex_);
+			if (this->m_callback_)
+				this->m_free_.push_back(idx);
+			else
+				this->m_done_.push_back(idx);
+		}
+		this->m_cond_.notify_all();
+	}
+}
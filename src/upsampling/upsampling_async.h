@@ -0,0 +1,88 @@
+#pragma once
+#include "upsampling.h"
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+typedef struct Upsampling_Result{
+	uint64_t frame_id = 0; // id returned by submit()
+	bool success = false; // same as the return value of run()
+	int status = UPSAMPLING_OK; // Upsampling_Status (UPSAMPLING_UNSUPPORTED: dense/conf not written)
+	cv::Mat dense; // 32FC1 dense depthmap
+	cv::Mat conf; // 32FC1 confidence map
+	int64_t timestamp_ns = 0; // input (capture) timestamp, steady clock
+	int64_t submit_ns = 0; // submit time, steady clock
+	int64_t done_ns = 0; // finish time, steady clock
+} Upsampling_Result;
+
+/**
+ * @brief pipelined run() on two worker threads
+ *
+ * Stage 1 (upsampling::prepare(): projection and depth edge filtering) of
+ * frame N+1 runs while stage 2 (upsampling::solve(): FGS filter creation and
+ * FGS) of frame N runs, so the throughput is bounded by the slower stage
+ * instead of the sum of both. Frame buffers are owned by num_buffers slots;
+ * submit() blocks while all slots are in flight or not yet polled.
+ * Results are returned in submission order, by poll()/wait() or by the
+ * callback on the stage 2 thread.
+ *
+ * The pipeline has its own upsampling_context. The engine can be
+ * reconfigured (set_*) while frames are in flight: each frame keeps the
+ * parameter snapshot captured by stage 1 until its solve() is done.
+ *
+ * The stages are those of run() without its per frame feedback: a frame
+ * whose snapshot has a latency budget (quality control) or static frame skip
+ * is not processed and returns UPSAMPLING_UNSUPPORTED. No mask is fused,
+ * call upsampling::foreground_mask()/occlusion_mask() on the results.
+ * Incremental preprocessing works across frames: stage 1 keeps one flood
+ * cache for the pipeline, not one per slot.
+ */
+class upsampling_async
+{
+public:
+	// num_buffers: frames in flight (2: double buffering, 3: one more can be queued)
+	upsampling_async(const upsampling& engine, int num_buffers = 3);
+	// callback: called on the stage 2 thread for each result instead of poll()/wait()
+	upsampling_async(const upsampling& engine, int num_buffers, std::function<void(Upsampling_Result&)> callback);
+	~upsampling_async();
+	// copy the inputs into a free slot and start processing, returns frame id
+	// dense/conf: optional output buffers (avoids allocation of the result)
+	// timestamp_ns: capture timestamp, steady clock (0: submit time)
+	uint64_t submit(const cv::Mat& img_guide, const cv::Mat& pc_flood, const cv::Mat& pc_spot,
+					cv::Mat dense = cv::Mat(), cv::Mat conf = cv::Mat(), int64_t timestamp_ns = 0);
+	// oldest finished frame, false if not finished yet
+	bool poll(Upsampling_Result& result);
+	// wait for the oldest frame, false if no frame is in flight
+	bool wait(Upsampling_Result& result);
+	// number of submitted frames not returned by poll()/wait() yet
+	int get_num_in_flight(void);
+private:
+	typedef struct Async_Slot{
+		cv::Mat guide; // copy of input
+		cv::Mat flood; // copy of input
+		cv::Mat spot; // copy of input
+		Upsampling_Frame frame; // buffers of stage 1
+		Upsampling_Result result; // output of stage 2
+	} Async_Slot;
+	bool pop(std::deque<int>& queue, int& idx);
+	void prepare_loop(); // stage 1 thread
+	void solve_loop(); // stage 2 thread
+	const upsampling& m_engine_;
+	upsampling_context m_context_; // solver state of stage 2
+	Flood_Cache m_flood_cache_; // incremental preprocessing of stage 1, swapped into the slot being prepared
+	std::function<void(Upsampling_Result&)> m_callback_;
+	std::vector<Async_Slot> m_slots_;
+	std::deque<int> m_free_; // free slots
+	std::deque<int> m_prepare_queue_; // submitted
+	std::deque<int> m_solve_queue_; // prepared
+	std::deque<int> m_done_; // solved, waiting for poll
+	std::mutex m_mutex_;
+	std::condition_variable m_cond_;
+	std::thread m_prepare_thread_;
+	std::thread m_solve_thread_;
+	bool m_stop_ = false;
+	uint64_t m_next_id_ = 0;
+};
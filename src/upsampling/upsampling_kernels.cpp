@@ -0,0 +1,476 @@
+#include "upsampling_kernels.h"
+#include <algorithm>
+#include <limits>
+#include <math.h>
+
+#if defined(UPSAMPLING_CPU_DISPATCH) && defined(__GNUC__) && defined(__x86_64__) && defined(__linux__) && !defined(__ANDROID__)
+#define KERNEL_DISPATCH 1
+#define KERNEL_CLONES __attribute__((target_clones("avx512f", "avx2", "sse4.2", "default")))
+#else
+#define KERNEL_DISPATCH 0
+#define KERNEL_CLONES
+#endif
+
+/**
+ * @brief instruction set selected by the runtime dispatch
+ *
+ * @return const char* : "avx512f", "avx2", "sse4.2" or "default"
+ */
+const char* get_kernel_isa(void)
+{
+#if KERNEL_DISPATCH
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f"))
+		return "avx512f";
+	if (__builtin_cpu_supports("avx2"))
+		return "avx2";
+	if (__builtin_cpu_supports("sse4.2"))
+		return "sse4.2";
+#endif
+	return "default";
+}
+
+/**
+ * @brief FGS guide weights of one row
+ *
+ * @param g : guide row
+ * @param g_next : next guide row (g on the last row)
+ * @param cn : channels (1 or 3)
+ * @param w : width
+ * @param last_row : vertical weights are 0
+ * @param lut : colour weight table
+ * @param ch : output horizontal weights (last column 0)
+ * @param cv_ : output vertical weights
+ */
+KERNEL_CLONES
+void fgs_guide_weights_row(const uint8_t* g, const uint8_t* g_next, int cn, int w, bool last_row,
+							const float* lut, float* ch, float* cv_)
+{
+	if (cn == 1) {
+		for (int j = 0; j < w - 1; ++j) {
+			int dh = g[j] - g[j + 1];
+			int dv = g[j] - g_next[j];
+			ch[j] = lut[dh * dh];
+			cv_[j] = last_row ? 0.f : lut[dv * dv];
+		}
+	} else {
+		for (int j = 0; j < w - 1; ++j) {
+			int dh = 0, dv = 0;
+			for (int k = 0; k < 3; ++k) {
+				int a = g[j * 3 + k];
+				int b = g[(j + 1) * 3 + k];
+				int c = g_next[j * 3 + k];
+				dh += (a - b) * (a - b);
+				dv += (a - c) * (a - c);
+			}
+			ch[j] = lut[dh];
+			cv_[j] = last_row ? 0.f : lut[dv];
+		}
+	}
+	// last column
+	int dv = 0;
+	for (int k = 0; k < cn; ++k) {
+		int a = g[(w - 1) * cn + k];
+		int c = g_next[(w - 1) * cn + k];
+		dv += (a - c) * (a - c);
+	}
+	ch[w - 1] = 0.f;
+	cv_[w - 1] = last_row ? 0.f : lut[dv];
+}
+
+/**
+ * @brief FGS vertical pass, first row of the column stripe
+ *
+ * @param c : vertical weights of the row
+ * @param d : elimination coefficients of the row
+ * @param cur : image row (in place)
+ * @param update_d : write d (first image only)
+ * @param start : first column
+ * @param end : last column + 1
+ * @param lambda : smoothness
+ */
+KERNEL_CLONES
+void fgs_vertical_first_row(const float* c, float* d, float* cur, bool update_d, int start, int end, float lambda)
+{
+	for (int j = start; j < end; ++j) {
+		float denom = 1.f / (1.f - lambda * c[j]);
+		if (update_d)
+			d[j] = lambda * c[j] * denom;
+		cur[j] *= denom;
+	}
+}
+
+/**
+ * @brief FGS vertical pass, forward elimination of one row
+ *
+ * @param c_prev : vertical weights of the previous row
+ * @param c : vertical weights of the row
+ * @param d_prev : elimination coefficients of the previous row
+ * @param d : elimination coefficients of the row
+ * @param cur_prev : previous image row
+ * @param cur : image row (in place)
+ * @param update_d : write d (first image only)
+ * @param start : first column
+ * @param end : last column + 1
+ * @param lambda : smoothness
+ */
+KERNEL_CLONES
+void fgs_vertical_forward_row(const float* c_prev, const float* c, const float* d_prev, float* d,
+								const float* cur_prev, float* cur, bool update_d, int start, int end, float lambda)
+{
+	if (update_d) {
+		for (int j = start; j < end; ++j) {
+			float denom = 1.f / (1.f - lambda * c[j] - lambda * c_prev[j] * (1.f + d_prev[j]));
+			d[j] = lambda * c[j] * denom;
+			cur[j] = (cur[j] - lambda * c_prev[j] * cur_prev[j]) * denom;
+		}
+	} else {
+		for (int j = start; j < end; ++j) {
+			float denom = 1.f / (1.f - lambda * c[j] - lambda * c_prev[j] * (1.f + d_prev[j]));
+			cur[j] = (cur[j] - lambda * c_prev[j] * cur_prev[j]) * denom;
+		}
+	}
+}
+
+/**
+ * @brief FGS vertical pass, back substitution of one row
+ *
+ * @param d : elimination coefficients of the row
+ * @param cur_next : next image row
+ * @param cur : image row (in place)
+ * @param start : first column
+ * @param end : last column + 1
+ */
+KERNEL_CLONES
+void fgs_vertical_backward_row(const float* d, const float* cur_next, float* cur, int start, int end)
+{
+	for (int j = start; j < end; ++j)
+		cur[j] -= d[j] * cur_next[j];
+}
+
+/**
+ * @brief PCG y = (M + lambda * L) x of one row
+ *
+ * @param ch : horizontal weights of the row
+ * @param cv_ : vertical weights of the row
+ * @param cv_up : vertical weights of the previous row (clamped)
+ * @param m : data weights of the row
+ * @param xc : x of the row
+ * @param xu : x of the previous row (clamped)
+ * @param xd : x of the next row (clamped)
+ * @param y : output row
+ * @param first_row : no upper neighbour
+ * @param w : width
+ * @param lambda : smoothness
+ */
+KERNEL_CLONES
+void pcg_apply_row(const float* ch, const float* cv_, const float* cv_up, const float* m, const float* xc,
+					const float* xu, const float* xd, float* y, bool first_row, int w, float lambda)
+{
+	float up = first_row ? 0.f : 1.f;
+	// borders: ch[w - 1] = 0 and ch[-1] is treated as 0
+	y[0] = m[0] * xc[0] + lambda * (-ch[0] * (xc[0] - xc[w > 1 ? 1 : 0]) - cv_[0] * (xc[0] - xd[0])
+								- up * cv_up[0] * (xc[0] - xu[0]));
+	for (int j = 1; j < w - 1; ++j) {
+		float v = xc[j];
+		float s = -ch[j] * (v - xc[j + 1]) - cv_[j] * (v - xd[j]) - ch[j - 1] * (v - xc[j - 1])
+					- up * cv_up[j] * (v - xu[j]);
+		y[j] = m[j] * v + lambda * s;
+	}
+	if (w > 1) {
+		int j = w - 1;
+		float v = xc[j];
+		float s = -cv_[j] * (v - xd[j]) - ch[j - 1] * (v - xc[j - 1]) - up * cv_up[j] * (v - xu[j]);
+		y[j] = m[j] * v + lambda * s;
+	}
+}
+
+enum Mask_Kind {
+	MASK_NONE = 0, // no mask
+	MASK_FOREGROUND, // foreground mask
+	MASK_OCCLUSION, // occlusion mask against the virtual depth
+};
+
+/**
+ * @brief foreground of a pixel
+ *
+ * @return uint8_t : 255: near_z <= d <= far_z and c >= conf_threshold (NaN and 0 depth: 0)
+ */
+inline uint8_t foreground(float d, float c, const Foreground_Range& fg_range)
+{
+	return (d > 0.f && d >= fg_range.near_z && d <= fg_range.far_z && c >= fg_range.conf_threshold) ? 255 : 0;
+}
+
+/**
+ * @brief occlusion of a virtual pixel by the real depth
+ *
+ * Inside the tie band the real depth wins by its confidence: conf 1 occludes
+ * up to margin behind the virtual depth, conf 0 only margin in front of it.
+ *
+ * @return uint8_t : 255: d < vd + margin * (2c - 1) and c >= conf_threshold (no virtual or real depth: 0)
+ */
+inline uint8_t occlusion(float d, float c, float vd, const Occlusion_Test& occ)
+{
+	return (vd > 0.f && d > 0.f && c >= occ.conf_threshold && d < vd + occ.margin * (2.f * c - 1.f)) ? 255 : 0;
+}
+
+/**
+ * @brief mask of a pixel
+ *
+ * @tparam MASK : Mask_Kind
+ */
+template <int MASK>
+inline uint8_t mask_value(float d, float c, const float* vd, int j, const Foreground_Range& fg_range,
+							const Occlusion_Test& occ)
+{
+	if (MASK == MASK_OCCLUSION)
+		return occlusion(d, c, vd[j], occ);
+	return foreground(d, c, fg_range);
+}
+
+/**
+ * @brief solver post processing of one row (outputs fixed at compile time)
+ *
+ * @tparam MASK : Mask_Kind written to fg
+ * @tparam DENSE : write dense and conf
+ */
+template <int MASK, bool DENSE>
+inline void post_process_row_t(const float* s, const float* m, const uint8_t* r, float* d, float* c, int w,
+								bool normalize, float conf_scale, float conf_thresh,
+								uint8_t* fg, const Foreground_Range& fg_range, const float* vd, const Occlusion_Test& occ)
+{
+	const float nan = std::numeric_limits<float>::quiet_NaN();
+	for (int j = 0; j < w; ++j) {
+		float dv = normalize ? s[j] / m[j] : s[j];
+		float cv_ = std::min(m[j] * conf_scale, 1.f);
+		bool out = r != nullptr && r[j] == 0;
+		float c_out = out ? nan : cv_;
+		float d_out = (out || cv_ < conf_thresh) ? nan : dv;
+		if (DENSE) {
+			c[j] = c_out;
+			d[j] = d_out;
+		}
+		if (MASK != MASK_NONE)
+			fg[j] = mask_value<MASK>(d_out, c_out, vd, j, fg_range, occ);
+	}
+}
+
+/**
+ * @brief solver post processing of one row
+ *
+ * @param s : smoothed sparse depth
+ * @param m : smoothed mask
+ * @param r : valid range (nullptr: everywhere)
+ * @param d : output dense depth, can be s
+ * @param c : output confidence, can be m
+ * @param w : width
+ * @param normalize : divide depth by weight
+ * @param conf_scale : confidence per weight
+ * @param conf_thresh : confidence threshold of dense (0: off)
+ * @param fg : output mask (nullptr: none)
+ * @param fg_range : foreground range
+ * @param vd : virtual depth (nullptr: fg is the foreground mask, else the occlusion mask)
+ * @param occ : occlusion test
+ * @param write_dense : write d and c (false: fg only)
+ */
+KERNEL_CLONES
+void post_process_row(const float* s, const float* m, const uint8_t* r, float* d, float* c, int w,
+						bool normalize, float conf_scale, float conf_thresh,
+						uint8_t* fg, const Foreground_Range& fg_range, const float* vd, const Occlusion_Test& occ,
+						bool write_dense)
+{
+	if (fg == nullptr)
+		post_process_row_t<MASK_NONE, true>(s, m, r, d, c, w, normalize, conf_scale, conf_thresh, fg, fg_range, vd, occ);
+	else if (vd != nullptr && write_dense)
+		post_process_row_t<MASK_OCCLUSION, true>(s, m, r, d, c, w, normalize, conf_scale, conf_thresh, fg, fg_range, vd, occ);
+	else if (vd != nullptr)
+		post_process_row_t<MASK_OCCLUSION, false>(s, m, r, d, c, w, normalize, conf_scale, conf_thresh, fg, fg_range, vd, occ);
+	else if (write_dense)
+		post_process_row_t<MASK_FOREGROUND, true>(s, m, r, d, c, w, normalize, conf_scale, conf_thresh, fg, fg_range, vd, occ);
+	else
+		post_process_row_t<MASK_FOREGROUND, false>(s, m, r, d, c, w, normalize, conf_scale, conf_thresh, fg, fg_range, vd, occ);
+}
+
+/**
+ * @brief flood/spot merge of one row (outputs fixed at compile time)
+ *
+ * @tparam MASK : Mask_Kind written to fg
+ * @tparam DENSE : write dense and conf
+ */
+template <int MASK, bool DENSE>
+inline void merge_row_t(const uint8_t* r, const float* ds, const float* cs, float* d, float* c, int w, float conf_thresh,
+						uint8_t* fg, const Foreground_Range& fg_range, const float* vd, const Occlusion_Test& occ)
+{
+	const float nan = std::numeric_limits<float>::quiet_NaN();
+	for (int j = 0; j < w; ++j) {
+		float dv = r[j] == 0 ? ds[j] : d[j];
+		float c_out = r[j] == 0 ? cs[j] : c[j];
+		float d_out = c_out < conf_thresh ? nan : dv;
+		if (DENSE) {
+			c[j] = c_out;
+			d[j] = d_out;
+		}
+		if (MASK != MASK_NONE)
+			fg[j] = mask_value<MASK>(d_out, c_out, vd, j, fg_range, occ);
+	}
+}
+
+/**
+ * @brief flood/spot merge of one row
+ *
+ * @param r : flood range
+ * @param ds : dense depth of spot
+ * @param cs : confidence of spot
+ * @param d : dense depth of flood, merged result
+ * @param c : confidence of flood, merged result
+ * @param w : width
+ * @param conf_thresh : confidence threshold of dense (0: off)
+ * @param fg : output mask (nullptr: none)
+ * @param fg_range : foreground range
+ * @param vd : virtual depth (nullptr: fg is the foreground mask, else the occlusion mask)
+ * @param occ : occlusion test
+ * @param write_dense : write d and c (false: fg only)
+ */
+KERNEL_CLONES
+void merge_row(const uint8_t* r, const float* ds, const float* cs, float* d, float* c, int w, float conf_thresh,
+				uint8_t* fg, const Foreground_Range& fg_range, const float* vd, const Occlusion_Test& occ, bool write_dense)
+{
+	if (fg == nullptr)
+		merge_row_t<MASK_NONE, true>(r, ds, cs, d, c, w, conf_thresh, fg, fg_range, vd, occ);
+	else if (vd != nullptr && write_dense)
+		merge_row_t<MASK_OCCLUSION, true>(r, ds, cs, d, c, w, conf_thresh, fg, fg_range, vd, occ);
+	else if (vd != nullptr)
+		merge_row_t<MASK_OCCLUSION, false>(r, ds, cs, d, c, w, conf_thresh, fg, fg_range, vd, occ);
+	else if (write_dense)
+		merge_row_t<MASK_FOREGROUND, true>(r, ds, cs, d, c, w, conf_thresh, fg, fg_range, vd, occ);
+	else
+		merge_row_t<MASK_FOREGROUND, false>(r, ds, cs, d, c, w, conf_thresh, fg, fg_range, vd, occ);
+}
+
+/**
+ * @brief foreground mask of one row
+ *
+ * @param d : dense depth
+ * @param c : confidence
+ * @param fg : output foreground mask
+ * @param w : width
+ * @param fg_range : foreground range
+ */
+KERNEL_CLONES
+void foreground_mask_row(const float* d, const float* c, uint8_t* fg, int w, const Foreground_Range& fg_range)
+{
+	for (int j = 0; j < w; ++j)
+		fg[j] = foreground(d[j], c[j], fg_range);
+}
+
+/**
+ * @brief occlusion mask of one row
+ *
+ * @param d : dense depth
+ * @param c : confidence
+ * @param vd : virtual depth
+ * @param occ : output occlusion mask
+ * @param w : width
+ * @param test : occlusion test
+ */
+KERNEL_CLONES
+void occlusion_mask_row(const float* d, const float* c, const float* vd, uint8_t* occ, int w, const Occlusion_Test& test)
+{
+	for (int j = 0; j < w; ++j)
+		occ[j] = occlusion(d[j], c[j], vd[j], test);
+}
+
+/**
+ * @brief joint bilateral upsampling of one row of the coarse spot grid
+ *
+ * Pixel j lies between the nodes j / step and j / step + 1 of the coarse rows
+ * 0 and 1. A node weighs W = bilinear weight * colour weight of the pixel
+ * against the guide at the node, so the depth of a node does not cross a
+ * guide edge between the node and the pixel.
+ *
+ * @param g : guide row
+ * @param cn : channels (1 or 3)
+ * @param g0 : guide at the nodes of coarse row 0
+ * @param g1 : guide at the nodes of coarse row 1
+ * @param z0 : depth of the nodes of coarse row 0
+ * @param c0 : confidence of the nodes of coarse row 0
+ * @param z1 : depth of the nodes of coarse row 1
+ * @param c1 : confidence of the nodes of coarse row 1
+ * @param fy : vertical position between coarse row 0 and 1 (0~1)
+ * @param step : node distance (pixels)
+ * @param w : width
+ * @param lut : colour weight table (negative, fgs_solver::create_weight_table())
+ * @param s : output confidence weighted depth
+ * @param m : output confidence
+ */
+KERNEL_CLONES
+void spot_jbu_row(const uint8_t* g, int cn, const uint8_t* g0, const uint8_t* g1, const float* z0, const float* c0,
+					const float* z1, const float* c1, float fy, int step, int w, const float* lut, float* s, float* m)
+{
+	const float inv_step = 1.f / step;
+	for (int j = 0; j < w; ++j) {
+		int k = j / step;
+		float fx = (j - k * step) * inv_step;
+		const int nodes[4] = {k, k + 1, k, k + 1};
+		const float ws[4] = {(1.f - fx) * (1.f - fy), fx * (1.f - fy), (1.f - fx) * fy, fx * fy};
+		float sum_w = 0.f, sum_c = 0.f, sum_z = 0.f;
+		for (int n = 0; n < 4; ++n) {
+			const uint8_t* gn = n < 2 ? g0 : g1;
+			int diff = 0;
+			for (int ch = 0; ch < cn; ++ch) {
+				int d = g[j * cn + ch] - gn[nodes[n] * cn + ch];
+				diff += d * d;
+			}
+			float wn = ws[n] * (1e-6f - lut[diff]); // no zero weight on strong edges
+			float cn_ = n < 2 ? c0[nodes[n]] : c1[nodes[n]];
+			float zn = n < 2 ? z0[nodes[n]] : z1[nodes[n]];
+			sum_w += wn;
+			sum_c += wn * cn_;
+			sum_z += wn * cn_ * zn;
+		}
+		s[j] = sum_z / sum_w;
+		m[j] = sum_c / sum_w;
+	}
+}
+
+/**
+ * @brief confidence mask of one row
+ *
+ * @param d : dense depth
+ * @param c : confidence
+ * @param f : output filtered depth
+ * @param w : width
+ * @param threshold : threshold
+ */
+KERNEL_CLONES
+void confidence_mask_row(const float* d, const float* c, float* f, int w, float threshold)
+{
+	const float nan = std::numeric_limits<float>::quiet_NaN();
+	for (int j = 0; j < w; ++j)
+		f[j] = c[j] < threshold ? nan : d[j];
+}
+
+/**
+ * @brief projection of one row of points to guide coordinates
+ *
+ * Rounded coordinates are written for every point (vectorized), the caller
+ * checks z and the guide bounds before converting to integer.
+ *
+ * @param xyz : points (3 floats per point)
+ * @param n : number of points
+ * @param fx : focal length x
+ * @param fy : focal length y
+ * @param cx : principal point x
+ * @param cy : principal point y
+ * @param u : output u (n elements)
+ * @param v : output v (n elements)
+ */
+KERNEL_CLONES
+void project_row(const float* xyz, int n, float fx, float fy, float cx, float cy, float* u, float* v)
+{
+	for (int i = 0; i < n; ++i) {
+		float z = xyz[i * 3 + 2];
+		u[i] = roundf(xyz[i * 3] * fx / z + cx);
+		v[i] = roundf(xyz[i * 3 + 1] * fy / z + cy);
+	}
+}
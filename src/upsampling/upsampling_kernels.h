@@ -0,0 +1,62 @@
+#pragma once
+#include <stdint.h>
+
+/**
+ * @brief hot row kernels of libupsampling
+ *
+ * With UPSAMPLING_CPU_DISPATCH (GCC/Clang, x86-64 Linux) every kernel is
+ * built for AVX-512, AVX2, SSE4.2 and the x86-64 baseline, the loader picks
+ * the best clone for the CPU at startup (ifunc), so one binary runs the
+ * widest vectors the machine has. Elsewhere the kernels are plain functions.
+ * The callers keep the row loops on the OpenCV worker pool and pass one
+ * row (or one column stripe of a row) per call.
+ */
+
+typedef struct Foreground_Range{
+	float near_z = 0.f; // (m) nearest foreground depth
+	float far_z = 0.f; // (m) farthest foreground depth
+	float conf_threshold = 0.f; // minimum confidence of foreground
+} Foreground_Range; // foreground: near_z <= dense <= far_z and conf >= conf_threshold
+
+typedef struct Occlusion_Test{
+	float margin = 0.01f; // (m) tie band around the virtual depth
+	float conf_threshold = 0.f; // real depth of lower confidence never occludes
+} Occlusion_Test; // occluded: dense < virtual depth + margin * (2 * conf - 1) and conf >= conf_threshold
+
+// instruction set selected by the runtime dispatch ("avx512f", "avx2", "sse4.2", "default")
+const char* get_kernel_isa(void);
+
+// FGS guide weights of one row, ch/cv_ = lut[squared difference to the right/lower pixel]
+void fgs_guide_weights_row(const uint8_t* g, const uint8_t* g_next, int cn, int w, bool last_row,
+							const float* lut, float* ch, float* cv_);
+// FGS vertical pass, first row of the column stripe [start, end)
+void fgs_vertical_first_row(const float* c, float* d, float* cur, bool update_d, int start, int end, float lambda);
+// FGS vertical pass, forward elimination of row i from row i - 1
+void fgs_vertical_forward_row(const float* c_prev, const float* c, const float* d_prev, float* d,
+								const float* cur_prev, float* cur, bool update_d, int start, int end, float lambda);
+// FGS vertical pass, back substitution of row i from row i + 1
+void fgs_vertical_backward_row(const float* d, const float* cur_next, float* cur, int start, int end);
+// PCG y = (M + lambda * L) x of row i (xu/xd/cv_up: rows above/below, clamped)
+void pcg_apply_row(const float* ch, const float* cv_, const float* cv_up, const float* m, const float* xc,
+					const float* xu, const float* xd, float* y, bool first_row, int w, float lambda);
+// solver post processing of one row (see post_process()), fg: mask (nullptr: none), foreground mask or
+// occlusion mask against the virtual depth vd (nullptr: foreground), write_dense: false writes only fg
+void post_process_row(const float* s, const float* m, const uint8_t* r, float* d, float* c, int w,
+						bool normalize, float conf_scale, float conf_thresh,
+						uint8_t* fg, const Foreground_Range& fg_range, const float* vd, const Occlusion_Test& occ,
+						bool write_dense);
+// flood/spot merge of one row (see upsampling::merge_flood_spot()), masks as post_process_row()
+void merge_row(const uint8_t* r, const float* ds, const float* cs, float* d, float* c, int w, float conf_thresh,
+				uint8_t* fg, const Foreground_Range& fg_range, const float* vd, const Occlusion_Test& occ, bool write_dense);
+// foreground mask of one row from dense and conf
+void foreground_mask_row(const float* d, const float* c, uint8_t* fg, int w, const Foreground_Range& fg_range);
+// occlusion mask of one row from dense, conf and virtual depth
+void occlusion_mask_row(const float* d, const float* c, const float* vd, uint8_t* occ, int w, const Occlusion_Test& test);
+// joint bilateral upsampling of one row of the coarse spot grid (see upsampling::spot_interpolation()),
+// s = sum(W c z) / sum(W), m = sum(W c) / sum(W) over the 4 nodes around each pixel
+void spot_jbu_row(const uint8_t* g, int cn, const uint8_t* g0, const uint8_t* g1, const float* z0, const float* c0,
+					const float* z1, const float* c1, float fy, int step, int w, const float* lut, float* s, float* m);
+// confidence mask of one row, f = NaN where c < threshold
+void confidence_mask_row(const float* d, const float* c, float* f, int w, float threshold);
+// projection of one row of xyz points to rounded guide coordinates
+void project_row(const float* xyz, int n, float fx, float fy, float cx, float cy, float* u, float* v);
@@ -0,0 +1,195 @@
+#include "upsampling_stream.h"
+#include <algorithm>
+#include <chrono>
+
+const size_t STREAM_LATENCY_HISTORY = 1024; // frames for latency statistics
+
+/**
+ * @brief Construct a new upsampling stream object
+ *
+ * @param engine : configured upsampling object
+ * @param policy : backpressure policy
+ * @param queue_size : number of frames waiting for the pipeline
+ */
+upsampling_stream::upsampling_stream(const upsampling& engine, Stream_Policy policy, int queue_size)
+	: m_policy_(policy),
+	  m_pipeline_(engine, m_num_buffers_, [this](Upsampling_Result& result) -> void { this->on_result(result); })
+{
+	if (queue_size < 1 || policy == STREAM_KEEP_LATEST)
+		queue_size = 1;
+	this->m_queue_size_ = static_cast<size_t>(queue_size);
+	this->m_latency_ms_.reserve(STREAM_LATENCY_HISTORY);
+	this->m_feed_thread_ = std::thread(&upsampling_stream::feed_loop, this);
+}
+
+/**
+ * @brief Destroy the upsampling stream object, queued frames are discarded
+ *
+ */
+upsampling_stream::~upsampling_stream()
+{
+	{
+		std::lock_guard<std::mutex> lock(this->m_mutex_);
+		this->m_stop_ = true;
+	}
+	this->m_cond_.notify_all();
+	this->m_feed_thread_.join();
+	// m_pipeline_ finishes the frames in flight
+}
+
+/**
+ * @brief copy and queue one frame
+ *
+ * @param img_guide : guide image
+ * @param pc_flood : flood point cloud (can be empty)
+ * @param pc_spot : spot point cloud (can be empty)
+ * @param timestamp_ns : capture timestamp, steady clock (0: now)
+ * @return true : queued without drop
+ * @return false : a queued frame was dropped for this one
+ */
+bool upsampling_stream::push(const cv::Mat& img_guide, const cv::Mat& pc_flood, const cv::Mat& pc_spot, int64_t timestamp_ns)
+{
+	if (timestamp_ns == 0)
+		timestamp_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+							std::chrono::steady_clock::now().time_since_epoch()).count();
+	Stream_Input input;
+	{
+		std::unique_lock<std::mutex> lock(this->m_mutex_);
+		if (!this->m_recycled_.empty()) { // reuse buffers
+			input = std::move(this->m_recycled_.back());
+			this->m_recycled_.pop_back();
+		}
+	}
+	img_guide.copyTo(input.guide);
+	pc_flood.copyTo(input.flood);
+	pc_spot.copyTo(input.spot);
+	input.timestamp_ns = timestamp_ns;
+	bool dropped = false;
+	{
+		std::unique_lock<std::mutex> lock(this->m_mutex_);
+		if (this->m_policy_ == STREAM_BLOCK) {
+			this->m_cond_.wait(lock, [this]() -> bool {
+				return this->m_stop_ || this->m_queue_.size() < this->m_queue_size_;
+			});
+		}
+		while (this->m_queue_.size() >= this->m_queue_size_) { // drop oldest
+			this->m_recycled_.push_back(std::move(this->m_queue_.front()));
+			this->m_queue_.pop_front();
+			this->m_stats_.num_dropped += 1;
+			dropped = true;
+		}
+		this->m_queue_.push_back(std::move(input));
+		this->m_stats_.num_pushed += 1;
+	}
+	this->m_cond_.notify_all();
+	return !dropped;
+}
+
+/**
+ * @brief newest result
+ *
+ * @param result : output result
+ * @return true : new result
+ * @return false : no new result since the last call
+ */
+bool upsampling_stream::get_latest(Upsampling_Result& result)
+{
+	std::lock_guard<std::mutex> lock(this->m_mutex_);
+	if (!this->m_has_new_)
+		return false;
+	result = this->m_latest_;
+	this->m_has_new_ = false;
+	return true;
+}
+
+/**
+ * @brief wait until all queued frames are processed
+ *
+ */
+void upsampling_stream::flush()
+{
+	std::unique_lock<std::mutex> lock(this->m_mutex_);
+	this->m_cond_.wait(lock, [this]() -> bool {
+		return this->m_queue_.empty() && this->m_num_in_pipeline_ == 0;
+	});
+}
+
+/**
+ * @brief counters and latency statistics of the recent frames
+ *
+ * @param stats : output statistics
+ */
+void upsampling_stream::get_stats(Stream_Stats& stats)
+{
+	std::vector<double> latency;
+	{
+		std::lock_guard<std::mutex> lock(this->m_mutex_);
+		stats = this->m_stats_;
+		latency = this->m_latency_ms_;
+	}
+	if (latency.empty())
+		return;
+	std::sort(latency.begin(), latency.end());
+	double sum = 0.0;
+	for (double v : latency)
+		sum += v;
+	size_t n = latency.size();
+	stats.latency_avg_ms = sum / n;
+	stats.latency_p99_ms = latency[std::min(n - 1, n * 99 / 100)];
+	stats.latency_max_ms = latency[n - 1];
+}
+
+/**
+ * @brief feeder thread: submits queued frames when the pipeline has a free slot
+ *
+ * Frames stay in the queue (where the policy can drop them) until the pipeline
+ * can take them, so a submitted frame is never older than necessary.
+ */
+void upsampling_stream::feed_loop()
+{
+	while (true) {
+		Stream_Input input;
+		{
+			std::unique_lock<std::mutex> lock(this->m_mutex_);
+			this->m_cond_.wait(lock, [this]() -> bool {
+				return this->m_stop_ || (!this->m_queue_.empty() && this->m_num_in_pipeline_ < this->m_num_buffers_);
+			});
+			if (this->m_stop_)
+				return;
+			input = std::move(this->m_queue_.front());
+			this->m_queue_.pop_front();
+			this->m_num_in_pipeline_ += 1;
+		}
+		this->m_cond_.notify_all(); // queue has space
+		this->m_pipeline_.submit(input.guide, input.flood, input.spot, cv::Mat(), cv::Mat(), input.timestamp_ns);
+		{
+			std::lock_guard<std::mutex> lock(this->m_mutex_);
+			this->m_recycled_.push_back(std::move(input));
+		}
+	}
+}
+
+/**
+ * @brief result callback on the stage 2 thread of the pipeline
+ *
+ * @param result : result, dense/conf are handed over
+ */
+void upsampling_stream::on_result(Upsampling_Result& result)
+{
+	double latency_ms = (result.done_ns - result.timestamp_ns) / 1e6;
+	{
+		std::lock_guard<std::mutex> lock(this->m_mutex_);
+		this->m_latest_ = result;
+		this->m_has_new_ = true;
+		this->m_stats_.num_processed += 1;
+		this->m_stats_.latency_last_ms = latency_ms;
+		if (this->m_latency_ms_.size() < STREAM_LATENCY_HISTORY) {
+			this->m_latency_ms_.push_back(latency_ms);
+		} else {
+			this->m_latency_ms_[this->m_latency_pos_] = latency_ms;
+			this->m_latency_pos_ = (this->m_latency_pos_ + 1) % STREAM_LATENCY_HISTORY;
+		}
+		this->m_num_in_pipeline_ -= 1;
+	}
+	this->m_cond_.notify_all();
+}
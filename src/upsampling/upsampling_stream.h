@@ -0,0 +1,71 @@
+#pragma once
+#include "upsampling_async.h"
+
+enum Stream_Policy {
+	STREAM_BLOCK = 0, // push() waits while the queue is full (no drop, latency grows)
+	STREAM_DROP_OLDEST = 1, // push() drops the oldest queued frame when the queue is full
+	STREAM_KEEP_LATEST = 2, // only the newest frame is queued (queue size 1)
+};
+
+typedef struct Stream_Stats{
+	uint64_t num_pushed = 0; // frames given to push()
+	uint64_t num_processed = 0; // results
+	uint64_t num_dropped = 0; // frames dropped by the policy
+	double latency_last_ms = 0.0; // capture -> result of the last frame
+	double latency_avg_ms = 0.0; // average of the recent frames
+	double latency_p99_ms = 0.0; // 99 percentile of the recent frames
+	double latency_max_ms = 0.0; // max of the recent frames
+} Stream_Stats;
+
+/**
+ * @brief real-time front-end of upsampling_async with a backpressure policy
+ *
+ * push() never blocks with STREAM_DROP_OLDEST/STREAM_KEEP_LATEST: frames wait
+ * in a bounded queue and are dropped by the policy when the pipeline falls
+ * behind the sensor, so the latency stays bounded and get_latest() returns
+ * the freshest depth.
+ */
+class upsampling_stream
+{
+public:
+	// queue_size: number of frames waiting for the pipeline (1 for STREAM_KEEP_LATEST)
+	upsampling_stream(const upsampling& engine, Stream_Policy policy = STREAM_KEEP_LATEST, int queue_size = 2);
+	~upsampling_stream();
+	// copy and queue one frame, timestamp_ns: capture timestamp (0: now)
+	// return false if a frame was dropped (STREAM_DROP_OLDEST/STREAM_KEEP_LATEST)
+	bool push(const cv::Mat& img_guide, const cv::Mat& pc_flood, const cv::Mat& pc_spot, int64_t timestamp_ns = 0);
+	// newest result, false if there is no new result since the last call
+	bool get_latest(Upsampling_Result& result);
+	// wait until all queued frames are processed
+	void flush();
+	// counters and latency
+	void get_stats(Stream_Stats& stats);
+	Stream_Policy get_policy(void) { return this->m_policy_; };
+private:
+	typedef struct Stream_Input{
+		cv::Mat guide;
+		cv::Mat flood;
+		cv::Mat spot;
+		int64_t timestamp_ns = 0;
+	} Stream_Input;
+	void feed_loop(); // moves queued frames into the pipeline
+	void on_result(Upsampling_Result& result); // called by the pipeline
+	const Stream_Policy m_policy_;
+	size_t m_queue_size_;
+	std::deque<Stream_Input> m_queue_; // waiting frames
+	std::vector<Stream_Input> m_recycled_; // buffers of consumed frames
+	int m_num_buffers_ = 2; // frames in the pipeline at most
+	int m_num_in_pipeline_ = 0; // submitted, no result yet
+	bool m_stop_ = false;
+	std::mutex m_mutex_;
+	std::condition_variable m_cond_;
+	// results
+	Upsampling_Result m_latest_;
+	bool m_has_new_ = false;
+	Stream_Stats m_stats_;
+	std::vector<double> m_latency_ms_; // ring of recent latencies
+	size_t m_latency_pos_ = 0;
+	// pipeline is last: destroyed first (calls on_result until then)
+	upsampling_async m_pipeline_;
+	std::thread m_feed_thread_;
+};
@@ -0,0 +1,427 @@
+/**
+ * @file upsampling_test.cpp
+ * @brief tests of upsampling
+ * @version 2.0
+ * @date 2026-10-19
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+#include "upsampling.h"
+#include "upsampling_async.h"
+#include "test_check.h"
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <math.h>
+
+#define TEST_GUIDE_WIDTH 160
+#define TEST_GUIDE_HEIGHT 120
+#define TEST_GRID_WIDTH 20
+#define TEST_GRID_HEIGHT 15
+
+static const Camera_Params g_cam(80.f, 60.f, 100.f, 100.f);
+
+/**
+ * @brief engine of the test resolution and camera
+ *
+ * @param dc : engine
+ */
+static void setup(upsampling& dc)
+{
+	dc.set_cam_paramters(g_cam);
+}
+
+/**
+ * @brief synthetic scene: gradient guide, slanted flood plane and a few spot points
+ *
+ * @param guide : output guide (8UC3)
+ * @param flood : output flood grid (32FC3)
+ * @param spot : output spot points (32FC3)
+ */
+static void make_scene(cv::Mat& guide, cv::Mat& flood, cv::Mat& spot)
+{
+	guide.create(TEST_GUIDE_HEIGHT, TEST_GUIDE_WIDTH, CV_8UC3);
+	for (int r = 0; r < guide.rows; ++r) {
+		cv::Vec3b* g = guide.ptr<cv::Vec3b>(r);
+		for (int c = 0; c < guide.cols; ++c)
+			g[c] = cv::Vec3b(static_cast<uchar>(c / 2), static_cast<uchar>(r), 128);
+	}
+	flood.create(TEST_GRID_HEIGHT, TEST_GRID_WIDTH, CV_32FC3);
+	for (int r = 0; r < flood.rows; ++r) {
+		cv::Vec3f* p = flood.ptr<cv::Vec3f>(r);
+		for (int c = 0; c < flood.cols; ++c) {
+			float u = 4.f + 8.f * c;
+			float v = 4.f + 8.f * r;
+			float z = 1.f + 0.001f * u;
+			p[c] = cv::Vec3f((u - g_cam.cx) * z / g_cam.fx, (v - g_cam.cy) * z / g_cam.fy, z);
+		}
+	}
+	spot.create(1, 6, CV_32FC3);
+	for (int i = 0; i < spot.cols; ++i) {
+		float u = 20.f + 24.f * i;
+		float v = 30.f + 10.f * i;
+		float z = 2.f;
+		spot.at<cv::Vec3f>(0, i) = cv::Vec3f((u - g_cam.cx) * z / g_cam.fx, (v - g_cam.cy) * z / g_cam.fy, z);
+	}
+}
+
+/**
+ * @brief difference of two depth maps
+ *
+ * @param a : map a
+ * @param b : map b
+ * @param max_diff : max absolute difference of pixels valid in both
+ * @param num_mismatch : pixels valid in only one
+ * @return double : mean absolute difference of pixels valid in both (-1: different size)
+ */
+static double depth_diff(const cv::Mat& a, const cv::Mat& b, float& max_diff, int& num_mismatch)
+{
+	max_diff = 0.f;
+	num_mismatch = 0;
+	if (a.size() != b.size() || a.type() != CV_32FC1 || b.type() != CV_32FC1)
+		return -1.0;
+	double sum = 0.0;
+	int num = 0;
+	for (int r = 0; r < a.rows; ++r) {
+		const float* pa = a.ptr<float>(r);
+		const float* pb = b.ptr<float>(r);
+		for (int c = 0; c < a.cols; ++c) {
+			if (isnan(pa[c]) != isnan(pb[c])) {
+				num_mismatch += 1;
+				continue;
+			}
+			if (isnan(pa[c]))
+				continue;
+			float d = fabsf(pa[c] - pb[c]);
+			max_diff = std::max(max_diff, d);
+			sum += d;
+			num += 1;
+		}
+	}
+	return num == 0 ? 0.0 : sum / num;
+}
+
+/**
+ * @brief every get_config() snapshot is consistent while setters run concurrently, no update is lost
+ */
+static void test_config_snapshot(void)
+{
+	upsampling dc(TEST_GUIDE_WIDTH, TEST_GUIDE_HEIGHT, TEST_GRID_WIDTH, TEST_GRID_HEIGHT);
+	setup(dc);
+	const int num_updates = 500;
+	dc.set_occlusion_test(0.f, 0.f);
+	dc.set_foreground_range(0.f, 1.f);
+	std::atomic<bool> done(false);
+	std::atomic<int> num_torn(0);
+	std::thread th_reader([&dc, &done, &num_torn]() -> void {
+		while (!done.load()) {
+			std::shared_ptr<const Upsampling_Config> cfg = dc.get_config();
+			// each setter writes its pair of fields together
+			if (cfg->occlusion_margin != cfg->occlusion_conf_threshold || cfg->fg_far != cfg->fg_near + 1.f)
+				num_torn += 1;
+			if (!cfg->tables)
+				num_torn += 1;
+		}
+	});
+	std::vector<std::thread> setters;
+	setters.emplace_back([&dc, num_updates]() -> void {
+		for (int i = 1; i <= num_updates; ++i)
+			dc.set_latency_budget(static_cast<float>(i));
+	});
+	setters.emplace_back([&dc, num_updates]() -> void {
+		for (int i = 1; i <= num_updates; ++i)
+			dc.set_confidence_threshold(i / 1000.f);
+	});
+	setters.emplace_back([&dc, num_updates]() -> void {
+		for (int i = 1; i <= num_updates; ++i)
+			dc.set_occlusion_test(i / 1000.f, i / 1000.f);
+	});
+	setters.emplace_back([&dc, num_updates]() -> void {
+		for (int i = 1; i <= num_updates; ++i)
+			dc.set_foreground_range(static_cast<float>(i), static_cast<float>(i) + 1.f);
+	});
+	for (auto& th : setters)
+		th.join();
+	done.store(true);
+	th_reader.join();
+	std::shared_ptr<const Upsampling_Config> cfg = dc.get_config();
+	TEST_CHECK(num_torn.load() == 0);
+	TEST_CHECK(cfg->latency_budget_ms == static_cast<float>(num_updates));
+	TEST_CHECK(cfg->conf_threshold == num_updates / 1000.f);
+	TEST_CHECK(cfg->occlusion_margin == num_updates / 1000.f);
+	TEST_CHECK(cfg->fg_near == static_cast<float>(num_updates));
+}
+
+/**
+ * @brief frames stay consistent while output scale and static frame skip change between them
+ */
+static void test_frame_snapshot(void)
+{
+	upsampling dc(TEST_GUIDE_WIDTH, TEST_GUIDE_HEIGHT, TEST_GRID_WIDTH, TEST_GRID_HEIGHT);
+	setup(dc);
+	cv::Mat guide, flood, spot, dense, conf;
+	make_scene(guide, flood, spot);
+	std::atomic<bool> done(false);
+	std::thread th_setter([&dc, &done]() -> void {
+		for (int i = 0; !done.load(); ++i) {
+			dc.set_output_scale(1 + (i & 1));
+			dc.set_static_frame_skip((i & 2) ? 0.f : 5.f, 0.01f);
+		}
+	});
+	upsampling_context ctx;
+	cv::Size full_size(TEST_GUIDE_WIDTH, TEST_GUIDE_HEIGHT);
+	cv::Size half_size(TEST_GUIDE_WIDTH / 2, TEST_GUIDE_HEIGHT / 2);
+	int num_failed = 0;
+	for (int n = 0; n < 200; ++n) {
+		cv::Mat frame_guide = guide.clone();
+		frame_guide(cv::Rect(16 * (n % 8), 48, 16, 16)) += cv::Scalar(60, 60, 60); // partial recompute candidates
+		bool res = false;
+		try {
+			res = dc.run(ctx, frame_guide, flood, cv::Mat(), dense, conf);
+		} catch (const cv::Exception&) {
+			res = false;
+		}
+		if (!res || dense.size() != conf.size() || (dense.size() != full_size && dense.size() != half_size))
+			num_failed += 1;
+	}
+	done.store(true);
+	th_setter.join();
+	TEST_CHECK(num_failed == 0);
+}
+
+/**
+ * @brief a partial recompute of a changed block agrees with a full solve of the frame
+ */
+static void test_partial_skip(void)
+{
+	upsampling dc(TEST_GUIDE_WIDTH, TEST_GUIDE_HEIGHT, TEST_GRID_WIDTH, TEST_GRID_HEIGHT);
+	setup(dc);
+	dc.set_static_frame_skip(5.f, 0.01f);
+	upsampling ref(TEST_GUIDE_WIDTH, TEST_GUIDE_HEIGHT, TEST_GRID_WIDTH, TEST_GRID_HEIGHT);
+	setup(ref);
+	cv::Mat guide, flood, spot, dense, conf, dense_ref, conf_ref;
+	make_scene(guide, flood, spot);
+	upsampling_context ctx, ctx_ref;
+	TEST_CHECK(dc.run(ctx, guide, flood, cv::Mat(), dense, conf));
+	cv::Mat guide_b = guide.clone();
+	guide_b(cv::Rect(64, 48, 16, 16)) += cv::Scalar(60, 60, 60); // one changed block
+	TEST_CHECK(dc.run(ctx, guide_b, flood, cv::Mat(), dense, conf));
+	Static_Skip_Stats stats;
+	ctx.get_skip_stats(stats);
+	TEST_CHECK(stats.num_frames == 2);
+	TEST_CHECK(stats.num_partial == 1);
+	TEST_CHECK(stats.skipped_pixel_ratio > 0.0);
+	TEST_CHECK(ref.run(ctx_ref, guide_b, flood, cv::Mat(), dense_ref, conf_ref));
+	float max_diff;
+	int num_mismatch;
+	double mean_diff = depth_diff(dense, dense_ref, max_diff, num_mismatch);
+	TEST_CHECK(mean_diff >= 0.0 && mean_diff < 0.01);
+	TEST_CHECK(max_diff <= 0.05f);
+	TEST_CHECK(num_mismatch <= static_cast<int>(dense.total() / 100));
+}
+
+/**
+ * @brief with static frame skip the mask of full and skipped frames equals the fused mask without skip
+ */
+static void test_skip_mask(void)
+{
+	upsampling dc(TEST_GUIDE_WIDTH, TEST_GUIDE_HEIGHT, TEST_GRID_WIDTH, TEST_GRID_HEIGHT);
+	setup(dc);
+	dc.set_static_frame_skip(5.f, 0.01f);
+	dc.set_foreground_range(1.f, 1.08f);
+	upsampling ref(TEST_GUIDE_WIDTH, TEST_GUIDE_HEIGHT, TEST_GRID_WIDTH, TEST_GRID_HEIGHT);
+	setup(ref);
+	ref.set_foreground_range(1.f, 1.08f);
+	cv::Mat guide, flood, spot, dense, conf, mask, dense_ref, conf_ref, mask_ref;
+	make_scene(guide, flood, spot);
+	upsampling_context ctx, ctx_ref;
+	TEST_CHECK(ref.run(ctx_ref, guide, flood, cv::Mat(), dense_ref, conf_ref, mask_ref));
+	for (int n = 0; n < 2; ++n) { // full, then skipped
+		TEST_CHECK(dc.run(ctx, guide, flood, cv::Mat(), dense, conf, mask, true));
+		TEST_CHECK(!dense.empty() && mask.size() == dense.size()); // dense/conf written with static frame skip
+		TEST_CHECK(mask.size() == mask_ref.size() && cv::countNonZero(mask != mask_ref) == 0);
+	}
+	Static_Skip_Stats stats;
+	ctx.get_skip_stats(stats);
+	TEST_CHECK(stats.num_skipped == 1);
+}
+
+/**
+ * @brief SOLVER_PCG converges and agrees with FGS
+ */
+static void test_pcg_solver(void)
+{
+	upsampling dc(TEST_GUIDE_WIDTH, TEST_GUIDE_HEIGHT, TEST_GRID_WIDTH, TEST_GRID_HEIGHT);
+	setup(dc);
+	dc.set_solver(SOLVER_PCG, 1e-3f, 50);
+	upsampling ref(TEST_GUIDE_WIDTH, TEST_GUIDE_HEIGHT, TEST_GRID_WIDTH, TEST_GRID_HEIGHT);
+	setup(ref);
+	cv::Mat guide, flood, spot, dense, conf, dense_ref, conf_ref;
+	make_scene(guide, flood, spot);
+	upsampling_context ctx, ctx_ref;
+	for (int i = 0; i < 3; ++i) // warm started from the previous frames
+		TEST_CHECK(dc.run(ctx, guide, flood, cv::Mat(), dense, conf));
+	int num_iter;
+	float residual;
+	ctx.get_solver_stats(num_iter, residual);
+	TEST_CHECK(residual < 1e-2f);
+	TEST_CHECK(ref.run(ctx_ref, guide, flood, cv::Mat(), dense_ref, conf_ref));
+	float max_diff;
+	int num_mismatch;
+	double mean_diff = depth_diff(dense, dense_ref, max_diff, num_mismatch);
+	TEST_CHECK(mean_diff >= 0.0 && mean_diff < 0.05);
+	TEST_CHECK(num_mismatch <= static_cast<int>(dense.total() / 100));
+}
+
+/**
+ * @brief a guide of another resolution is rejected, also with a cached frame of static frame skip
+ */
+static void test_wrong_guide(void)
+{
+	upsampling dc(TEST_GUIDE_WIDTH, TEST_GUIDE_HEIGHT, TEST_GRID_WIDTH, TEST_GRID_HEIGHT);
+	setup(dc);
+	cv::Mat guide, flood, spot, dense, conf;
+	make_scene(guide, flood, spot);
+	cv::Mat small_guide;
+	cv::resize(guide, small_guide, cv::Size(TEST_GUIDE_WIDTH / 2, TEST_GUIDE_HEIGHT / 2));
+	TEST_CHECK(!dc.run(small_guide, flood, spot, dense, conf));
+	upsampling_context ctx;
+	TEST_CHECK(!dc.run(ctx, small_guide, flood, spot, dense, conf));
+	Upsampling_Frame frame;
+	TEST_CHECK(!dc.prepare(small_guide, flood, spot, frame));
+	TEST_CHECK(frame.config != nullptr);
+	dc.set_static_frame_skip(5.f, 0.01f);
+	TEST_CHECK(dc.run(ctx, guide, flood, cv::Mat(), dense, conf)); // cached
+	TEST_CHECK(!dc.run(ctx, small_guide, flood, cv::Mat(), dense, conf));
+	TEST_CHECK(dc.run(ctx, guide, flood, cv::Mat(), dense, conf));
+}
+
+/**
+ * @brief the stage 1 variants give the same result as the generic preprocessing
+ */
+static void test_pipeline_variants(void)
+{
+	upsampling dc(TEST_GUIDE_WIDTH, TEST_GUIDE_HEIGHT, TEST_GRID_WIDTH, TEST_GRID_HEIGHT);
+	setup(dc);
+	upsampling generic(TEST_GUIDE_WIDTH, TEST_GUIDE_HEIGHT, TEST_GRID_WIDTH, TEST_GRID_HEIGHT);
+	setup(generic);
+	generic.use_specialized_pipeline(false);
+	cv::Mat guide, flood, spot;
+	make_scene(guide, flood, spot);
+	for (int proc = 0; proc < 2; ++proc) { // with and without preprocessing
+		dc.use_proprocessing(proc == 0);
+		generic.use_proprocessing(proc == 0);
+		for (int mode = 1; mode <= 3; ++mode) {
+			cv::Mat dense, conf, dense_ref, conf_ref;
+			upsampling_context ctx, ctx_ref;
+			const cv::Mat& pc_flood = (mode & 1) ? flood : cv::Mat();
+			const cv::Mat& pc_spot = (mode & 2) ? spot : cv::Mat();
+			TEST_CHECK(dc.run(ctx, guide, pc_flood, pc_spot, dense, conf));
+			TEST_CHECK(generic.run(ctx_ref, guide, pc_flood, pc_spot, dense_ref, conf_ref));
+			float max_diff;
+			int num_mismatch;
+			TEST_CHECK(depth_diff(dense, dense_ref, max_diff, num_mismatch) >= 0.0);
+			TEST_CHECK(max_diff <= 1e-5f);
+			TEST_CHECK(num_mismatch == 0);
+		}
+	}
+}
+
+/**
+ * @brief run_view() validates and runs on one snapshot: a concurrent output scale change is an invalid view, never an error
+ */
+static void test_view_snapshot(void)
+{
+	upsampling dc(TEST_GUIDE_WIDTH, TEST_GUIDE_HEIGHT, TEST_GRID_WIDTH, TEST_GRID_HEIGHT);
+	setup(dc);
+	cv::Mat guide, flood, spot;
+	make_scene(guide, flood, spot);
+	cv::Mat dense(TEST_GUIDE_HEIGHT, TEST_GUIDE_WIDTH, CV_32FC1);
+	Upsampling_View guide_view, flood_view, spot_view, dense_view, conf_view;
+	guide_view.data = guide.data;
+	guide_view.width = guide.cols;
+	guide_view.height = guide.rows;
+	guide_view.type = guide.type();
+	flood_view.data = flood.data;
+	flood_view.width = flood.cols;
+	flood_view.height = flood.rows;
+	flood_view.type = CV_32FC3;
+	dense_view.data = dense.data;
+	dense_view.width = dense.cols;
+	dense_view.height = dense.rows;
+	upsampling_context ctx;
+	TEST_CHECK(dc.run_view(ctx, guide_view, flood_view, spot_view, dense_view, conf_view) == UPSAMPLING_OK); // no conf view
+	std::atomic<bool> done(false);
+	std::thread th_setter([&dc, &done]() -> void {
+		for (int i = 0; !done.load(); ++i)
+			dc.set_output_scale(1 + (i & 1));
+	});
+	int num_error = 0;
+	for (int n = 0; n < 200; ++n) {
+		int status = dc.run_view(ctx, guide_view, flood_view, spot_view, dense_view, conf_view);
+		if (status != UPSAMPLING_OK && status != UPSAMPLING_INVALID_VIEW)
+			num_error += 1;
+	}
+	done.store(true);
+	th_setter.join();
+	TEST_CHECK(num_error == 0);
+}
+
+/**
+ * @brief upsampling_async agrees with run() (incremental preprocessing on), unsupported parameters are reported
+ */
+static void test_async(void)
+{
+	upsampling dc(TEST_GUIDE_WIDTH, TEST_GUIDE_HEIGHT, TEST_GRID_WIDTH, TEST_GRID_HEIGHT);
+	setup(dc);
+	dc.set_incremental_preprocessing(true);
+	cv::Mat guide, flood, spot;
+	make_scene(guide, flood, spot);
+	const int num_frames = 6;
+	std::vector<cv::Mat> floods(num_frames), dense_ref(num_frames);
+	upsampling_context ctx;
+	for (int n = 0; n < num_frames; ++n) {
+		floods[n] = flood.clone();
+		floods[n].at<cv::Vec3f>(n, n) *= 1.2f; // a moving changed point
+		cv::Mat conf;
+		TEST_CHECK(dc.run(ctx, guide, floods[n], cv::Mat(), dense_ref[n], conf));
+	}
+	{
+		upsampling_async pipeline(dc, 3);
+		for (int n = 0; n < num_frames; ++n)
+			pipeline.submit(guide, floods[n], cv::Mat());
+		Upsampling_Result result;
+		int num_results = 0;
+		while (pipeline.wait(result)) {
+			TEST_CHECK(result.success && result.status == UPSAMPLING_OK);
+			float max_diff;
+			int num_mismatch;
+			TEST_CHECK(depth_diff(result.dense, dense_ref[result.frame_id], max_diff, num_mismatch) >= 0.0);
+			TEST_CHECK(max_diff <= 1e-5f && num_mismatch == 0);
+			num_results += 1;
+		}
+		TEST_CHECK(num_results == num_frames);
+	}
+	dc.set_static_frame_skip(5.f, 0.01f);
+	upsampling_async pipeline(dc, 2);
+	pipeline.submit(guide, flood, cv::Mat());
+	Upsampling_Result result;
+	TEST_CHECK(pipeline.wait(result));
+	TEST_CHECK(!result.success && result.status == UPSAMPLING_UNSUPPORTED);
+}
+
+int main(void)
+{
+	test_config_snapshot();
+	test_frame_snapshot();
+	test_partial_skip();
+	test_skip_mask();
+	test_pcg_solver();
+	test_wrong_guide();
+	test_pipeline_variants();
+	test_view_snapshot();
+	test_async();
+	return g_test_failures == 0 ? 0 : 1;
+}